@@ -0,0 +1,95 @@
+#ifndef TEENSY_X86_SD_STUBS_BENCH_HARNESS_H
+#define TEENSY_X86_SD_STUBS_BENCH_HARNESS_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Minimal benchmark runner. A benchmark body performs `iterations` operations
+// and returns the number of payload bytes it moved (0 if throughput is not
+// meaningful). The runner grows the iteration count until one run takes at
+// least minSeconds, then reports the time per operation of that run.
+struct BenchResult {
+    std::string name;
+    uint64_t iterations;
+    double nsPerOp;
+    double bytesPerSecond;
+};
+
+class BenchRunner {
+public:
+    typedef std::function<uint64_t(uint64_t iterations)> Body;
+
+    double minSeconds = 0.25;
+    std::string filter;
+
+    void add(const std::string &name, Body body) {
+        _benchmarks.push_back({name, body});
+    }
+
+    std::vector<BenchResult> run() {
+        std::vector<BenchResult> results;
+        for (auto &b : _benchmarks) {
+            if (!filter.empty() && b.name.find(filter) == std::string::npos)
+                continue;
+            uint64_t iterations = 1;
+            while (true) {
+                auto start = std::chrono::steady_clock::now();
+                uint64_t bytes = b.body(iterations);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if (seconds >= minSeconds || iterations >= (1ULL << 40)) {
+                    results.push_back({b.name, iterations, seconds * 1e9 / iterations,
+                                       bytes ? bytes / seconds : 0});
+                    break;
+                }
+                // aim a little past the target so the next run usually suffices
+                double scale = seconds > 0 ? minSeconds * 1.4 / seconds : 100;
+                if (scale > 100) scale = 100;
+                if (scale < 2) scale = 2;
+                iterations = (uint64_t)(iterations * scale);
+            }
+        }
+        return results;
+    }
+
+    static void printConsole(FILE *out, const std::vector<BenchResult> &results) {
+        fprintf(out, "%-40s %14s %14s %12s\n", "benchmark", "iterations", "ns/op", "MB/s");
+        for (auto &r : results) {
+            fprintf(out, "%-40s %14llu %14.1f ", r.name.c_str(), (unsigned long long)r.iterations, r.nsPerOp);
+            if (r.bytesPerSecond > 0)
+                fprintf(out, "%12.1f\n", r.bytesPerSecond / 1e6);
+            else
+                fprintf(out, "%12s\n", "-");
+        }
+    }
+
+    static void printCsv(FILE *out, const std::vector<BenchResult> &results) {
+        fprintf(out, "name,iterations,ns_per_op,bytes_per_second\n");
+        for (auto &r : results)
+            fprintf(out, "%s,%llu,%.3f,%.0f\n", r.name.c_str(), (unsigned long long)r.iterations,
+                    r.nsPerOp, r.bytesPerSecond);
+    }
+
+    static void printJson(FILE *out, const std::vector<BenchResult> &results) {
+        fprintf(out, "{\n  \"benchmarks\": [\n");
+        for (size_t i = 0; i < results.size(); i++) {
+            const BenchResult &r = results[i];
+            fprintf(out, "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, \"bytes_per_second\": %.0f}%s\n",
+                    r.name.c_str(), (unsigned long long)r.iterations, r.nsPerOp, r.bytesPerSecond,
+                    i + 1 < results.size() ? "," : "");
+        }
+        fprintf(out, "  ]\n}\n");
+    }
+
+private:
+    struct Benchmark {
+        std::string name;
+        Body body;
+    };
+    std::vector<Benchmark> _benchmarks;
+};
+
+#endif //TEENSY_X86_SD_STUBS_BENCH_HARNESS_H
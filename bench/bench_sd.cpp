@@ -0,0 +1,408 @@
+// Throughput and latency of the File/SDClass paths for each storage backend.
+//
+//   ./bench [--format=console|json|csv] [--out=<file>] [--filter=<substring>]
+//           [--min-time=<seconds>]
+//
+// Benchmark names are <backend>/<operation>[/<bytes per call>]; the JSON and
+// CSV formats are meant to be archived and compared between releases.
+
+#include <Arduino.h>
+#include <SD.h>
+#include "bench_harness.h"
+#include "fat_image_test_fixture.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const uint32_t READ_FILE_SIZE = 4 * 1024 * 1024;
+static const uint32_t WRITE_FILE_LIMIT = 8 * 1024 * 1024;
+static const int SCAN_ENTRIES = 64;
+static const int BIG_DIR_ENTRIES = 2000;
+static const char *WORK_FOLDER = "bench_data";
+static const char *WORK_IMAGE = "bench_data.img";
+// O_WRITE alone does not create files on the card image backend
+static const uint8_t CREATE_MODE = O_WRITE | O_CREAT | O_TRUNC;
+
+static std::vector<uint8_t> scratch(64 * 1024);
+static std::vector<char> inMemoryData(READ_FILE_SIZE);
+
+// Offsets for the random access benchmarks, aligned to the transfer size.
+static std::vector<uint32_t> randomOffsets(uint32_t chunk) {
+    std::vector<uint32_t> offsets(4096);
+    uint32_t x = 12345;
+    for (auto &o : offsets) {
+        x = x * 1103515245 + 12345;
+        o = ((x >> 8) % (READ_FILE_SIZE / chunk)) * chunk;
+    }
+    return offsets;
+}
+
+static bool writeFile(const char *name, uint32_t size) {
+    File f = SD.open(name, CREATE_MODE);
+    if (!f)
+        return false;
+    for (uint32_t done = 0; done < size; done += scratch.size())
+        f.write(scratch.data(), scratch.size());
+    f.close();
+    return true;
+}
+
+// Files every writable backend needs before its benchmarks run.
+static bool prepare() {
+    if (!writeFile("read.bin", READ_FILE_SIZE))
+        return false;
+    SD.mkdir("scan");
+    char name[16];
+    for (int i = 0; i < SCAN_ENTRIES; i++) {
+        snprintf(name, sizeof(name), "scan/f%03d.txt", i);
+        File f = SD.open(name, CREATE_MODE);
+        if (!f)
+            return false;
+        f.write((const uint8_t *)name, strlen(name));
+        f.close();
+    }
+    return true;
+}
+
+static bool prepareBigDir() {
+    SD.mkdir("big");
+    char name[24];
+    for (int i = 0; i < BIG_DIR_ENTRIES; i++) {
+        snprintf(name, sizeof(name), "big/f%04d.txt", i);
+        File f = SD.open(name, CREATE_MODE);
+        if (!f)
+            return false;
+        f.close();
+    }
+    return true;
+}
+
+static void addReadBenchmarks(BenchRunner &runner, const std::string &backend) {
+    runner.add(backend + "/open_close", [](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            File f = SD.open("read.bin");
+            f.close();
+        }
+        return (uint64_t)0;
+    });
+
+    runner.add(backend + "/seq_read/1", [](uint64_t n) {
+        File f = SD.open("read.bin");
+        for (uint64_t i = 0; i < n; i++) {
+            if (f.position() + 1 > READ_FILE_SIZE)
+                f.seek(0);
+            f.read();
+        }
+        f.close();
+        return n;
+    });
+
+    for (uint32_t chunk : {512u, 65536u}) {
+        runner.add(backend + "/seq_read/" + std::to_string(chunk), [chunk](uint64_t n) {
+            File f = SD.open("read.bin");
+            for (uint64_t i = 0; i < n; i++) {
+                if (f.position() + chunk > READ_FILE_SIZE)
+                    f.seek(0);
+                f.read(scratch.data(), chunk);
+            }
+            f.close();
+            return n * chunk;
+        });
+    }
+
+    runner.add(backend + "/rand_read/512", [](uint64_t n) {
+        static const std::vector<uint32_t> offsets = randomOffsets(512);
+        File f = SD.open("read.bin");
+        for (uint64_t i = 0; i < n; i++) {
+            f.seek(offsets[i % offsets.size()]);
+            f.read(scratch.data(), 512);
+        }
+        f.close();
+        return n * 512;
+    });
+
+    runner.add(backend + "/exists", [](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++)
+            SD.exists(i & 1 ? "missing.bin" : "read.bin");
+        return (uint64_t)0;
+    });
+}
+
+static void addWriteBenchmarks(BenchRunner &runner, const std::string &backend) {
+    for (uint32_t chunk : {1u, 512u, 65536u}) {
+        runner.add(backend + "/seq_write/" + std::to_string(chunk), [chunk](uint64_t n) {
+            File f = SD.open("write.bin", CREATE_MODE);
+            uint32_t written = 0;
+            for (uint64_t i = 0; i < n; i++) {
+                if (written + chunk > WRITE_FILE_LIMIT) {
+                    // start over rather than fill the card
+                    f.close();
+                    f = SD.open("write.bin", CREATE_MODE);
+                    written = 0;
+                }
+                if (chunk == 1)
+                    f.write(scratch[0]);
+                else
+                    f.write(scratch.data(), chunk);
+                written += chunk;
+            }
+            f.close();
+            return n * chunk;
+        });
+    }
+
+    runner.add(backend + "/rand_write/512", [](uint64_t n) {
+        static const std::vector<uint32_t> offsets = randomOffsets(512);
+        File f = SD.open("read.bin", O_READ | O_WRITE);
+        for (uint64_t i = 0; i < n; i++) {
+            f.seek(offsets[i % offsets.size()]);
+            f.write(scratch.data(), 512);
+        }
+        f.close();
+        return n * 512;
+    });
+
+    // one iteration is one directory entry; the scan restarts when it runs out
+    runner.add(backend + "/dir_scan", [](uint64_t n) {
+        File dir = SD.open("scan");
+        for (uint64_t i = 0; i < n; i++) {
+            File entry = dir.openNextFile();
+            if (!entry) {
+                dir.close();
+                dir = SD.open("scan");
+                continue;
+            }
+            entry.close();
+        }
+        dir.close();
+        return (uint64_t)0;
+    });
+
+    runner.add(backend + "/mkdir_rmdir", [](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            SD.mkdir("tmpdir");
+            SD.rmdir("tmpdir");
+        }
+        return (uint64_t)0;
+    });
+
+    runner.add(backend + "/create_remove", [](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            File f = SD.open("tmp.bin", CREATE_MODE);
+            f.close();
+            SD.remove("tmp.bin");
+        }
+        return (uint64_t)0;
+    });
+}
+
+static void runBackend(BenchRunner &runner, std::vector<BenchResult> &results) {
+    std::vector<BenchResult> r = runner.run();
+    results.insert(results.end(), r.begin(), r.end());
+}
+
+int main(int argc, char **argv) {
+    initialize_mock_arduino();
+
+    std::string format = "console";
+    std::string outPath;
+    std::string filter;
+    double minSeconds = 0.25;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--format=", 0) == 0)
+            format = arg.substr(9);
+        else if (arg.rfind("--out=", 0) == 0)
+            outPath = arg.substr(6);
+        else if (arg.rfind("--filter=", 0) == 0)
+            filter = arg.substr(9);
+        else if (arg.rfind("--min-time=", 0) == 0)
+            minSeconds = atof(arg.substr(11).c_str());
+        else {
+            fprintf(stderr, "usage: %s [--format=console|json|csv] [--out=<file>] "
+                            "[--filter=<substring>] [--min-time=<seconds>]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    auto newRunner = [&]() {
+        BenchRunner runner;
+        runner.minSeconds = minSeconds;
+        runner.filter = filter;
+        return runner;
+    };
+
+    // host folder, LinuxFile
+    std::filesystem::remove_all(WORK_FOLDER);
+    SD.setSDCardFolderPath(WORK_FOLDER, true);
+    if (prepare()) {
+        BenchRunner runner = newRunner();
+        addReadBenchmarks(runner, "linux");
+        addWriteBenchmarks(runner, "linux");
+        runner.add("linux/exists_cached", [](uint64_t n) {
+            SD.setMetadataCache(true);
+            for (uint64_t i = 0; i < n; i++)
+                SD.exists(i & 1 ? "missing.bin" : "read.bin");
+            SD.setMetadataCache(false);
+            return (uint64_t)0;
+        });
+        runBackend(runner, results);
+    } else
+        fprintf(stderr, "skipping linux benchmarks: could not create files in %s\n", WORK_FOLDER);
+
+    // RamFileSystem
+    SD.setSDCardRamFileSystem();
+    if (prepare()) {
+        BenchRunner runner = newRunner();
+        addReadBenchmarks(runner, "ram");
+        addWriteBenchmarks(runner, "ram");
+        runBackend(runner, results);
+    }
+
+    // FAT16 card image, SdFile
+    if (format_fat16_image(WORK_IMAGE, 65536) && SD.setSDCardImagePath(WORK_IMAGE) && prepare()) {
+        BenchRunner runner = newRunner();
+        addReadBenchmarks(runner, "image");
+        addWriteBenchmarks(runner, "image");
+        // writes to a preallocated file in raw stream mode, to compare with seq_write
+        for (uint32_t chunk : {512u, 65536u}) {
+            runner.add("image/stream_write/" + std::to_string(chunk), [chunk](uint64_t n) {
+                auto start = []() {
+                    File f = SD.open("stream.bin", CREATE_MODE);
+                    f.preallocate(WRITE_FILE_LIMIT);
+                    f.rawStreamStart();
+                    return f;
+                };
+                File f = start();
+                uint32_t written = 0;
+                for (uint64_t i = 0; i < n; i++) {
+                    if (written + chunk > WRITE_FILE_LIMIT) {
+                        f.close();
+                        f = start();
+                        written = 0;
+                    }
+                    f.write(scratch.data(), chunk);
+                    written += chunk;
+                }
+                f.close();
+                return n * chunk;
+            });
+        }
+        // name lookups in a directory of BIG_DIR_ENTRIES files
+        if (prepareBigDir()) {
+            for (bool indexed : {false, true}) {
+                runner.add(indexed ? "image/open_big_dir_indexed" : "image/open_big_dir", [indexed](uint64_t n) {
+                    SD.setMetadataCache(indexed);
+                    char name[24];
+                    for (uint64_t i = 0; i < n; i++) {
+                        snprintf(name, sizeof(name), "big/f%04d.txt", (int)(i * 7919 % BIG_DIR_ENTRIES));
+                        File f = SD.open(name);
+                        f.close();
+                    }
+                    SD.setMetadataCache(false);
+                    return (uint64_t)0;
+                });
+            }
+        }
+        // 4 KiB reads of read.bin spread over one thread and one per
+        // processor, with concurrent readers on
+        for (unsigned threads : {1u, 0u}) {
+            runner.add(threads ? "image/parallel_read/1" : "image/parallel_read/all", [threads](uint64_t n) {
+                const uint32_t chunk = 4096;
+                unsigned count = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+                SD.setConcurrentReaders(true);
+                std::vector<std::thread> pool;
+                for (unsigned t = 0; t < count; t++) {
+                    pool.emplace_back([t, count, n]() {
+                        std::vector<uint8_t> buf(chunk);
+                        File f = SD.open("read.bin");
+                        f.seek((READ_FILE_SIZE / count * t) & ~(chunk - 1));
+                        for (uint64_t i = t; i < n; i += count) {
+                            if (f.position() + chunk > READ_FILE_SIZE)
+                                f.seek(0);
+                            f.read(buf.data(), chunk);
+                        }
+                        f.close();
+                    });
+                }
+                for (auto &th : pool)
+                    th.join();
+                SD.setConcurrentReaders(false);
+                return n * chunk;
+            });
+        }
+        // consistency check of the whole image, one thread and one per processor
+        for (uint8_t threads : {1, 0}) {
+            runner.add(threads ? "image/check/1" : "image/check/all", [threads](uint64_t n) {
+                check_report_t report;
+                for (uint64_t i = 0; i < n; i++)
+                    SD.checkCardImage(&report, false, threads);
+                return (uint64_t)0;
+            });
+        }
+        runBackend(runner, results);
+    } else
+        fprintf(stderr, "skipping image benchmarks: could not set up %s\n", WORK_IMAGE);
+
+    // FAT32 card image of 2M clusters, mounted from its FSInfo sector
+    if (format_fat32_image(WORK_IMAGE, 2 * 1024 * 1024) && SD.setSDCardImagePath(WORK_IMAGE)) {
+        BenchRunner runner = newRunner();
+        runner.add("image32/mount_and_append", [](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                SD.setSDCardImagePath(WORK_IMAGE);
+                File f = SD.open("log.bin", FILE_WRITE);
+                f.write(scratch.data(), 512);
+                f.close();
+            }
+            return n * 512;
+        });
+        runBackend(runner, results);
+    } else
+        fprintf(stderr, "skipping FAT32 image benchmarks: could not set up %s\n", WORK_IMAGE);
+
+    // 32 GiB FAT32 card image, formatted and filled from the host folder above
+    {
+        BenchRunner runner = newRunner();
+        runner.add("image32/format_from_folder", [](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                SD.formatCardImage(WORK_IMAGE, 32ULL << 30, WORK_FOLDER);
+            return (uint64_t)0;
+        });
+        runBackend(runner, results);
+    }
+
+    // read-only InMemoryFile
+    SD.setSDCardFileData(inMemoryData.data(), inMemoryData.size());
+    {
+        BenchRunner runner = newRunner();
+        addReadBenchmarks(runner, "inmemory");
+        runBackend(runner, results);
+    }
+
+    SD.setSDCardFolderPath("", false);
+    std::filesystem::remove_all(WORK_FOLDER);
+    std::remove(WORK_IMAGE);
+
+    FILE *out = stdout;
+    if (!outPath.empty()) {
+        out = fopen(outPath.c_str(), "w");
+        if (!out) {
+            perror(outPath.c_str());
+            return 1;
+        }
+    }
+    if (format == "json")
+        BenchRunner::printJson(out, results);
+    else if (format == "csv")
+        BenchRunner::printCsv(out, results);
+    else
+        BenchRunner::printConsole(out, results);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
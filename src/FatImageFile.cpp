@@ -0,0 +1,150 @@
+/*
+
+ SD - a slightly more friendly wrapper for sdfatlib
+
+ This library aims to expose a subset of SD card functionality
+ in the form of a higher level "wrapper" object.
+
+ License: GNU General Public License V3
+          (Because sdfatlib is licensed with this.)
+
+ (C) Copyright 2010 SparkFun Electronics
+
+ */
+
+#include "SD.h"
+
+// SdFile::read()/write() take a 16-bit count and read() returns int16_t, so
+// larger transfers are split into whole-block chunks below INT16_MAX.
+static const uint16_t MAX_TRANSFER = 63 * 512;
+
+FatImageFile::FatImageFile(const char *name, const SdFile &file) : AbstractFile(name), _file(file), _name(name) {
+    _fileName = _name.c_str();
+    _isDirectory = _file.isDir();
+}
+
+FatImageFile::~FatImageFile() {
+    if (_file.isOpen())
+        _file.close();
+}
+
+bool FatImageFile::isDirectory(void) {
+    return _file.isDir();
+}
+
+size_t FatImageFile::write(uint8_t val) {
+    return write(&val, 1);
+}
+
+size_t FatImageFile::write(const uint8_t *buf, size_t size) {
+    if (_file.rawStreaming()) {
+        // whole blocks only, straight to the card
+        if ((size & 0X1FF) || !_file.rawStreamWrite(buf, size >> 9))
+            return 0;
+        return size;
+    }
+    size_t written = 0;
+    while (written < size) {
+        size_t n = size - written;
+        if (n > MAX_TRANSFER) n = MAX_TRANSFER;
+        if (_file.write(buf + written, n) != n)
+            break;
+        written += n;
+    }
+    return written;
+}
+
+int FatImageFile::read() {
+    return _file.read();
+}
+
+int FatImageFile::peek() {
+    int c = _file.read();
+    if (c != -1)
+        _file.seekSet(_file.curPosition() - 1);
+    return c;
+}
+
+int FatImageFile::available() {
+    if (!_file.isFile()) return 0;
+    uint32_t n = _file.fileSize() - _file.curPosition();
+    return n > 0X7FFF ? 0X7FFF : n;
+}
+
+void FatImageFile::flush() {
+    if (_file.isOpen())
+        _file.sync();
+}
+
+bool FatImageFile::truncate(uint64_t size) {
+    if (size > 0XFFFFFFFF) return false;
+    return _file.truncate(size);
+}
+
+bool FatImageFile::preallocate(uint64_t size, bool *contiguous) {
+    if (size > 0XFFFFFFFF || !_file.preallocate(size))
+        return false;
+    if (contiguous) {
+        uint32_t bgnBlock, endBlock;
+        *contiguous = _file.contiguousRange(&bgnBlock, &endBlock);
+    }
+    return true;
+}
+
+bool FatImageFile::rawStreamStart() {
+    return _file.rawStreamStart();
+}
+
+bool FatImageFile::rawStreamStop() {
+    return _file.rawStreamStop();
+}
+
+int FatImageFile::read(void *buf, uint32_t nbyte) {
+    uint8_t *dst = (uint8_t *)buf;
+    uint32_t total = 0;
+    while (total < nbyte) {
+        uint32_t n = nbyte - total;
+        if (n > MAX_TRANSFER) n = MAX_TRANSFER;
+        int16_t r = _file.read(dst + total, n);
+        if (r < 0)
+            return total ? total : -1;
+        total += r;
+        if ((uint32_t)r < n)
+            break;
+    }
+    return total;
+}
+
+bool FatImageFile::seek(uint32_t pos) {
+    return _file.seekSet(pos);
+}
+
+uint32_t FatImageFile::position() {
+    return _file.curPosition();
+}
+
+uint32_t FatImageFile::size() {
+    return _file.fileSize();
+}
+
+void FatImageFile::close() {
+    if (_file.isOpen())
+        _file.close();
+}
+
+File FatImageFile::openNextFile(void) {
+    dir_t p;
+    while (_file.readDir(&p) > 0) {
+        // readDir() leaves the directory positioned just past the entry
+        uint16_t index = _file.curPosition() / 32 - 1;
+        SdFile f;
+        if (!f.open(&_file, index, O_READ))
+            break;
+        // the long name if there is one
+        char name[3 * LDIR_NAME_MAX + 1];
+        if (!f.getName(name, sizeof(name)))
+            SdFile::dirName(p, name);
+        return File(new FatImageFile(name, f));
+    }
+    return File(new InMemoryFile());
+}
@@ -17,6 +17,31 @@ int File::read(void *buf, uint32_t nbyte) {
     return file->read(buf, nbyte);
 }
 
+// Files never block, so skip Stream's per-byte timed read loop and hand the
+// whole request to the backend.
+size_t File::readBytes(char *buffer, size_t length) {
+    int n = file->read(buffer, length);
+    return n > 0 ? n : 0;
+}
+
+int File::readView(const uint8_t **data, uint32_t nbyte) {
+    return file->readView(data, nbyte);
+}
+
+bool File::preallocate(uint64_t size, bool *contiguous) {
+    if (contiguous)
+        *contiguous = false;
+    return file->preallocate(size, contiguous);
+}
+
+bool File::rawStreamStart() {
+    return file->rawStreamStart();
+}
+
+bool File::rawStreamStop() {
+    return file->rawStreamStop();
+}
+
 bool File::seek(uint32_t pos) {
     return file->seek(pos);
 }
@@ -84,6 +109,11 @@ File::File(const File &f) : file(f.file) {
 
 }
 
+File& File::operator=(const File &f) {
+    file = f.file;
+    return *this;
+}
+
 File File::openNextFile(void) {
     return file->openNextFile();
 }
@@ -1,4 +1,5 @@
 #include "SD.h"
+#include <cstring>
 
 InMemoryFile::InMemoryFile(const char *name, char *data, uint32_t size, uint8_t mode) : AbstractFile(name) {
     _fileName = name;
@@ -50,15 +51,26 @@ int InMemoryFile::read() {
 
 // buffered read for more efficient, high speed reading
 int InMemoryFile::read(void *buf, uint32_t nbyte) {
-    char * target = (char*)buf;
-    for (uint32_t i=0; i < nbyte; i++) {
-        // _size is int32_t with -1 as the empty/sentinel value; treat that as
-        // empty rather than comparing _position against a huge unsigned value.
-        if (_size < 0 || _position >= static_cast<uint32_t>(_size))
-            return i;
-        int byteRead = read();
-        target[i] = static_cast<char>(byteRead);
-    }
+    // _size is int32_t with -1 as the empty/sentinel value; treat that as
+    // empty rather than comparing _position against a huge unsigned value.
+    if (_size < 0 || _position >= static_cast<uint32_t>(_size))
+        return 0;
+    uint32_t remaining = _size - _position;
+    if (nbyte > remaining)
+        nbyte = remaining;
+    memcpy(buf, _data + _position, nbyte);
+    _position += nbyte;
+    return nbyte;
+}
+
+int InMemoryFile::readView(const uint8_t **data, uint32_t nbyte) {
+    if (_size < 0 || _position >= static_cast<uint32_t>(_size))
+        return 0;
+    uint32_t remaining = _size - _position;
+    if (nbyte > remaining)
+        nbyte = remaining;
+    *data = reinterpret_cast<const uint8_t *>(_data + _position);
+    _position += nbyte;
     return nbyte;
 }
 
@@ -14,11 +14,52 @@
 
 #include "SD.h"
 
+// Open modes passed in by callers use the SdFat O_* values. <fcntl.h> below
+// redefines several of those names as POSIX macros, so keep the SdFat ones.
+static const uint8_t SD_O_READ = O_READ;
+static const uint8_t SD_O_WRITE = O_WRITE;
+static const uint8_t SD_O_APPEND = O_APPEND;
+static const uint8_t SD_O_CREAT = O_CREAT;
+static const uint8_t SD_O_TRUNC = O_TRUNC;
+
 #include <string>
 #include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
-LinuxFile::LinuxFile(const char *name, const char *path, uint8_t mode, SDClass &sd) : AbstractFile(name), _sd(sd) {
+// pread()/pwrite() may transfer less than asked for; keep going until done.
+static ssize_t preadFully(int fd, uint8_t *buf, size_t count, off_t offset) {
+    size_t done = 0;
+    while (done < count) {
+        ssize_t r = ::pread(fd, buf + done, count - done, offset + done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return done ? (ssize_t)done : -1;
+        if (r == 0)
+            break;
+        done += r;
+    }
+    return done;
+}
+
+static bool pwriteFully(int fd, const uint8_t *buf, size_t count, off_t offset) {
+    size_t done = 0;
+    while (done < count) {
+        ssize_t r = ::pwrite(fd, buf + done, count - done, offset + done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        done += r;
+    }
+    return true;
+}
+
+LinuxFile::LinuxFile(const char *name, const char *path, uint8_t mode, SDClass &sd) : AbstractFile(name), _name(name), _sd(sd) {
     std::string actualFileName;
     if (strlen(path)==0) {
         actualFileName = sd.getSDCardFolderPath() + std::string("/") + std::string(name);
@@ -36,35 +77,58 @@ LinuxFile::LinuxFile(const char *name, const char *path, uint8_t mode, SDClass &
         memcpy(localPath, temppath.c_str(), temppath.length());
     }
     _path = path;
+    // name may point into a dirent that readdir() reuses, so keep a copy
+    _fileName = _name.c_str();
 
     // cout << actualFileName;
-    if (!is_directory(localFileName) ) {
+    if (is_directory(localFileName))
+        return;
+
+    // Same open semantics callers had with std::fstream: writing without
+    // reading or appending creates and truncates, appending creates, and
+    // read/write requires an existing file unless O_CREAT or O_TRUNC is set.
+    _readable = (mode & SD_O_READ) == SD_O_READ;
+    _append = (mode & SD_O_APPEND) == SD_O_APPEND;
+    _writable = (mode & SD_O_WRITE) == SD_O_WRITE || _append;
+    bool truncate = (mode & SD_O_TRUNC) == SD_O_TRUNC || (_writable && !_readable && !_append);
+    bool create = _append || truncate || (_writable && (mode & SD_O_CREAT) == SD_O_CREAT);
+
+    if (!_readable && !_writable) {
+        std::cout << "Not able to open " << actualFileName;
+        return;
+    }
 
-        std::iostream::openmode flags = static_cast<std::iostream::openmode>(0);
-        if ((mode & O_READ) == O_READ)
-            flags |= std::fstream::in;
+    int flags = _readable && _writable ? O_RDWR : _writable ? O_WRONLY : O_RDONLY;
+    if (create)
+        flags |= O_CREAT;
+    if (truncate && _writable)
+        flags |= O_TRUNC;
 
-        if ((mode & O_WRITE) == O_WRITE)
-            flags |= std::fstream::out;
+    _fd = ::open(localFileName, flags | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        std::cout << "Not able to open " << actualFileName;
+        return;
+    }
 
-        if ((mode & O_APPEND) == O_APPEND)
-            flags |= std::fstream::app;
+    struct stat st;
+    if (fstat(_fd, &st) != 0 || st.st_size > INT32_MAX) {
+        std::cout << "Not able to open " << actualFileName;
+        ::close(_fd);
+        _fd = -1;
+        return;
+    }
+    _size = st.st_size;
 
-        if ((mode & O_TRUNC) == O_TRUNC)
-            flags |= std::fstream::trunc;
+    if (sd.memoryMappedReads() && !_writable && mapFile())
+        return;
 
-        mockFile.open(actualFileName, flags);
-        if (!mockFile) {
-            std::cout << "Not able to open " << actualFileName;
-        }
-        _size = fileSize(actualFileName.c_str());
-    }
-    _fileName = name;
+    _bufferCapacity = sd.fileBufferSize();
+    if (_bufferCapacity > 0)
+        _buffer.reset(new uint8_t[_bufferCapacity]);
 }
 
 LinuxFile::~LinuxFile() {
-    if (mockFile.is_open())
-        mockFile.close();
+    close();
     if (dp != NULL)
         closedir(dp);
     // localFileName is declared `const char *`; cast away const to delete[].
@@ -72,34 +136,49 @@ LinuxFile::~LinuxFile() {
     delete[] localPath;
 }
 
-std::streampos LinuxFile::fileSize( const char* filePath ){
-    std::streampos fsize = 0;
-    std::ifstream file( filePath, std::ios::binary );
+// Map the whole file read-only; the mapping outlives the descriptor, which is
+// closed once the mapping is in place.
+bool LinuxFile::mapFile() {
+    if (_size > 0) {
+        void *map = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+        if (map == MAP_FAILED)
+            return false;
+        // typical use is streaming the file front to back
+        madvise(map, _size, MADV_SEQUENTIAL);
+        _map = static_cast<const uint8_t *>(map);
+    }
+    ::close(_fd);
+    _fd = -1;
 
-    fsize = file.tellg();
-    file.seekg( 0, std::ios::end );
-    fsize = file.tellg() - fsize;
-    file.close();
+    _position = 0;
+    _mapped = true;
+    return true;
+}
 
-    return fsize;
+// Write out pending data and drop whatever the buffer holds.
+bool LinuxFile::flushBuffer() {
+    bool ok = true;
+    if (_bufferDirty) {
+        ok = pwriteFully(_fd, _buffer.get(), _bufferLength, _bufferStart);
+        _bufferDirty = false;
+    }
+    _bufferLength = 0;
+    return ok;
+}
+
+std::streampos LinuxFile::fileSize( const char* filePath ){
+    struct stat st;
+    if (stat(filePath, &st) != 0)
+        return -1;
+    return st.st_size;
 }
 
 bool LinuxFile::is_directory( const char* pzPath )
 {
     if ( pzPath == NULL) return false;
 
-    DIR *pDir;
-    bool bExists = false;
-
-    pDir = opendir (pzPath);
-
-    if (pDir != NULL)
-    {
-        bExists = true;
-        (void) closedir (pDir);
-    }
-
-    return bExists;
+    struct stat st;
+    return stat(pzPath, &st) == 0 && S_ISDIR(st.st_mode);
 }
 
 size_t LinuxFile::write(uint8_t val) {
@@ -107,46 +186,59 @@ size_t LinuxFile::write(uint8_t val) {
 }
 
 size_t LinuxFile::write(const uint8_t *buf, size_t size) {
-    if (!mockFile.is_open()) {
+    if (_fd < 0 || !_writable) {
         return 0;
     }
+    if (_append)
+        _position = _size;
+    if ((uint64_t)_position + size > INT32_MAX)
+        return 0;
 
-    char * memblock = (char *)buf;
-
-    size_t before = mockFile.tellp(); //current pos
-    if (mockFile.write(memblock, size)) {
-        size_t after = mockFile.tellp();
-        //compute the difference
-        size_t numberOfBytesWritten = after - before;
-        //grow size only if the write extended past the current end-of-file
-        if ((int32_t)after > _size)
-            _size = (int32_t)after;
-        return numberOfBytesWritten;
+    // land the bytes in the buffer if they fall inside its window
+    if (_buffer && _position >= _bufferStart && _position <= _bufferStart + _bufferLength
+            && _position - _bufferStart + size <= _bufferCapacity) {
+        uint32_t offset = _position - _bufferStart;
+        memcpy(_buffer.get() + offset, buf, size);
+        if (offset + size > _bufferLength)
+            _bufferLength = offset + size;
+        _bufferDirty = true;
+    } else {
+        if (!flushBuffer())
+            return 0;
+        if (size < _bufferCapacity) {
+            memcpy(_buffer.get(), buf, size);
+            _bufferStart = _position;
+            _bufferLength = size;
+            _bufferDirty = true;
+        } else if (!pwriteFully(_fd, buf, size, _position)) {
+            return 0;
+        }
     }
 
-    return 0;
+    _position += size;
+    //grow size only if the write extended past the current end-of-file
+    if ((int32_t)_position > _size)
+        _size = (int32_t)_position;
+    return size;
 }
 
 int LinuxFile::read() {
-    if (! mockFile.is_open())
-        return -1;
-
-    char p;
-    if (!mockFile.read(&p, 1))
-        return -1;   // EOF or error
-
-    return static_cast<unsigned char>(p);
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
 }
 
 int LinuxFile::peek() {
-    if (! mockFile.is_open())
+    if (_fd < 0 && !_mapped)
         return 0;
 
-    return mockFile.peek();
+    int c = read();
+    if (c != -1)
+        _position--;
+    return c;
 }
 
 int LinuxFile::available() {
-    if (! mockFile.is_open()) return 0;
+    if (_fd < 0 && !_mapped) return 0;
     uint32_t p = position();
     long s = size();
     if (p > s) return 0;
@@ -157,19 +249,27 @@ int LinuxFile::available() {
 }
 
 void LinuxFile::flush() {
-    if (mockFile.is_open())
-        mockFile.flush();
+    if (_fd >= 0 && _bufferDirty) {
+        // keep the bytes around for reads that follow
+        pwriteFully(_fd, _buffer.get(), _bufferLength, _bufferStart);
+        _bufferDirty = false;
+    }
 }
 
 bool LinuxFile::seek(uint32_t pos) {
-    if (! mockFile.is_open()) return false;
-    mockFile.seekp(pos, std::ios::beg);
+    if (_mapped) {
+        if (pos > (uint32_t)_size) return false;
+        _position = pos;
+        return true;
+    }
+    if (_fd < 0) return false;
+    _position = pos;
     return true;
 }
 
 uint32_t LinuxFile::position() {
-    if (! mockFile.is_open()) return -1;
-    return mockFile.tellp();
+    if (_fd < 0 && !_mapped) return -1;
+    return _position;
 }
 
 uint32_t LinuxFile::size() {
@@ -177,14 +277,90 @@ uint32_t LinuxFile::size() {
 }
 
 void LinuxFile::close() {
-    if (mockFile.is_open())
-        mockFile.close();
+    if (_fd >= 0) {
+        flushBuffer();
+        ::close(_fd);
+        _fd = -1;
+    }
+    _buffer.reset();
+    _bufferCapacity = 0;
+    if (_map != nullptr)
+        munmap((void *)_map, _size);
+    _map = nullptr;
+    _mapped = false;
 }
 
 int LinuxFile::read(void *buf, uint32_t nbyte) {
-    mockFile.read((char *)buf, nbyte);
-    int bytesRead = mockFile.gcount();
-    return bytesRead;
+    if (_mapped) {
+        const uint8_t *data;
+        int n = readView(&data, nbyte);
+        if (n > 0)
+            memcpy(buf, data, n);
+        return n;
+    }
+    if (_fd < 0 || !_readable)
+        return 0;
+
+    uint8_t *dst = (uint8_t *)buf;
+    uint32_t total = 0;
+    while (total < nbyte && _position < (uint32_t)_size) {
+        uint32_t want = nbyte - total;
+        if (_position >= _bufferStart && _position < _bufferStart + _bufferLength) {
+            uint32_t n = _bufferStart + _bufferLength - _position;
+            if (n > want) n = want;
+            memcpy(dst + total, _buffer.get() + (_position - _bufferStart), n);
+            _position += n;
+            total += n;
+            continue;
+        }
+        if (!flushBuffer())
+            break;
+        if (want >= _bufferCapacity) {
+            // large request: skip the buffer and read straight into the caller's memory
+            ssize_t r = preadFully(_fd, dst + total, want, _position);
+            if (r > 0) {
+                _position += r;
+                total += r;
+            }
+            break;
+        }
+        ssize_t r = preadFully(_fd, _buffer.get(), _bufferCapacity, _position);
+        if (r <= 0)
+            break;
+        _bufferStart = _position;
+        _bufferLength = r;
+    }
+    return total;
+}
+
+int LinuxFile::readView(const uint8_t **data, uint32_t nbyte) {
+    if (!_mapped)
+        return -1;
+    uint32_t remaining = _size - _position;
+    if (nbyte > remaining)
+        nbyte = remaining;
+    *data = _map + _position;
+    _position += nbyte;
+    return nbyte;
+}
+
+// Uses fallocate() with FALLOC_FL_KEEP_SIZE rather than posix_fallocate(),
+// which would grow the file to size. The host file system doesn't tell us
+// how the blocks are laid out, so *contiguous is set false.
+bool LinuxFile::preallocate(uint64_t size, bool *contiguous) {
+    if (contiguous)
+        *contiguous = false;
+    if (_fd < 0 || !_writable || !flushBuffer())
+        return false;
+#ifdef FALLOC_FL_KEEP_SIZE
+    if (fallocate(_fd, FALLOC_FL_KEEP_SIZE, 0, size) != 0) {
+        perror("fallocate");
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
 }
 
 File LinuxFile::openNextFile(void) {
@@ -224,7 +400,17 @@ File LinuxFile::openNextFile(void) {
 }
 
 bool LinuxFile::truncate(uint64_t size) {
-    if (::truncate(localFileName, size) != 0)
+    // the mapping and views into it must keep matching the file
+    if (_mapped)
+        return false;
+    if (_fd >= 0 && !flushBuffer())
+        return false;
+    if (_fd >= 0 && _writable) {
+        if (ftruncate(_fd, size) != 0)
+            return false;
+    } else if (::truncate(localFileName, size) != 0)
         return false;
+    if (_fd >= 0)
+        _size = size;
     return true;
 }
\ No newline at end of file
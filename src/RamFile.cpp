@@ -0,0 +1,259 @@
+/*
+
+ SD - a slightly more friendly wrapper for sdfatlib
+
+ This library aims to expose a subset of SD card functionality
+ in the form of a higher level "wrapper" object.
+
+ License: GNU General Public License V3
+          (Because sdfatlib is licensed with this.)
+
+ (C) Copyright 2010 SparkFun Electronics
+
+ */
+
+#include "SD.h"
+#include <cstring>
+
+// Split a path into its non-empty components; "a//b/" and "/a/b" are both a, b.
+static std::vector<std::string> splitPath(const char *path) {
+    std::vector<std::string> parts;
+    std::string part;
+    for (const char *p = path; ; p++) {
+        if (*p == '/' || *p == 0) {
+            if (!part.empty() && part != ".")
+                parts.push_back(part);
+            part.clear();
+            if (*p == 0)
+                break;
+        } else
+            part += *p;
+    }
+    return parts;
+}
+
+RamFileSystem::RamFileSystem() : _root(std::make_shared<RamNode>()) {
+    _root->isDirectory = true;
+}
+
+std::shared_ptr<RamNode> RamFileSystem::lookup(const char *path) {
+    std::shared_ptr<RamNode> node = _root;
+    for (const std::string &part : splitPath(path)) {
+        if (!node->isDirectory)
+            return nullptr;
+        auto child = node->children.find(part);
+        if (child == node->children.end())
+            return nullptr;
+        node = child->second;
+    }
+    return node;
+}
+
+// Directory that holds the last component of path, which is returned in leaf.
+std::shared_ptr<RamNode> RamFileSystem::parentOf(const char *path, std::string &leaf) {
+    std::vector<std::string> parts = splitPath(path);
+    if (parts.empty())
+        return nullptr;
+    leaf = parts.back();
+    std::shared_ptr<RamNode> node = _root;
+    for (size_t i = 0; i + 1 < parts.size(); i++) {
+        auto child = node->children.find(parts[i]);
+        if (child == node->children.end() || !child->second->isDirectory)
+            return nullptr;
+        node = child->second;
+    }
+    return node;
+}
+
+AbstractFile *RamFileSystem::open(const char *path, uint8_t mode) {
+    std::shared_ptr<RamNode> node = lookup(path);
+    const char *slash = strrchr(path, '/');
+    const char *name = slash ? slash + 1 : path;
+    if (node && node->isDirectory)
+        return new RamFile(node == _root ? "/" : name, node, mode);
+
+    // Same rules LinuxFile applies: writing without reading or appending
+    // truncates, and only write modes may create the file.
+    bool readable = (mode & O_READ) == O_READ;
+    bool append = (mode & O_APPEND) == O_APPEND;
+    bool writable = (mode & O_WRITE) == O_WRITE || append;
+    bool truncate = (mode & O_TRUNC) == O_TRUNC || (writable && !readable && !append);
+    bool create = append || truncate || (writable && (mode & O_CREAT) == O_CREAT);
+    if (!readable && !writable)
+        return new InMemoryFile();
+
+    if (!node) {
+        std::string leaf;
+        std::shared_ptr<RamNode> parent = parentOf(path, leaf);
+        if (!create || !parent)
+            return new InMemoryFile();
+        node = std::make_shared<RamNode>();
+        parent->children[leaf] = node;
+    } else if (truncate && writable) {
+        node->data.clear();
+    }
+    return new RamFile(name, node, mode);
+}
+
+bool RamFileSystem::exists(const char *path) {
+    return lookup(path) != nullptr;
+}
+
+bool RamFileSystem::mkdir(const char *path) {
+    std::shared_ptr<RamNode> node = _root;
+    for (const std::string &part : splitPath(path)) {
+        std::shared_ptr<RamNode> &child = node->children[part];
+        if (!child) {
+            child = std::make_shared<RamNode>();
+            child->isDirectory = true;
+        } else if (!child->isDirectory) {
+            return false;
+        }
+        node = child;
+    }
+    return true;
+}
+
+// Like remove/rmdir in folder mode: drops files and whole directory trees
+// alike, and a path that does not exist is not an error.
+bool RamFileSystem::remove(const char *path) {
+    std::string leaf;
+    std::shared_ptr<RamNode> parent = parentOf(path, leaf);
+    if (parent)
+        parent->children.erase(leaf);
+    else if (splitPath(path).empty())
+        _root->children.clear();
+    return true;
+}
+
+RamFile::RamFile(const char *name, std::shared_ptr<RamNode> node, uint8_t mode) : AbstractFile(name), _node(node), _name(name) {
+    _fileName = _name.c_str();
+    _isDirectory = _node->isDirectory;
+    _readable = (mode & O_READ) == O_READ;
+    _append = (mode & O_APPEND) == O_APPEND;
+    _writable = !_isDirectory && ((mode & O_WRITE) == O_WRITE || _append);
+}
+
+bool RamFile::isDirectory(void) {
+    return _node && _node->isDirectory;
+}
+
+size_t RamFile::write(uint8_t val) {
+    return write(&val, 1);
+}
+
+size_t RamFile::write(const uint8_t *buf, size_t size) {
+    if (!_node || !_writable)
+        return 0;
+    std::vector<uint8_t> &data = _node->data;
+    if (_append)
+        _position = data.size();
+    if ((uint64_t)_position + size > INT32_MAX)
+        return 0;
+    if (_position + size > data.size())
+        data.resize(_position + size);
+    memcpy(data.data() + _position, buf, size);
+    _position += size;
+    return size;
+}
+
+int RamFile::read() {
+    if (!_node || !_readable || _position >= _node->data.size())
+        return -1;
+    return _node->data[_position++];
+}
+
+int RamFile::peek() {
+    if (!_node || !_readable || _position >= _node->data.size())
+        return -1;
+    return _node->data[_position];
+}
+
+int RamFile::available() {
+    if (!_node || _position >= _node->data.size())
+        return 0;
+    uint32_t n = _node->data.size() - _position;
+    return n > 0X7FFF ? 0X7FFF : n;
+}
+
+void RamFile::flush() {
+}
+
+bool RamFile::truncate(uint64_t size) {
+    if (!_node || _node->isDirectory || size > INT32_MAX)
+        return false;
+    _node->data.resize(size);
+    if (_position > size)
+        _position = size;
+    return true;
+}
+
+// Reserving vector capacity keeps appends from reallocating.
+bool RamFile::preallocate(uint64_t size, bool *contiguous) {
+    if (!_node || !_writable || _node->isDirectory || size > INT32_MAX)
+        return false;
+    _node->data.reserve(size);
+    if (contiguous)
+        *contiguous = true;
+    return true;
+}
+
+int RamFile::read(void *buf, uint32_t nbyte) {
+    const uint8_t *data;
+    int n = readView(&data, nbyte);
+    if (n > 0)
+        memcpy(buf, data, n);
+    return n < 0 ? 0 : n;
+}
+
+// The view stays valid until the file is next written or truncated.
+int RamFile::readView(const uint8_t **data, uint32_t nbyte) {
+    if (!_node || !_readable || _node->isDirectory)
+        return -1;
+    if (_position >= _node->data.size())
+        return 0;
+    uint32_t remaining = _node->data.size() - _position;
+    if (nbyte > remaining)
+        nbyte = remaining;
+    *data = _node->data.data() + _position;
+    _position += nbyte;
+    return nbyte;
+}
+
+bool RamFile::seek(uint32_t pos) {
+    if (!_node || pos > _node->data.size())
+        return false;
+    _position = pos;
+    return true;
+}
+
+uint32_t RamFile::position() {
+    if (!_node) return -1;
+    return _position;
+}
+
+uint32_t RamFile::size() {
+    if (!_node) return 0;
+    return _node->data.size();
+}
+
+void RamFile::close() {
+    _node.reset();
+}
+
+// Entries come back in name order; after the last one an empty File is
+// returned and the next call starts from the beginning again.
+File RamFile::openNextFile(void) {
+    if (!isDirectory())
+        return File(new InMemoryFile());
+
+    auto &children = _node->children;
+    auto next = _iterating ? children.upper_bound(_nextEntry) : children.begin();
+    if (next == children.end()) {
+        _iterating = false;
+        return File(new InMemoryFile());
+    }
+    _iterating = true;
+    _nextEntry = next->first;
+    return File(new RamFile(next->first.c_str(), next->second, O_READ));
+}
@@ -53,6 +53,7 @@
 #include <iostream>
 #include <fstream>
 #include <filesystem>
+#include <sys/stat.h>
 #include "SD.h"
 
 namespace fs = std::filesystem;
@@ -60,7 +61,7 @@ namespace fs = std::filesystem;
 namespace SDLib {
 
 // Used by `getNextPathComponent`
-#define MAX_COMPONENT_LEN 12 // What is max length?
+#define MAX_COMPONENT_LEN (3 * LDIR_NAME_MAX) // a long name in UTF-8
 #define PATH_COMPONENT_BUFFER_LEN MAX_COMPONENT_LEN+1
 
 bool getNextPathComponent(const char *path, unsigned int *p_offset,
@@ -107,6 +108,15 @@ bool getNextPathComponent(const char *path, unsigned int *p_offset,
 	buffer[bufferOffset++] = path[offset++];
   }
 
+  // A name that does not fit is no name at all rather than a different,
+  // shortened one.
+  if (path[offset] != '/' && path[offset] != '\0') {
+	bufferOffset = 0;
+	while (path[offset] != '/' && path[offset] != '\0') {
+	  offset++;
+	}
+  }
+
   buffer[bufferOffset] = '\0';
 
   // Skip trailing separator so we can determine if this
@@ -348,22 +358,22 @@ bool SDClass::begin(uint8_t csPin) {
 	Return true if initialization succeeds, false otherwise.
 
    */
-  return (_sdCardFolderLocation.length() > 0 || (_fileData != NULL && _fileSize > 0)) ;
+  return (_useCardImage || _ramFileSystem || _sdCardFolderLocation.length() > 0 || (_fileData != NULL && _fileSize > 0)) ;
 }
 
 bool SDClass::begin(uint32_t clock, uint8_t csPin) {
-    return (_sdCardFolderLocation.length() > 0 || (_fileData != NULL && _fileSize > 0));
+    return (_useCardImage || _ramFileSystem || _sdCardFolderLocation.length() > 0 || (_fileData != NULL && _fileSize > 0));
 }
 
-// this little helper is used to traverse paths
-SdFile SDClass::getParentDir(const char *filepath, int *index) {
-  // get parent directory
-  SdFile d1 = root; // start with the mostparent, root!
+// this little helper is used to traverse paths. Files in the root
+// directory are looked up in root itself; for deeper paths the parent
+// directory is opened into *dir. Returns 0 if a subdirectory is missing.
+SdFile *SDClass::getParentDir(const char *filepath, int *index, SdFile *dir) {
   SdFile d2;
 
   // we'll use the pointers to swap between the two objects
-  SdFile *parent = &d1;
-  SdFile *subdir = &d2;
+  SdFile *parent = &root; // start with the mostparent, root!
+  SdFile *subdir = dir;
   
   const char *origpath = filepath;
 
@@ -381,10 +391,12 @@ SdFile SDClass::getParentDir(const char *filepath, int *index) {
 	}
 
 	// extract just the name of the next subdirectory
-	uint8_t idx = strchr(filepath, '/') - filepath;
-	if (idx > 12)
-	  idx = 12;    // dont let them specify long names
-	char subdirname[13];
+	size_t idx = strchr(filepath, '/') - filepath;
+	if (idx > MAX_COMPONENT_LEN) {
+	  // too long for a long name
+	  return 0;
+	}
+	char subdirname[MAX_COMPONENT_LEN + 1];
 	strncpy(subdirname, filepath, idx);
 	subdirname[idx] = 0;
 
@@ -392,28 +404,67 @@ SdFile SDClass::getParentDir(const char *filepath, int *index) {
 	subdir->close();
 	if (! subdir->open(parent, subdirname, O_READ)) {
 	  // failed to open one of the subdirectories
-	  return SdFile();
+	  return 0;
 	}
 	// move forward to the next subdirectory
 	filepath += idx;
 
-	// we reuse the objects, close it.
-	parent->close();
+	// we reuse the objects, close it. root stays open.
+	if (parent != &root) {
+	  parent->close();
+	}
 
 	// swap the pointers
-	SdFile *t = parent;
+	SdFile *t = (parent == &root) ? &d2 : parent;
 	parent = subdir;
 	subdir = t;
   }
 
   *index = (int)(filepath - origpath);
   // parent is now the parent diretory of the file!
-  return *parent;
+  if (parent == &d2) {
+    *dir = d2;
+    parent = dir;
+  }
+  return parent;
 }
 
 
 File SDClass::open(const char *filepath, uint8_t mode) {
     AbstractFile *result;
+    if (_useCardImage) {
+        // the walk and root are shared with other threads' opens
+        SdVolumeLock hold(&volume);
+        int pathidx;
+        SdFile subdir;
+        SdFile *parentdir = getParentDir(filepath, &pathidx, &subdir);
+        if (!parentdir) {
+            return File(new InMemoryFile());
+        }
+        if (!filepath[pathidx]) {
+            // it was the directory itself; the handle gets its own
+            // position, starting at the first entry, and the name of the
+            // path's last component
+            std::string name = filepath;
+            while (!name.empty() && name.back() == '/')
+                name.pop_back();
+            name = name.substr(name.rfind('/') + 1);
+            SdFile dir = *parentdir;
+            dir.rewind();
+            return File(new FatImageFile(name.empty() ? "/" : name.c_str(), dir));
+        }
+        filepath += pathidx;
+        SdFile file;
+        if (!file.open(parentdir, filepath, mode)) {
+            return File(new InMemoryFile());
+        }
+        if (mode & O_APPEND) {
+            file.seekEnd();
+        }
+        return File(new FatImageFile(filepath, file));
+    }
+    if (_ramFileSystem)
+        return File(_ramFileSystem->open(filepath, mode));
     if (_useMockData) {
         result = new InMemoryFile(filepath, _fileData, _fileSize, mode  );
     } else {
@@ -429,6 +480,9 @@ File SDClass::open(const char *filepath, uint8_t mode) {
             memcpy(pathBuf, temppath.c_str(), temppath.length());
             path = pathBuf;
         }
+        // opening for write may create the file
+        if (_metadataCache && (mode & (O_WRITE | O_APPEND | O_CREAT | O_TRUNC)))
+            _existsCache.erase(normalizePath(filepath));
         result = new LinuxFile(fileNameString.c_str(), path, mode, *this);
     }
     return File(result);
@@ -438,32 +492,168 @@ bool SDClass::exists(const char *filepath) {
     if (_useMockData)
     	return true;
 
+    if (_useCardImage) {
+        if (!filepath[0] || !strcmp(filepath, "/"))
+            return true;
+        SdVolumeLock hold(&volume);
+        return walkPath(filepath, root, callback_pathExists);
+    }
+
+    if (_ramFileSystem)
+        return _ramFileSystem->exists(filepath);
+
+    std::string key;
+    if (_metadataCache) {
+        key = normalizePath(filepath);
+        auto cached = _existsCache.find(key);
+        if (cached != _existsCache.end())
+            return cached->second;
+    }
+
     const std::string path = _sdCardFolderLocation + "/" + std::string(filepath);
-    const char *pathCstr = path.c_str();
-    std::fstream file(pathCstr);
-    bool isFile = (bool)file;
-    if (isFile)
-        return true;
+    struct stat st;
+    bool found = stat(path.c_str(), &st) == 0;
+
+    if (_metadataCache)
+        _existsCache[key] = found;
+    return found;
+}
+
+// "a//b/", "/a/b" and "./a/b" all name the same entry in the cache.
+std::string SDClass::normalizePath(const char *filepath) {
+    std::string result;
+    std::string part;
+    for (const char *p = filepath; ; p++) {
+        if (*p == '/' || *p == 0) {
+            if (!part.empty() && part != ".") {
+                if (!result.empty())
+                    result += '/';
+                result += part;
+            }
+            part.clear();
+            if (*p == 0)
+                break;
+        } else
+            part += *p;
+    }
+    return result;
+}
 
-    bool is_Directory = LinuxFile::is_directory (pathCstr);
-    return is_Directory;
+bool SDClass::setConcurrentReaders(bool enabled) {
+    if (!_useCardImage)
+        return false;
+    return volume.concurrentEnable(enabled);
+}
+
+void SDClass::setMetadataCache(bool enabled) {
+    _metadataCache = enabled;
+    _existsCache.clear();
+    volume.dirIndexEnable(enabled);
 }
 
 std::string SDClass::getSDCardFolderPath() {
     return _sdCardFolderLocation;
 }
 
+std::string SDClass::getSDCardImagePath() {
+    return _sdCardImageLocation;
+}
+
+bool SDClass::setSDCardImagePath(std::string path) {
+    unmountCardImage();
+    _ramFileSystem.reset();
+    _useMockData = false;
+    _sdCardFolderLocation = "";
+    _sdCardImageLocation = path;
+
+    if (!card.openImage(path.c_str())) {
+        Serial.printf("Unable to open card image '%s'\n", path.c_str());
+        return false;
+    }
+    if (!volume.init(&card) || !root.openRoot(&volume)) {
+        Serial.printf("No FAT16/FAT32/exFAT volume in card image '%s'\n", path.c_str());
+        volume.cacheClear();
+        card.closeImage();
+        return false;
+    }
+    _useCardImage = true;
+    return true;
+}
+
+bool SDClass::formatCardImage(std::string path, uint64_t bytes, std::string fromFolder,
+                              uint8_t fatType, uint32_t clusterBytes) {
+    unmountCardImage();
+    SdFormat formatter(fatType, clusterBytes);
+    if (!formatter.format(path.c_str(), bytes)) {
+        Serial.printf("Unable to format card image '%s'\n", path.c_str());
+        return false;
+    }
+    if (!setSDCardImagePath(path))
+        return false;
+    if (!fromFolder.empty() && !formatter.copyFolder(&root, fromFolder.c_str())) {
+        Serial.printf("Unable to copy '%s' into card image '%s'\n", fromFolder.c_str(), path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool SDClass::checkCardImage(check_report_t *report, bool repair, uint8_t threads) {
+    if (!_useCardImage)
+        return false;
+    // other threads' opens wait until root is reopened
+    SdVolumeLock hold(&volume);
+    SdCheck checker(threads);
+    bool ok = checker.check(&volume, report, repair);
+    if (repair) {
+        // pick up a repaired root directory
+        root.close();
+        root.openRoot(&volume);
+    }
+    return ok;
+}
+
+bool SDClass::defragCardImage(defrag_report_t *report) {
+    if (!_useCardImage)
+        return false;
+    return SdDefrag().defrag(&volume, report);
+}
+
+void SDClass::unmountCardImage() {
+    if (!card.isImage())
+        return;
+    // each mount starts with one thread at a time
+    volume.concurrentEnable(false);
+    if (root.isOpen())
+        root.close();
+    // write back and forget blocks cached from this card
+    volume.cacheClear();
+    card.closeImage();
+    _useCardImage = false;
+}
+
 void SDClass::setSDCardFolderPath(std::string path, bool createDirectoryIfNotAlreadyExisting) {
+	unmountCardImage();
+	_ramFileSystem.reset();
 	_useMockData = false;
 	_sdCardFolderLocation = "";
+	_existsCache.clear();
 	if (createDirectoryIfNotAlreadyExisting && !exists(path) ) {
 		mkdir(path);
 	}
 
     _sdCardFolderLocation = path;
+    _existsCache.clear();
 }
 
 bool SDClass::mkdir(const char *filepath) {
+    if (_useCardImage) {
+        SdVolumeLock hold(&volume);
+        return walkPath(filepath, root, callback_makeDirPath);
+    }
+    if (_ramFileSystem)
+        return _ramFileSystem->mkdir(filepath);
+
+    _existsCache.clear();
     std::string path;
 	
 	if (_sdCardFolderLocation.size() == 0)
@@ -486,11 +676,20 @@ bool SDClass::mkdir(const char *filepath) {
 }
 
 bool SDClass::rmdir(const char *filepath) {
+    if (_useCardImage) {
+        SdVolumeLock hold(&volume);
+        return walkPath(filepath, root, callback_rmdir);
+    }
+    if (_ramFileSystem)
+        return _ramFileSystem->remove(filepath);
+
     if (_sdCardFolderLocation.size() == 0)
         return true;
 
     std::string path = _sdCardFolderLocation + "/" + std::string(filepath);
     if (exists(filepath)) {
+        // remove_all() may take a whole subtree with it
+        _existsCache.clear();
         try {
             fs::remove_all(path);
         } catch (const std::exception &e) {
@@ -502,11 +701,20 @@ bool SDClass::rmdir(const char *filepath) {
 }
 
 bool SDClass::remove(const char *filepath) {
+    if (_useCardImage) {
+        SdVolumeLock hold(&volume);
+        return walkPath(filepath, root, callback_remove);
+    }
+    if (_ramFileSystem)
+        return _ramFileSystem->remove(filepath);
+
     if (_sdCardFolderLocation.size() == 0)
         return false;
 
     std::string path = _sdCardFolderLocation + "/" + std::string(filepath);
     if (exists(filepath)) {
+        // remove_all() may take a whole subtree with it
+        _existsCache.clear();
         try {
             fs::remove_all(path);
         } catch (const std::exception &e) {
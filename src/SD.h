@@ -3,6 +3,9 @@
 
 #include "Arduino.h"
 #include "utility/SdFat.h"
+#include "utility/SdCheck.h"
+#include "utility/SdDefrag.h"
+#include "utility/SdFormat.h"
 #include "Print.h"
 #include <cstdio>
 #include "utility/SdFatUtil.h"
@@ -11,6 +14,10 @@
 #include <fstream>
 #include <cstdint>
 #include <memory>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <vector>
 
 #define BUILTIN_SDCARD 254
 
@@ -41,6 +48,20 @@ namespace SDLib {
         virtual void close() = 0;
         virtual operator bool() = 0;
         virtual File openNextFile(void) = 0;
+        // Zero-copy read: point *data at up to nbyte bytes of file content at
+        // the current position and advance past them. Returns the number of
+        // bytes available at *data, or -1 if the file is not memory backed.
+        virtual int readView(const uint8_t ** /*data*/, uint32_t /*nbyte*/) { return -1; }
+        // Reserve space for the file to grow to size bytes without changing
+        // its size, so later writes don't stall on allocation. *contiguous,
+        // if given, is set if the file's storage is known to be one run.
+        // Returns false if the backend can not reserve space.
+        virtual bool preallocate(uint64_t /*size*/, bool * /*contiguous*/) { return false; }
+        // Send writes straight to the card as whole 512 byte blocks, for a
+        // contiguous file on a card image. write() then only takes multiples
+        // of 512 bytes; the size is updated by rawStreamStop() or close().
+        virtual bool rawStreamStart() { return false; }
+        virtual bool rawStreamStop() { return false; }
 
     };
 
@@ -54,6 +75,8 @@ public:
 
     File(const File& f);
 
+    File& operator=(const File& f);
+
     File();
 
     size_t write(uint8_t ch) override;
@@ -65,6 +88,12 @@ public:
     void flush() override;
     bool truncate(uint64_t size=0);
     int read(void *buf, uint32_t nbyte);
+    size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+    int readView(const uint8_t **data, uint32_t nbyte);
+    bool preallocate(uint64_t size, bool *contiguous = nullptr);
+    bool rawStreamStart();
+    bool rawStreamStop();
     bool seek(uint32_t pos);
     uint32_t position();
     uint32_t size();
@@ -94,6 +123,7 @@ public:
     void flush() override;
     bool truncate(uint64_t size) override;
     int read(void *buf, uint32_t nbyte) override;
+    int readView(const uint8_t **data, uint32_t nbyte) override;
     bool seek(uint32_t pos) override;
     uint32_t position() override;
     uint32_t size() override;
@@ -110,8 +140,25 @@ private:
     const char * localFileName = nullptr;
     char * localPath = nullptr;
     const char * _path;
-    std::fstream mockFile = std::fstream();
+    std::string _name;
+    int _fd = -1;
+    bool _readable = false;
+    bool _writable = false;
+    bool _append = false;
+    uint32_t _position = 0;
+    // user-space buffer in front of the descriptor, sized by
+    // SDClass::setFileBufferSize(); holds either read-ahead or pending writes
+    std::unique_ptr<uint8_t[]> _buffer;
+    uint32_t _bufferCapacity = 0;
+    uint32_t _bufferStart = 0;
+    uint32_t _bufferLength = 0;
+    bool _bufferDirty = false;
+    bool flushBuffer();
     DIR *dp = NULL;
+    // read-only files opened with SDClass::setMemoryMappedReads(true)
+    const uint8_t *_map = nullptr;
+    bool _mapped = false;
+    bool mapFile();
 public:
     LinuxFile(const char *name, const char *path, uint8_t mode = O_READ, SDClass &sd = SD);
     LinuxFile(SDClass &sd = SD);
@@ -127,12 +174,14 @@ public:
     void flush() override;
     bool truncate(uint64_t size) override;
     int read(void *buf, uint32_t nbyte) override;
+    int readView(const uint8_t **data, uint32_t nbyte) override;
+    bool preallocate(uint64_t size, bool *contiguous) override;
     bool seek(uint32_t pos) override;
     uint32_t position() override;
     uint32_t size() override;
     void close() override;
     explicit operator bool() override {
-        return (mockFile.is_open() ||  isDirectory());
+        return (_fd >= 0 || _mapped || isDirectory());
     }
     bool isDirectory(void) override {
         return is_directory(localFileName);
@@ -141,6 +190,94 @@ public:
     SDClass &_sd;
 };
 
+class FatImageFile : public AbstractFile {
+private:
+    SdFile _file;
+    std::string _name;
+public:
+    FatImageFile(const char *name, const SdFile &file);
+    ~FatImageFile() override;
+    bool isDirectory(void) override;
+    size_t write(uint8_t) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    int read() override;
+    int peek() override;
+    int available() override;
+    void flush() override;
+    bool truncate(uint64_t size) override;
+    int read(void *buf, uint32_t nbyte) override;
+    bool preallocate(uint64_t size, bool *contiguous) override;
+    bool rawStreamStart() override;
+    bool rawStreamStop() override;
+    bool seek(uint32_t pos) override;
+    uint32_t position() override;
+    uint32_t size() override;
+    void close() override;
+    explicit operator bool() override {
+        return _file.isOpen();
+    }
+    File openNextFile(void) override;
+};
+
+// A file or directory in the tree kept by RamFileSystem. Open RamFile
+// objects share ownership, so removing an open file leaves it readable.
+struct RamNode {
+    bool isDirectory = false;
+    std::vector<uint8_t> data;
+    std::map<std::string, std::shared_ptr<RamNode>> children;
+};
+
+// Directory tree held entirely in memory, selected with
+// SDClass::setSDCardRamFileSystem(). Paths, open modes, mkdir, remove and
+// rmdir behave as they do for a folder on the host.
+class RamFileSystem {
+private:
+    std::shared_ptr<RamNode> _root;
+    std::shared_ptr<RamNode> lookup(const char *path);
+    std::shared_ptr<RamNode> parentOf(const char *path, std::string &leaf);
+public:
+    RamFileSystem();
+    AbstractFile *open(const char *path, uint8_t mode);
+    bool exists(const char *path);
+    bool mkdir(const char *path);
+    bool remove(const char *path);
+};
+
+class RamFile : public AbstractFile {
+private:
+    std::shared_ptr<RamNode> _node;
+    std::string _name;
+    uint32_t _position = 0;
+    bool _readable;
+    bool _writable;
+    bool _append;
+    // name of the last entry handed out by openNextFile()
+    std::string _nextEntry;
+    bool _iterating = false;
+public:
+    RamFile(const char *name, std::shared_ptr<RamNode> node, uint8_t mode = O_READ);
+    ~RamFile() override = default;
+    bool isDirectory(void) override;
+    size_t write(uint8_t) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    int read() override;
+    int peek() override;
+    int available() override;
+    void flush() override;
+    bool truncate(uint64_t size) override;
+    int read(void *buf, uint32_t nbyte) override;
+    int readView(const uint8_t **data, uint32_t nbyte) override;
+    bool preallocate(uint64_t size, bool *contiguous) override;
+    bool seek(uint32_t pos) override;
+    uint32_t position() override;
+    uint32_t size() override;
+    void close() override;
+    explicit operator bool() override {
+        return _node != nullptr;
+    }
+    File openNextFile(void) override;
+};
+
 class SDClass {
 private:
   // These are required for initialisation and use of sdfatlib
@@ -149,10 +286,18 @@ private:
     SdFile root;
 
     // my quick&dirty iterator, should be replaced
-    SdFile getParentDir(const char *filepath, int *indx);
+    SdFile *getParentDir(const char *filepath, int *indx, SdFile *dir);
 
     std::string _sdCardFolderLocation;
+    std::string _sdCardImageLocation;
+    bool _useCardImage = false;
     bool _useMockData = false;
+    std::unique_ptr<RamFileSystem> _ramFileSystem;
+    bool _memoryMappedReads = false;
+    uint32_t _fileBufferSize = 4096;
+    bool _metadataCache = false;
+    std::unordered_map<std::string, bool> _existsCache;
+    static std::string normalizePath(const char *filepath);
     char *_fileData = nullptr;
     uint32_t _fileSize = 0;
 
@@ -161,6 +306,13 @@ public:
 
     }
 
+    // Each instance has its own card and volume, so several card images
+    // can be mounted at once; a mounted image is written back when the
+    // instance goes away.
+    ~SDClass() {
+        unmountCardImage();
+    }
+
     SDClass(std::string sdCardFolderLocation) : 
         _sdCardFolderLocation(sdCardFolderLocation) 
     {
@@ -171,7 +323,75 @@ public:
 
     void setSDCardFolderPath(std::string path, bool createDirectoryIfNotAlreadyExisting = false);
     
+    // Mount a raw FAT16/FAT32/exFAT card image (e.g. a dd copy of a real card).
+    // Files are then served by the SdFat volume code instead of the host
+    // file system, with VFAT long names (UTF-8) as well as 8.3 names.
+    // Returns false if the image can not be mounted.
+    bool setSDCardImagePath(std::string path);
+    std::string getSDCardImagePath();
+
+    // Create a sparse FAT16/FAT32 card image of `bytes` bytes at `path`,
+    // copy the host folder `fromFolder` into it if one is given, and mount
+    // it. fatType 0 means FAT16 up to 2 GiB and FAT32 above; clusterBytes 0
+    // picks a cluster size for the capacity. Files are laid out contiguously.
+    // Returns false if the image can't be made, filled or mounted.
+    bool formatCardImage(std::string path, uint64_t bytes, std::string fromFolder = "",
+                         uint8_t fatType = 0, uint32_t clusterBytes = 0);
+
+    // Serve files opened read-only in folder mode from a memory mapping
+    // instead of a stream, so File::readView() can hand out pointers.
+    // truncate() fails on such a file.
+    void setMemoryMappedReads(bool enabled) {
+        _memoryMappedReads = enabled;
+    }
+    bool memoryMappedReads() {
+        return _memoryMappedReads;
+    }
+
+    // Size of the user-space buffer each LinuxFile keeps in front of its
+    // descriptor. Zero sends every read and write straight to the kernel.
+    // Applies to files opened after the call.
+    void setFileBufferSize(uint32_t bytes) {
+        _fileBufferSize = bytes;
+    }
+    uint32_t fileBufferSize() {
+        return _fileBufferSize;
+    }
+
+    // Remember exists() answers in folder mode, keyed on the normalized path.
+    // SDClass's own mkdir/remove/rmdir and opens for write keep the cache
+    // current; files created or deleted behind its back are not noticed until
+    // the cache is switched off or the folder path is set again. On a card
+    // image it keeps an index of names per directory instead, so opening or
+    // creating a file does not scan the whole directory.
+    void setMetadataCache(bool enabled);
+    bool metadataCache() {
+        return _metadataCache;
+    }
+
+    // Let several threads read files of the mounted card image at once,
+    // each File from one thread. Reads share the volume and a lock-striped
+    // block cache; opens, writes, checks and other changes take it in
+    // turn. Turn it on while no other thread uses this instance; turning it
+    // off waits for reads in progress. Unmounting the image turns it off.
+    // Returns false if no card image is mounted.
+    bool setConcurrentReaders(bool enabled);
+
+    // Serve every path from an empty directory tree held in memory; nothing
+    // touches the host file system until another mode is selected. Calling
+    // it again starts over with an empty tree.
+    void setSDCardRamFileSystem() {
+        unmountCardImage();
+        _useMockData = false;
+        _ramFileSystem.reset(new RamFileSystem());
+    }
+    bool usingRamFileSystem() {
+        return _ramFileSystem != nullptr;
+    }
+
     void setSDCardFileData(char *data, uint32_t size) {
+        unmountCardImage();
+        _ramFileSystem.reset();
         _fileData = data;
         _fileSize = size;
         _useMockData = true;
@@ -204,6 +424,24 @@ public:
     bool rmdir(const char *filepath);
     bool rmdir(const std::string &filepath) { return rmdir(filepath.c_str()); }
 
+    // Check the mounted card image's FAT, bitmap and directories against
+    // each other, fixing what is wrong if repair is set. Files should be
+    // closed first. threads is the number of threads, zero for one per
+    // processor. Returns false if no image is mounted or it can't be read;
+    // problems found are in report.
+    bool checkCardImage(check_report_t *report, bool repair = false, uint8_t threads = 0);
+
+    // Move each fragmented file of the mounted FAT16/FAT32 card image into
+    // one run of clusters. Files should be closed first. Returns false if
+    // no such image is mounted or it can't be read or written; report has
+    // the fragmentation before and after.
+    bool defragCardImage(defrag_report_t *report);
+
+    // The volume of the mounted card image, to tune or inspect its block
+    // cache. An instance and the files opened through it should be used
+    // from one thread at a time; separate instances may run in parallel.
+    SdVolume &cardVolume() { return volume; }
+
 private:
 
     // This is used to determine the mode used to open a file
@@ -213,6 +451,8 @@ private:
     // It shouldn't be set directly--it is set via the parameters to `open`.
     int fileOpenMode;
 
+    void unmountCardImage();
+
     friend class File;
     friend bool callback_openPath(SdFile&, const char *, bool, void *);
 };
@@ -288,6 +288,42 @@ uint32_t const FAT32MASK = 0X0FFFFFFF;
 /** Type name for fat32BootSector */
 typedef struct fat32BootSector fbs_t;
 //------------------------------------------------------------------------------
+/**
+ * \struct fat32FsInfo
+ *
+ * \brief FSInfo sector of a FAT32 volume.
+ *
+ * Both counts are hints: 0XFFFFFFFF means unknown and a driver must check
+ * them against the volume before trusting them.
+ */
+struct fat32FsInfo {
+           /** must be 0X41615252 */
+  uint32_t leadSignature;
+           /** must be zero */
+  uint8_t  reserved1[480];
+           /** must be 0X61417272 */
+  uint32_t structSignature;
+           /** last known count of free clusters on the volume */
+  uint32_t freeCount;
+           /** cluster at which to start looking for free clusters */
+  uint32_t nextFree;
+           /** must be zero */
+  uint8_t  reserved2[12];
+           /** must be 0XAA550000 */
+  uint32_t trailSignature;
+} __attribute__((packed));
+/** Value of fat32FsInfo::leadSignature. */
+uint32_t const FSINFO_LEAD_SIG = 0X41615252;
+/** Value of fat32FsInfo::structSignature. */
+uint32_t const FSINFO_STRUCT_SIG = 0X61417272;
+/** Value of fat32FsInfo::trailSignature. */
+uint32_t const FSINFO_TRAIL_SIG = 0XAA550000;
+/** Value of a fat32FsInfo count that is not known. */
+uint32_t const FSINFO_UNKNOWN = 0XFFFFFFFF;
+
+/** Type name for fat32FsInfo */
+typedef struct fat32FsInfo fsinfo_t;
+//------------------------------------------------------------------------------
 /**
  * \struct directoryEntry
  * \brief FAT short directory entry
@@ -401,6 +437,45 @@ uint8_t const DIR_ATT_DEFINED_BITS = 0X3F;
 static inline uint8_t DIR_IS_LONG_NAME(const dir_t* dir) {
   return (dir->attributes & DIR_ATT_LONG_NAME_MASK) == DIR_ATT_LONG_NAME;
 }
+//------------------------------------------------------------------------------
+/**
+ * \struct longDirectoryEntry
+ * \brief FAT long file name directory entry
+ *
+ * A long name is kept in the entries just before the short name entry it
+ * belongs to, last part first.  Each entry holds 13 UCS-2 characters; a
+ * name that does not fill its last entry ends with a zero character and
+ * the rest is padded with 0XFFFF.
+ */
+struct longDirectoryEntry {
+          /** Position of this part of the name counting from one, ORed with
+           *  LDIR_ORD_LAST_LONG_ENTRY for the last part. */
+  uint8_t  ord;
+           /** Characters 1-5 of this part. */
+  uint16_t name1[5];
+           /** Always DIR_ATT_LONG_NAME. */
+  uint8_t  attributes;
+           /** Zero for a long name entry. */
+  uint8_t  type;
+           /** Checksum of the short name the entry belongs to. */
+  uint8_t  checksum;
+           /** Characters 6-11 of this part. */
+  uint16_t name2[6];
+           /** Always zero. */
+  uint16_t mustBeZero;
+           /** Characters 12-13 of this part. */
+  uint16_t name3[2];
+} __attribute__((packed));
+/** Type name for longDirectoryEntry */
+typedef struct longDirectoryEntry ldir_t;
+/** ord bit for the entry holding the last part of a long name */
+uint8_t const LDIR_ORD_LAST_LONG_ENTRY = 0X40;
+/** characters in one long name entry */
+uint8_t const LDIR_NAME_CHARS = 13;
+/** most characters in a long name */
+uint16_t const LDIR_NAME_MAX = 255;
+/** most entries used by one long name */
+uint8_t const LDIR_MAX_ENTRIES = 20;
 /** Mask for file/subdirectory tests */
 uint8_t const DIR_ATT_FILE_TYPE_MASK = (DIR_ATT_VOLUME_ID | DIR_ATT_DIRECTORY);
 /** Directory entry is for a file */
@@ -415,4 +490,189 @@ static inline uint8_t DIR_IS_SUBDIR(const dir_t* dir) {
 static inline uint8_t DIR_IS_FILE_OR_SUBDIR(const dir_t* dir) {
   return (dir->attributes & DIR_ATT_VOLUME_ID) == 0;
 }
+//------------------------------------------------------------------------------
+/*
+ * exFAT structures, from the Microsoft exFAT File System Specification
+ * https://learn.microsoft.com/windows/win32/fileio/exfat-specification
+ */
+/**
+ * \struct exFatBootSector
+ *
+ * \brief Boot sector for an exFAT volume.  Offsets and lengths are in
+ * sectors from the start of the volume.
+ */
+struct exFatBootSector {
+           /** X86 jmp to boot program */
+  uint8_t  jmpToBootCode[3];
+           /** "EXFAT   " */
+  char     fileSystemName[8];
+           /** where a FAT volume has its BIOS Parameter Block, all zero */
+  uint8_t  mustBeZero[53];
+           /** first sector of the volume on the device */
+  uint64_t partitionOffset;
+           /** size of the volume in sectors */
+  uint64_t volumeLength;
+           /** first sector of the first FAT */
+  uint32_t fatOffset;
+           /** size of one FAT in sectors */
+  uint32_t fatLength;
+           /** first sector of cluster two */
+  uint32_t clusterHeapOffset;
+           /** clusters in the cluster heap */
+  uint32_t clusterCount;
+           /** first cluster of the root directory */
+  uint32_t rootDirectoryCluster;
+           /** usually generated by combining date and time */
+  uint32_t volumeSerialNumber;
+           /** 0X0100 for version 1.00 */
+  uint16_t fileSystemRevision;
+           /** bit 0 active FAT, bit 1 volume dirty, bit 2 media failure */
+  uint16_t volumeFlags;
+           /** log2 of the sector size, 9 to 12 */
+  uint8_t  bytesPerSectorShift;
+           /** log2 of the cluster size in sectors */
+  uint8_t  sectorsPerClusterShift;
+           /** 1, or 2 for TexFAT */
+  uint8_t  numberOfFats;
+           /** for int0x13 use value 0X80 for hard drive */
+  uint8_t  driveSelect;
+           /** percentage of clusters in use, 0XFF if unknown */
+  uint8_t  percentInUse;
+           /** should be zero */
+  uint8_t  reserved[7];
+           /** X86 boot code */
+  uint8_t  bootCode[390];
+           /** must be 0X55 */
+  uint8_t  bootSectorSig0;
+           /** must be 0XAA */
+  uint8_t  bootSectorSig1;
+} __attribute__((packed));
+/** Type name for exFatBootSector */
+typedef struct exFatBootSector exfat_fbs_t;
+/** exFAT end of chain value. */
+uint32_t const EXFAT_EOC = 0XFFFFFFFF;
+//------------------------------------------------------------------------------
+/**
+ * \struct exFatDirFile
+ * \brief exFAT file directory entry
+ *
+ * A file or directory is an entry set: this entry, a stream extension entry
+ * and the file name entries, with the set's checksum in the first entry.
+ * Timestamps hold a FAT date in the high 16 bits and a FAT time in the low
+ * 16 bits.
+ */
+struct exFatDirFile {
+           /** EXFAT_TYPE_FILE */
+  uint8_t  type;
+           /** entries in the set after this one */
+  uint8_t  setCount;
+           /** checksum of the whole set, see the specification */
+  uint16_t setChecksum;
+           /** DIR_ATT_ bits */
+  uint16_t attributes;
+           /** should be zero */
+  uint16_t reserved1;
+           /** time the file was created */
+  uint32_t createTimestamp;
+           /** time of last write */
+  uint32_t modifyTimestamp;
+           /** time of last access */
+  uint32_t accessTimestamp;
+           /** hundredths of a second to add to createTimestamp, 0-199 */
+  uint8_t  create10ms;
+           /** hundredths of a second to add to modifyTimestamp, 0-199 */
+  uint8_t  modify10ms;
+           /** UTC offset of createTimestamp, zero if not recorded */
+  uint8_t  createUtcOffset;
+           /** UTC offset of modifyTimestamp, zero if not recorded */
+  uint8_t  modifyUtcOffset;
+           /** UTC offset of accessTimestamp, zero if not recorded */
+  uint8_t  accessUtcOffset;
+           /** should be zero */
+  uint8_t  reserved2[7];
+} __attribute__((packed));
+/** Type name for exFatDirFile */
+typedef struct exFatDirFile exdir_file_t;
+/**
+ * \struct exFatDirStream
+ * \brief exFAT stream extension directory entry, the second of a set
+ */
+struct exFatDirStream {
+           /** EXFAT_TYPE_STREAM */
+  uint8_t  type;
+           /** EXFAT_FLAG_ bits */
+  uint8_t  flags;
+           /** should be zero */
+  uint8_t  reserved1;
+           /** characters in the name */
+  uint8_t  nameLength;
+           /** hash of the name in upper case, see the specification */
+  uint16_t nameHash;
+           /** should be zero */
+  uint16_t reserved2;
+           /** bytes written, the rest up to dataLength read as zero */
+  uint64_t validDataLength;
+           /** should be zero */
+  uint32_t reserved3;
+           /** first cluster of the data, zero if none */
+  uint32_t firstCluster;
+           /** size in bytes */
+  uint64_t dataLength;
+} __attribute__((packed));
+/** Type name for exFatDirStream */
+typedef struct exFatDirStream exdir_stream_t;
+/**
+ * \struct exFatDirName
+ * \brief exFAT file name directory entry
+ */
+struct exFatDirName {
+           /** EXFAT_TYPE_NAME */
+  uint8_t  type;
+           /** should be zero */
+  uint8_t  flags;
+           /** the next EXFAT_NAME_CHARS characters of the name */
+  uint16_t name[15];
+} __attribute__((packed));
+/** Type name for exFatDirName */
+typedef struct exFatDirName exdir_name_t;
+/**
+ * \struct exFatDirAlloc
+ * \brief exFAT allocation bitmap and up-case table directory entries
+ */
+struct exFatDirAlloc {
+           /** EXFAT_TYPE_BITMAP or EXFAT_TYPE_UPCASE */
+  uint8_t  type;
+           /** bitmap: bit 0 selects the bitmap of the second FAT */
+  uint8_t  flags;
+           /** up-case table: bytes 4-7 hold the table checksum */
+  uint8_t  reserved[18];
+           /** first cluster of the bitmap or table */
+  uint32_t firstCluster;
+           /** size in bytes */
+  uint64_t dataLength;
+} __attribute__((packed));
+/** Type name for exFatDirAlloc */
+typedef struct exFatDirAlloc exdir_alloc_t;
+/** entry type bit for an entry in use, entries without it are free */
+uint8_t const EXFAT_TYPE_IN_USE = 0X80;
+/** entry type for the end of the directory, nothing in use follows */
+uint8_t const EXFAT_TYPE_END = 0X00;
+/** entry type of the allocation bitmap entry in the root directory */
+uint8_t const EXFAT_TYPE_BITMAP = 0X81;
+/** entry type of the up-case table entry in the root directory */
+uint8_t const EXFAT_TYPE_UPCASE = 0X82;
+/** entry type of the first entry of a file or directory */
+uint8_t const EXFAT_TYPE_FILE = 0X85;
+/** entry type of a stream extension entry */
+uint8_t const EXFAT_TYPE_STREAM = 0XC0;
+/** entry type of a file name entry */
+uint8_t const EXFAT_TYPE_NAME = 0XC1;
+/** stream flag, set if the file may have clusters */
+uint8_t const EXFAT_FLAG_ALLOCATION_POSSIBLE = 0X01;
+/** stream flag, set if the clusters are contiguous and not in the FAT */
+uint8_t const EXFAT_FLAG_NO_FAT_CHAIN = 0X02;
+/** characters in one file name entry */
+uint8_t const EXFAT_NAME_CHARS = 15;
+/** most entries in a set this library handles: file, stream and 17 names */
+uint8_t const EXFAT_MAX_SET = 19;
 #endif  // FatStructs_h
@@ -18,6 +18,9 @@
  * <http://www.gnu.org/licenses/>.
  */
 #include "Sd2Card.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /** Send a byte to the card */
 static void spiSend(uint8_t b) {
@@ -64,6 +67,7 @@ uint8_t Sd2Card::cardCommand(uint8_t cmd, uint32_t arg) {
  *         or zero if an error occurs.
  */
 uint32_t Sd2Card::cardSize(void) {
+  if (isImage()) return imageBlocks_;
   csd_t csd;
   if (!readCSD(&csd)) return 0;
   if (csd.v1.csd_ver == 0) {
@@ -93,6 +97,13 @@ void Sd2Card::chipSelectLow(void) {
   //digitalWrite(chipSelectPin_, LOW);
 }
 //------------------------------------------------------------------------------
+/** Detach the card image opened by openImage(), if any. */
+void Sd2Card::closeImage(void) {
+  if (imageFd_ >= 0) ::close(imageFd_);
+  imageFd_ = -1;
+  imageBlocks_ = 0;
+}
+//------------------------------------------------------------------------------
 /** Erase a range of blocks.
  *
  * \param[in] firstBlock The address of the first block in the range.
@@ -107,6 +118,21 @@ void Sd2Card::chipSelectLow(void) {
  * the value zero, false, is returned for failure.
  */
 uint8_t Sd2Card::erase(uint32_t firstBlock, uint32_t lastBlock) {
+  if (isImage()) {
+    // erased flash reads back as zero on this card
+    static const uint8_t zero[512] = {0};
+    if (lastBlock < firstBlock || lastBlock >= imageBlocks_) {
+      error(SD_CARD_ERROR_ERASE);
+      return false;
+    }
+    for (uint32_t b = firstBlock; b <= lastBlock; b++) {
+      if (pwrite(imageFd_, zero, 512, (off_t)b << 9) != 512) {
+        error(SD_CARD_ERROR_ERASE);
+        return false;
+      }
+    }
+    return true;
+  }
   if (!eraseSingleBlockEnable()) {
     error(SD_CARD_ERROR_ERASE_SINGLE_BLOCK);
     goto fail;
@@ -156,10 +182,44 @@ uint8_t Sd2Card::eraseSingleBlockEnable(void) {
 uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {
   errorCode_ = inBlock_ = partialBlockRead_ = type_ = 0;
   chipSelectPin_ = chipSelectPin;
+  // an image is always block addressed like an SDHC card
+  if (isImage()) {
+    type(SD_CARD_TYPE_SDHC);
+    return true;
+  }
   // 16-bit init start time allows over a minute
   return false;
 }
 //------------------------------------------------------------------------------
+/**
+ * Use a raw disk image file as the card.
+ *
+ * The image is a byte for byte copy of a card, for example made with dd,
+ * and is served as 512 byte blocks with pread()/pwrite().  All block
+ * functions of this class then operate on the image.
+ *
+ * \param[in] path Path of the image file on the host.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.  The reason for failure
+ * can be determined by calling errorCode().
+ */
+uint8_t Sd2Card::openImage(const char* path) {
+  closeImage();
+  int fd = ::open(path, O_RDWR);
+  if (fd < 0) fd = ::open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < 512 ||
+      (st.st_size & 0X1FF) || (st.st_size >> 9) > 0XFFFFFFFF) {
+    if (fd >= 0) ::close(fd);
+    error(SD_CARD_ERROR_IMAGE);
+    return false;
+  }
+  imageFd_ = fd;
+  imageBlocks_ = st.st_size >> 9;
+  return init();
+}
+//------------------------------------------------------------------------------
 /**
  * Enable or disable partial block reads.
  *
@@ -191,6 +251,41 @@ uint8_t Sd2Card::readBlock(uint32_t block, uint8_t* dst) {
   return readData(block, 0, 512, dst);
 }
 //------------------------------------------------------------------------------
+/**
+ * Read consecutive 512 byte blocks from an SD card device.
+ *
+ * \param[in] block Logical block of the first block to be read.
+ * \param[out] dst Pointer to the location that will receive the data.
+ * \param[in] count Number of blocks to read.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::readBlocks(uint32_t block, uint8_t* dst, uint32_t count) {
+  if (isImage()) {
+    // one transfer for the whole run
+    if (count > imageBlocks_ || block > imageBlocks_ - count) {
+      error(SD_CARD_ERROR_READ);
+      return false;
+    }
+    size_t size = (size_t)count << 9;
+    off_t pos = (off_t)block << 9;
+    for (size_t done = 0; done < size;) {
+      ssize_t n = pread(imageFd_, dst + done, size - done, pos + done);
+      if (n <= 0) {
+        error(SD_CARD_ERROR_READ);
+        return false;
+      }
+      done += n;
+    }
+    return true;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    if (!readBlock(block + i, dst + ((size_t)i << 9))) return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
 /**
  * Read part of a 512 byte block from an SD card.
  *
@@ -207,6 +302,14 @@ uint8_t Sd2Card::readData(uint32_t block,
   if ((count + offset) > 512) {
     goto fail;
   }
+  if (isImage()) {
+    if (block >= imageBlocks_ || pread(imageFd_, dst, count,
+        ((off_t)block << 9) + offset) != count) {
+      error(SD_CARD_ERROR_READ);
+      return false;
+    }
+    return true;
+  }
   if (!inBlock_ || block != block_ || offset < offset_) {
     block_ = block;
     // use address if not SDHC card
@@ -349,6 +452,14 @@ uint8_t Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
   }
 #endif  // SD_PROTECT_BLOCK_ZERO
 
+  if (isImage()) {
+    if (blockNumber >= imageBlocks_ ||
+        pwrite(imageFd_, src, 512, (off_t)blockNumber << 9) != 512) {
+      error(SD_CARD_ERROR_WRITE);
+      return false;
+    }
+    return true;
+  }
   // use address if not SDHC card
   if (type() != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
   if (cardCommand(CMD24, blockNumber)) {
@@ -375,8 +486,62 @@ uint8_t Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
   return false;
 }
 //------------------------------------------------------------------------------
+/**
+ * Writes consecutive 512 byte blocks to an SD card.
+ *
+ * \param[in] blockNumber Logical block of the first block to be written.
+ * \param[in] src Pointer to the location of the data to be written.
+ * \param[in] count Number of blocks to write.
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::writeBlocks(uint32_t blockNumber, const uint8_t* src,
+                             uint32_t count) {
+#if SD_PROTECT_BLOCK_ZERO
+  // don't allow write to first block
+  if (blockNumber == 0 && count) {
+    error(SD_CARD_ERROR_WRITE_BLOCK_ZERO);
+    return false;
+  }
+#endif  // SD_PROTECT_BLOCK_ZERO
+
+  if (isImage()) {
+    if (count > imageBlocks_ || blockNumber > imageBlocks_ - count) {
+      error(SD_CARD_ERROR_WRITE);
+      return false;
+    }
+    size_t size = (size_t)count << 9;
+    off_t pos = (off_t)blockNumber << 9;
+    for (size_t done = 0; done < size;) {
+      ssize_t n = pwrite(imageFd_, src + done, size - done, pos + done);
+      if (n <= 0) {
+        error(SD_CARD_ERROR_WRITE);
+        return false;
+      }
+      done += n;
+    }
+    return true;
+  }
+  if (count == 1) return writeBlock(blockNumber, src);
+  if (!writeStart(blockNumber, count)) return false;
+  for (uint32_t i = 0; i < count; i++) {
+    if (!writeData(src + ((size_t)i << 9))) return false;
+  }
+  return writeStop();
+}
+//------------------------------------------------------------------------------
 /** Write one data block in a multiple block write sequence */
 uint8_t Sd2Card::writeData(const uint8_t* src) {
+  if (isImage()) {
+    // block_ is the next block of the sequence started by writeStart()
+    if (block_ >= imageBlocks_ ||
+        pwrite(imageFd_, src, 512, (off_t)block_ << 9) != 512) {
+      error(SD_CARD_ERROR_WRITE_MULTIPLE);
+      return false;
+    }
+    block_++;
+    return true;
+  }
   // wait for previous write to finish
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) {
     error(SD_CARD_ERROR_WRITE_MULTIPLE);
@@ -386,6 +551,33 @@ uint8_t Sd2Card::writeData(const uint8_t* src) {
   return writeData(WRITE_MULTIPLE_TOKEN, src);
 }
 //------------------------------------------------------------------------------
+/** Write \a count data blocks in a multiple block write sequence */
+uint8_t Sd2Card::writeData(const uint8_t* src, uint32_t count) {
+  if (isImage()) {
+    // one transfer for the whole run
+    if (count > imageBlocks_ || block_ > imageBlocks_ - count) {
+      error(SD_CARD_ERROR_WRITE_MULTIPLE);
+      return false;
+    }
+    size_t size = (size_t)count << 9;
+    off_t pos = (off_t)block_ << 9;
+    for (size_t done = 0; done < size;) {
+      ssize_t n = pwrite(imageFd_, src + done, size - done, pos + done);
+      if (n <= 0) {
+        error(SD_CARD_ERROR_WRITE_MULTIPLE);
+        return false;
+      }
+      done += n;
+    }
+    block_ += count;
+    return true;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    if (!writeData(src + ((size_t)i << 9))) return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
 // send one block of data for write block or write multiple blocks
 uint8_t Sd2Card::writeData(uint8_t token, const uint8_t* src) {
 #ifdef OPTIMIZE_HARDWARE_SPI
@@ -444,6 +636,10 @@ uint8_t Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
     goto fail;
   }
 #endif  // SD_PROTECT_BLOCK_ZERO
+  if (isImage()) {
+    block_ = blockNumber;
+    return true;
+  }
   // send pre-erase count
   if (cardAcmd(ACMD23, eraseCount)) {
     error(SD_CARD_ERROR_ACMD23);
@@ -468,6 +664,7 @@ uint8_t Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
  * the value zero, false, is returned for failure.
  */
 uint8_t Sd2Card::writeStop(void) {
+  if (isImage()) return true;
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
   spiSend(STOP_TRAN_TOKEN);
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
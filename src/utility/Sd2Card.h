@@ -84,6 +84,8 @@ uint8_t const SD_CARD_ERROR_WRITE_PROGRAMMING = 0X14;
 uint8_t const SD_CARD_ERROR_WRITE_TIMEOUT = 0X15;
 /** incorrect rate selected */
 uint8_t const SD_CARD_ERROR_SCK_RATE = 0X16;
+/** card image file could not be opened or is not a whole number of blocks */
+uint8_t const SD_CARD_ERROR_IMAGE = 0X17;
 //------------------------------------------------------------------------------
 // card types
 /** Standard capacity V1 SD card */
@@ -100,8 +102,14 @@ uint8_t const SD_CARD_TYPE_SDHC = 3;
 class Sd2Card {
  public:
   /** Construct an instance of Sd2Card. */
-  Sd2Card(void) : errorCode_(0), inBlock_(0), partialBlockRead_(0), type_(0) {}
+  Sd2Card(void) : errorCode_(0), imageBlocks_(0), imageFd_(-1), inBlock_(0),
+    partialBlockRead_(0), type_(0) {}
+  ~Sd2Card(void) {closeImage();}
+  // the card owns the image file descriptor
+  Sd2Card(const Sd2Card&) = delete;
+  Sd2Card& operator=(const Sd2Card&) = delete;
   uint32_t cardSize(void);
+  void closeImage(void);
   uint8_t erase(uint32_t firstBlock, uint32_t lastBlock);
   uint8_t eraseSingleBlockEnable(void);
   /**
@@ -126,10 +134,14 @@ class Sd2Card {
     return init(sckRateID, 0);
   }
   uint8_t init(uint8_t sckRateID, uint8_t chipSelectPin);
+  /** \return True if the card is backed by a raw disk image file. */
+  uint8_t isImage(void) const {return imageFd_ >= 0;}
+  uint8_t openImage(const char* path);
   void partialBlockRead(uint8_t value);
   /** Returns the current value, true or false, for partial block read. */
   uint8_t partialBlockRead(void) const {return partialBlockRead_;}
   uint8_t readBlock(uint32_t block, uint8_t* dst);
+  uint8_t readBlocks(uint32_t block, uint8_t* dst, uint32_t count);
   uint8_t readData(uint32_t block,
           uint16_t offset, uint16_t count, uint8_t* dst);
   /**
@@ -153,13 +165,17 @@ class Sd2Card {
   /** Return the card type: SD V1, SD V2 or SDHC */
   uint8_t type(void) const {return type_;}
   uint8_t writeBlock(uint32_t blockNumber, const uint8_t* src);
+  uint8_t writeBlocks(uint32_t blockNumber, const uint8_t* src, uint32_t count);
   uint8_t writeData(const uint8_t* src);
+  uint8_t writeData(const uint8_t* src, uint32_t count);
   uint8_t writeStart(uint32_t blockNumber, uint32_t eraseCount);
   uint8_t writeStop(void);
  private:
   uint32_t block_;
   uint8_t chipSelectPin_;
   uint8_t errorCode_;
+  uint32_t imageBlocks_;
+  int imageFd_;
   uint8_t inBlock_;
   uint16_t offset_;
   uint8_t partialBlockRead_;
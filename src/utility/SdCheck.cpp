@@ -0,0 +1,592 @@
+/* Arduino SdFat Library
+ * Copyright (C) 2009 by William Greiman
+ *
+ * This file is part of the Arduino SdFat Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino SdFat Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "SdCheck.h"
+
+#include <string.h>
+#include <thread>
+//------------------------------------------------------------------------------
+// blocks of the FAT or bitmap read per transfer
+static uint32_t const CHECK_CHUNK_BLOCKS = 64;
+//------------------------------------------------------------------------------
+// add the counts of one thread to the total
+static void addReport(check_report_t* total, const check_report_t& part) {
+  total->files += part.files;
+  total->directories += part.directories;
+  total->usedClusters += part.usedClusters;
+  total->freeClusters += part.freeClusters;
+  total->badChains += part.badChains;
+  total->crossLinks += part.crossLinks;
+  total->lostChains += part.lostChains;
+  total->lostClusters += part.lostClusters;
+  total->sizeMismatches += part.sizeMismatches;
+  total->bitmapMismatches += part.bitmapMismatches;
+  total->repairs += part.repairs;
+}
+//------------------------------------------------------------------------------
+// true if the FAT or, on exFAT, the bitmap has the cluster in use
+uint8_t SdCheck::allocated(uint32_t cluster) const {
+  if (vol_->fatType_ == 64) {
+    uint32_t n = cluster - 2;
+    return (bitmap_[n >> 3] >> (n & 7)) & 1;
+  }
+  return next_[cluster] != 0;
+}
+//------------------------------------------------------------------------------
+/**
+ * Check a volume.
+ *
+ * Files and directories should be closed first; the cache is written back
+ * before the check starts.
+ *
+ * \param[in] vol The volume, mounted by SdVolume::init().
+ * \param[out] report What was found.
+ * \param[in] repair True to fix the problems found.
+ *
+ * \return The value one, true, is returned if the check, and the repair if
+ * asked for, ran.  The value zero, false, is returned if the volume is not
+ * FAT16, FAT32 or exFAT or an I/O error occurred.  Problems found on the
+ * volume are returned in \a report, not as a failure.
+ */
+uint8_t SdCheck::check(SdVolume* vol, check_report_t* report,
+                       uint8_t repair) {
+  *report = check_report_t();
+  uint8_t type = vol->fatType();
+  if (type != 16 && type != 32 && type != 64) return false;
+  vol_ = vol;
+  // concurrent readers wait until the check and any repair are done
+  SdVolumeLock hold(vol);
+
+  // the card must hold everything the cache has
+  if (!vol_->cacheFlush()) return false;
+
+  // pread() on an image is safe from several threads, a card is not
+  workers_ = threads_ ? threads_ : std::thread::hardware_concurrency();
+  if (workers_ == 0 || !vol_->sdCard()->isImage()) workers_ = 1;
+
+  entries_ = vol->clusterCount_ + 2;
+  next_.assign(entries_, 0);
+  refs_.reset(new std::atomic<uint8_t>[entries_]());
+  owner_.reset(new std::atomic<uint32_t>[entries_]());
+  nextOwner_ = 1;
+  ioError_ = false;
+  jobs_.clear();
+  fixes_.clear();
+  busy_ = 0;
+
+  uint32_t perBlock = type == 16 ? 256 : 128;
+  split((entries_ + perBlock - 1) / perBlock,
+        [this](uint32_t, uint32_t b, uint32_t e) {readFat(b, e);});
+  if (type == 64) {
+    uint32_t blocks = (vol->clusterCount_ + 4095) >> 12;
+    bitmap_.assign((size_t)blocks << 9, 0);
+    split(blocks, [this](uint32_t, uint32_t b, uint32_t e) {
+      readBitmap(b, e);
+    });
+  }
+  if (ioError_) return false;
+  split(entries_, [this](uint32_t, uint32_t b, uint32_t e) {linkRange(b, e);});
+
+  // the root first, its subdirectories as they are found
+  job_t root = {type == 16 ? 0 : vol->rootDirStart_, 0, nextOwner_++, false};
+  jobs_.push_back(root);
+  std::vector<check_report_t> parts(workers_);
+  split(workers_, [this, &parts](uint32_t t, uint32_t, uint32_t) {
+    dirWorker(&parts[t]);
+  });
+  split(entries_, [this, &parts](uint32_t t, uint32_t b, uint32_t e) {
+    countClusters(b, e, &parts[t]);
+  });
+  for (uint32_t t = 0; t < workers_; t++) addReport(report, parts[t]);
+
+  uint8_t rtn = !ioError_;
+  if (rtn && repair && !report->clean()) {
+    rtn = this->repair(report);
+  }
+  next_.clear();
+  bitmap_.clear();
+  refs_.reset();
+  owner_.reset();
+  fixes_.clear();
+  return rtn;
+}
+//------------------------------------------------------------------------------
+// Read the entries of a directory and check the chain of each file and
+// subdirectory in it.
+uint8_t SdCheck::checkDir(const job_t& job, check_report_t* report) {
+  job_t dir = job;
+  report->directories++;
+  if (dir.cluster && dir.count == 0) {
+    // the root's chain has no entry to be checked with
+    walk_t w = walkChain(dir.cluster, dir.owner);
+    if (w.bad) report->badChains++;
+    if (w.cross) report->crossLinks++;
+    dir.count = w.length;
+  }
+  // the directory's blocks in order
+  std::vector<uint32_t> blocks;
+  if (dir.cluster == 0) {
+    for (uint32_t i = 0; i < vol_->rootDirEntryCount_ / 16U; i++) {
+      blocks.push_back(vol_->rootDirStart_ + i);
+    }
+  } else {
+    uint32_t c = dir.cluster;
+    for (uint32_t i = 0; i < dir.count; i++) {
+      for (uint32_t b = 0; b < vol_->blocksPerCluster_; b++) {
+        blocks.push_back(vol_->clusterStartBlock(c) + b);
+      }
+      c = dir.noChain ? c + 1 : next_[c];
+    }
+  }
+  std::vector<uint8_t> data(blocks.size() << 9);
+  for (size_t i = 0; i < blocks.size();) {
+    size_t n = 1;
+    while (i + n < blocks.size() && blocks[i + n] == blocks[i] + n) n++;
+    if (!vol_->sdCard()->readBlocks(blocks[i], &data[i << 9], n)) {
+      ioError_ = true;
+      return false;
+    }
+    i += n;
+  }
+  uint32_t count = blocks.size() * 16;
+  fix_t where;
+  memset(&where, 0, sizeof(where));
+
+  if (vol_->fatType_ != 64) {
+    const dir_t* d = reinterpret_cast<const dir_t*>(data.data());
+    for (uint32_t i = 0; i < count; i++) {
+      const dir_t* p = d + i;
+      if (p->name[0] == DIR_NAME_FREE) break;
+      // long name entries have the volume id bit
+      if (p->name[0] == DIR_NAME_DELETED || p->name[0] == '.' ||
+        !DIR_IS_FILE_OR_SUBDIR(p)) {
+        continue;
+      }
+      uint32_t first = p->firstClusterLow;
+      if (vol_->fatType_ == 32) first |= (uint32_t)p->firstClusterHigh << 16;
+      where.blocks[0] = blocks[i >> 4];
+      where.index[0] = i & 15;
+      where.entries = 1;
+      if (DIR_IS_SUBDIR(p)) {
+        checkEntry(first, 0, true, false, where, report);
+      } else {
+        report->files++;
+        checkEntry(first, p->fileSize, false, false, where, report);
+      }
+    }
+    return true;
+  }
+  for (uint32_t i = 0; i < count;) {
+    const uint8_t* e = &data[i << 5];
+    if (e[0] == EXFAT_TYPE_END) break;
+    where.blocks[0] = blocks[i >> 4];
+    where.index[0] = i & 15;
+    where.entries = 1;
+    if (e[0] == EXFAT_TYPE_BITMAP || e[0] == EXFAT_TYPE_UPCASE) {
+      const exdir_alloc_t* a = reinterpret_cast<const exdir_alloc_t*>(e);
+      checkEntry(a->firstCluster, a->dataLength, false, false, where, report);
+      i++;
+      continue;
+    }
+    const exdir_file_t* f = reinterpret_cast<const exdir_file_t*>(e);
+    const exdir_stream_t* s = reinterpret_cast<const exdir_stream_t*>(e + 32);
+    if (f->type != EXFAT_TYPE_FILE || f->setCount < 2 ||
+      f->setCount >= EXFAT_MAX_SET || i + f->setCount >= count ||
+      s->type != EXFAT_TYPE_STREAM) {
+      i++;
+      continue;
+    }
+    where.entries = f->setCount + 1;
+    for (uint8_t k = 0; k < where.entries; k++) {
+      where.blocks[k] = blocks[(i + k) >> 4];
+      where.index[k] = (i + k) & 15;
+    }
+    uint8_t isDir = (f->attributes & DIR_ATT_DIRECTORY) != 0;
+    if (!isDir) report->files++;
+    checkEntry(s->firstCluster, s->dataLength, isDir,
+               (s->flags & EXFAT_FLAG_NO_FAT_CHAIN) != 0, where, report);
+    i += where.entries;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// Claim the clusters of one directory entry, note what a repair would
+// change and queue a subdirectory to be read.
+void SdCheck::checkEntry(uint32_t first, uint64_t size, uint8_t isDir,
+                         uint8_t noChain, const fix_t& where,
+                         check_report_t* report) {
+  uint32_t shift = clusterBytesShift();
+  uint64_t need = (size + (1ULL << shift) - 1) >> shift;
+  uint32_t owner = nextOwner_++;
+  walk_t w;
+  memset(&w, 0, sizeof(w));
+  if (first && noChain) {
+    // a run past the end of the volume stops there as a bad chain
+    w = walkRun(first, need < entries_ ? need : entries_, owner);
+  } else if (first) {
+    w = walkChain(first, owner);
+  }
+  fix_t fix = where;
+  fix.first = first;
+  fix.length = w.length;
+  fix.last = w.last;
+  fix.keep = w.length;
+  fix.noChain = noChain;
+  fix.isDir = isDir;
+  fix.size = size;
+  uint8_t change = false;
+  if (w.bad || w.cross) {
+    if (w.bad) report->badChains++;
+    if (w.cross) report->crossLinks++;
+    change = true;
+  } else if (!isDir && need != w.length) {
+    report->sizeMismatches++;
+    change = true;
+  }
+  if (change) {
+    // keep what the file has, up to what its size needs
+    if (!isDir && need < fix.keep) fix.keep = need;
+    uint64_t bytes = (uint64_t)fix.keep << shift;
+    if (fix.size > bytes) fix.size = bytes;
+    if (isDir && vol_->fatType_ == 64) fix.size = bytes;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (change) fixes_.push_back(fix);
+  if (isDir && w.length) {
+    job_t job = {first, w.length, owner, noChain};
+    jobs_.push_back(job);
+    wake_.notify_one();
+  }
+}
+//------------------------------------------------------------------------------
+// Take cluster for owner.  False if another owner has it, or this one
+// already does, which means the chain loops.
+uint8_t SdCheck::claim(uint32_t cluster, uint32_t owner, walk_t* walk) {
+  uint32_t had = 0;
+  if (owner_[cluster].compare_exchange_strong(had, owner,
+                                              std::memory_order_relaxed)) {
+    walk->length++;
+    walk->last = cluster;
+    return true;
+  }
+  if (had == owner) {
+    walk->bad = true;
+  } else {
+    walk->cross = true;
+  }
+  return false;
+}
+//------------------------------------------------------------------------------
+// Count free, used and lost clusters in [begin, end) once every directory
+// has been read.
+void SdCheck::countClusters(uint32_t begin, uint32_t end,
+                            check_report_t* report) {
+  uint8_t exFat = vol_->fatType_ == 64;
+  for (uint32_t c = begin < 2 ? 2 : begin; c < end; c++) {
+    // clusters marked bad are neither free nor lost
+    if (next_[c] == NEXT_BAD) continue;
+    uint8_t used = allocated(c);
+    if (!used) report->freeClusters++;
+    if (owner_[c].load(std::memory_order_relaxed)) {
+      report->usedClusters++;
+      if (!used) report->bitmapMismatches++;
+      continue;
+    }
+    if (!used) continue;
+    report->lostClusters++;
+    // a lost chain starts where nothing links to it; on exFAT clusters in
+    // a row that are not in the FAT are one chain
+    if (refs_[c].load(std::memory_order_relaxed)) continue;
+    if (exFat && c > 2 && next_[c - 1] == 0 && allocated(c - 1) &&
+      !owner_[c - 1].load(std::memory_order_relaxed)) {
+      continue;
+    }
+    report->lostChains++;
+  }
+}
+//------------------------------------------------------------------------------
+// Read directories from the queue until it is empty and no thread is
+// reading one that could add more.
+void SdCheck::dirWorker(check_report_t* report) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    wake_.wait(lock, [this] {return !jobs_.empty() || busy_ == 0;});
+    if (jobs_.empty()) break;
+    job_t job = jobs_.back();
+    jobs_.pop_back();
+    busy_++;
+    lock.unlock();
+    checkDir(job, report);
+    lock.lock();
+    busy_--;
+    if (busy_ == 0 && jobs_.empty()) wake_.notify_all();
+  }
+}
+//------------------------------------------------------------------------------
+// checksum of an exFAT entry set, stored in the set's first entry
+void SdCheck::exSetChecksum(uint8_t* set, uint8_t entries) {
+  uint16_t sum = 0;
+  for (uint16_t i = 0; i < 32U * entries; i++) {
+    if (i == 2 || i == 3) continue;
+    sum = ((sum & 1) ? 0X8000 : 0) + (sum >> 1) + set[i];
+  }
+  set[2] = sum;
+  set[3] = sum >> 8;
+}
+//------------------------------------------------------------------------------
+// count the links into each cluster of [begin, end)
+void SdCheck::linkRange(uint32_t begin, uint32_t end) {
+  for (uint32_t c = begin < 2 ? 2 : begin; c < end; c++) {
+    uint32_t n = next_[c];
+    if (n < 2 || n >= entries_) continue;
+    // saturates, only zero or not matters
+    if (refs_[n].load(std::memory_order_relaxed) < 0XFF) {
+      refs_[n].fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+}
+//------------------------------------------------------------------------------
+// copy FAT blocks [begin, end) into next_ with end of chain and bad
+// cluster values made the same for every FAT type
+void SdCheck::readFat(uint32_t begin, uint32_t end) {
+  uint8_t type = vol_->fatType_;
+  uint32_t perBlock = type == 16 ? 256 : 128;
+  std::vector<uint8_t> chunk(CHECK_CHUNK_BLOCKS << 9);
+  for (uint32_t b = begin; b < end; b += CHECK_CHUNK_BLOCKS) {
+    uint32_t n = end - b < CHECK_CHUNK_BLOCKS ? end - b : CHECK_CHUNK_BLOCKS;
+    if (!vol_->sdCard()->readBlocks(vol_->fatStartBlock_ + b,
+                                        chunk.data(), n)) {
+      ioError_ = true;
+      return;
+    }
+    const uint16_t* fat16 = reinterpret_cast<const uint16_t*>(chunk.data());
+    const uint32_t* fat32 = reinterpret_cast<const uint32_t*>(chunk.data());
+    uint32_t base = b * perBlock;
+    uint32_t last = base + n * perBlock;
+    if (last > entries_) last = entries_;
+    for (uint32_t c = base; c < last; c++) {
+      uint32_t v;
+      if (type == 16) {
+        v = fat16[c - base];
+        if (v >= FAT16EOC_MIN) {
+          v = NEXT_EOC;
+        } else if (v == FAT16EOC_MIN - 1) {
+          v = NEXT_BAD;
+        }
+      } else {
+        v = fat32[c - base];
+        if (type == 32) v &= FAT32MASK;
+        uint32_t eoc = type == 32 ? FAT32EOC_MIN : 0XFFFFFFF8;
+        if (v >= eoc) {
+          v = NEXT_EOC;
+        } else if (v == eoc - 1) {
+          v = NEXT_BAD;
+        }
+      }
+      next_[c] = v;
+    }
+  }
+}
+//------------------------------------------------------------------------------
+// copy exFAT allocation bitmap blocks [begin, end) into bitmap_
+void SdCheck::readBitmap(uint32_t begin, uint32_t end) {
+  for (uint32_t b = begin; b < end; b += CHECK_CHUNK_BLOCKS) {
+    uint32_t n = end - b < CHECK_CHUNK_BLOCKS ? end - b : CHECK_CHUNK_BLOCKS;
+    if (!vol_->sdCard()->readBlocks(vol_->bitmapStartBlock_ + b,
+                                        &bitmap_[(size_t)b << 9], n)) {
+      ioError_ = true;
+      return;
+    }
+  }
+}
+//------------------------------------------------------------------------------
+// free a cluster through the volume and forget it was claimed
+uint8_t SdCheck::release(uint32_t cluster) {
+  if (vol_->fatType_ == 64) {
+    // fatPut() clears the bitmap bit too
+    if (next_[cluster] == 0) {
+      if (!vol_->freeMapSet(cluster, false)) return false;
+    } else if (!vol_->fatPut(cluster, 0)) {
+      return false;
+    }
+    uint32_t n = cluster - 2;
+    bitmap_[n >> 3] &= ~(1 << (n & 7));
+  } else if (!vol_->fatPut(cluster, 0)) {
+    return false;
+  }
+  next_[cluster] = 0;
+  owner_[cluster].store(0, std::memory_order_relaxed);
+  return true;
+}
+//------------------------------------------------------------------------------
+// Fix what check() found, one thread through the volume and its cache.
+uint8_t SdCheck::repair(check_report_t* report) {
+  // freeMapSet() skips clusters the volume's map already has right, so
+  // the map must agree with the card rather than with the last mount
+  if (!vol_->freeMapInit()) return false;
+  for (size_t i = 0; i < fixes_.size(); i++) {
+    if (!repairEntry(fixes_[i])) return false;
+    report->repairs++;
+  }
+  for (uint32_t c = 2; c < entries_; c++) {
+    if (next_[c] == NEXT_BAD) continue;
+    uint8_t owned = owner_[c].load(std::memory_order_relaxed) != 0;
+    if (allocated(c) && !owned) {
+      if (!release(c)) return false;
+      report->repairs++;
+    } else if (owned && !allocated(c)) {
+      if (!vol_->freeMapSet(c, true)) return false;
+      report->repairs++;
+    }
+  }
+  vol_->allocSearchStart_ = 2;
+  vol_->dirIndexClear();
+  // the map was rebuilt from the card, so FSInfo gets its count
+  if (!vol_->fsInfoSync()) return false;
+  return vol_->cacheFlush();
+}
+//------------------------------------------------------------------------------
+// End an entry's chain after the clusters it keeps, free the ones after
+// them that it had and write the new first cluster and size.  A directory
+// left without clusters is removed.
+uint8_t SdCheck::repairEntry(const fix_t& fix) {
+  if (fix.noChain) {
+    for (uint32_t k = fix.keep; k < fix.length; k++) {
+      if (!release(fix.first + k)) return false;
+    }
+  } else {
+    uint32_t c = fix.first;
+    uint32_t lastKept = 0;
+    for (uint32_t k = 0; k < fix.length; k++) {
+      uint32_t n = next_[c];
+      if (k < fix.keep) {
+        lastKept = c;
+      } else if (!release(c)) {
+        return false;
+      }
+      c = n;
+    }
+    if (lastKept) {
+      if (!vol_->fatPutEOC(lastKept)) return false;
+      next_[lastKept] = NEXT_EOC;
+    }
+  }
+  uint32_t first = fix.keep ? fix.first : 0;
+  uint8_t remove = fix.isDir && !first;
+
+  if (vol_->fatType_ != 64) {
+    if (!vol_->cacheRawBlock(fix.blocks[0], SdVolume::CACHE_FOR_WRITE)) {
+      return false;
+    }
+    dir_t* d = vol_->cacheBuffer()->dir + fix.index[0];
+    if (remove) {
+      d->name[0] = DIR_NAME_DELETED;
+      return true;
+    }
+    if (!fix.isDir) d->fileSize = fix.size;
+    d->firstClusterLow = first & 0XFFFF;
+    d->firstClusterHigh = first >> 16;
+    return true;
+  }
+  uint8_t set[32 * EXFAT_MAX_SET];
+  for (uint8_t k = 0; k < fix.entries; k++) {
+    if (!vol_->cacheRawBlock(fix.blocks[k], SdVolume::CACHE_FOR_READ)) {
+      return false;
+    }
+    memcpy(set + 32 * k, vol_->cacheBuffer()->dir + fix.index[k], 32);
+  }
+  if (fix.entries == 1) {
+    // the bitmap or up-case table
+    exdir_alloc_t* a = reinterpret_cast<exdir_alloc_t*>(set);
+    a->firstCluster = first;
+    a->dataLength = fix.size;
+  } else if (remove) {
+    for (uint8_t k = 0; k < fix.entries; k++) {
+      set[32 * k] &= ~EXFAT_TYPE_IN_USE;
+    }
+  } else {
+    exdir_stream_t* s = reinterpret_cast<exdir_stream_t*>(set + 32);
+    s->firstCluster = first;
+    s->dataLength = fix.size;
+    if (s->validDataLength > fix.size) s->validDataLength = fix.size;
+    if (!first) s->flags &= ~EXFAT_FLAG_NO_FAT_CHAIN;
+    exSetChecksum(set, fix.entries);
+  }
+  for (uint8_t k = 0; k < fix.entries; k++) {
+    if (!vol_->cacheRawBlock(fix.blocks[k], SdVolume::CACHE_FOR_WRITE)) {
+      return false;
+    }
+    memcpy(vol_->cacheBuffer()->dir + fix.index[k], set + 32 * k, 32);
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// Call f(thread, begin, end) for workers_ slices of [0, count), each on its
+// own thread unless there is only one.
+template <typename F>
+void SdCheck::split(uint32_t count, F f) {
+  if (workers_ == 1) {
+    f(0, 0, count);
+    return;
+  }
+  uint32_t step = (count + workers_ - 1) / workers_;
+  std::vector<std::thread> pool;
+  for (uint32_t t = 0; t < workers_; t++) {
+    uint64_t begin = (uint64_t)t * step;
+    uint64_t end = begin + step;
+    if (begin > count) begin = count;
+    if (end > count) end = count;
+    pool.emplace_back(f, t, (uint32_t)begin, (uint32_t)end);
+  }
+  for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+}
+//------------------------------------------------------------------------------
+// claim a chain through the FAT
+SdCheck::walk_t SdCheck::walkChain(uint32_t first, uint32_t owner) {
+  walk_t w;
+  memset(&w, 0, sizeof(w));
+  uint32_t c = first;
+  for (;;) {
+    // out of the volume, a free cluster or one marked bad
+    if (c < 2 || c >= entries_ || next_[c] == 0 || next_[c] == NEXT_BAD) {
+      w.bad = true;
+      break;
+    }
+    if (!claim(c, owner, &w)) break;
+    if (next_[c] == NEXT_EOC) break;
+    c = next_[c];
+  }
+  return w;
+}
+//------------------------------------------------------------------------------
+// claim count clusters in a row, an exFAT file that is not in the FAT
+SdCheck::walk_t SdCheck::walkRun(uint32_t first, uint32_t count,
+                                 uint32_t owner) {
+  walk_t w;
+  memset(&w, 0, sizeof(w));
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t c = first + i;
+    if (c < 2 || c >= entries_) {
+      w.bad = true;
+      break;
+    }
+    if (!claim(c, owner, &w)) break;
+  }
+  return w;
+}
@@ -0,0 +1,162 @@
+/* Arduino SdFat Library
+ * Copyright (C) 2009 by William Greiman
+ *
+ * This file is part of the Arduino SdFat Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino SdFat Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef SdCheck_h
+#define SdCheck_h
+/**
+ * \file
+ * SdCheck class, a consistency check of a FAT16, FAT32 or exFAT volume
+ */
+#include "SdFat.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+//------------------------------------------------------------------------------
+/**
+ * \brief What SdCheck::check() found on a volume
+ */
+struct check_report_t {
+           /** Files reached from the root directory. */
+  uint32_t files;
+           /** Directories reached from the root, the root included. */
+  uint32_t directories;
+           /** Clusters that belong to a file or directory. */
+  uint32_t usedClusters;
+           /** Clusters the FAT, or on exFAT the bitmap, marks free. */
+  uint32_t freeClusters;
+           /** Chains that leave the volume, reach a free or bad cluster or
+               loop back on themselves. */
+  uint32_t badChains;
+           /** Chains that run into a cluster of another file or directory. */
+  uint32_t crossLinks;
+           /** Chains in use that no directory entry reaches. */
+  uint32_t lostChains;
+           /** Clusters in use that no directory entry reaches. */
+  uint32_t lostClusters;
+           /** Files whose size does not match the length of their chain. */
+  uint32_t sizeMismatches;
+           /** exFAT: clusters of a file or directory the bitmap marks free. */
+  uint32_t bitmapMismatches;
+           /** Changes written by a repair. */
+  uint32_t repairs;
+  /** \return True if no problems were found. */
+  uint8_t clean(void) const {
+    return !badChains && !crossLinks && !lostClusters && !sizeMismatches &&
+      !bitmapMismatches;
+  }
+};
+//------------------------------------------------------------------------------
+/**
+ * \class SdCheck
+ * \brief Check a volume's FAT, bitmap and directories against each other
+ *
+ * The FAT and allocation bitmap are read in large transfers, split between
+ * threads, instead of a block at a time through the SdVolume cache.  The
+ * directory tree is then walked by the same threads, each taking the next
+ * directory from a shared queue and claiming the clusters of the entries
+ * it finds, so two chains that share a cluster are seen however the work
+ * was split.  The threads' counts are added up at the end.
+ *
+ * With repair, problems are fixed through the volume once the check is
+ * done: a bad or cross-linked chain is ended at its last good cluster, a
+ * size is cut to the clusters the file has and clusters past its size are
+ * freed, lost clusters are freed and the exFAT bitmap is corrected.
+ */
+class SdCheck {
+ public:
+  /**
+   * \param[in] threads Threads to use, zero for one per processor.  A card
+   * that is not an image is always checked by one thread.
+   */
+  explicit SdCheck(uint8_t threads = 0) : threads_(threads) {}
+  uint8_t check(SdVolume* vol, check_report_t* report, uint8_t repair = false);
+
+ private:
+  // normalized FAT entries in next_
+  static uint32_t const NEXT_EOC = 0XFFFFFFFF;
+  static uint32_t const NEXT_BAD = 0XFFFFFFF7;
+  // a directory waiting to be read
+  struct job_t {
+    uint32_t cluster;   // first cluster, zero for the FAT16 root
+    uint32_t count;     // clusters if noChain
+    uint32_t owner;     // claim id of the directory
+    uint8_t noChain;    // exFAT contiguous directory
+  };
+  // a directory entry whose chain or size repair would change
+  struct fix_t {
+    uint32_t blocks[EXFAT_MAX_SET];  // block of each entry of the set
+    uint8_t index[EXFAT_MAX_SET];    // position of each entry in its block
+    uint8_t entries;    // one for FAT, the set on exFAT
+    uint32_t first;     // first cluster
+    uint32_t length;    // clusters claimed before a problem
+    uint32_t last;      // last cluster claimed, zero if none
+    uint32_t keep;      // clusters the file keeps
+    uint64_t size;      // size the entry gets
+    uint8_t isDir;      // entry is a directory
+    uint8_t noChain;    // exFAT contiguous file
+  };
+  // outcome of following one chain
+  struct walk_t {
+    uint32_t length;    // clusters claimed
+    uint32_t last;      // last cluster claimed
+    uint8_t bad;        // ended at a bad link or looped
+    uint8_t cross;      // ended at another owner's cluster
+  };
+
+  uint8_t threads_;
+  uint32_t workers_;                          // threads of this check
+  SdVolume* vol_;
+  uint32_t entries_;                          // clusterCount + 2
+  std::vector<uint32_t> next_;                // FAT, normalized
+  std::vector<uint8_t> bitmap_;               // exFAT allocation bitmap
+  std::unique_ptr<std::atomic<uint8_t>[]> refs_;    // links into a cluster
+  std::unique_ptr<std::atomic<uint32_t>[]> owner_;  // claim id, zero if none
+  std::atomic<uint32_t> nextOwner_;
+  std::atomic<uint8_t> ioError_;
+  std::mutex mutex_;                          // guards jobs_, fixes_, busy_
+  std::condition_variable wake_;
+  std::vector<job_t> jobs_;
+  std::vector<fix_t> fixes_;
+  uint32_t busy_;                             // threads reading a directory
+
+  uint8_t allocated(uint32_t cluster) const;
+  uint8_t checkDir(const job_t& job, check_report_t* report);
+  void checkEntry(uint32_t first, uint64_t size, uint8_t isDir,
+                  uint8_t noChain, const fix_t& where, check_report_t* report);
+  uint32_t clusterBytesShift(void) const {
+    return vol_->clusterSizeShift_ + 9;
+  }
+  uint8_t claim(uint32_t cluster, uint32_t owner, walk_t* walk);
+  void countClusters(uint32_t begin, uint32_t end, check_report_t* report);
+  void dirWorker(check_report_t* report);
+  static void exSetChecksum(uint8_t* set, uint8_t entries);
+  void linkRange(uint32_t begin, uint32_t end);
+  void readFat(uint32_t begin, uint32_t end);
+  void readBitmap(uint32_t begin, uint32_t end);
+  uint8_t release(uint32_t cluster);
+  uint8_t repair(check_report_t* report);
+  uint8_t repairEntry(const fix_t& fix);
+  template <typename F> void split(uint32_t count, F f);
+  walk_t walkChain(uint32_t first, uint32_t owner);
+  walk_t walkRun(uint32_t first, uint32_t count, uint32_t owner);
+};
+#endif  // SdCheck_h
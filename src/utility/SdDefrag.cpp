@@ -0,0 +1,169 @@
+/* Arduino SdFat Library
+ * Copyright (C) 2009 by William Greiman
+ *
+ * This file is part of the Arduino SdFat Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino SdFat Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "SdDefrag.h"
+//------------------------------------------------------------------------------
+/**
+ * Move the fragmented files of a volume into contiguous runs of clusters.
+ *
+ * Files and directories should be closed first, except the root directory,
+ * which is not changed; an open file would keep using its old clusters.
+ *
+ * \param[in] vol The volume, mounted by SdVolume::init().
+ * \param[out] report Fragmentation before and after, and what was moved.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure include a volume that is not FAT16 or FAT32, a broken
+ * chain or an I/O error.  A file with no free run long enough for it is
+ * left where it is and counted in \a report, not a failure.
+ */
+uint8_t SdDefrag::defrag(SdVolume* vol, defrag_report_t* report) {
+  *report = defrag_report_t();
+  if (vol->fatType() != 16 && vol->fatType() != 32) return false;
+  vol_ = vol;
+  files_.clear();
+  // concurrent readers wait while clusters move
+  SdVolumeLock hold(vol);
+
+  // copies read the card directly, so it must hold everything cached
+  if (!vol_->cacheFlush()) return false;
+  SdFile root;
+  if (!root.openRoot(vol) || !collect(&root)) return false;
+
+  report->files = files_.size();
+  for (size_t i = 0; i < files_.size(); i++) {
+    report->scoreBefore += files_[i].breaks;
+    if (files_[i].breaks) report->fragmentedBefore++;
+  }
+  // a pass that moves a file frees its old clusters for the files left
+  for (uint8_t progress = true; progress;) {
+    progress = false;
+    for (size_t i = 0; i < files_.size(); i++) {
+      file_t* file = &files_[i];
+      if (!file->breaks) continue;
+      uint8_t moved;
+      if (!move(file, &moved)) return false;
+      if (!moved) continue;
+      report->movedFiles++;
+      report->movedClusters += file->clusters;
+      progress = true;
+    }
+  }
+  for (size_t i = 0; i < files_.size(); i++) {
+    report->scoreAfter += files_[i].breaks;
+    if (files_[i].breaks) report->fragmentedAfter++;
+  }
+  return vol_->fsInfoSync() && vol_->cacheFlush();
+}
+//------------------------------------------------------------------------------
+// add the files in dir and the directories below it to files_
+uint8_t SdDefrag::collect(SdFile* dir) {
+  dir_t entry;
+  int8_t n;
+  dir->rewind();
+  while ((n = dir->readDir(&entry)) > 0) {
+    uint16_t index = dir->curPosition() / 32 - 1;
+    SdFile f;
+    if (!f.open(dir, index, O_READ)) return false;
+    if (f.isSubDir()) {
+      if (!collect(&f)) return false;
+      continue;
+    }
+    if (!f.firstCluster()) continue;
+
+    file_t file;
+    file.dirBlock = f.dirBlock();
+    file.dirIndex = f.dirIndex();
+    file.first = f.firstCluster();
+    file.clusters = 0;
+    file.breaks = 0;
+    uint32_t c = file.first;
+    while (true) {
+      // a chain longer than the volume has a loop
+      if (++file.clusters > vol_->clusterCount()) return false;
+      uint32_t next;
+      if (!vol_->fatGet(c, &next)) return false;
+      if (vol_->isEOC(next)) break;
+      if (next != c + 1) file.breaks++;
+      c = next;
+    }
+    files_.push_back(file);
+  }
+  return n == 0;
+}
+//------------------------------------------------------------------------------
+// copy the chain that starts at from to the run of clusters that starts at
+// to, one run of the chain at a time
+uint8_t SdDefrag::copyChain(uint32_t from, uint32_t to) {
+  uint8_t shift = vol_->clusterSizeShift();
+  buffer_.resize(COPY_BLOCKS * 512);
+  uint32_t dst = vol_->clusterStartBlock(to);
+  uint32_t c = from;
+  while (!vol_->isEOC(c)) {
+    // find the end of the run that starts at c
+    uint32_t count = 1;
+    uint32_t next;
+    for (;; count++) {
+      if (!vol_->fatGet(c + count - 1, &next)) return false;
+      if (next != c + count) break;
+    }
+    uint32_t src = vol_->clusterStartBlock(c);
+    uint32_t blocks = count << shift;
+    for (uint32_t b = 0; b < blocks; b += COPY_BLOCKS) {
+      uint32_t n = blocks - b < COPY_BLOCKS ? blocks - b : COPY_BLOCKS;
+      if (!vol_->readBlocks(src + b, buffer_.data(), n) ||
+        !vol_->writeBlocks(dst + b, buffer_.data(), n)) {
+        return false;
+      }
+    }
+    dst += blocks;
+    c = next;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// move a file into a free run, *moved is false if there is none
+uint8_t SdDefrag::move(file_t* file, uint8_t* moved) {
+  *moved = false;
+  uint32_t first = 0;
+  if (!vol_->allocContiguous(file->clusters, &first)) return true;
+
+  // the new run is chained in the FAT before any data is copied into it
+  if (!vol_->cacheFlush()) return false;
+  if (!copyChain(file->first, first)) return false;
+  uint32_t blocks = file->clusters << vol_->clusterSizeShift();
+  vol_->cacheInvalidate(vol_->clusterStartBlock(first), blocks);
+
+  // point the entry at the copy and only then free the old chain
+  if (!vol_->cacheRawBlock(file->dirBlock, SdVolume::CACHE_FOR_WRITE)) {
+    return false;
+  }
+  dir_t* d = vol_->cacheBuffer()->dir + file->dirIndex;
+  d->firstClusterLow = first & 0XFFFF;
+  d->firstClusterHigh = first >> 16;
+  if (!vol_->cacheFlush()) return false;
+  if (!vol_->freeChain(file->first)) return false;
+  if (!vol_->cacheFlush()) return false;
+
+  file->first = first;
+  file->breaks = 0;
+  *moved = true;
+  return true;
+}
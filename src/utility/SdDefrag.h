@@ -0,0 +1,91 @@
+/* Arduino SdFat Library
+ * Copyright (C) 2009 by William Greiman
+ *
+ * This file is part of the Arduino SdFat Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino SdFat Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef SdDefrag_h
+#define SdDefrag_h
+/**
+ * \file
+ * SdDefrag class, moves fragmented files of a FAT16 or FAT32 volume into
+ * contiguous runs of clusters
+ */
+#include "SdFat.h"
+
+#include <vector>
+//------------------------------------------------------------------------------
+/**
+ * \brief What SdDefrag::defrag() found and did
+ *
+ * The fragmentation score is the number of breaks in the files' chains,
+ * places where a cluster is not followed by the next one on the volume.
+ * Reading every file from start to end seeks once per break.
+ */
+struct defrag_report_t {
+           /** Files with at least one cluster. */
+  uint32_t files;
+           /** Fragmentation score before the files were moved. */
+  uint32_t scoreBefore;
+           /** Fragmentation score after the files were moved. */
+  uint32_t scoreAfter;
+           /** Files in more than one run of clusters before. */
+  uint32_t fragmentedBefore;
+           /** Files in more than one run of clusters after. */
+  uint32_t fragmentedAfter;
+           /** Files moved into a run of their own. */
+  uint32_t movedFiles;
+           /** Clusters copied to move them. */
+  uint32_t movedClusters;
+};
+//------------------------------------------------------------------------------
+/**
+ * \class SdDefrag
+ * \brief Move each fragmented file of a volume into one run of clusters
+ *
+ * A file is moved by allocating a free run as long as its chain, copying
+ * its clusters there a run at a time in large multiple block transfers,
+ * pointing its directory entry at the new run and then freeing the old
+ * chain.  Each step is written back before the next, so the file is whole
+ * on the card whenever the work stops.  Files that did not fit are tried
+ * again once others have left their old clusters free.  Directories are
+ * not moved.
+ */
+class SdDefrag {
+ public:
+  uint8_t defrag(SdVolume* vol, defrag_report_t* report);
+
+ private:
+  // blocks copied per transfer
+  static uint32_t const COPY_BLOCKS = 256;
+  // a file that may be moved
+  struct file_t {
+    uint32_t dirBlock;   // block of its directory entry
+    uint8_t dirIndex;    // position of the entry in the block
+    uint32_t first;      // first cluster
+    uint32_t clusters;   // length of the chain
+    uint32_t breaks;     // places the chain is not contiguous
+  };
+
+  SdVolume* vol_;
+  std::vector<file_t> files_;
+  std::vector<uint8_t> buffer_;
+
+  uint8_t collect(SdFile* dir);
+  uint8_t copyChain(uint32_t from, uint32_t to);
+  uint8_t move(file_t* file, uint8_t* moved);
+};
+#endif  // SdDefrag_h
@@ -0,0 +1,186 @@
+/* Arduino SdFat Library
+ * Copyright (C) 2009 by William Greiman
+ *
+ * This file is part of the Arduino SdFat Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino SdFat Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "SdFat.h"
+#include <string.h>
+//------------------------------------------------------------------------------
+// forget all names, the directory must be read again before use
+void SdDirIndex::clear(void) {
+  for (uint32_t i = 0; i < capacity_; i++) delete[] table_[i].key;
+  delete[] table_;
+  table_ = 0;
+  capacity_ = 0;
+  count_ = 0;
+  freeHint_ = 0;
+  valid_ = false;
+}
+//------------------------------------------------------------------------------
+// Remove the 8.3 name and any long name of the entry at dirIndex in block.
+// lfnCount long name entries before it are being freed too.
+uint8_t SdDirIndex::erase(const uint8_t* name, uint32_t block,
+                          uint8_t dirIndex, uint8_t lfnCount) {
+  if (!count_) return false;
+  const char* key = reinterpret_cast<const char*>(name);
+  uint32_t i = probe(key, 11, hashKey(key, 11));
+  slot_t* slot = &table_[i];
+  if (!slot->key || slot->block != block ||
+    (slot->entry & 0XF) != dirIndex) {
+    return false;
+  }
+  uint16_t entry = slot->entry;
+  uint8_t hasLong = slot->hasLong;
+  uint32_t longHash = slot->longHash;
+  removeSlot(i);
+  if (hasLong) {
+    // the long name is the only long key with this hash and entry
+    uint32_t mask = capacity_ - 1;
+    for (i = longHash & mask; table_[i].key; i = (i + 1) & mask) {
+      slot = &table_[i];
+      if ((slot->length & LONG_KEY) && slot->hash == longHash &&
+        slot->entry == entry && slot->block == block) {
+        removeSlot(i);
+        break;
+      }
+    }
+  }
+  if (entry - lfnCount < freeHint_) freeHint_ = entry - lfnCount;
+  return true;
+}
+//------------------------------------------------------------------------------
+uint8_t SdDirIndex::find(const uint8_t* name, uint16_t* entry) const {
+  if (!count_) return false;
+  const char* key = reinterpret_cast<const char*>(name);
+  uint32_t i = probe(key, 11, hashKey(key, 11));
+  if (!table_[i].key) return false;
+  *entry = table_[i].entry;
+  return true;
+}
+//------------------------------------------------------------------------------
+// look up a long name folded as by the long name key of insert()
+uint8_t SdDirIndex::findLong(const char* key, uint16_t length,
+                             uint16_t* entry) const {
+  if (!count_) return false;
+  length |= LONG_KEY;
+  uint32_t i = probe(key, length, hashKey(key, length));
+  if (!table_[i].key) return false;
+  *entry = table_[i].entry;
+  return true;
+}
+//------------------------------------------------------------------------------
+// double the table, keeping it at most half full
+uint8_t SdDirIndex::grow(void) {
+  uint32_t oldCapacity = capacity_;
+  slot_t* old = table_;
+  capacity_ = oldCapacity ? 2 * oldCapacity : 64;
+  table_ = new slot_t[capacity_];
+  memset(table_, 0, capacity_ * sizeof(slot_t));
+  uint32_t mask = capacity_ - 1;
+  for (uint32_t i = 0; i < oldCapacity; i++) {
+    if (!old[i].key) continue;
+    uint32_t j = old[i].hash & mask;
+    while (table_[j].key) j = (j + 1) & mask;
+    table_[j] = old[i];
+  }
+  delete[] old;
+  return true;
+}
+//------------------------------------------------------------------------------
+// FNV-1a of the key bytes, long names hashed apart from 8.3 names
+uint32_t SdDirIndex::hashKey(const char* key, uint16_t length) {
+  uint32_t h = length & LONG_KEY ? 2166136261UL ^ 0X5A : 2166136261UL;
+  length &= ~LONG_KEY;
+  for (uint16_t i = 0; i < length; i++) {
+    h ^= (uint8_t)key[i];
+    h *= 16777619UL;
+  }
+  return h;
+}
+//------------------------------------------------------------------------------
+// Add the 8.3 name of an entry and, if longKey is not zero, its long name
+// folded to upper case.  The first entry added for a name wins, like a
+// directory scan.
+uint8_t SdDirIndex::insert(const uint8_t* name, const char* longKey,
+                           uint16_t longLength, uint32_t block,
+                           uint16_t entry) {
+  slot_t* slot = insertKey(reinterpret_cast<const char*>(name), 11, block,
+                           entry);
+  if (!slot) return false;
+  if (longKey) {
+    slot_t* longSlot = insertKey(longKey, longLength | LONG_KEY, block, entry);
+    if (!longSlot) return false;
+    // insertKey() may have moved the short name slot
+    const char* key = reinterpret_cast<const char*>(name);
+    slot = &table_[probe(key, 11, hashKey(key, 11))];
+    if (slot->entry == entry && slot->block == block) {
+      slot->hasLong = true;
+      slot->longHash = hashKey(longKey, longLength | LONG_KEY);
+    }
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// add one key, return its slot or the slot of an earlier entry with the key
+SdDirIndex::slot_t* SdDirIndex::insertKey(const char* key, uint16_t length,
+                                          uint32_t block, uint16_t entry) {
+  if (2 * (count_ + 1) > capacity_ && !grow()) return 0;
+  uint32_t hash = hashKey(key, length);
+  slot_t* slot = &table_[probe(key, length, hash)];
+  if (slot->key) return slot;
+  uint16_t bytes = length & ~LONG_KEY;
+  slot->key = new char[bytes];
+  memcpy(slot->key, key, bytes);
+  slot->hash = hash;
+  slot->block = block;
+  slot->longHash = 0;
+  slot->entry = entry;
+  slot->length = length;
+  slot->hasLong = false;
+  count_++;
+  return slot;
+}
+//------------------------------------------------------------------------------
+// slot holding key or the empty slot where it belongs
+uint32_t SdDirIndex::probe(const char* key, uint16_t length,
+                           uint32_t hash) const {
+  uint32_t mask = capacity_ - 1;
+  uint32_t i = hash & mask;
+  while (table_[i].key && (table_[i].hash != hash ||
+    table_[i].length != length ||
+    memcmp(table_[i].key, key, length & ~LONG_KEY))) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+//------------------------------------------------------------------------------
+// Empty slot i.  The slots after it in the probe sequence are moved back
+// so no tombstones are needed.
+void SdDirIndex::removeSlot(uint32_t i) {
+  uint32_t mask = capacity_ - 1;
+  delete[] table_[i].key;
+  count_--;
+  for (uint32_t j = (i + 1) & mask; table_[j].key; j = (j + 1) & mask) {
+    uint32_t k = table_[j].hash & mask;
+    // move j into the hole at i unless its home lies between i and j
+    if (((j - k) & mask) >= ((j - i) & mask)) {
+      table_[i] = table_[j];
+      i = j;
+    }
+  }
+  table_[i].key = 0;
+}
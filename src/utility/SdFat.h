@@ -23,6 +23,11 @@
 #include "Sd2Card.h"
 #include "FatStructs.h"
 #include "Print.h"
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
 
 #pragma push_macro("O_WRONLY")
 #pragma push_macro("O_RDONLY")
@@ -150,14 +155,83 @@ uint16_t const FAT_DEFAULT_DATE = ((2000 - 1980) << 9) | (1 << 5) | 1;
 /** Default time for file timestamp is 1 am */
 uint16_t const FAT_DEFAULT_TIME = (1 << 11);
 //------------------------------------------------------------------------------
+/** Number of cluster runs each SdFile remembers to speed up seeks. */
+#ifndef SD_FILE_EXTENTS
+#define SD_FILE_EXTENTS 16
+#endif  // SD_FILE_EXTENTS
+/**
+ * \brief A run of adjacent clusters in a file's cluster chain
+ */
+struct extent_t {
+           /** Position of the run's first cluster in the chain. */
+  uint32_t index;
+           /** Cluster number of the run's first cluster. */
+  uint32_t cluster;
+           /** Number of clusters in the run. */
+  uint32_t count;
+};
+//------------------------------------------------------------------------------
+/** Number of directories an SdVolume keeps a name index for. */
+#ifndef SD_DIR_INDEXES
+#define SD_DIR_INDEXES 4
+#endif  // SD_DIR_INDEXES
+/**
+ * \class SdDirIndex
+ * \brief Hash table from 8.3 names to the entries of one directory
+ */
+class SdDirIndex {
+ public:
+  SdDirIndex(void) : dirCluster_(0), freeHint_(0), lastUse_(0), valid_(false),
+    table_(0), capacity_(0), count_(0) {}
+  ~SdDirIndex(void) {delete[] table_;}
+  void clear(void);
+  uint8_t erase(const uint8_t* name, uint32_t block, uint8_t dirIndex,
+                uint8_t lfnCount);
+  uint8_t find(const uint8_t* name, uint16_t* entry) const;
+  uint8_t findLong(const char* key, uint16_t length, uint16_t* entry) const;
+  uint8_t insert(const uint8_t* name, const char* longKey,
+                 uint16_t longLength, uint32_t block, uint16_t entry);
+ private:
+  friend class SdFile;
+  friend class SdVolume;
+  // length bit for long name keys
+  static uint16_t const LONG_KEY = 0X8000;
+  struct slot_t {
+    char* key;          // 8.3 name or folded long name, zero if empty slot
+    uint32_t hash;      // hash of key
+    uint32_t block;     // block holding the short name entry
+    uint32_t longHash;  // hash of the long name of a short name slot
+    uint16_t entry;     // position of the short name entry / 32
+    uint16_t length;    // bytes in key, ORed with LONG_KEY for long names
+    uint8_t hasLong;    // short name slot with a long name slot
+  };
+  uint32_t dirCluster_;  // first cluster of the directory, zero for FAT16 root
+  uint16_t freeHint_;    // no free entry before this one
+  uint32_t lastUse_;     // for replacing the least recently used index
+  uint8_t valid_;        // true once the directory has been read
+  slot_t* table_;        // open addressing, linear probing
+  uint32_t capacity_;    // slots in table_, zero or a power of two
+  uint32_t count_;       // keys in table_
+  uint8_t grow(void);
+  static uint32_t hashKey(const char* key, uint16_t length);
+  slot_t* insertKey(const char* key, uint16_t length, uint32_t block,
+                    uint16_t entry);
+  uint32_t probe(const char* key, uint16_t length, uint32_t hash) const;
+  void removeSlot(uint32_t i);
+  // owns table_, not copyable
+  SdDirIndex(const SdDirIndex&);
+  SdDirIndex& operator=(const SdDirIndex&);
+};
+//------------------------------------------------------------------------------
 /**
  * \class SdFile
- * \brief Access FAT16 and FAT32 files on SD and SDHC cards.
+ * \brief Access FAT16, FAT32 and exFAT files on SD, SDHC and SDXC cards.
  */
 class SdFile : public Print {
  public:
   /** Create an instance of SdFile. */
-  SdFile(void) : type_(FAT_FILE_TYPE_CLOSED) {}
+  SdFile(void) : type_(FAT_FILE_TYPE_CLOSED), extentCount_(0),
+    readEnd_(0XFFFFFFFF), streamEnd_(0) {}
   /**
    * writeError is set to true if an error occurs during a write().
    * Set writeError to false before calling print() and/or write() and check
@@ -226,6 +300,7 @@ class SdFile : public Print {
   static void dirName(const dir_t& dir, char* name);
   /** \return The total number of bytes in a file or directory. */
   uint32_t fileSize(void) const {return fileSize_;}
+  uint8_t getName(char* name, uint16_t size);
   /** \return The first cluster number for a file or directory. */
   uint32_t firstCluster(void) const {return firstCluster_;}
   /** \return True if this is a SdFile for a directory else false. */
@@ -246,10 +321,16 @@ class SdFile : public Print {
   uint8_t open(SdFile* dirFile, const char* fileName, uint8_t oflag);
 
   uint8_t openRoot(SdVolume* vol);
+  uint8_t preallocate(uint32_t length);
   static void printDirName(const dir_t& dir, uint8_t width);
   static void printFatDate(uint16_t fatDate);
   static void printFatTime(uint16_t fatTime);
   static void printTwoDigits(uint8_t v);
+  uint8_t rawStreamStart(void);
+  /** \return True if a raw stream is open, see rawStreamStart(). */
+  uint8_t rawStreaming(void) const {return streamEnd_ != 0;}
+  uint8_t rawStreamStop(void);
+  uint8_t rawStreamWrite(const void* buf, uint32_t count);
   /**
    * Read the next byte from a file.
    *
@@ -393,14 +474,19 @@ class SdFile : public Print {
   // should be 0XF
   static uint8_t const F_OFLAG = (O_ACCMODE | O_APPEND | O_SYNC);
   // available bits
-  static uint8_t const F_UNUSED = 0X30;
+  static uint8_t const F_UNUSED = 0X00;
+  // clusters past the end of the data are reserved, see preallocate()
+  static uint8_t const F_RESERVED = 0X20;
+  // exFAT clusters are contiguous and not in the FAT, see mapContiguous()
+  static uint8_t const F_NO_FAT_CHAIN = 0X10;
   // use unbuffered SD read
   static uint8_t const F_FILE_UNBUFFERED_READ = 0X40;
   // sync of directory entry required
   static uint8_t const F_FILE_DIR_DIRTY = 0X80;
 
 // make sure F_OFLAG is ok
-#if ((F_UNUSED | F_FILE_UNBUFFERED_READ | F_FILE_DIR_DIRTY) & F_OFLAG)
+#if ((F_UNUSED | F_RESERVED | F_NO_FAT_CHAIN | F_FILE_UNBUFFERED_READ | \
+  F_FILE_DIR_DIRTY) & F_OFLAG)
 #error flags_ bits conflict
 #endif  // flags_ bits
 
@@ -414,15 +500,60 @@ class SdFile : public Print {
   uint32_t  fileSize_;      // file size in bytes
   uint32_t  firstCluster_;  // first cluster of file
   SdVolume* vol_;           // volume where file is located
+  uint32_t  dirCluster_;    // first cluster of the directory holding the entry
+  uint16_t  dirEntry_;      // position of the entry in that directory / 32
+  uint8_t   lfnCount_;      // long name entries before the entry, on exFAT
+                            // the entries of the set after the first
+  uint32_t  dirClusters_;   // exFAT: clusters of the directory holding the
+                            // entry if they are contiguous, else zero
+  extent_t  extents_[SD_FILE_EXTENTS];  // start of the chain as runs
+  uint8_t   extentCount_;   // runs in extents_
+  uint8_t   extentsEnd_;    // true if extents_ maps the whole chain
+  uint32_t  readEnd_;       // position the last read() ended at
+  uint32_t  streamBlock_;   // next block of a raw stream
+  uint32_t  streamEnd_;     // block after the raw stream, zero if none
 
   // private functions
   uint8_t addCluster(void);
   uint8_t addDirCluster(void);
   dir_t* cacheDirEntry(uint8_t action);
+  uint8_t chainSize(uint32_t* size);
+  uint8_t clusterAt(uint32_t index, uint32_t* cluster,
+                    uint8_t shared = false);
+  uint8_t entryIsFileOrSubDir(const dir_t* p) const;
+  uint8_t exOpen(SdFile* dirFile, const char* fileName, uint8_t oflag);
+  uint8_t exOpenIndex(SdFile* dirFile, uint16_t index, uint8_t oflag);
+  uint8_t exReadEntrySet(SdFile* parent, dir_t* set);
+  int8_t exReadDir(dir_t* dir);
+  static uint8_t exReadSet(SdFile* dirFile, uint16_t index, dir_t* set);
+  uint8_t exRemove(void);
+  uint8_t exSyncEntry(void);
+  uint8_t exTimestamp(uint8_t flags, uint16_t dirDate, uint16_t dirTime,
+                      uint8_t tenths);
+  static uint8_t exWriteSet(SdFile* dirFile, uint16_t index, dir_t* set);
+  uint8_t indexDir(SdDirIndex* index);
+  uint8_t lfnCountAt(SdFile* dirFile, uint16_t index);
+  uint8_t rmRfCollect(std::vector<uint32_t>* chains);
+  uint8_t contiguousBlocks(uint32_t max, uint8_t allocate, uint32_t* count);
   static void (*dateTime_)(uint16_t* date, uint16_t* time);
   static uint8_t make83Name(const char* str, uint8_t* name);
+  void mapContiguous(uint32_t count) {
+    extents_[0].index = 0;
+    extents_[0].cluster = firstCluster_;
+    extents_[0].count = count;
+    extentCount_ = 1;
+    extentsEnd_ = true;
+  }
+  uint8_t nextCluster(uint32_t* next, uint8_t shared = false);
   uint8_t openCachedEntry(uint8_t cacheIndex, uint8_t oflags);
+  uint8_t openParent(SdFile* dir);
+  uint8_t readAhead(uint32_t block);
   dir_t* readDirCache(void);
+  int16_t readShared(void* buf, uint16_t nbyte);
+  void resetExtents(void) {
+    extentCount_ = 0;
+    extentsEnd_ = false;
+  }
 };
 //==============================================================================
 // SdVolume class
@@ -442,27 +573,217 @@ union cache_t {
   mbr_t    mbr;
            /** Used to access to a cached FAT boot sector. */
   fbs_t    fbs;
+           /** Used to access to a cached exFAT boot sector. */
+  exfat_fbs_t exfbs;
+           /** Used to access a cached FAT32 FSInfo sector. */
+  fsinfo_t fsinfo;
+};
+//------------------------------------------------------------------------------
+/** Maximum number of blocks the SdVolume cache can hold. */
+#ifndef SD_CACHE_MAX_SLOTS
+#define SD_CACHE_MAX_SLOTS 32
+#endif  // SD_CACHE_MAX_SLOTS
+/** Default number of cache slots reserved for FAT blocks. */
+#ifndef SD_CACHE_FAT_SLOTS
+#define SD_CACHE_FAT_SLOTS 4
+#endif  // SD_CACHE_FAT_SLOTS
+/** Default number of cache slots for directory and file data blocks. */
+#ifndef SD_CACHE_DATA_SLOTS
+#define SD_CACHE_DATA_SLOTS 8
+#endif  // SD_CACHE_DATA_SLOTS
+/** Largest read-ahead window in blocks; the window buffer is this big. */
+#ifndef SD_READ_AHEAD_MAX_BLOCKS
+#define SD_READ_AHEAD_MAX_BLOCKS 64
+#endif  // SD_READ_AHEAD_MAX_BLOCKS
+/** Default read-ahead window in blocks, zero for no read-ahead. */
+#ifndef SD_READ_AHEAD_BLOCKS
+#define SD_READ_AHEAD_BLOCKS 16
+#endif  // SD_READ_AHEAD_BLOCKS
+/** Non-zero to write the second and later FAT copies once per sync. */
+#ifndef SD_FAT_WRITE_BACK
+#define SD_FAT_WRITE_BACK 1
+#endif  // SD_FAT_WRITE_BACK
+/** FAT blocks whose copies can wait for the next sync. */
+#ifndef SD_FAT_PENDING_MAX
+#define SD_FAT_PENDING_MAX 32
+#endif  // SD_FAT_PENDING_MAX
+/** Adjacent FAT blocks copied with one multi-block write. */
+#ifndef SD_FAT_COPY_RUN
+#define SD_FAT_COPY_RUN 8
+#endif  // SD_FAT_COPY_RUN
+/** FAT entries searched from the FSInfo hint before the FAT is scanned
+    into the free cluster map. */
+#ifndef SD_FAT_SCAN_MAX
+#define SD_FAT_SCAN_MAX 1024
+#endif  // SD_FAT_SCAN_MAX
+/** Lock stripes of the block cache shared by concurrent readers. */
+#ifndef SD_CACHE_STRIPES
+#define SD_CACHE_STRIPES 16
+#endif  // SD_CACHE_STRIPES
+/** Blocks held by each stripe of the concurrent readers' cache. */
+#ifndef SD_CACHE_STRIPE_SLOTS
+#define SD_CACHE_STRIPE_SLOTS 4
+#endif  // SD_CACHE_STRIPE_SLOTS
+/**
+ * \brief One block held by the SdVolume cache
+ */
+struct cache_slot_t {
+  cache_slot_t() : blockNumber(0XFFFFFFFF), mirrorBlock(0), lastUse(0),
+    dirty(0), mirrorCount(0) {}
+           /** Contents of the block. */
+  cache_t  buffer;
+           /** Block held in buffer, 0XFFFFFFFF if none. */
+  uint32_t blockNumber;
+           /** Second FAT copy of blockNumber to write with it, zero if none. */
+  uint32_t mirrorBlock;
+           /** Access stamp used for least recently used eviction. */
+  uint32_t lastUse;
+           /** Non-zero if buffer differs from the card. */
+  uint8_t  dirty;
+           /** FAT copies after the first, spaced mirrorBlock - blockNumber. */
+  uint8_t  mirrorCount;
+};
+/**
+ * \brief One lock stripe of the cache shared by concurrent readers
+ */
+struct cache_stripe_t {
+  cache_stripe_t() : clock(0) {}
+           /** Held while a slot is looked up or filled. */
+  std::mutex lock;
+           /** Blocks whose number modulo SD_CACHE_STRIPES is this stripe. */
+  cache_slot_t slots[SD_CACHE_STRIPE_SLOTS];
+           /** Source of lastUse stamps. */
+  uint32_t clock;
+};
+/**
+ * \brief Counters for tuning the SdVolume cache size and read-ahead window
+ */
+struct cache_stats_t {
+           /** FAT block requests served from the cache. */
+  uint32_t fatHits;
+           /** FAT block requests that had to read the card. */
+  uint32_t fatMisses;
+           /** Directory and data block requests served from the cache. */
+  uint32_t dataHits;
+           /** Directory and data block requests that had to read the card. */
+  uint32_t dataMisses;
+           /** Dirty blocks written back to the card. */
+  uint32_t writeBacks;
+           /** Data blocks served from the read-ahead window. */
+  uint32_t readAheadHits;
+           /** Sequential reads of a block not in the window, which refill it. */
+  uint32_t readAheadMisses;
+           /** Blocks written to the second and later FAT copies. */
+  uint32_t fatCopyWrites;
 };
 //------------------------------------------------------------------------------
 /**
  * \class SdVolume
- * \brief Access FAT16 and FAT32 volumes on SD and SDHC cards.
+ * \brief Access FAT16, FAT32 and exFAT volumes on SD, SDHC and SDXC cards.
+ *
+ * Each volume has its own block cache, read-ahead window and name index, so
+ * volumes on different cards can be mounted side by side.  A volume and the
+ * files open on it must be used from one thread at a time, unless
+ * concurrentEnable() lets threads read it together, but different volumes
+ * may be used from different threads.
  */
 class SdVolume {
  public:
   /** Create an instance of SdVolume */
-  SdVolume(void) :allocSearchStart_(2), fatType_(0) {}
+  SdVolume(void) :cacheFatSlots_(SD_CACHE_FAT_SLOTS),
+    cacheSlotCount_(SD_CACHE_FAT_SLOTS + SD_CACHE_DATA_SLOTS),
+    cacheCurrent_(&cacheSlots_[SD_CACHE_FAT_SLOTS]), cacheClock_(0),
+    cacheStats_(), sdCard_(0), readAheadBlock_(0), readAheadCount_(0),
+    readAheadWindow_(SD_READ_AHEAD_BLOCKS), fatPendingCount_(0),
+    fatPendingStride_(0), fatPendingCopies_(0),
+    fatWriteBack_(SD_FAT_WRITE_BACK), allocSearchStart_(2), fatType_(0),
+    freeMap_(0),
+    freeClusters_(FSINFO_UNKNOWN), fsInfoBlock_(0), fsInfoDirty_(false),
+    dirIndexClock_(0), dirIndexEnabled_(false), upcase_(0), upcaseCount_(0),
+    lockOwner_(), lockDepth_(0), stripes_(0) {}
+  ~SdVolume(void) {
+    delete[] freeMap_;
+    delete[] upcase_;
+    delete[] stripes_.load();
+  }
   /** Clear the cache and returns a pointer to the cache.  Used by the WaveRP
    *  recorder to do raw write to the SD card.  Not for normal apps.
    */
-  static uint8_t* cacheClear(void) {
-    cacheFlush();
-    cacheBlockNumber_ = 0XFFFFFFFF;
-    return cacheBuffer_.data;
+  uint8_t* cacheClear(void);
+  /**
+   * Set the number of cache slots for FAT blocks and for directory and file
+   * data blocks.  Each pool is evicted least recently used first.  Cached
+   * blocks are written back and dropped.
+   *
+   * \return The value one, true, is returned for success and the value
+   * zero, false, is returned if either pool is empty, the total exceeds
+   * SD_CACHE_MAX_SLOTS or a write back failed.
+   */
+  uint8_t cacheConfigure(uint8_t fatSlots, uint8_t dataSlots);
+  /**
+   * Let threads read different files of this volume at the same time.
+   *
+   * While enabled, SdFile::read() holds the volume shared and serves
+   * partial blocks and FAT entries from a cache of SD_CACHE_STRIPES
+   * stripes, each with its own lock, so readers only wait for each other
+   * on blocks of the same stripe.  Every other SdFile call holds the
+   * volume exclusively, so writers and FAT or directory updates take turns
+   * and readers wait only while one runs.  Each SdFile is still used from
+   * one thread at a time.  Enable it, and call init(), cacheConfigure()
+   * and the other volume settings, while no other thread uses the volume.
+   * Disabling waits for the readers and writers in progress to finish.
+   *
+   * \param[in] enable True to allow concurrent readers.
+   *
+   * \return The value one, true, is returned for success and the value
+   * zero, false, is returned if \a enable is set and the volume is not on
+   * a card image, since an SPI card takes one transfer at a time.
+   */
+  uint8_t concurrentEnable(uint8_t enable);
+  /** \return True if concurrent readers are enabled. */
+  uint8_t concurrentEnabled(void) const {return stripes_.load() != 0;}
+  /**
+   * Choose when the second and later copies of the FAT are written.
+   *
+   * With write back, the default, a dirty FAT block is kept in the cache
+   * in preference to clean ones and only its first copy is written when it
+   * has to leave.  The other copies are written once per sync() or close(),
+   * in block order with adjacent blocks in one transfer.  Until then they
+   * hold the FAT as of the last sync, so a power cut can leave the copies
+   * different but the last synced allocation intact in the later ones.
+   *
+   * With write through every write of a FAT block writes all of its copies,
+   * so the copies never differ for longer than one block write.
+   *
+   * \param[in] enable True for write back, false for write through.
+   *
+   * \return The value one, true, is returned for success and the value
+   * zero, false, is returned if writing the delayed copies failed.
+   */
+  uint8_t fatWriteBackEnable(uint8_t enable);
+  /** \return True if FAT copies are written back at sync. */
+  uint8_t fatWriteBackEnabled(void) {return fatWriteBack_;}
+  /** \return Hit, miss and write back counts since the last reset. */
+  const cache_stats_t& cacheStats(void) {return cacheStats_;}
+  /** Zero the counters returned by cacheStats(). */
+  void cacheResetStats(void) {cacheStats_ = cache_stats_t();}
+  /**
+   * Keep a name index for the SD_DIR_INDEXES most recently searched
+   * directories so SdFile::open() by name need not scan the directory.
+   * An index is built on the first lookup in a directory and follows
+   * files created and removed through this volume.
+   *
+   * \param[in] enable True to build indexes, false to drop them.
+   */
+  void dirIndexEnable(uint8_t enable) {
+    dirIndexClear();
+    dirIndexEnabled_ = enable;
   }
+  /** \return True if directory name indexes are enabled. */
+  uint8_t dirIndexEnabled(void) const {return dirIndexEnabled_;}
   /**
-   * Initialize a FAT volume.  Try partition one first then try super
-   * floppy format.
+   * Initialize a FAT or exFAT volume.  Try partition one first then try
+   * super floppy format.
    *
    * \param[in] dev The Sd2Card where the volume is located.
    *
@@ -473,10 +794,24 @@ class SdVolume {
    */
   uint8_t init(Sd2Card* dev) { return init(dev, 1) ? true : init(dev, 0);}
   uint8_t init(Sd2Card* dev, uint8_t part);
+  /**
+   * Set the read-ahead window.  While an SdFile is read sequentially the
+   * data blocks that follow the one being read, up to \a blocks of them,
+   * are read from the card in one transfer, and the FAT blocks that chain
+   * them are brought into the cache on the way.
+   *
+   * \param[in] blocks Window size in blocks, zero to turn read-ahead off.
+   *
+   * \return The value one, true, is returned for success and the value
+   * zero, false, is returned if \a blocks exceeds SD_READ_AHEAD_MAX_BLOCKS.
+   */
+  uint8_t readAheadConfigure(uint8_t blocks);
+  /** \return The read-ahead window in blocks, zero if read-ahead is off. */
+  uint8_t readAheadWindow(void) {return readAheadWindow_;}
 
   // inline functions that return volume info
   /** \return The volume's cluster size in blocks. */
-  uint8_t blocksPerCluster(void) const {return blocksPerCluster_;}
+  uint32_t blocksPerCluster(void) const {return blocksPerCluster_;}
   /** \return The number of blocks in one FAT. */
   uint32_t blocksPerFat(void)  const {return blocksPerFat_;}
   /** \return The total number of clusters in the volume. */
@@ -489,15 +824,18 @@ class SdVolume {
   uint8_t fatCount(void) const {return fatCount_;}
   /** \return The logical block number for the start of the first FAT. */
   uint32_t fatStartBlock(void) const {return fatStartBlock_;}
-  /** \return The FAT type of the volume. Values are 12, 16 or 32. */
+  /** \return The FAT type of the volume. Values are 12, 16, 32 or 64 for
+       exFAT. */
   uint8_t fatType(void) const {return fatType_;}
+  uint32_t freeClusterCount(void);
   /** \return The number of entries in the root directory for FAT16 volumes. */
   uint32_t rootDirEntryCount(void) const {return rootDirEntryCount_;}
   /** \return The logical block number for the start of the root directory
-       on FAT16 volumes or the first cluster number on FAT32 volumes. */
+       on FAT16 volumes or the first cluster number on FAT32 and exFAT
+       volumes. */
   uint32_t rootDirStart(void) const {return rootDirStart_;}
   /** return a pointer to the Sd2Card object for this volume */
-  static Sd2Card* sdCard(void) {return sdCard_;}
+  Sd2Card* sdCard(void) {return sdCard_;}
 //------------------------------------------------------------------------------
 #if ALLOW_DEPRECATED_FUNCTIONS
   // Deprecated functions  - suppress cpplint warnings with NOLINT comment
@@ -513,60 +851,208 @@ class SdVolume {
   private:
   // Allow SdFile access to SdVolume private data.
   friend class SdFile;
+  friend class SdCheck;
+  friend class SdDefrag;
+  friend class SdVolumeLock;
 
   // value for action argument in cacheRawBlock to indicate read from cache
   static uint8_t const CACHE_FOR_READ = 0;
   // value for action argument in cacheRawBlock to indicate cache dirty
   static uint8_t const CACHE_FOR_WRITE = 1;
 
-  static cache_t cacheBuffer_;        // 512 byte cache for device blocks
-  static uint32_t cacheBlockNumber_;  // Logical number of block in the cache
-  static Sd2Card* sdCard_;            // Sd2Card object for cache
-  static uint8_t cacheDirty_;         // cacheFlush() will write block if true
-  static uint32_t cacheMirrorBlock_;  // block number for mirror FAT
+  // value for pool argument in cacheRawBlock for FAT blocks
+  static uint8_t const CACHE_POOL_FAT = 1;
+
+  cache_slot_t cacheSlots_[SD_CACHE_MAX_SLOTS];  // FAT pool first
+  uint8_t cacheFatSlots_;       // slots in the FAT pool
+  uint8_t cacheSlotCount_;      // slots in use, both pools
+  cache_slot_t* cacheCurrent_;  // slot of the last block cached
+  uint32_t cacheClock_;         // source of lastUse stamps
+  cache_stats_t cacheStats_;    // hit and miss counters
+  Sd2Card* sdCard_;             // Sd2Card object for cache
+  // blocks read ahead of a sequential reader, kept current by write backs
+  uint8_t readAheadBuffer_[SD_READ_AHEAD_MAX_BLOCKS * 512];
+  uint32_t readAheadBlock_;     // first block in readAheadBuffer_
+  uint8_t readAheadCount_;      // blocks in readAheadBuffer_
+  uint8_t readAheadWindow_;     // see readAheadConfigure()
+  // FAT blocks, in order, whose later copies wait for cacheFlush()
+  uint32_t fatPending_[SD_FAT_PENDING_MAX];
+  uint8_t fatPendingCount_;     // blocks in fatPending_
+  uint32_t fatPendingStride_;   // blocks from one FAT copy to the next
+  uint8_t fatPendingCopies_;    // copies after the first
+  uint8_t fatWriteBack_;        // see fatWriteBackEnable()
+  uint8_t fatCopyBuffer_[SD_FAT_COPY_RUN * 512];  // run being copied
 //
   uint32_t allocSearchStart_;   // start cluster for alloc search
-  uint8_t blocksPerCluster_;    // cluster size in blocks
+  uint32_t blocksPerCluster_;   // cluster size in blocks
   uint32_t blocksPerFat_;       // FAT size in blocks
   uint32_t clusterCount_;       // clusters in one FAT
   uint8_t clusterSizeShift_;    // shift to convert cluster count to block count
   uint32_t dataStartBlock_;     // first data block number
   uint8_t fatCount_;            // number of FATs on volume
   uint32_t fatStartBlock_;      // start block for first FAT
-  uint8_t fatType_;             // volume type (12, 16, OR 32)
+  uint8_t fatType_;             // volume type (12, 16, 32 OR 64 for exFAT)
   uint16_t rootDirEntryCount_;  // number of entries in FAT16 root dir
   uint32_t rootDirStart_;       // root start block for FAT16, cluster for FAT32
+  uint32_t* freeMap_;           // bit per cluster, set if in use
+  uint32_t freeClusters_;       // free clusters, FSINFO_UNKNOWN if not known
+  uint32_t fsInfoBlock_;        // FAT32 FSInfo sector, zero if none
+  uint8_t fsInfoDirty_;         // free count changed since fsInfoSync()
+  SdDirIndex dirIndexes_[SD_DIR_INDEXES];  // name index per directory
+  uint32_t dirIndexClock_;      // source of SdDirIndex lastUse stamps
+  uint8_t dirIndexEnabled_;     // see dirIndexEnable()
+  uint32_t bitmapStartBlock_;   // exFAT allocation bitmap, kept like freeMap_
+  uint16_t* upcase_;            // exFAT up-case table as (char, upper) pairs
+                                // for the characters that change
+  uint32_t upcaseCount_;        // pairs in upcase_
+  // see concurrentEnable(); readers hold lock_ shared, everything else
+  // holds it exclusively through SdVolumeLock
+  std::shared_mutex lock_;
+  std::atomic<std::thread::id> lockOwner_;  // thread holding lock_ exclusively
+  uint32_t lockDepth_;          // nested SdVolumeLocks of lockOwner_
+  std::atomic<cache_stripe_t*> stripes_;  // readers' cache, zero if not
+                                          // concurrent
+  // owns freeMap_ and upcase_, not copyable
+  SdVolume(const SdVolume&);
+  SdVolume& operator=(const SdVolume&);
   //----------------------------------------------------------------------------
   uint8_t allocContiguous(uint32_t count, uint32_t* curCluster);
-  uint8_t blockOfCluster(uint32_t position) const {
+  uint8_t allocUnchained(uint32_t count, uint32_t* curCluster);
+  uint32_t blockOfCluster(uint32_t position) const {
           return (position >> 9) & (blocksPerCluster_ - 1);}
   uint32_t clusterStartBlock(uint32_t cluster) const {
            return dataStartBlock_ + ((cluster - 2) << clusterSizeShift_);}
   uint32_t blockNumber(uint32_t cluster, uint32_t position) const {
            return clusterStartBlock(cluster) + blockOfCluster(position);}
-  static uint8_t cacheFlush(void);
-  static uint8_t cacheRawBlock(uint32_t blockNumber, uint8_t action);
-  static void cacheSetDirty(void) {cacheDirty_ |= CACHE_FOR_WRITE;}
-  static uint8_t cacheZeroBlock(uint32_t blockNumber);
-  uint8_t chainSize(uint32_t beginCluster, uint32_t* size) const;
-  uint8_t fatGet(uint32_t cluster, uint32_t* value) const;
+  // the block cached by the last cacheRawBlock() or cacheZeroBlock() call
+  cache_t* cacheBuffer(void) {return &cacheCurrent_->buffer;}
+  uint32_t cacheBlockNumber(void) {return cacheCurrent_->blockNumber;}
+  uint8_t cacheContains(uint32_t blockNumber) {
+    return cacheFind(blockNumber) != 0;
+  }
+  cache_slot_t* cacheFind(uint32_t blockNumber);
+  uint8_t cacheFlush(void);
+  // forget cached blocks in [block, block + count) that are being overwritten
+  void cacheInvalidate(uint32_t block, uint32_t count);
+  uint8_t cacheLoad(uint32_t blockNumber, uint8_t action, uint8_t pool);
+  uint8_t cacheRawBlock(uint32_t blockNumber, uint8_t action,
+                               uint8_t pool = 0) {
+    // the current slot is already the most recently used one
+    if (cacheCurrent_->blockNumber != blockNumber) {
+      return cacheLoad(blockNumber, action, pool);
+    }
+    if (pool == CACHE_POOL_FAT) {
+      cacheStats_.fatHits++;
+    } else {
+      cacheStats_.dataHits++;
+    }
+    cacheCurrent_->dirty |= action;
+    return true;
+  }
+  void cacheSetDirty(void) {cacheCurrent_->dirty |= CACHE_FOR_WRITE;}
+  void cacheSetMirror(uint32_t block, uint8_t count) {
+    cacheCurrent_->mirrorBlock = block;
+    cacheCurrent_->mirrorCount = count;
+  }
+  // write back dirty cached blocks in [block, block + count)
+  uint8_t cacheSync(uint32_t block, uint32_t count);
+  cache_slot_t* cacheVictim(uint8_t pool);
+  uint8_t cacheWriteBack(cache_slot_t* slot);
+  uint8_t cacheZeroBlock(uint32_t blockNumber);
+  uint8_t chainSize(uint32_t beginCluster, uint32_t* size);
+  uint8_t clusterFree(uint32_t cluster, uint8_t* isFree);
+  void dirIndexClear(void);
+  void dirIndexDrop(uint32_t dirCluster);
+  void dirIndexErase(const uint8_t* name, uint32_t block, uint8_t dirIndex,
+                     uint8_t lfnCount);
+  SdDirIndex* dirIndexFor(uint32_t dirCluster);
+  uint8_t exFatInit(uint32_t volumeStartBlock);
+  uint8_t exUpcaseInit(uint32_t cluster, uint32_t length);
+  uint8_t fatGet(uint32_t cluster, uint32_t* value);
+  uint8_t fatCopyFlush(void);
+  uint8_t fatCopyPending(uint32_t block, uint32_t stride,
+                                uint8_t copies);
+  uint8_t fatCopyWrite(uint32_t block, const uint8_t* src,
+                              uint32_t count, uint32_t stride, uint8_t copies);
   uint8_t fatPut(uint32_t cluster, uint32_t value);
   uint8_t fatPutEOC(uint32_t cluster) {
-    return fatPut(cluster, 0x0FFFFFFF);
+    return fatPut(cluster, fatType_ == 64 ? EXFAT_EOC : FAT32EOC);
   }
+  uint8_t fatPutRun(uint32_t cluster, uint32_t count);
   uint8_t freeChain(uint32_t cluster);
+  uint8_t freeChains(const uint32_t* first, uint32_t count);
+  uint8_t freeUnchained(uint32_t cluster, uint32_t count);
+  uint32_t freeMapFind(uint32_t first, uint32_t last, uint32_t count) const;
+  uint8_t freeMapInit(void);
+  uint8_t freeMapSet(uint32_t cluster, uint8_t used);
+  uint8_t fsInfoLoad(void);
+  uint8_t fsInfoSync(void);
   uint8_t isEOC(uint32_t cluster) const {
     return  cluster >= (fatType_ == 16 ? FAT16EOC_MIN : FAT32EOC_MIN);
   }
   uint8_t readBlock(uint32_t block, uint8_t* dst) {
     return sdCard_->readBlock(block, dst);}
+  uint16_t upcase(uint16_t c) const;
   uint8_t readData(uint32_t block, uint16_t offset,
     uint16_t count, uint8_t* dst) {
       return sdCard_->readData(block, offset, count, dst);
   }
+  uint8_t readBlocks(uint32_t block, uint8_t* dst, uint32_t count) {
+    return sdCard_->readBlocks(block, dst, count);
+  }
+  uint8_t readAheadContains(uint32_t block) {
+    return block - readAheadBlock_ < readAheadCount_;
+  }
+  uint8_t readAheadCopy(uint32_t block, uint16_t offset,
+                               uint16_t count, uint8_t* dst);
+  uint8_t readAheadFill(uint32_t block, uint8_t count);
+  uint8_t lockOwned(void) const {
+    return lockOwner_.load() == std::this_thread::get_id();
+  }
+  uint8_t sharedFatGet(uint32_t cluster, uint32_t* value);
+  uint8_t sharedRead(uint32_t block, uint16_t offset,
+                     uint16_t count, uint8_t* dst);
+  uint8_t sharedReadBlocks(uint32_t block, uint8_t* dst, uint32_t count);
+  void stripeInvalidate(uint32_t block, uint32_t count);
   uint8_t writeBlock(uint32_t block, const uint8_t* dst) {
+    stripeInvalidate(block, 1);
     return sdCard_->writeBlock(block, dst);
   }
+  uint8_t writeBlocks(uint32_t block, const uint8_t* src, uint32_t count) {
+    stripeInvalidate(block, count);
+    return sdCard_->writeBlocks(block, src, count);
+  }
+};
+//------------------------------------------------------------------------------
+/**
+ * \class SdVolumeLock
+ * \brief Hold a volume exclusively while in scope if it allows concurrent
+ * readers, see SdVolume::concurrentEnable().  Holds nest on one thread.
+ */
+class SdVolumeLock {
+ public:
+  /** Hold \a vol, which may be zero for nothing to hold. */
+  explicit SdVolumeLock(SdVolume* vol)
+    : vol_(vol && vol->concurrentEnabled() ? vol : 0) {
+    if (!vol_) return;
+    if (vol_->lockOwned()) {
+      vol_->lockDepth_++;
+      return;
+    }
+    vol_->lock_.lock();
+    vol_->lockOwner_ = std::this_thread::get_id();
+    vol_->lockDepth_ = 1;
+  }
+  ~SdVolumeLock(void) {
+    if (!vol_ || --vol_->lockDepth_) return;
+    vol_->lockOwner_ = std::thread::id();
+    vol_->lock_.unlock();
+  }
+
+ private:
+  SdVolume* vol_;
+  SdVolumeLock(const SdVolumeLock&);
+  SdVolumeLock& operator=(const SdVolumeLock&);
 };
 
 #pragma pop_macro("O_WRONLY")
@@ -18,6 +18,9 @@
  * <http://www.gnu.org/licenses/>.
  */
 #include "SdFat.h"
+#include <string.h>
+#include <mutex>
+#include <shared_mutex>
 
 //------------------------------------------------------------------------------
 // callback function for date/time
@@ -28,10 +31,282 @@ void (*SdFile::dateTime_)(uint16_t* date, uint16_t* time) = NULL;
 void (*SdFile::oldDateTime_)(uint16_t& date, uint16_t& time) = NULL;  // NOLINT
 #endif  // ALLOW_DEPRECATED_FUNCTIONS
 //------------------------------------------------------------------------------
+// long file name helpers
+
+// byte offsets of the characters in a long name entry
+static const uint8_t lfnOffset[LDIR_NAME_CHARS] = {
+  1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30
+};
+static uint16_t lfnGetChar(const dir_t* p, uint8_t i) {
+  const uint8_t* b = reinterpret_cast<const uint8_t*>(p) + lfnOffset[i];
+  return b[0] | (b[1] << 8);
+}
+static void lfnPutChar(dir_t* p, uint8_t i, uint16_t c) {
+  uint8_t* b = reinterpret_cast<uint8_t*>(p) + lfnOffset[i];
+  b[0] = c;
+  b[1] = c >> 8;
+}
+// long names compare without regard to the case of ASCII letters
+static uint16_t lfnFold(uint16_t c) {
+  return c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c;
+}
+// checksum of a short name kept in its long name entries
+static uint8_t lfnChecksum(const uint8_t* name) {
+  uint8_t sum = 0;
+  for (uint8_t i = 0; i < 11; i++) {
+    sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+  }
+  return sum;
+}
+// compare the part of lname a long name entry holds
+static uint8_t lfnCompare(const dir_t* p, const uint16_t* lname,
+                          uint16_t length) {
+  uint16_t k = ((p->name[0] & 0X1F) - 1) * LDIR_NAME_CHARS;
+  for (uint8_t i = 0; i < LDIR_NAME_CHARS; i++, k++) {
+    uint16_t c = lfnGetChar(p, i);
+    // a short last part ends with a zero
+    if (k == length) return c == 0;
+    if (lfnFold(c) != lfnFold(lname[k])) return false;
+  }
+  return true;
+}
+// copy the part of a long name an entry holds, return the name's length
+// if this is the entry with the last part
+static uint16_t lfnCopy(const dir_t* p, uint16_t* lname) {
+  uint16_t k = ((p->name[0] & 0X1F) - 1) * LDIR_NAME_CHARS;
+  for (uint8_t i = 0; i < LDIR_NAME_CHARS; i++, k++) {
+    uint16_t c = lfnGetChar(p, i);
+    if (c == 0) return k;
+    lname[k] = c;
+  }
+  return k;
+}
+// fill a long name entry with part ord of lname
+static void lfnFill(dir_t* p, uint8_t ord, uint8_t last, uint8_t sum,
+                    const uint16_t* lname, uint16_t length) {
+  ldir_t* ld = reinterpret_cast<ldir_t*>(p);
+  memset(p, 0, sizeof(dir_t));
+  ld->ord = last ? ord | LDIR_ORD_LAST_LONG_ENTRY : ord;
+  ld->attributes = DIR_ATT_LONG_NAME;
+  ld->checksum = sum;
+  uint16_t k = (ord - 1) * LDIR_NAME_CHARS;
+  for (uint8_t i = 0; i < LDIR_NAME_CHARS; i++, k++) {
+    lfnPutChar(p, i, k < length ? lname[k] : k == length ? 0 : 0XFFFF);
+  }
+}
+// Convert a UTF-8 name to a long name.  Return its length, zero if it is
+// not a valid long name.
+static uint16_t lfnParse(const char* str, uint16_t* lname) {
+  const uint8_t* s = reinterpret_cast<const uint8_t*>(str);
+  uint16_t n = 0;
+  while (*s) {
+    uint16_t c;
+    if (s[0] < 0X80) {
+      c = *s++;
+    } else if ((s[0] & 0XE0) == 0XC0 && (s[1] & 0XC0) == 0X80) {
+      c = ((s[0] & 0X1F) << 6) | (s[1] & 0X3F);
+      s += 2;
+      if (c < 0X80) return 0;
+    } else if ((s[0] & 0XF0) == 0XE0 && (s[1] & 0XC0) == 0X80 &&
+      (s[2] & 0XC0) == 0X80) {
+      c = ((s[0] & 0X0F) << 12) | ((s[1] & 0X3F) << 6) | (s[2] & 0X3F);
+      s += 3;
+      if (c < 0X800 || (c >= 0XD800 && c <= 0XDFFF)) return 0;
+    } else {
+      // not UTF-8 or outside the range UCS-2 can hold
+      return 0;
+    }
+    if (c < 0X20 || (c < 0X80 && strchr("\"*/:<>?\\|", c))) return 0;
+    if (n == LDIR_NAME_MAX) return 0;
+    lname[n++] = c;
+  }
+  // trailing dots and spaces are dropped by other systems
+  if (n == 0 || lname[n - 1] == '.' || lname[n - 1] == ' ') return 0;
+  return n;
+}
+// Convert a long name to UTF-8, with ASCII letters in upper case if fold is
+// set.  Return the length, zero if it does not fit in size bytes with its
+// terminating zero.
+static uint16_t lfnToUtf8(const uint16_t* lname, uint16_t length, char* str,
+                          uint16_t size, uint8_t fold) {
+  uint16_t n = 0;
+  for (uint16_t i = 0; i < length; i++) {
+    uint16_t c = fold ? lfnFold(lname[i]) : lname[i];
+    if (c < 0X80) {
+      if (n + 1 >= size) return 0;
+      str[n++] = c;
+    } else if (c < 0X800) {
+      if (n + 2 >= size) return 0;
+      str[n++] = 0XC0 | (c >> 6);
+      str[n++] = 0X80 | (c & 0X3F);
+    } else {
+      if (n + 3 >= size) return 0;
+      str[n++] = 0XE0 | (c >> 12);
+      str[n++] = 0X80 | ((c >> 6) & 0X3F);
+      str[n++] = 0X80 | (c & 0X3F);
+    }
+  }
+  if (n >= size) return 0;
+  str[n] = 0;
+  return n;
+}
+// character of a short name for a long name character, zero to drop it
+static uint8_t lfnShortChar(uint16_t c) {
+  if (c == ' ' || c == '.') return 0;
+  if (c >= 'a' && c <= 'z') return c - ('a' - 'A');
+  if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+    (c < 0X80 && strchr("$%'-_@~`!(){}#&", c))) {
+    return c;
+  }
+  return '_';
+}
+// Short name basis for a long name: up to eight characters of the name
+// before its last dot and three after it, in upper case, with characters
+// 8.3 names cannot hold replaced by '_'.  Return the base length.
+static uint8_t lfnBasis(const uint16_t* lname, uint16_t length,
+                        uint8_t* name) {
+  memset(name, ' ', 11);
+  uint16_t dot = 0;
+  for (uint16_t i = length; i-- > 1;) {
+    if (lname[i] == '.') {
+      dot = i;
+      break;
+    }
+  }
+  uint16_t end = dot ? dot : length;
+  uint8_t n = 0;
+  for (uint16_t i = 0; i < end && n < 8; i++) {
+    uint8_t c = lfnShortChar(lname[i]);
+    if (c) name[n++] = c;
+  }
+  if (dot) {
+    uint8_t m = 8;
+    for (uint16_t i = dot + 1; i < length && m < 11; i++) {
+      uint8_t c = lfnShortChar(lname[i]);
+      if (c) name[m++] = c;
+    }
+  }
+  if (n == 0) name[n++] = '_';
+  return n;
+}
+// number of characters of the basis kept in front of a tail of nd digits
+static uint8_t lfnKeep(uint8_t baseLength, uint8_t nd) {
+  return baseLength < 7 - nd ? baseLength : 7 - nd;
+}
+// the basis with the numeric tail ~tail, tail at most 999
+static void lfnMakeShort(const uint8_t* basis, uint8_t baseLength,
+                         uint16_t tail, uint8_t* name) {
+  uint8_t nd = tail < 10 ? 1 : tail < 100 ? 2 : 3;
+  uint8_t keep = lfnKeep(baseLength, nd);
+  memcpy(name, basis, 11);
+  name[keep] = '~';
+  for (uint8_t i = nd; i > 0; i--) {
+    name[keep + i] = '0' + tail % 10;
+    tail /= 10;
+  }
+  for (uint8_t i = keep + nd + 1; i < 8; i++) name[i] = ' ';
+}
+// if name is the basis with a numeric tail set the tail's bit in tails
+static void lfnTailUsed(const uint8_t* name, const uint8_t* basis,
+                        uint8_t baseLength, uint32_t* tails) {
+  if (memcmp(name + 8, basis + 8, 3)) return;
+  for (uint8_t nd = 1; nd <= 3; nd++) {
+    uint8_t keep = lfnKeep(baseLength, nd);
+    if (name[keep] != '~' || memcmp(name, basis, keep)) continue;
+    uint16_t tail = 0;
+    uint8_t i = keep + 1;
+    while (i <= keep + nd && name[i] >= '0' && name[i] <= '9') {
+      tail = 10 * tail + name[i++] - '0';
+    }
+    if (i <= keep + nd) continue;
+    while (i < 8 && name[i] == ' ') i++;
+    if (i == 8) tails[tail >> 5] |= 1UL << (tail & 31);
+  }
+}
+//------------------------------------------------------------------------------
+// exFAT entry set helpers
+
+// checksum of an entry set, leaving out the checksum field
+static uint16_t exSetChecksum(const dir_t* set, uint8_t count) {
+  const uint8_t* b = reinterpret_cast<const uint8_t*>(set);
+  uint16_t sum = 0;
+  for (uint16_t i = 0; i < 32U * count; i++) {
+    if (i == 2 || i == 3) continue;
+    sum = ((sum & 1) ? 0X8000 : 0) + (sum >> 1) + b[i];
+  }
+  return sum;
+}
+// hash of an up-cased name, kept in the stream entry so most names that
+// differ are passed over without comparing them
+static uint16_t exNameHash(const uint16_t* uname, uint16_t length) {
+  uint16_t hash = 0;
+  for (uint16_t i = 0; i < length; i++) {
+    hash = ((hash & 1) ? 0X8000 : 0) + (hash >> 1) + (uname[i] & 0XFF);
+    hash = ((hash & 1) ? 0X8000 : 0) + (hash >> 1) + (uname[i] >> 8);
+  }
+  return hash;
+}
+// copy the name of an entry set, return its length
+static uint16_t exNameCopy(const dir_t* set, uint16_t* lname) {
+  const exdir_stream_t* s = reinterpret_cast<const exdir_stream_t*>(set + 1);
+  for (uint16_t k = 0; k < s->nameLength; k++) {
+    const exdir_name_t* n =
+      reinterpret_cast<const exdir_name_t*>(set + 2 + k / EXFAT_NAME_CHARS);
+    lname[k] = n->name[k % EXFAT_NAME_CHARS];
+  }
+  return s->nameLength;
+}
+// The FAT entry readDir() and dirEntry() return for an entry set.  Its 8.3
+// name is the basis of the long name, without a numeric tail.
+static void exDirEntry(const dir_t* set, dir_t* dir) {
+  const exdir_file_t* f = reinterpret_cast<const exdir_file_t*>(set);
+  const exdir_stream_t* s = reinterpret_cast<const exdir_stream_t*>(set + 1);
+  uint16_t lname[LDIR_NAME_MAX];
+  uint16_t length = exNameCopy(set, lname);
+  memset(dir, 0, sizeof(dir_t));
+  lfnBasis(lname, length, dir->name);
+  dir->attributes = f->attributes & (DIR_ATT_READ_ONLY | DIR_ATT_HIDDEN |
+    DIR_ATT_SYSTEM | DIR_ATT_DIRECTORY | DIR_ATT_ARCHIVE);
+  dir->creationTimeTenths = f->create10ms;
+  dir->creationDate = f->createTimestamp >> 16;
+  dir->creationTime = f->createTimestamp & 0XFFFF;
+  dir->lastAccessDate = f->accessTimestamp >> 16;
+  dir->lastWriteDate = f->modifyTimestamp >> 16;
+  dir->lastWriteTime = f->modifyTimestamp & 0XFFFF;
+  dir->firstClusterLow = s->firstCluster & 0XFFFF;
+  dir->firstClusterHigh = s->firstCluster >> 16;
+  dir->fileSize = s->dataLength > 0XFFFFFFFF ? 0XFFFFFFFF : s->dataLength;
+}
+//------------------------------------------------------------------------------
 // add a cluster to a file
 uint8_t SdFile::addCluster() {
+  if (flags_ & F_NO_FAT_CHAIN) {
+    if (firstCluster_ == 0) {
+      curCluster_ = 0;
+      if (!vol_->allocUnchained(1, &curCluster_)) return false;
+      firstCluster_ = curCluster_;
+      mapContiguous(1);
+      flags_ |= F_FILE_DIR_DIRTY;
+      return true;
+    }
+    // stay contiguous while the cluster after the last one is free
+    uint8_t isFree;
+    if (!vol_->clusterFree(curCluster_ + 1, &isFree)) return false;
+    if (isFree) {
+      if (!vol_->allocUnchained(1, &curCluster_)) return false;
+      extents_[0].count++;
+      return true;
+    }
+    // chain the clusters so far in the FAT and carry on as a chained file
+    if (!vol_->fatPutRun(firstCluster_, extents_[0].count)) return false;
+    flags_ &= ~F_NO_FAT_CHAIN;
+    flags_ |= F_FILE_DIR_DIRTY;
+  }
   if (!vol_->allocContiguous(1, &curCluster_)) return false;
 
+  // the chain is longer than extents_ knows
+  extentsEnd_ = false;
+
   // if first cluster of file link to directory entry
   if (firstCluster_ == 0) {
     firstCluster_ = curCluster_;
@@ -40,6 +315,38 @@ uint8_t SdFile::addCluster() {
   return true;
 }
 //------------------------------------------------------------------------------
+// Count the blocks, at most max, that follow the block at curPosition_
+// without a gap on the card and move curCluster_ to the cluster holding the
+// last of them.  With allocate set, a free cluster directly after the end of
+// the chain is added to the file when more blocks are wanted.
+uint8_t SdFile::contiguousBlocks(uint32_t max, uint8_t allocate,
+                                 uint32_t* count) {
+  if (type_ == FAT_FILE_TYPE_ROOT16) {
+    *count = max;
+    return true;
+  }
+  uint32_t n = vol_->blocksPerCluster() - vol_->blockOfCluster(curPosition_);
+  while (n < max) {
+    uint32_t next;
+    if (!nextCluster(&next)) return false;
+    if (vol_->isEOC(next)) {
+      if (!allocate || curCluster_ > vol_->clusterCount()) break;
+      uint8_t isFree;
+      if (!vol_->clusterFree(curCluster_ + 1, &isFree)) return false;
+      if (!isFree) break;
+      // allocContiguous() starts its search right after curCluster_
+      if (!addCluster()) return false;
+    } else if (next == curCluster_ + 1) {
+      curCluster_ = next;
+    } else {
+      break;
+    }
+    n += vol_->blocksPerCluster();
+  }
+  *count = n < max ? n : max;
+  return true;
+}
+//------------------------------------------------------------------------------
 // Add a cluster to a directory file and zero the cluster.
 // return with first block of cluster in the cache
 uint8_t SdFile::addDirCluster(void) {
@@ -47,8 +354,8 @@ uint8_t SdFile::addDirCluster(void) {
 
   // zero data in cluster insure first cluster is in cache
   uint32_t block = vol_->clusterStartBlock(curCluster_);
-  for (uint8_t i = vol_->blocksPerCluster_; i != 0; i--) {
-    if (!SdVolume::cacheZeroBlock(block + i - 1)) return false;
+  for (uint32_t i = vol_->blocksPerCluster_; i != 0; i--) {
+    if (!vol_->cacheZeroBlock(block + i - 1)) return false;
   }
   // Increase directory file size by cluster size
   fileSize_ += 512UL << vol_->clusterSizeShift_;
@@ -58,8 +365,8 @@ uint8_t SdFile::addDirCluster(void) {
 // cache a file's directory entry
 // return pointer to cached entry or null for failure
 dir_t* SdFile::cacheDirEntry(uint8_t action) {
-  if (!SdVolume::cacheRawBlock(dirBlock_, action)) return NULL;
-  return SdVolume::cacheBuffer_.dir + dirIndex_;
+  if (!vol_->cacheRawBlock(dirBlock_, action)) return NULL;
+  return vol_->cacheBuffer()->dir + dirIndex_;
 }
 //------------------------------------------------------------------------------
 /**
@@ -71,11 +378,180 @@ dir_t* SdFile::cacheDirEntry(uint8_t action) {
  * Reasons for failure include no file is open or an I/O error.
  */
 uint8_t SdFile::close(void) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
+  if (streamEnd_ && !rawStreamStop()) return false;
   if (!sync())return false;
   type_ = FAT_FILE_TYPE_CLOSED;
   return true;
 }
 //------------------------------------------------------------------------------
+// size in bytes of the file's cluster chain, mapping it into extents_
+uint8_t SdFile::chainSize(uint32_t* size) {
+  uint32_t c;
+  if (!extentsEnd_) clusterAt(0XFFFFFFFF, &c);
+  if (!extentsEnd_) {
+    // more runs than extents_ holds or an I/O error
+    return vol_->chainSize(firstCluster_, size);
+  }
+  extent_t* last = &extents_[extentCount_ - 1];
+  *size = (last->index + last->count) << (vol_->clusterSizeShift_ + 9);
+  return true;
+}
+//------------------------------------------------------------------------------
+// Find the cluster at position index in the file's chain.  extents_ holds
+// the start of the chain as runs of adjacent clusters so earlier positions
+// are a binary search away; the table grows as later positions are looked
+// up and once it is full the rest of the chain is followed in the FAT,
+// through the readers' cache if shared.
+uint8_t SdFile::clusterAt(uint32_t index, uint32_t* cluster, uint8_t shared) {
+  if (firstCluster_ == 0) return false;
+  if (extentCount_ == 0) {
+    extents_[0].index = 0;
+    extents_[0].cluster = firstCluster_;
+    extents_[0].count = 1;
+    extentCount_ = 1;
+  }
+  // last run that starts at or before index
+  uint8_t lo = 0;
+  uint8_t hi = extentCount_;
+  while (hi - lo > 1) {
+    uint8_t mid = (lo + hi) / 2;
+    if (extents_[mid].index <= index) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  extent_t* e = &extents_[lo];
+  if (index - e->index < e->count) {
+    *cluster = e->cluster + (index - e->index);
+    return true;
+  }
+  // index is past the last run
+  if (extentsEnd_) return false;
+  uint32_t n = e->index + e->count - 1;
+  uint32_t c = e->cluster + e->count - 1;
+  if (extentCount_ == SD_FILE_EXTENTS && curPosition_ != 0) {
+    // start from the current position if it is further along
+    uint32_t nCur = (curPosition_ - 1) >> (vol_->clusterSizeShift_ + 9);
+    if (nCur > n && nCur <= index) {
+      n = nCur;
+      c = curCluster_;
+      e = 0;
+    }
+  }
+  while (n < index) {
+    uint32_t next;
+    if (shared ? !vol_->sharedFatGet(c, &next) : !vol_->fatGet(c, &next)) {
+      return false;
+    }
+    if (vol_->isEOC(next)) {
+      // end of chain is only known if every run was recorded
+      if (e) extentsEnd_ = true;
+      return false;
+    }
+    n++;
+    if (!e) {
+      // table full
+    } else if (next == c + 1) {
+      e->count++;
+    } else if (extentCount_ < SD_FILE_EXTENTS) {
+      e = &extents_[extentCount_++];
+      e->index = n;
+      e->cluster = next;
+      e->count = 1;
+    } else {
+      e = 0;
+    }
+    c = next;
+  }
+  *cluster = c;
+  return true;
+}
+//------------------------------------------------------------------------------
+// add the names in this directory to index and find its first empty slot
+uint8_t SdFile::indexDir(SdDirIndex* index) {
+  uint16_t lname[LDIR_MAX_ENTRIES * LDIR_NAME_CHARS];
+  char key[3 * LDIR_MAX_ENTRIES * LDIR_NAME_CHARS + 1];
+  uint16_t lnameLength = 0;
+  uint8_t lfnOrd = 0;
+  uint8_t lfnSum = 0;
+  uint8_t emptyFound = false;
+  rewind();
+  while (curPosition_ < fileSize_) {
+    uint16_t entry = curPosition_ >> 5;
+    dir_t* p = readDirCache();
+    if (p == NULL) return false;
+
+    if (p->name[0] == DIR_NAME_FREE || p->name[0] == DIR_NAME_DELETED) {
+      lfnOrd = 0;
+      if (!emptyFound) {
+        emptyFound = true;
+        index->freeHint_ = entry;
+      }
+      // done if no entries follow
+      if (p->name[0] == DIR_NAME_FREE) break;
+    } else if (DIR_IS_LONG_NAME(p)) {
+      // collect the long name for the short name entry that follows
+      const ldir_t* ld = reinterpret_cast<const ldir_t*>(p);
+      uint8_t ord = ld->ord & 0X1F;
+      if (ld->ord & LDIR_ORD_LAST_LONG_ENTRY) {
+        lfnOrd = ord && ord <= LDIR_MAX_ENTRIES ? ord : 0;
+        lfnSum = ld->checksum;
+        if (lfnOrd) lnameLength = lfnCopy(p, lname);
+      } else if (lfnOrd && ord == lfnOrd - 1 && ld->checksum == lfnSum) {
+        lfnOrd = ord;
+        lfnCopy(p, lname);
+      } else {
+        lfnOrd = 0;
+      }
+    } else {
+      uint16_t keyLength = 0;
+      if (lfnOrd == 1 && lfnSum == lfnChecksum(p->name)) {
+        keyLength = lfnToUtf8(lname, lnameLength, key, sizeof(key), true);
+      }
+      lfnOrd = 0;
+      if (!index->insert(p->name, keyLength ? key : 0, keyLength,
+                         vol_->cacheBlockNumber(), entry)) {
+        return false;
+      }
+    }
+  }
+  if (!emptyFound) index->freeHint_ = fileSize_ >> 5;
+  index->valid_ = true;
+  return true;
+}
+//------------------------------------------------------------------------------
+// Number of long name entries, making up a whole name with the right
+// checksum, just before the entry at index in dirFile.
+uint8_t SdFile::lfnCountAt(SdFile* dirFile, uint16_t index) {
+  if (!dirFile->seekSet(32UL * index)) return 0;
+  dir_t* p = dirFile->readDirCache();
+  if (p == NULL) return 0;
+  uint8_t sum = lfnChecksum(p->name);
+  for (uint8_t n = 1; n <= LDIR_MAX_ENTRIES && n <= index; n++) {
+    if (!dirFile->seekSet(32UL * (index - n))) return 0;
+    p = dirFile->readDirCache();
+    if (p == NULL || !DIR_IS_LONG_NAME(p)) return 0;
+    const ldir_t* ld = reinterpret_cast<const ldir_t*>(p);
+    if ((ld->ord & 0X1F) != n || ld->checksum != sum) return 0;
+    if (ld->ord & LDIR_ORD_LAST_LONG_ENTRY) return n;
+  }
+  return 0;
+}
+//------------------------------------------------------------------------------
+// the cluster after curCluster_, an end of chain value past the last one;
+// shared for a reader holding the volume shared, see readShared()
+uint8_t SdFile::nextCluster(uint32_t* next, uint8_t shared) {
+  if (flags_ & F_NO_FAT_CHAIN) {
+    uint32_t last = firstCluster_ + extents_[0].count - 1;
+    *next = curCluster_ < last ? curCluster_ + 1 : FAT32EOC;
+    return true;
+  }
+  if (shared) return vol_->sharedFatGet(curCluster_, next);
+  return vol_->fatGet(curCluster_, next);
+}
+//------------------------------------------------------------------------------
 /**
  * Check for contiguous file and return its raw block range.
  *
@@ -88,9 +564,16 @@ uint8_t SdFile::close(void) {
  * or an I/O error occurred.
  */
 uint8_t SdFile::contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
   // error if no blocks
   if (firstCluster_ == 0) return false;
 
+  if (flags_ & F_NO_FAT_CHAIN) {
+    *bgnBlock = vol_->clusterStartBlock(firstCluster_);
+    *endBlock = vol_->clusterStartBlock(firstCluster_ + extents_[0].count - 1)
+                + vol_->blocksPerCluster_ - 1;
+    return true;
+  }
   for (uint32_t c = firstCluster_; ; c++) {
     uint32_t next;
     if (!vol_->fatGet(c, &next)) return false;
@@ -127,6 +610,7 @@ uint8_t SdFile::contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock) {
  */
 uint8_t SdFile::createContiguous(SdFile* dirFile,
         const char* fileName, uint32_t size) {
+  SdVolumeLock hold(dirFile->isOpen() ? dirFile->vol_ : 0);
   // don't allow zero length file
   if (size == 0) return false;
   if (!open(dirFile, fileName, O_CREAT | O_EXCL | O_RDWR)) return false;
@@ -134,8 +618,14 @@ uint8_t SdFile::createContiguous(SdFile* dirFile,
   // calculate number of clusters needed
   uint32_t count = ((size - 1) >> (vol_->clusterSizeShift_ + 9)) + 1;
 
-  // allocate clusters
-  if (!vol_->allocContiguous(count, &firstCluster_)) {
+  // allocate clusters, on exFAT without a FAT chain
+  if (flags_ & F_NO_FAT_CHAIN) {
+    if (!vol_->allocUnchained(count, &firstCluster_)) {
+      remove();
+      return false;
+    }
+    mapContiguous(count);
+  } else if (!vol_->allocContiguous(count, &firstCluster_)) {
     remove();
     return false;
   }
@@ -155,9 +645,18 @@ uint8_t SdFile::createContiguous(SdFile* dirFile,
  * the value zero, false, is returned for failure.
  */
 uint8_t SdFile::dirEntry(dir_t* dir) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
   // make sure fields on SD are correct
   if (!sync()) return false;
 
+  if (vol_->fatType() == 64) {
+    // an exFAT entry set converted to a FAT entry
+    dir_t set[EXFAT_MAX_SET];
+    SdFile parent;
+    if (!exReadEntrySet(&parent, set)) return false;
+    exDirEntry(set, dir);
+    return true;
+  }
   // read entry
   dir_t* p = cacheDirEntry(SdVolume::CACHE_FOR_READ);
   if (!p) return false;
@@ -184,6 +683,407 @@ void SdFile::dirName(const dir_t& dir, char* name) {
   name[j] = 0;
 }
 //------------------------------------------------------------------------------
+// true if p is the entry of a file or subdirectory, on exFAT the first
+// entry of its set
+uint8_t SdFile::entryIsFileOrSubDir(const dir_t* p) const {
+  if (vol_->fatType() == 64) return p->name[0] == EXFAT_TYPE_FILE;
+  return DIR_IS_FILE_OR_SUBDIR(p);
+}
+//------------------------------------------------------------------------------
+// open() for exFAT, where every name is a long name matched through the
+// volume's up-case table and a new file is an entry set of a file entry, a
+// stream entry and the name entries
+uint8_t SdFile::exOpen(SdFile* dirFile, const char* fileName, uint8_t oflag) {
+  uint16_t lname[LDIR_NAME_MAX];
+  uint16_t uname[LDIR_NAME_MAX];
+  uint16_t sname[LDIR_NAME_MAX];
+  dir_t set[EXFAT_MAX_SET];
+
+  uint16_t length = lfnParse(fileName, lname);
+  if (!length || !dirFile->isDir()) return false;
+  vol_ = dirFile->vol_;
+  for (uint16_t i = 0; i < length; i++) uname[i] = vol_->upcase(lname[i]);
+  uint16_t hash = exNameHash(uname, length);
+  uint8_t needed = 2 + (length + EXFAT_NAME_CHARS - 1) / EXFAT_NAME_CHARS;
+
+  // first run of needed empty entries
+  uint16_t newEntry = 0;
+  uint8_t freeRun = 0;
+
+  dirFile->rewind();
+  while (dirFile->curPosition_ < dirFile->fileSize_) {
+    uint16_t entry = dirFile->curPosition_ >> 5;
+    dir_t* p = dirFile->readDirCache();
+    if (p == NULL) return false;
+    uint8_t type = p->name[0];
+
+    if (!(type & EXFAT_TYPE_IN_USE)) {
+      if (freeRun < needed && freeRun++ == 0) newEntry = entry;
+      // done if no entries follow
+      if (type == EXFAT_TYPE_END) break;
+      continue;
+    }
+    if (freeRun < needed) freeRun = 0;
+    if (type != EXFAT_TYPE_FILE) continue;
+
+    // the stream entry has the length and hash of the name
+    p = dirFile->readDirCache();
+    if (p == NULL) return false;
+    const exdir_stream_t* s = reinterpret_cast<const exdir_stream_t*>(p);
+    if (s->type != EXFAT_TYPE_STREAM) {
+      // look at it again as an entry of its own
+      if (!dirFile->seekSet(32UL * (entry + 1))) return false;
+      continue;
+    }
+    if (s->nameLength != length || s->nameHash != hash) continue;
+    if (!exReadSet(dirFile, entry, set)) {
+      if (!dirFile->seekSet(32UL * (entry + 2))) return false;
+      continue;
+    }
+    exNameCopy(set, sname);
+    uint16_t i = 0;
+    while (i < length && vol_->upcase(sname[i]) == uname[i]) i++;
+    if (i < length) continue;
+
+    // don't open existing file if O_CREAT and O_EXCL
+    if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) return false;
+    return exOpenIndex(dirFile, entry, oflag);
+  }
+  // only create file if O_CREAT and O_WRITE
+  if ((oflag & (O_CREAT | O_WRITE)) != (O_CREAT | O_WRITE)) return false;
+
+  // use the run of empty entries, which may continue past the end of the
+  // directory, or add entries at the end
+  if (!freeRun) newEntry = dirFile->fileSize_ >> 5;
+  if (32UL * (newEntry + needed) > dirFile->fileSize_) {
+    // new clusters are added after curCluster_
+    if (!dirFile->seekSet(dirFile->fileSize_)) return false;
+    while (32UL * (newEntry + needed) > dirFile->fileSize_) {
+      if (!dirFile->addDirCluster()) return false;
+    }
+    // a subdirectory's size is in its stream entry
+    if (dirFile->isSubDir()) {
+      dirFile->flags_ |= F_FILE_DIR_DIRTY;
+      if (!dirFile->sync()) return false;
+    }
+    // curCluster_ no longer goes with curPosition_
+    dirFile->rewind();
+  }
+  // initialize as empty file
+  memset(set, 0, needed * sizeof(dir_t));
+  exdir_file_t* f = reinterpret_cast<exdir_file_t*>(set);
+  exdir_stream_t* s = reinterpret_cast<exdir_stream_t*>(set + 1);
+  f->type = EXFAT_TYPE_FILE;
+  f->setCount = needed - 1;
+  f->attributes = DIR_ATT_ARCHIVE;
+
+  // set timestamps
+  uint16_t date;
+  uint16_t time;
+  if (dateTime_) {
+    // call user function
+    dateTime_(&date, &time);
+  } else {
+    // use default date/time
+    date = FAT_DEFAULT_DATE;
+    time = FAT_DEFAULT_TIME;
+  }
+  f->createTimestamp = (uint32_t)date << 16 | time;
+  f->modifyTimestamp = f->createTimestamp;
+  f->accessTimestamp = f->createTimestamp;
+
+  s->type = EXFAT_TYPE_STREAM;
+  s->flags = EXFAT_FLAG_ALLOCATION_POSSIBLE;
+  s->nameLength = length;
+  s->nameHash = hash;
+  for (uint16_t k = 0; k < length; k++) {
+    exdir_name_t* n =
+      reinterpret_cast<exdir_name_t*>(set + 2 + k / EXFAT_NAME_CHARS);
+    n->type = EXFAT_TYPE_NAME;
+    n->name[k % EXFAT_NAME_CHARS] = lname[k];
+  }
+  // force write of entries to SD
+  if (!exWriteSet(dirFile, newEntry, set)) return false;
+  return exOpenIndex(dirFile, newEntry, oflag);
+}
+//------------------------------------------------------------------------------
+// open(dirFile, index, oflag) for exFAT, index is that of the file entry
+uint8_t SdFile::exOpenIndex(SdFile* dirFile, uint16_t index, uint8_t oflag) {
+  dir_t set[EXFAT_MAX_SET];
+  if (!exReadSet(dirFile, index, set)) return false;
+  const exdir_file_t* f = reinterpret_cast<const exdir_file_t*>(set);
+  const exdir_stream_t* s = reinterpret_cast<const exdir_stream_t*>(set + 1);
+
+  // write or truncate is an error for a directory or read-only file
+  if (f->attributes & (DIR_ATT_READ_ONLY | DIR_ATT_DIRECTORY)) {
+    if (oflag & (O_WRITE | O_TRUNC)) return false;
+  }
+  // fileSize_ holds sizes up to 4 GiB - 1
+  if (s->dataLength > 0XFFFFFFFF) return false;
+  vol_ = dirFile->vol_;
+  uint32_t dataLength = s->dataLength;
+  firstCluster_ = dataLength ? s->firstCluster : 0;
+
+  // save open flags for read/write
+  flags_ = oflag & (O_ACCMODE | O_SYNC | O_APPEND);
+
+  // clusters past ValidDataLength are reserved, see preallocate()
+  fileSize_ = dataLength;
+  if (s->validDataLength < dataLength && !(f->attributes & DIR_ATT_DIRECTORY)) {
+    fileSize_ = s->validDataLength;
+    flags_ |= F_RESERVED;
+  }
+  if (firstCluster_ == 0) {
+    // data is empty; clusters it gets need not be chained
+    if (dataLength) return false;
+    flags_ |= F_NO_FAT_CHAIN;
+    resetExtents();
+  } else if (s->flags & EXFAT_FLAG_NO_FAT_CHAIN) {
+    // the clusters are in a row and the FAT does not hold them
+    uint32_t count = ((dataLength - 1) >> (vol_->clusterSizeShift_ + 9)) + 1;
+    if (firstCluster_ < 2 ||
+      count > vol_->clusterCount_ + 2 - firstCluster_) {
+      return false;
+    }
+    flags_ |= F_NO_FAT_CHAIN;
+    mapContiguous(count);
+  } else {
+    resetExtents();
+  }
+  type_ = f->attributes & DIR_ATT_DIRECTORY ? FAT_FILE_TYPE_SUBDIR
+                                            : FAT_FILE_TYPE_NORMAL;
+
+  // remember location of the entry set
+  dirBlock_ = 0;
+  dirIndex_ = 0;
+  dirCluster_ = dirFile->firstCluster_;
+  dirClusters_ = dirFile->flags_ & F_NO_FAT_CHAIN ?
+                 dirFile->extents_[0].count : 0;
+  dirEntry_ = index;
+  lfnCount_ = f->setCount;
+
+  // set to start of file
+  curCluster_ = 0;
+  curPosition_ = 0;
+  readEnd_ = 0XFFFFFFFF;
+
+  // truncate file to zero length if requested
+  if (oflag & O_TRUNC) return truncate(0);
+  return true;
+}
+//------------------------------------------------------------------------------
+// readDir() for exFAT, leaves the directory just past the file entry
+int8_t SdFile::exReadDir(dir_t* dir) {
+  dir_t set[EXFAT_MAX_SET];
+  while (curPosition_ < fileSize_) {
+    uint16_t index = curPosition_ >> 5;
+    dir_t* p = readDirCache();
+    if (p == NULL) return -1;
+
+    // last entry if EXFAT_TYPE_END
+    if (p->name[0] == EXFAT_TYPE_END) break;
+    if (p->name[0] != EXFAT_TYPE_FILE) continue;
+
+    // a damaged set is passed over
+    uint8_t ok = exReadSet(this, index, set);
+    if (!seekSet(32UL * (index + 1))) return -1;
+    if (!ok) continue;
+    exDirEntry(set, dir);
+    return sizeof(dir_t);
+  }
+  return 0;
+}
+//------------------------------------------------------------------------------
+// read the entry set of this file through its directory, opened in parent
+uint8_t SdFile::exReadEntrySet(SdFile* parent, dir_t* set) {
+  if (isRoot() || !openParent(parent)) return false;
+  return exReadSet(parent, dirEntry_, set);
+}
+//------------------------------------------------------------------------------
+// Read the entry set whose file entry is at index in dirFile and check its
+// entries and checksum.
+uint8_t SdFile::exReadSet(SdFile* dirFile, uint16_t index, dir_t* set) {
+  if (!dirFile->seekSet(32UL * index)) return false;
+  dir_t* p = dirFile->readDirCache();
+  if (p == NULL || p->name[0] != EXFAT_TYPE_FILE) return false;
+  uint8_t count = p->name[1] + 1;
+  if (count < 3 || count > EXFAT_MAX_SET) return false;
+  memcpy(set, p, sizeof(dir_t));
+  for (uint8_t i = 1; i < count; i++) {
+    p = dirFile->readDirCache();
+    if (p == NULL) return false;
+    memcpy(set + i, p, sizeof(dir_t));
+  }
+  const exdir_file_t* f = reinterpret_cast<const exdir_file_t*>(set);
+  const exdir_stream_t* s = reinterpret_cast<const exdir_stream_t*>(set + 1);
+  if (s->type != EXFAT_TYPE_STREAM || s->nameLength == 0 ||
+    s->nameLength > (count - 2) * EXFAT_NAME_CHARS) {
+    return false;
+  }
+  uint8_t names = (s->nameLength + EXFAT_NAME_CHARS - 1) / EXFAT_NAME_CHARS;
+  for (uint8_t i = 2; i < 2 + names; i++) {
+    if (set[i].name[0] != EXFAT_TYPE_NAME) return false;
+  }
+  return f->setChecksum == exSetChecksum(set, count);
+}
+//------------------------------------------------------------------------------
+// mark the entries of this file's set deleted
+uint8_t SdFile::exRemove(void) {
+  SdFile dir;
+  if (!openParent(&dir)) return false;
+  if (!dir.seekSet(32UL * dirEntry_)) return false;
+  for (uint8_t i = 0; i <= lfnCount_; i++) {
+    dir_t* p = dir.readDirCache();
+    if (p == NULL) return false;
+    p->name[0] &= ~EXFAT_TYPE_IN_USE;
+    vol_->cacheSetDirty();
+  }
+  return vol_->cacheFlush();
+}
+//------------------------------------------------------------------------------
+// sync() for exFAT, the size and clusters are in the stream entry
+uint8_t SdFile::exSyncEntry(void) {
+  dir_t set[EXFAT_MAX_SET];
+  SdFile dir;
+  if (!exReadEntrySet(&dir, set)) return false;
+  exdir_file_t* f = reinterpret_cast<exdir_file_t*>(set);
+  exdir_stream_t* s = reinterpret_cast<exdir_stream_t*>(set + 1);
+
+  // makeDir() converts a new file to a directory
+  if (isDir()) f->attributes |= DIR_ATT_DIRECTORY;
+
+  // data past ValidDataLength reads as zero so it is kept at the size,
+  // except to record clusters reserved past the end of the data
+  s->dataLength = fileSize_;
+  s->validDataLength = fileSize_;
+  if ((flags_ & F_RESERVED) && firstCluster_) {
+    uint8_t shift = vol_->clusterSizeShift_ + 9;
+    uint32_t size;
+    if (flags_ & F_NO_FAT_CHAIN) {
+      size = extents_[0].count << shift;
+    } else if (!chainSize(&size)) {
+      return false;
+    }
+    uint32_t used = fileSize_ ? ((fileSize_ - 1) >> shift) + 1 : 0;
+    if ((size >> shift) > used) s->dataLength = size;
+  }
+  s->firstCluster = firstCluster_;
+  s->flags |= EXFAT_FLAG_ALLOCATION_POSSIBLE;
+  if (firstCluster_ && (flags_ & F_NO_FAT_CHAIN)) {
+    s->flags |= EXFAT_FLAG_NO_FAT_CHAIN;
+  } else {
+    s->flags &= ~EXFAT_FLAG_NO_FAT_CHAIN;
+  }
+  // set modify time if user supplied a callback date/time function
+  if (dateTime_) {
+    uint16_t date;
+    uint16_t time;
+    dateTime_(&date, &time);
+    f->modifyTimestamp = (uint32_t)date << 16 | time;
+    f->modify10ms = 0;
+    f->accessTimestamp = f->modifyTimestamp;
+  }
+  return exWriteSet(&dir, dirEntry_, set);
+}
+//------------------------------------------------------------------------------
+// timestamp() for exFAT
+uint8_t SdFile::exTimestamp(uint8_t flags, uint16_t dirDate, uint16_t dirTime,
+                            uint8_t tenths) {
+  dir_t set[EXFAT_MAX_SET];
+  SdFile dir;
+  if (!exReadEntrySet(&dir, set)) return false;
+  exdir_file_t* f = reinterpret_cast<exdir_file_t*>(set);
+  uint32_t stamp = (uint32_t)dirDate << 16 | dirTime;
+  if (flags & T_ACCESS) {
+    f->accessTimestamp = stamp;
+  }
+  if (flags & T_CREATE) {
+    f->createTimestamp = stamp;
+    f->create10ms = tenths;
+  }
+  if (flags & T_WRITE) {
+    f->modifyTimestamp = stamp;
+    f->modify10ms = 0;
+  }
+  if (!exWriteSet(&dir, dirEntry_, set)) return false;
+  return sync();
+}
+//------------------------------------------------------------------------------
+// write an entry set at index in dirFile with a new checksum
+uint8_t SdFile::exWriteSet(SdFile* dirFile, uint16_t index, dir_t* set) {
+  exdir_file_t* f = reinterpret_cast<exdir_file_t*>(set);
+  uint8_t count = f->setCount + 1;
+  f->setChecksum = exSetChecksum(set, count);
+  if (!dirFile->seekSet(32UL * index)) return false;
+  for (uint8_t i = 0; i < count; i++) {
+    dir_t* p = dirFile->readDirCache();
+    if (p == NULL) return false;
+    memcpy(p, set + i, sizeof(dir_t));
+    dirFile->vol_->cacheSetDirty();
+  }
+  return dirFile->vol_->cacheFlush();
+}
+//------------------------------------------------------------------------------
+/**
+ * Get a file's name: its long name if it has one, else its 8.3 name.
+ *
+ * \param[out] name An array of \a size bytes for the name as a zero
+ * terminated UTF-8 string.
+ * \param[in] size The size of \a name.  An 8.3 name needs 13 bytes, a long
+ * name up to 766.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure include no file is open, the name does not fit
+ * or an I/O error occurred.
+ */
+uint8_t SdFile::getName(char* name, uint16_t size) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
+  if (!isOpen()) return false;
+  if (isRoot()) {
+    if (size < 2) return false;
+    name[0] = '/';
+    name[1] = 0;
+    return true;
+  }
+  if (vol_->fatType() == 64) {
+    // exFAT only has long names
+    dir_t set[EXFAT_MAX_SET];
+    uint16_t lname[LDIR_NAME_MAX];
+    SdFile parent;
+    if (!exReadEntrySet(&parent, set)) return false;
+    uint16_t length = exNameCopy(set, lname);
+    return lfnToUtf8(lname, length, name, size, false) != 0;
+  }
+  if (lfnCount_) {
+    // assemble the long name from the entries before the short name entry
+    uint16_t lname[LDIR_MAX_ENTRIES * LDIR_NAME_CHARS];
+    uint16_t length = 0;
+    SdFile dir;
+    if (!openParent(&dir)) return false;
+    for (uint8_t i = 1; i <= lfnCount_; i++) {
+      if (!dir.seekSet(32UL * (dirEntry_ - i))) return false;
+      dir_t* p = dir.readDirCache();
+      if (p == NULL) return false;
+      length = lfnCopy(p, lname);
+    }
+    return lfnToUtf8(lname, length, name, size, false) != 0;
+  }
+  if (size < 13) return false;
+  dir_t* p = cacheDirEntry(SdVolume::CACHE_FOR_READ);
+  if (!p) return false;
+  dirName(*p, name);
+
+  // Windows keeps names like "readme.txt" as 8.3 names with flags
+  // for a lower case base and extension
+  uint8_t lower = p->reservedNT & 0X08;
+  for (char* c = name; *c; c++) {
+    if (*c == '.') lower = p->reservedNT & 0X10;
+    if (lower && *c >= 'A' && *c <= 'Z') *c += 'a' - 'A';
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
 /** List directory contents to Serial.
  *
  * \param[in] flags The inclusive OR of
@@ -198,19 +1098,13 @@ void SdFile::dirName(const dir_t& dir, char* name) {
  * list to indicate subdirectory level.
  */
 void SdFile::ls(uint8_t flags, uint8_t indent) {
-  dir_t* p;
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
+  dir_t d;
+  dir_t* p = &d;
 
+  // readDir() returns only subdirectories and files
   rewind();
-  while ((p = readDirCache())) {
-    // done if past last used entry
-    if (p->name[0] == DIR_NAME_FREE) break;
-
-    // skip deleted entry and entries for . and  ..
-    if (p->name[0] == DIR_NAME_DELETED || p->name[0] == '.') continue;
-
-    // only list subdirectories and files
-    if (!DIR_IS_FILE_OR_SUBDIR(p)) continue;
-
+  while (readDir(p) > 0) {
     // print any indent spaces
     for (int8_t i = 0; i < indent; i++) Serial.print(' ');
 
@@ -254,13 +1148,13 @@ uint8_t SdFile::make83Name(const char* str, uint8_t* name) {
       n = 10;  // max index for full 8.3 name
       i = 8;   // place for extension
     } else {
-      // illegal FAT characters
+      // illegal FAT characters, such names need long name entries
       uint8_t b;
 #if defined(__AVR__)
-      PGM_P p = PSTR("|<>^+=?/[];,*\"\\");
+      PGM_P p = PSTR("|<>^+=?/[];,*\"\\:");
       while ((b = pgm_read_byte(p++))) if (b == c) return false;
-#elif defined(__arm__)
-      const uint8_t valid[] = "|<>^+=?/[];,*\"\\";
+#else
+      const uint8_t valid[] = "|<>^+=?/[];,*\"\\:";
       const uint8_t *p = valid;
       while ((b = *p++)) if (b == c) return false;
 #endif
@@ -279,7 +1173,8 @@ uint8_t SdFile::make83Name(const char* str, uint8_t* name) {
  * \param[in] dir An open SdFat instance for the directory that will containing
  * the new directory.
  *
- * \param[in] dirName A valid 8.3 DOS name for the new directory.
+ * \param[in] dirName A valid 8.3 DOS name or long name for the new
+ * directory.
  *
  * \return The value one, true, is returned for success and
  * the value zero, false, is returned for failure.
@@ -287,21 +1182,26 @@ uint8_t SdFile::make83Name(const char* str, uint8_t* name) {
  * directory, \a dirName is invalid or already exists in \a dir.
  */
 uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
+  SdVolumeLock hold(dir->isOpen() ? dir->vol_ : 0);
   dir_t d;
 
   // create a normal file
   if (!open(dir, dirName, O_CREAT | O_EXCL | O_RDWR)) return false;
 
   // convert SdFile to directory
-  flags_ = O_READ;
+  flags_ = O_READ | (flags_ & F_NO_FAT_CHAIN);
   type_ = FAT_FILE_TYPE_SUBDIR;
 
   // allocate and zero first cluster
   if (!addDirCluster())return false;
+  vol_->dirIndexDrop(firstCluster_);
 
   // force entry to SD
   if (!sync()) return false;
 
+  // exFAT directories have no '.' and '..' entries
+  if (vol_->fatType() == 64) return true;
+
   // cache entry - should already be in cache due to sync() call
   dir_t* p = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
   if (!p) return false;
@@ -316,10 +1216,10 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
 
   // cache block for '.'  and '..'
   uint32_t block = vol_->clusterStartBlock(firstCluster_);
-  if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) return false;
+  if (!vol_->cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) return false;
 
   // copy '.' to block
-  memcpy(&SdVolume::cacheBuffer_.dir[0], &d, sizeof(d));
+  memcpy(&vol_->cacheBuffer()->dir[0], &d, sizeof(d));
 
   // make entry for '..'
   d.name[1] = '.';
@@ -331,13 +1231,14 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
     d.firstClusterHigh = dir->firstCluster_ >> 16;
   }
   // copy '..' to block
-  memcpy(&SdVolume::cacheBuffer_.dir[1], &d, sizeof(d));
+  memcpy(&vol_->cacheBuffer()->dir[1], &d, sizeof(d));
 
   // set position after '..'
   curPosition_ = 2 * sizeof(d);
 
   // write first block
-  return SdVolume::cacheFlush();
+  if (!vol_->fsInfoSync()) return false;
+  return vol_->cacheFlush();
 }
 //------------------------------------------------------------------------------
 /**
@@ -346,7 +1247,10 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
  * \param[in] dirFile An open SdFat instance for the directory containing the
  * file to be opened.
  *
- * \param[in] fileName A valid 8.3 DOS name for a file to be opened.
+ * \param[in] fileName A valid 8.3 DOS name or UTF-8 long name for a file
+ * to be opened.  Long names match without regard to the case of ASCII
+ * letters.  A file created with a name that is not an 8.3 name gets long
+ * name entries and a generated 8.3 name like "NEWTEX~1.TXT".
  *
  * \param[in] oflag Values for \a oflag are constructed by a bitwise-inclusive
  * OR of flags from the following list
@@ -387,59 +1291,169 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
  * or can't be opened in the access mode specified by oflag.
  */
 uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
+  SdVolumeLock hold(dirFile->isOpen() ? dirFile->vol_ : 0);
   uint8_t dname[11];
+  uint16_t lname[LDIR_NAME_MAX];
+  char key[3 * LDIR_NAME_MAX + 1];
+  uint16_t keyLength = 0;
   dir_t* p;
 
   // error if already open
   if (isOpen())return false;
 
-  if (!make83Name(fileName, dname)) return false;
-  vol_ = dirFile->vol_;
-  dirFile->rewind();
+  if (dirFile->vol_->fatType() == 64) return exOpen(dirFile, fileName, oflag);
 
-  // bool for empty entry found
-  uint8_t emptyFound = false;
+  // a name is looked up as an 8.3 name if it is one and as a long name if
+  // it is one; a new file gets long name entries unless it is 8.3
+  uint8_t is83 = make83Name(fileName, dname);
+  uint16_t lnameLength = lfnParse(fileName, lname);
+  if (!is83 && !lnameLength) return false;
+  if (lnameLength) {
+    keyLength = lfnToUtf8(lname, lnameLength, key, sizeof(key), true);
+  }
+  uint8_t needed = is83 ? 1 : 1 + (lnameLength + LDIR_NAME_CHARS - 1) /
+                                  LDIR_NAME_CHARS;
+  vol_ = dirFile->vol_;
 
-  // search for file
+  // with a name index only the search for empty entries reads the directory
+  SdDirIndex* nameIndex = 0;
+  if (vol_->dirIndexEnabled_ && dirFile->isDir()) {
+    nameIndex = vol_->dirIndexFor(dirFile->firstCluster_);
+    if (!nameIndex->valid_ && !dirFile->indexDir(nameIndex)) {
+      nameIndex->clear();
+      return false;
+    }
+    uint16_t entry;
+    if ((is83 && nameIndex->find(dname, &entry)) ||
+      (lnameLength && nameIndex->findLong(key, keyLength, &entry))) {
+      // don't open existing file if O_CREAT and O_EXCL
+      if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) return false;
+      return open(dirFile, entry, oflag);
+    }
+    if ((oflag & (O_CREAT | O_WRITE)) != (O_CREAT | O_WRITE)) return false;
+    if (!dirFile->seekSet(32UL * nameIndex->freeHint_)) return false;
+  } else {
+    dirFile->rewind();
+  }
+  // numeric tails taken by short names like the one a long name would get
+  uint8_t basis[11];
+  uint8_t basisLength = 0;
+  uint32_t tailsUsed[32];
+  if (!is83) {
+    basisLength = lfnBasis(lname, lnameLength, basis);
+    memset(tailsUsed, 0, sizeof(tailsUsed));
+  }
+  // first empty entry and the first run of needed empty entries
+  uint16_t firstFree = 0XFFFF;
+  uint16_t newEntry = 0;
+  uint8_t freeRun = 0;
+
+  // long name entries seen since the last short name entry; lfnOrd is the
+  // ord of the last one, zero if they do not make a complete chain
+  uint8_t lfnOrd = 0;
+  uint8_t lfnCount = 0;
+  uint8_t lfnSum = 0;
+  uint8_t lfnMatch = false;
+
+  // search for file, checking each long name as its entries go by
   while (dirFile->curPosition_ < dirFile->fileSize_) {
-    uint8_t index = 0XF & (dirFile->curPosition_ >> 5);
+    uint16_t entry = dirFile->curPosition_ >> 5;
     p = dirFile->readDirCache();
     if (p == NULL) return false;
 
     if (p->name[0] == DIR_NAME_FREE || p->name[0] == DIR_NAME_DELETED) {
-      // remember first empty slot
-      if (!emptyFound) {
-        emptyFound = true;
-        dirIndex_ = index;
-        dirBlock_ = SdVolume::cacheBlockNumber_;
-      }
+      lfnOrd = 0;
+      if (firstFree == 0XFFFF) firstFree = entry;
+      if (freeRun < needed && freeRun++ == 0) newEntry = entry;
       // done if no entries follow
       if (p->name[0] == DIR_NAME_FREE) break;
-    } else if (!memcmp(dname, p->name, 11)) {
+      continue;
+    }
+    if (freeRun < needed) freeRun = 0;
+    if (nameIndex) continue;
+
+    if (DIR_IS_LONG_NAME(p)) {
+      const ldir_t* ld = reinterpret_cast<const ldir_t*>(p);
+      uint8_t ord = ld->ord & 0X1F;
+      if (ld->ord & LDIR_ORD_LAST_LONG_ENTRY) {
+        // holds the last part of a name
+        lfnOrd = ord <= LDIR_MAX_ENTRIES ? ord : 0;
+        lfnCount = lfnOrd;
+        lfnSum = ld->checksum;
+        lfnMatch = lnameLength > (ord - 1) * LDIR_NAME_CHARS &&
+                   lnameLength <= ord * LDIR_NAME_CHARS;
+      } else if (lfnOrd && ord == lfnOrd - 1 && ld->checksum == lfnSum) {
+        lfnOrd = ord;
+      } else {
+        lfnOrd = 0;
+      }
+      if (lfnOrd && lfnMatch) lfnMatch = lfnCompare(p, lname, lnameLength);
+      continue;
+    }
+    // a long name belongs to the short name entry that follows it
+    uint8_t hasLong = lfnOrd == 1 && lfnSum == lfnChecksum(p->name);
+    lfnOrd = 0;
+    if ((is83 && !memcmp(dname, p->name, 11)) ||
+      (hasLong && lfnMatch)) {
       // don't open existing file if O_CREAT and O_EXCL
       if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) return false;
 
       // open found file
-      return openCachedEntry(0XF & index, oflag);
+      dirCluster_ = dirFile->firstCluster_;
+      dirEntry_ = entry;
+      lfnCount_ = hasLong ? lfnCount : 0;
+      return openCachedEntry(0XF & entry, oflag);
     }
+    if (!is83) lfnTailUsed(p->name, basis, basisLength, tailsUsed);
   }
   // only create file if O_CREAT and O_WRITE
   if ((oflag & (O_CREAT | O_WRITE)) != (O_CREAT | O_WRITE)) return false;
 
-  // cache found slot or add cluster if end of file
-  if (emptyFound) {
-    p = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
-    if (!p) return false;
-  } else {
+  // short name for a long name
+  if (!is83) {
+    uint16_t tail = 1;
+    while (true) {
+      if (tail > 999) return false;
+      lfnMakeShort(basis, basisLength, tail, dname);
+      uint16_t entry;
+      if (nameIndex ? !nameIndex->find(dname, &entry) :
+        !(tailsUsed[tail >> 5] & (1UL << (tail & 31)))) {
+        break;
+      }
+      tail++;
+    }
+  }
+  // use the run of empty entries, which may continue past the end of the
+  // directory, or add entries at the end
+  if (!freeRun) newEntry = dirFile->fileSize_ >> 5;
+  if (32UL * (newEntry + needed) > dirFile->fileSize_) {
     if (dirFile->type_ == FAT_FILE_TYPE_ROOT16) return false;
 
-    // add and zero cluster for dirFile - first cluster is in cache for write
-    if (!dirFile->addDirCluster()) return false;
-
-    // use first entry in cluster
-    dirIndex_ = 0;
-    p = SdVolume::cacheBuffer_.dir;
+    // new clusters are linked after curCluster_
+    if (!dirFile->seekSet(dirFile->fileSize_)) return false;
+    while (32UL * (newEntry + needed) > dirFile->fileSize_) {
+      // add and zero cluster for dirFile
+      if (!dirFile->addDirCluster()) return false;
+    }
+    // curCluster_ no longer goes with curPosition_
+    dirFile->rewind();
   }
+  // long name entries, last part first
+  uint8_t sum = lfnChecksum(dname);
+  for (uint8_t i = 0; i + 1 < needed; i++) {
+    uint8_t ord = needed - 1 - i;
+    if (!dirFile->seekSet(32UL * (newEntry + i))) return false;
+    p = dirFile->readDirCache();
+    if (p == NULL) return false;
+    vol_->cacheSetDirty();
+    lfnFill(p, ord, i == 0, sum, lname, lnameLength);
+  }
+  if (!dirFile->seekSet(32UL * (newEntry + needed - 1))) return false;
+  p = dirFile->readDirCache();
+  if (p == NULL) return false;
+  vol_->cacheSetDirty();
+  dirIndex_ = 0XF & (newEntry + needed - 1);
+
   // initialize as empty file
   memset(p, 0, sizeof(dir_t));
   memcpy(p->name, dname, 11);
@@ -458,8 +1472,20 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
   p->lastWriteTime = p->creationTime;
 
   // force write of entry to SD
-  if (!SdVolume::cacheFlush()) return false;
-
+  if (!vol_->cacheFlush()) return false;
+
+  dirCluster_ = dirFile->firstCluster_;
+  dirEntry_ = newEntry + needed - 1;
+  lfnCount_ = needed - 1;
+  if (nameIndex) {
+    if (nameIndex->insert(dname, is83 ? 0 : key, keyLength,
+                          vol_->cacheBlockNumber(), dirEntry_)) {
+      if (firstFree >= newEntry) firstFree = dirEntry_ + 1;
+      nameIndex->freeHint_ = firstFree;
+    } else {
+      nameIndex->clear();
+    }
+  }
   // open entry in cache
   return openCachedEntry(dirIndex_, oflag);
 }
@@ -479,6 +1505,7 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
  *
  */
 uint8_t SdFile::open(SdFile* dirFile, uint16_t index, uint8_t oflag) {
+  SdVolumeLock hold(dirFile->isOpen() ? dirFile->vol_ : 0);
   // error if already open
   if (isOpen())return false;
 
@@ -486,6 +1513,7 @@ uint8_t SdFile::open(SdFile* dirFile, uint16_t index, uint8_t oflag) {
   if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) return false;
 
   vol_ = dirFile->vol_;
+  if (vol_->fatType() == 64) return exOpenIndex(dirFile, index, oflag);
 
   // seek to location of entry
   if (!dirFile->seekSet(32 * index)) return false;
@@ -499,6 +1527,16 @@ uint8_t SdFile::open(SdFile* dirFile, uint16_t index, uint8_t oflag) {
       p->name[0] == DIR_NAME_DELETED || p->name[0] == '.') {
     return false;
   }
+  dirCluster_ = dirFile->firstCluster_;
+  dirEntry_ = index;
+  // a long name would be in the entries just before
+  if (index && ((index & 0XF) == 0 || DIR_IS_LONG_NAME(p - 1))) {
+    lfnCount_ = lfnCountAt(dirFile, index);
+    if (!dirFile->seekSet(32UL * index)) return false;
+    if (!dirFile->readDirCache()) return false;
+  } else {
+    lfnCount_ = 0;
+  }
   // open cached entry
   return openCachedEntry(index & 0XF, oflag);
 }
@@ -506,7 +1544,7 @@ uint8_t SdFile::open(SdFile* dirFile, uint16_t index, uint8_t oflag) {
 // open a cached directory entry. Assumes vol_ is initializes
 uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   // location of entry in cache
-  dir_t* p = SdVolume::cacheBuffer_.dir + dirIndex;
+  dir_t* p = vol_->cacheBuffer()->dir + dirIndex;
 
   // write or truncate is an error for a directory or read-only file
   if (p->attributes & (DIR_ATT_READ_ONLY | DIR_ATT_DIRECTORY)) {
@@ -514,18 +1552,20 @@ uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   }
   // remember location of directory entry on SD
   dirIndex_ = dirIndex;
-  dirBlock_ = SdVolume::cacheBlockNumber_;
+  dirBlock_ = vol_->cacheBlockNumber();
+  dirClusters_ = 0;
 
   // copy first cluster number for directory fields
   firstCluster_ = (uint32_t)p->firstClusterHigh << 16;
   firstCluster_ |= p->firstClusterLow;
+  resetExtents();
 
   // make sure it is a normal file or subdirectory
   if (DIR_IS_FILE(p)) {
     fileSize_ = p->fileSize;
     type_ = FAT_FILE_TYPE_NORMAL;
   } else if (DIR_IS_SUBDIR(p)) {
-    if (!vol_->chainSize(firstCluster_, &fileSize_)) return false;
+    if (!chainSize(&fileSize_)) return false;
     type_ = FAT_FILE_TYPE_SUBDIR;
   } else {
     return false;
@@ -536,12 +1576,46 @@ uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
+  readEnd_ = 0XFFFFFFFF;
 
   // truncate file to zero length if requested
   if (oflag & O_TRUNC) return truncate(0);
   return true;
 }
 //------------------------------------------------------------------------------
+// open the directory that holds this file's entry
+uint8_t SdFile::openParent(SdFile* dir) {
+  if (dirCluster_ == 0 ||
+    (vol_->fatType() >= 32 && dirCluster_ == vol_->rootDirStart())) {
+    return dir->openRoot(vol_);
+  }
+  dir->vol_ = vol_;
+  dir->firstCluster_ = dirCluster_;
+  dir->flags_ = O_READ;
+  if (dirClusters_) {
+    // an exFAT directory without a FAT chain
+    dir->flags_ |= F_NO_FAT_CHAIN;
+    dir->mapContiguous(dirClusters_);
+    dir->fileSize_ = dirClusters_ << (vol_->clusterSizeShift_ + 9);
+  } else {
+    dir->resetExtents();
+    if (!dir->chainSize(&dir->fileSize_)) return false;
+  }
+  dir->type_ = FAT_FILE_TYPE_SUBDIR;
+  dir->curCluster_ = 0;
+  dir->curPosition_ = 0;
+  dir->readEnd_ = 0XFFFFFFFF;
+
+  // its own entry is not needed
+  dir->dirBlock_ = 0;
+  dir->dirIndex_ = 0;
+  dir->dirCluster_ = 0;
+  dir->dirEntry_ = 0;
+  dir->lfnCount_ = 0;
+  dir->dirClusters_ = 0;
+  return true;
+}
+//------------------------------------------------------------------------------
 /**
  * Open a volume's root directory.
  *
@@ -553,6 +1627,7 @@ uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
  * or it a FAT12 volume.
  */
 uint8_t SdFile::openRoot(SdVolume* vol) {
+  SdVolumeLock hold(vol);
   // error if file is already open
   if (isOpen()) return false;
 
@@ -560,28 +1635,107 @@ uint8_t SdFile::openRoot(SdVolume* vol) {
     type_ = FAT_FILE_TYPE_ROOT16;
     firstCluster_ = 0;
     fileSize_ = 32 * vol->rootDirEntryCount();
-  } else if (vol->fatType() == 32) {
+  } else if (vol->fatType() == 32 || vol->fatType() == 64) {
     type_ = FAT_FILE_TYPE_ROOT32;
     firstCluster_ = vol->rootDirStart();
-    if (!vol->chainSize(firstCluster_, &fileSize_)) return false;
   } else {
     // volume is not initialized or FAT12
     return false;
   }
   vol_ = vol;
+  resetExtents();
+  if (type_ == FAT_FILE_TYPE_ROOT32 && !chainSize(&fileSize_)) {
+    type_ = FAT_FILE_TYPE_CLOSED;
+    return false;
+  }
   // read only
   flags_ = O_READ;
 
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
+  readEnd_ = 0XFFFFFFFF;
 
   // root has no directory entry
   dirBlock_ = 0;
   dirIndex_ = 0;
+  dirCluster_ = 0;
+  dirEntry_ = 0;
+  lfnCount_ = 0;
+  dirClusters_ = 0;
   return true;
 }
 //------------------------------------------------------------------------------
+/**
+ * Reserve clusters for a file to grow to \a length bytes so later writes
+ * don't have to allocate.  The file size is not changed.  The clusters are
+ * taken in one run, right after the file's last cluster if they are free,
+ * and one at a time if there is no run long enough.  contiguousRange()
+ * tells if the file ends up contiguous.
+ *
+ * Reserved clusters past the end of the data are released by truncate()
+ * and remove().  On exFAT the reservation is kept in the stream entry's
+ * DataLength with ValidDataLength at the end of the data.
+ *
+ * \param[in] length The size in bytes the file may grow to.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure include the file is not open for write, is a
+ * directory, the volume is full or an I/O error occurred.
+ */
+uint8_t SdFile::preallocate(uint32_t length) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
+  if (!isFile() || !(flags_ & O_WRITE)) return false;
+
+  // clusters the file has and needs
+  uint8_t shift = vol_->clusterSizeShift_ + 9;
+  uint32_t need = length ? ((length - 1) >> shift) + 1 : 0;
+  uint32_t have = 0;
+  uint32_t last = 0;
+  if (firstCluster_) {
+    uint32_t size;
+    if (!chainSize(&size)) return false;
+    have = size >> shift;
+    if (!clusterAt(have - 1, &last)) return false;
+  }
+  if (need <= have) return true;
+  uint32_t extra = need - have;
+
+  // one run of clusters, after the last cluster if it can be
+  uint32_t c = last;
+  if (flags_ & F_NO_FAT_CHAIN) {
+    if (vol_->allocUnchained(extra, &c)) {
+      if (firstCluster_ == 0) {
+        firstCluster_ = c;
+        mapContiguous(extra);
+      } else {
+        extents_[0].count += extra;
+      }
+      extra = 0;
+    }
+  } else if (vol_->allocContiguous(extra, &c)) {
+    if (firstCluster_ == 0) firstCluster_ = c;
+    // the chain is longer than extents_ knows
+    extentsEnd_ = false;
+    extra = 0;
+  }
+  if (extra) {
+    // a cluster at a time, as write() would
+    uint32_t cur = curCluster_;
+    curCluster_ = last;
+    while (extra--) {
+      if (!addCluster()) {
+        curCluster_ = cur;
+        return false;
+      }
+    }
+    curCluster_ = cur;
+  }
+  flags_ |= F_RESERVED | F_FILE_DIR_DIRTY;
+  return sync();
+}
+//------------------------------------------------------------------------------
 /** %Print the name field of a directory entry in 8.3 format to Serial.
  *
  * \param[in] dir The directory structure containing the name.
@@ -648,6 +1802,88 @@ void SdFile::printTwoDigits(uint8_t v) {
   Serial.print(str);
 }
 //------------------------------------------------------------------------------
+/**
+ * Start a raw stream of whole blocks to a contiguous file.
+ *
+ * The blocks from the current position to the end of the file's clusters
+ * are written with one Sd2Card::writeStart() multiple block write, without
+ * the block cache or FAT and directory updates.  The file size is brought
+ * up to date by rawStreamStop() or close().  No other access to the card
+ * is allowed until the stream is stopped.
+ *
+ * Use createContiguous() or preallocate() to give the file its clusters.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure include the file is not open for write, is not
+ * contiguous, has no clusters past the current position, the position
+ * is not on a block boundary or an I/O error occurred.
+ */
+uint8_t SdFile::rawStreamStart(void) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
+  if (!isFile() || !(flags_ & O_WRITE) || streamEnd_) return false;
+  if ((flags_ & O_APPEND) && !seekEnd()) return false;
+  if (curPosition_ & 0X1FF) return false;
+
+  uint32_t bgnBlock, endBlock;
+  if (!contiguousRange(&bgnBlock, &endBlock)) return false;
+  uint32_t block = bgnBlock + (curPosition_ >> 9);
+  if (block > endBlock) return false;
+  uint32_t count = endBlock - block + 1;
+
+  // the card takes nothing else until writeStop()
+  if (!vol_->cacheFlush()) return false;
+  vol_->cacheInvalidate(block, count);
+  if (!vol_->sdCard()->writeStart(block, count)) return false;
+  streamBlock_ = block;
+  streamEnd_ = endBlock + 1;
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * Write whole blocks to a raw stream started by rawStreamStart().
+ *
+ * \param[in] buf Pointer to the data to be written.
+ * \param[in] count Number of 512 byte blocks to write.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure include no stream is open, the blocks would go past
+ * the file's clusters or an I/O error occurred.
+ */
+uint8_t SdFile::rawStreamWrite(const void* buf, uint32_t count) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
+  const uint8_t* src = reinterpret_cast<const uint8_t*>(buf);
+  if (!streamEnd_ || count > streamEnd_ - streamBlock_) return false;
+  if (!vol_->sdCard()->writeData(src, count)) return false;
+  streamBlock_ += count;
+  curPosition_ += count << 9;
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * End a raw stream and write the file size to its directory entry.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure include no stream is open or an I/O error occurred.
+ */
+uint8_t SdFile::rawStreamStop(void) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
+  if (!streamEnd_) return false;
+  streamEnd_ = 0;
+  if (!vol_->sdCard()->writeStop()) return false;
+  if (curPosition_ > fileSize_) fileSize_ = curPosition_;
+  // the position moved without following the clusters
+  if (curPosition_ &&
+    !clusterAt((curPosition_ - 1) >> (vol_->clusterSizeShift_ + 9),
+               &curCluster_)) {
+    return false;
+  }
+  flags_ |= F_FILE_DIR_DIRTY;
+  return sync();
+}
+//------------------------------------------------------------------------------
 /**
  * Read data from a file starting at the current position.
  *
@@ -668,9 +1904,17 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
   // error if not open or write only
   if (!isOpen() || !(flags_ & O_READ)) return -1;
 
+  // alongside other readers unless this thread already holds the volume
+  if (vol_->concurrentEnabled() && !vol_->lockOwned()) {
+    return readShared(buf, nbyte);
+  }
+
   // max bytes left in file
   if (nbyte > (fileSize_ - curPosition_)) nbyte = fileSize_ - curPosition_;
 
+  // reading on from where the last read stopped
+  uint8_t sequential = curPosition_ == readEnd_;
+
   // amount left to read
   uint16_t toRead = nbyte;
   while (toRead > 0) {
@@ -679,7 +1923,7 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
     if (type_ == FAT_FILE_TYPE_ROOT16) {
       block = vol_->rootDirStart() + (curPosition_ >> 9);
     } else {
-      uint8_t blockOfCluster = vol_->blockOfCluster(curPosition_);
+      uint32_t blockOfCluster = vol_->blockOfCluster(curPosition_);
       if (offset == 0 && blockOfCluster == 0) {
         // start of new cluster
         if (curPosition_ == 0) {
@@ -687,7 +1931,7 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
           curCluster_ = firstCluster_;
         } else {
           // get next cluster from FAT
-          if (!vol_->fatGet(curCluster_, &curCluster_)) return -1;
+          if (!nextCluster(&curCluster_)) return -1;
         }
       }
       block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
@@ -697,24 +1941,120 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
     // amount to be read from current block
     if (n > (512 - offset)) n = 512 - offset;
 
-    // no buffering needed if n == 512 or user requests no buffering
-    if ((unbufferedRead() || n == 512) &&
-      block != SdVolume::cacheBlockNumber_) {
-      if (!vol_->readData(block, offset, n, dst)) return -1;
+    if (offset == 0 && toRead >= 1024) {
+      // several whole blocks - one transfer for the contiguous part
+      uint32_t count;
+      if (!contiguousBlocks(toRead >> 9, false, &count)) return -1;
+      n = count << 9;
+      // the card must be current if a dirty copy of one of them is cached
+      if (!vol_->cacheSync(block, count)) return -1;
+      if (!vol_->readBlocks(block, dst, count)) return -1;
       dst += n;
     } else {
-      // read block to cache and copy data to caller
-      if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_READ)) return -1;
-      uint8_t* src = SdVolume::cacheBuffer_.data + offset;
-      uint8_t* end = src + n;
-      while (src != end) *dst++ = *src++;
+      if (sequential && vol_->readAheadWindow_ &&
+        block != vol_->cacheBlockNumber() &&
+        !vol_->readAheadContains(block) &&
+        !vol_->cacheContains(block)) {
+        if (!readAhead(block)) return -1;
+      }
+      if ((unbufferedRead() || n == 512) && !vol_->cacheContains(block)) {
+        if (!vol_->readAheadCopy(block, offset, n, dst) &&
+          !vol_->readData(block, offset, n, dst)) {
+          return -1;
+        }
+        dst += n;
+      } else {
+        // read block to cache and copy data to caller
+        if (!vol_->cacheRawBlock(block, SdVolume::CACHE_FOR_READ)) {
+          return -1;
+        }
+        uint8_t* src = vol_->cacheBuffer()->data + offset;
+        uint8_t* end = src + n;
+        while (src != end) *dst++ = *src++;
+      }
     }
     curPosition_ += n;
     toRead -= n;
   }
+  readEnd_ = curPosition_;
   return nbyte;
 }
 //------------------------------------------------------------------------------
+// read() while other threads may read the volume too.  The volume is held
+// shared, so nothing changes its cache or the card meanwhile; whole blocks
+// go straight to the card and partial ones through the striped cache,
+// without the read-ahead window.
+int16_t SdFile::readShared(void* buf, uint16_t nbyte) {
+  uint8_t* dst = reinterpret_cast<uint8_t*>(buf);
+  std::shared_lock<std::shared_mutex> hold(vol_->lock_);
+  // concurrent readers may have been turned off while this one waited
+  if (!vol_->concurrentEnabled()) {
+    hold.unlock();
+    return read(buf, nbyte);
+  }
+
+  if (nbyte > (fileSize_ - curPosition_)) nbyte = fileSize_ - curPosition_;
+  uint16_t toRead = nbyte;
+  while (toRead > 0) {
+    uint32_t block;
+    uint16_t offset = curPosition_ & 0X1FF;
+    uint32_t blockOfCluster = vol_->blockOfCluster(curPosition_);
+    if (type_ == FAT_FILE_TYPE_ROOT16) {
+      block = vol_->rootDirStart() + (curPosition_ >> 9);
+    } else {
+      if (offset == 0 && blockOfCluster == 0) {
+        if (curPosition_ == 0) {
+          curCluster_ = firstCluster_;
+        } else {
+          if (!nextCluster(&curCluster_, true)) return -1;
+        }
+      }
+      block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
+    }
+    uint16_t n = toRead;
+    if (n > (512 - offset)) n = 512 - offset;
+
+    if (offset == 0 && toRead >= 1024) {
+      // whole blocks to the end of the run of adjacent clusters
+      uint32_t max = toRead >> 9;
+      uint32_t count = max;
+      if (type_ != FAT_FILE_TYPE_ROOT16) {
+        count = vol_->blocksPerCluster() - blockOfCluster;
+        while (count < max) {
+          uint32_t next;
+          if (!nextCluster(&next, true)) return -1;
+          if (next != curCluster_ + 1) break;
+          curCluster_ = next;
+          count += vol_->blocksPerCluster();
+        }
+        if (count > max) count = max;
+      }
+      n = count << 9;
+      if (!vol_->sharedReadBlocks(block, dst, count)) return -1;
+    } else {
+      if (!vol_->sharedRead(block, offset, n, dst)) return -1;
+    }
+    dst += n;
+    curPosition_ += n;
+    toRead -= n;
+  }
+  readEnd_ = curPosition_;
+  return nbyte;
+}
+//------------------------------------------------------------------------------
+// Fill the volume's read-ahead window with block, the block at curPosition_,
+// and the blocks after it up to the end of the window, the file or the run
+// of adjacent clusters.  Following the chain caches the FAT blocks for it.
+uint8_t SdFile::readAhead(uint32_t block) {
+  uint32_t max = ((fileSize_ + 511) >> 9) - (curPosition_ >> 9);
+  if (max > vol_->readAheadWindow_) max = vol_->readAheadWindow_;
+  uint32_t cluster = curCluster_;
+  uint32_t count;
+  uint8_t rtn = contiguousBlocks(max, false, &count);
+  curCluster_ = cluster;
+  return rtn && vol_->readAheadFill(block, count);
+}
+//------------------------------------------------------------------------------
 /**
  * Read the next directory entry from a directory file.
  *
@@ -727,9 +2067,11 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
  * a directory file or an I/O error occurred.
  */
 int8_t SdFile::readDir(dir_t* dir) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
   int8_t n;
   // if not a directory file or miss-positioned return an error
   if (!isDir() || (0X1F & curPosition_)) return -1;
+  if (vol_->fatType() == 64) return exReadDir(dir);
 
   while ((n = read(dir, sizeof(dir_t))) == sizeof(dir_t)) {
     // last entry if DIR_NAME_FREE
@@ -759,7 +2101,7 @@ dir_t* SdFile::readDirCache(void) {
   curPosition_ += 31;
 
   // return pointer to entry
-  return (SdVolume::cacheBuffer_.dir + i);
+  return (vol_->cacheBuffer()->dir + i);
 }
 //------------------------------------------------------------------------------
 /**
@@ -767,9 +2109,8 @@ dir_t* SdFile::readDirCache(void) {
  *
  * The directory entry and all data for the file are deleted.
  *
- * \note This function should not be used to delete the 8.3 version of a
- * file that has a long name. For example if a file has the long name
- * "New Text Document.txt" you should not delete the 8.3 name "NEWTEX~1.TXT".
+ * The long name entries of a file that has a long name are deleted with
+ * it, whether it was opened by its long name or its 8.3 name.
  *
  * \return The value one, true, is returned for success and
  * the value zero, false, is returned for failure.
@@ -777,21 +2118,40 @@ dir_t* SdFile::readDirCache(void) {
  * or an I/O error occurred.
  */
 uint8_t SdFile::remove(void) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
   // free any clusters - will fail if read-only or directory
   if (!truncate(0)) return false;
 
+  if (vol_->fatType() == 64) {
+    type_ = FAT_FILE_TYPE_CLOSED;
+    return exRemove();
+  }
   // cache directory entry
   dir_t* d = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
   if (!d) return false;
 
   // mark entry deleted
+  vol_->dirIndexErase(d->name, dirBlock_, dirIndex_, lfnCount_);
   d->name[0] = DIR_NAME_DELETED;
 
   // set this SdFile closed
   type_ = FAT_FILE_TYPE_CLOSED;
 
   // write entry to SD
-  return SdVolume::cacheFlush();
+  if (!vol_->cacheFlush()) return false;
+  if (lfnCount_ == 0) return true;
+
+  // mark its long name entries deleted
+  SdFile dir;
+  if (!openParent(&dir)) return false;
+  for (uint8_t i = 1; i <= lfnCount_; i++) {
+    if (!dir.seekSet(32UL * (dirEntry_ - i))) return false;
+    dir_t* p = dir.readDirCache();
+    if (p == NULL) return false;
+    p->name[0] = DIR_NAME_DELETED;
+    vol_->cacheSetDirty();
+  }
+  return vol_->cacheFlush();
 }
 //------------------------------------------------------------------------------
 /**
@@ -802,9 +2162,8 @@ uint8_t SdFile::remove(void) {
  * \param[in] dirFile The directory that contains the file.
  * \param[in] fileName The name of the file to be removed.
  *
- * \note This function should not be used to delete the 8.3 version of a
- * file that has a long name. For example if a file has the long name
- * "New Text Document.txt" you should not delete the 8.3 name "NEWTEX~1.TXT".
+ * The long name entries of a file that has a long name are deleted with
+ * it, whether it was opened by its long name or its 8.3 name.
  *
  * \return The value one, true, is returned for success and
  * the value zero, false, is returned for failure.
@@ -813,6 +2172,7 @@ uint8_t SdFile::remove(void) {
  * or an I/O error occurred.
  */
 uint8_t SdFile::remove(SdFile* dirFile, const char* fileName) {
+  SdVolumeLock hold(dirFile->isOpen() ? dirFile->vol_ : 0);
   SdFile file;
   if (!file.open(dirFile, fileName, O_WRITE)) return false;
   return file.remove();
@@ -824,9 +2184,8 @@ uint8_t SdFile::remove(SdFile* dirFile, const char* fileName) {
  * root directory.  rmDir() follows DOS and Windows and ignores the
  * read-only attribute for the directory.
  *
- * \note This function should not be used to delete the 8.3 version of a
- * directory that has a long name. For example if a directory has the
- * long name "New folder" you should not delete the 8.3 name "NEWFOL~1".
+ * The long name entries of a directory that has a long name are deleted
+ * with it.
  *
  * \return The value one, true, is returned for success and
  * the value zero, false, is returned for failure.
@@ -834,6 +2193,7 @@ uint8_t SdFile::remove(SdFile* dirFile, const char* fileName) {
  * directory, is not empty, or an I/O error occurred.
  */
 uint8_t SdFile::rmDir(void) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
   // must be open subdirectory
   if (!isSubDir()) return false;
 
@@ -848,8 +2208,11 @@ uint8_t SdFile::rmDir(void) {
     // skip empty slot or '.' or '..'
     if (p->name[0] == DIR_NAME_DELETED || p->name[0] == '.') continue;
     // error not empty
-    if (DIR_IS_FILE_OR_SUBDIR(p)) return false;
+    if (entryIsFileOrSubDir(p)) return false;
   }
+  // its clusters may become another directory
+  vol_->dirIndexDrop(firstCluster_);
+
   // convert empty directory to normal file for remove
   type_ = FAT_FILE_TYPE_NORMAL;
   flags_ |= O_WRITE;
@@ -865,13 +2228,25 @@ uint8_t SdFile::rmDir(void) {
  * subdirectories.  The directory will then be removed if it is not root.
  * The read-only attribute for files will be ignored.
  *
- * \note This function should not be used to delete the 8.3 version of
- * a directory that has a long name.  See remove() and rmDir().
+ * On FAT16 and FAT32 all the directory entries are deleted first and the
+ * clusters of every file are then freed together, so each FAT block is
+ * written once however many files had clusters in it.
  *
  * \return The value one, true, is returned for success and
  * the value zero, false, is returned for failure.
  */
 uint8_t SdFile::rmRfStar(void) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
+  if (vol_->fatType() != 64) {
+    // delete every entry in the tree, then free all the chains at once
+    std::vector<uint32_t> chains;
+    if (!rmRfCollect(&chains)) return false;
+    if (!vol_->freeChains(chains.data(), chains.size())) return false;
+    if (!vol_->cacheFlush()) return false;
+    // don't try to delete root
+    if (isRoot()) return true;
+    return rmDir();
+  }
   rewind();
   while (curPosition_ < fileSize_) {
     SdFile f;
@@ -889,7 +2264,7 @@ uint8_t SdFile::rmRfStar(void) {
     if (p->name[0] == DIR_NAME_DELETED || p->name[0] == '.') continue;
 
     // skip if part of long file name or volume label in root
-    if (!DIR_IS_FILE_OR_SUBDIR(p)) continue;
+    if (!entryIsFileOrSubDir(p)) continue;
 
     if (!f.open(this, index, O_READ)) return false;
     if (f.isSubDir()) {
@@ -910,6 +2285,49 @@ uint8_t SdFile::rmRfStar(void) {
   return rmDir();
 }
 //------------------------------------------------------------------------------
+// Mark every entry in this directory and the directories below it deleted
+// and add the first cluster of each file and subdirectory to chains.  The
+// entries of a directory block are changed together in the cache and the
+// name index of each directory is dropped once.
+uint8_t SdFile::rmRfCollect(std::vector<uint32_t>* chains) {
+  vol_->dirIndexDrop(firstCluster_);
+  rewind();
+  while (curPosition_ < fileSize_) {
+    // remember position
+    uint16_t index = curPosition_/32;
+
+    dir_t* p = readDirCache();
+    if (!p) return false;
+
+    // done if past last entry
+    if (p->name[0] == DIR_NAME_FREE) break;
+
+    // skip empty slot or '.' or '..'
+    if (p->name[0] == DIR_NAME_DELETED || p->name[0] == '.') continue;
+
+    // every long name entry goes, skip the volume label in root
+    if (!DIR_IS_LONG_NAME(p)) {
+      if (!entryIsFileOrSubDir(p)) continue;
+      uint32_t cluster = (uint32_t)p->firstClusterHigh << 16 |
+                         p->firstClusterLow;
+      if (DIR_IS_SUBDIR(p)) {
+        SdFile f;
+        if (!f.open(this, index, O_READ)) return false;
+        if (!f.rmRfCollect(chains)) return false;
+
+        // cache the entry again
+        if (!seekSet(32u*index)) return false;
+        p = readDirCache();
+        if (!p) return false;
+      }
+      if (cluster) chains->push_back(cluster);
+    }
+    p->name[0] = DIR_NAME_DELETED;
+    vol_->cacheSetDirty();
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
 /**
  * Sets a file's position.
  *
@@ -919,8 +2337,8 @@ uint8_t SdFile::rmRfStar(void) {
  * the value zero, false, is returned for failure.
  */
 uint8_t SdFile::seekSet(uint32_t pos) {
-  // error if file not open or seek past end of file
-  if (!isOpen() || pos > fileSize_) return false;
+  // error if file not open, seek past end of file or streaming
+  if (!isOpen() || pos > fileSize_ || streamEnd_) return false;
 
   if (type_ == FAT_FILE_TYPE_ROOT16) {
     curPosition_ = pos;
@@ -936,15 +2354,17 @@ uint8_t SdFile::seekSet(uint32_t pos) {
   uint32_t nCur = (curPosition_ - 1) >> (vol_->clusterSizeShift_ + 9);
   uint32_t nNew = (pos - 1) >> (vol_->clusterSizeShift_ + 9);
 
-  if (nNew < nCur || curPosition_ == 0) {
-    // must follow chain from first cluster
-    curCluster_ = firstCluster_;
-  } else {
-    // advance from curPosition
-    nNew -= nCur;
-  }
-  while (nNew--) {
-    if (!vol_->fatGet(curCluster_, &curCluster_)) return false;
+  if (nNew != nCur || curPosition_ == 0) {
+    // a seek only reads the FAT, so it goes alongside readers
+    uint8_t shared = vol_->concurrentEnabled() && !vol_->lockOwned();
+    std::shared_lock<std::shared_mutex> hold(vol_->lock_, std::defer_lock);
+    if (shared) {
+      hold.lock();
+      shared = vol_->concurrentEnabled();
+    }
+    uint32_t c;
+    if (!clusterAt(nNew, &c, shared)) return false;
+    curCluster_ = c;
   }
   curPosition_ = pos;
   return true;
@@ -960,29 +2380,38 @@ uint8_t SdFile::seekSet(uint32_t pos) {
  * opened or an I/O error.
  */
 uint8_t SdFile::sync(void) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
   // only allow open files and directories
   if (!isOpen()) return false;
+  // rawStreamStop() syncs once the card is free
+  if (streamEnd_) return true;
 
   if (flags_ & F_FILE_DIR_DIRTY) {
-    dir_t* d = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
-    if (!d) return false;
+    if (vol_->fatType() == 64) {
+      // the exFAT root has no entry
+      if (!isRoot() && !exSyncEntry()) return false;
+    } else {
+      dir_t* d = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
+      if (!d) return false;
 
-    // do not set filesize for dir files
-    if (!isDir()) d->fileSize = fileSize_;
+      // do not set filesize for dir files
+      if (!isDir()) d->fileSize = fileSize_;
 
-    // update first cluster fields
-    d->firstClusterLow = firstCluster_ & 0XFFFF;
-    d->firstClusterHigh = firstCluster_ >> 16;
+      // update first cluster fields
+      d->firstClusterLow = firstCluster_ & 0XFFFF;
+      d->firstClusterHigh = firstCluster_ >> 16;
 
-    // set modify time if user supplied a callback date/time function
-    if (dateTime_) {
-      dateTime_(&d->lastWriteDate, &d->lastWriteTime);
-      d->lastAccessDate = d->lastWriteDate;
+      // set modify time if user supplied a callback date/time function
+      if (dateTime_) {
+        dateTime_(&d->lastWriteDate, &d->lastWriteTime);
+        d->lastAccessDate = d->lastWriteDate;
+      }
     }
     // clear directory dirty
     flags_ &= ~F_FILE_DIR_DIRTY;
   }
-  return SdVolume::cacheFlush();
+  if (!vol_->fsInfoSync()) return false;
+  return vol_->cacheFlush();
 }
 //------------------------------------------------------------------------------
 /**
@@ -1021,6 +2450,7 @@ uint8_t SdFile::sync(void) {
  */
 uint8_t SdFile::timestamp(uint8_t flags, uint16_t year, uint8_t month,
          uint8_t day, uint8_t hour, uint8_t minute, uint8_t second) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
   if (!isOpen()
     || year < 1980
     || year > 2107
@@ -1033,25 +2463,29 @@ uint8_t SdFile::timestamp(uint8_t flags, uint16_t year, uint8_t month,
     || second > 59) {
       return false;
   }
+  uint16_t dirDate = FAT_DATE(year, month, day);
+  uint16_t dirTime = FAT_TIME(hour, minute, second);
+  // seems to be units of 1/100 second not 1/10 as Microsoft states
+  uint8_t tenths = second & 1 ? 100 : 0;
+  if (vol_->fatType() == 64) {
+    return !isRoot() && exTimestamp(flags, dirDate, dirTime, tenths);
+  }
   dir_t* d = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
   if (!d) return false;
 
-  uint16_t dirDate = FAT_DATE(year, month, day);
-  uint16_t dirTime = FAT_TIME(hour, minute, second);
   if (flags & T_ACCESS) {
     d->lastAccessDate = dirDate;
   }
   if (flags & T_CREATE) {
     d->creationDate = dirDate;
     d->creationTime = dirTime;
-    // seems to be units of 1/100 second not 1/10 as Microsoft states
-    d->creationTimeTenths = second & 1 ? 100 : 0;
+    d->creationTimeTenths = tenths;
   }
   if (flags & T_WRITE) {
     d->lastWriteDate = dirDate;
     d->lastWriteTime = dirTime;
   }
-  SdVolume::cacheSetDirty();
+  vol_->cacheSetDirty();
   return sync();
 }
 //------------------------------------------------------------------------------
@@ -1068,14 +2502,15 @@ uint8_t SdFile::timestamp(uint8_t flags, uint16_t year, uint8_t month,
  * \a length is greater than the current file size or an I/O error occurs.
  */
 uint8_t SdFile::truncate(uint32_t length) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
 // error if not a normal file or read-only
   if (!isFile() || !(flags_ & O_WRITE)) return false;
 
   // error if length is greater than current size
   if (length > fileSize_) return false;
 
-  // fileSize and length are zero - nothing to do
-  if (fileSize_ == 0) return true;
+  // no clusters, not even reserved ones - nothing to do
+  if (firstCluster_ == 0) return true;
 
   // remember position for seek after truncation
   uint32_t newPos = curPosition_ > length ? length : curPosition_;
@@ -1083,10 +2518,30 @@ uint8_t SdFile::truncate(uint32_t length) {
   // position to last cluster in truncated file
   if (!seekSet(length)) return false;
 
-  if (length == 0) {
+  if (flags_ & F_NO_FAT_CHAIN) {
+    // free the clusters past the ones length needs
+    uint32_t keep = length ? ((length - 1) >> (vol_->clusterSizeShift_ + 9)) + 1
+                           : 0;
+    uint32_t count = extents_[0].count;
+    if (keep < count) {
+      if (!vol_->freeUnchained(firstCluster_ + keep, count - keep)) {
+        return false;
+      }
+    }
+    if (keep == 0) {
+      firstCluster_ = 0;
+      resetExtents();
+    } else {
+      extents_[0].count = keep;
+    }
+  } else if (length == 0) {
     // free all clusters
     if (!vol_->freeChain(firstCluster_)) return false;
     firstCluster_ = 0;
+    resetExtents();
+
+    // on exFAT the clusters it gets next need not be chained
+    if (vol_->fatType() == 64) flags_ |= F_NO_FAT_CHAIN;
   } else {
     uint32_t toFree;
     if (!vol_->fatGet(curCluster_, &toFree)) return false;
@@ -1097,11 +2552,13 @@ uint8_t SdFile::truncate(uint32_t length) {
 
       // current cluster is end of chain
       if (!vol_->fatPutEOC(curCluster_)) return false;
+      resetExtents();
     }
   }
   fileSize_ = length;
 
-  // need to update directory entry
+  // need to update directory entry, clusters past length are gone
+  flags_ &= ~F_RESERVED;
   flags_ |= F_FILE_DIR_DIRTY;
 
   if (!sync()) return false;
@@ -1124,25 +2581,32 @@ uint8_t SdFile::truncate(uint32_t length) {
  * \a nbyte.  If an error occurs, write() returns 0.  Possible errors
  * include write() is called before a file has been opened, write is called
  * for a read-only file, device is full, a corrupt file system or an I/O error.
+ * Clusters a failed write added past the end of the file are freed again
+ * unless the file has clusters reserved by preallocate().
  *
  */
 size_t SdFile::write(const void* buf, uint16_t nbyte) {
+  SdVolumeLock hold(isOpen() ? vol_ : 0);
   // convert void* to uint8_t*  -  must be before goto statements
   const uint8_t* src = reinterpret_cast<const uint8_t*>(buf);
 
   // number of bytes left to write  -  must be before goto statements
   uint16_t nToWrite = nbyte;
 
-  // error if not a normal file or is read-only
-  if (!isFile() || !(flags_ & O_WRITE)) goto writeErrorReturn;
+  // set once clusters may be added  -  must be before goto statements
+  uint8_t growing = false;
+
+  // error if not a normal file, is read-only or is streaming
+  if (!isFile() || !(flags_ & O_WRITE) || streamEnd_) goto writeErrorReturn;
 
   // seek to end of file if append flag
   if ((flags_ & O_APPEND) && curPosition_ != fileSize_) {
     if (!seekEnd()) goto writeErrorReturn;
   }
+  growing = true;
 
   while (nToWrite > 0) {
-    uint8_t blockOfCluster = vol_->blockOfCluster(curPosition_);
+    uint32_t blockOfCluster = vol_->blockOfCluster(curPosition_);
     uint16_t blockOffset = curPosition_ & 0X1FF;
     if (blockOfCluster == 0 && blockOffset == 0) {
       // start of new cluster
@@ -1155,7 +2619,7 @@ size_t SdFile::write(const void* buf, uint16_t nbyte) {
         }
       } else {
         uint32_t next;
-        if (!vol_->fatGet(curCluster_, &next)) return false;
+        if (!nextCluster(&next)) return false;
         if (vol_->isEOC(next)) {
           // add cluster if at end of chain
           if (!addCluster()) goto writeErrorReturn;
@@ -1172,27 +2636,33 @@ size_t SdFile::write(const void* buf, uint16_t nbyte) {
 
     // block for data write
     uint32_t block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
-    if (n == 512) {
+    if (blockOffset == 0 && nToWrite >= 1024) {
+      // several whole blocks - one transfer for the contiguous part
+      uint32_t count;
+      if (!contiguousBlocks(nToWrite >> 9, true, &count)) {
+        goto writeErrorReturn;
+      }
+      n = count << 9;
+      vol_->cacheInvalidate(block, count);
+      if (!vol_->writeBlocks(block, src, count)) goto writeErrorReturn;
+      src += n;
+    } else if (n == 512) {
       // full block - don't need to use cache
       // invalidate cache if block is in cache
-      if (SdVolume::cacheBlockNumber_ == block) {
-        SdVolume::cacheBlockNumber_ = 0XFFFFFFFF;
-      }
+      vol_->cacheInvalidate(block, 1);
       if (!vol_->writeBlock(block, src)) goto writeErrorReturn;
       src += 512;
     } else {
       if (blockOffset == 0 && curPosition_ >= fileSize_) {
         // start of new block don't need to read into cache
-        if (!SdVolume::cacheFlush()) goto writeErrorReturn;
-        SdVolume::cacheBlockNumber_ = block;
-        SdVolume::cacheSetDirty();
+        if (!vol_->cacheZeroBlock(block)) goto writeErrorReturn;
       } else {
         // rewrite part of block
-        if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) {
+        if (!vol_->cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) {
           goto writeErrorReturn;
         }
       }
-      uint8_t* dst = SdVolume::cacheBuffer_.data + blockOffset;
+      uint8_t* dst = vol_->cacheBuffer()->data + blockOffset;
       uint8_t* end = dst + n;
       while (dst != end) *dst++ = *src++;
     }
@@ -1214,6 +2684,9 @@ size_t SdFile::write(const void* buf, uint16_t nbyte) {
   return nbyte;
 
  writeErrorReturn:
+  // clusters added past fileSize_ before the error would belong to no
+  // directory entry, an exFAT one only records them if they are reserved
+  if (growing && !(flags_ & F_RESERVED)) truncate(fileSize_);
   // return for write error
   //writeError = true;
   setWriteError();
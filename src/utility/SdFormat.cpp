@@ -0,0 +1,291 @@
+/* Arduino SdFat Library
+ * Copyright (C) 2009 by William Greiman
+ *
+ * This file is part of the Arduino SdFat Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino SdFat Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "SdFormat.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+//------------------------------------------------------------------------------
+/**
+ * Copy the files and directories in a host folder into a directory.
+ *
+ * Entries are copied in name order, so a folder always gives the same
+ * image.  Each file gets its clusters in one run where the volume has one
+ * and its whole blocks are written with a raw stream, see
+ * SdFile::rawStreamStart(); directories are made with SdFile::makeDir().
+ * Anything that is neither a file nor a directory is skipped.
+ *
+ * \param[in] dir An open directory of a mounted volume.
+ *
+ * \param[in] folder Path of the host folder.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure include a host file that can't be read or is 4 GiB
+ * or more, a name that is not valid on FAT or already in \a dir, a full
+ * volume or root directory, or an I/O error.
+ */
+uint8_t SdFormat::copyFolder(SdFile* dir, const char* folder) {
+  std::error_code ec;
+  std::vector<std::filesystem::directory_entry> entries;
+  for (std::filesystem::directory_iterator it(folder, ec), end;
+       !ec && it != end; it.increment(ec)) {
+    entries.push_back(*it);
+  }
+  if (ec) return false;
+  std::sort(entries.begin(), entries.end());
+
+  // concurrent readers wait for the whole copy
+  SdVolume* vol = dir->volume();
+  SdVolumeLock hold(vol);
+
+  // a name index saves rescanning the directory for each name created
+  uint8_t indexed = vol->dirIndexEnabled();
+  if (!indexed) vol->dirIndexEnable(true);
+  uint8_t ok = true;
+  for (size_t i = 0; ok && i < entries.size(); i++) {
+    std::string name = entries[i].path().filename().string();
+    std::string path = entries[i].path().string();
+    if (entries[i].is_directory(ec)) {
+      SdFile sub;
+      ok = sub.makeDir(dir, name.c_str()) && copyFolder(&sub, path.c_str());
+      sub.close();
+    } else if (entries[i].is_regular_file(ec)) {
+      ok = copyFile(dir, name.c_str(), path.c_str());
+    }
+  }
+  if (!indexed) vol->dirIndexEnable(false);
+  return ok;
+}
+//------------------------------------------------------------------------------
+// copy the host file at path into dir as name
+uint8_t SdFormat::copyFile(SdFile* dir, const char* name, const char* path) {
+  std::error_code ec;
+  uint64_t size = std::filesystem::file_size(path, ec);
+  if (ec || size > 0XFFFFFFFF) return false;
+  FILE* in = fopen(path, "rb");
+  if (!in) return false;
+  SdFile f;
+  if (!f.open(dir, name, O_CREAT | O_EXCL | O_WRITE)) {
+    fclose(in);
+    return false;
+  }
+  uint8_t ok = size == 0 || f.preallocate(size);
+  std::vector<uint8_t> buf(size < COPY_CHUNK ? size : COPY_CHUNK);
+
+  // whole blocks go straight to the card if the clusters are in one run
+  uint32_t blocks = size >> 9;
+  if (ok && blocks && f.rawStreamStart()) {
+    while (ok && blocks) {
+      uint32_t n = blocks < (COPY_CHUNK >> 9) ? blocks : COPY_CHUNK >> 9;
+      ok = fread(buf.data(), 512, n, in) == n && f.rawStreamWrite(buf.data(), n);
+      blocks -= n;
+    }
+    if (!f.rawStreamStop()) ok = false;
+  }
+  // the last partial block, or the whole file if it is not contiguous
+  while (ok) {
+    size_t n = fread(buf.data(), 1, buf.size() < 32768 ? buf.size() : 32768, in);
+    if (n == 0) break;
+    ok = f.write(buf.data(), n) == n;
+  }
+  if (ferror(in)) ok = false;
+  fclose(in);
+  if (!f.close()) ok = false;
+  return ok;
+}
+//------------------------------------------------------------------------------
+/**
+ * Create a card image holding an empty FAT16 or FAT32 volume.
+ *
+ * The image is a super floppy, with no partition table, and has two FATs.
+ * FAT16 has a 512 entry root directory; FAT32 has its root directory in
+ * cluster 2, an FSInfo sector and a backup boot sector.  The data region
+ * starts on a cluster boundary.  Any existing file at \a path is replaced,
+ * which must not be done to an image that is mounted.
+ *
+ * \param[in] path Path of the image file.
+ *
+ * \param[in] bytes Capacity, rounded down to whole blocks; at most
+ * 2 TiB - 512.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure include a FAT type or cluster size that is not
+ * supported, a capacity that gives the FAT type too few or too many
+ * clusters, or an I/O error.
+ */
+uint8_t SdFormat::format(const char* path, uint64_t bytes) {
+  uint64_t size = bytes & ~511ULL;
+  if (size >> 9 > 0XFFFFFFFF) return false;
+  uint32_t blocks = size >> 9;
+  uint32_t spc = clusterBytes_ >> 9;
+  if (clusterBytes_ &&
+    (spc == 0 || spc > 128 || (clusterBytes_ & (clusterBytes_ - 1)))) {
+    return false;
+  }
+  uint8_t type = fatType_;
+  if (type == 0) {
+    if (spc) {
+      type = blocks / spc <= FAT16_MAX_CLUSTERS ? 16 : 32;
+    } else {
+      type = size <= (2ULL << 30) ? 16 : 32;
+    }
+  }
+  if (type != 16 && type != 32) return false;
+
+  uint8_t fixed = spc != 0;
+  if (!fixed) {
+    spc = 1;
+    if (type == 32) {
+      // 4 KiB to 8 GiB, then as Windows does up to 32 KiB
+      spc = 8;
+      for (uint64_t limit = 8ULL << 30; size > limit && spc < 64; limit <<= 1) {
+        spc <<= 1;
+      }
+    }
+  }
+  uint16_t reserved;
+  uint32_t fatBlocks;
+  uint32_t clusters;
+  for (;;) {
+    if (!layout(type, blocks, spc, &reserved, &fatBlocks, &clusters)) {
+      return false;
+    }
+    if (type == 16) {
+      if (clusters <= FAT16_MAX_CLUSTERS) break;
+      if (fixed || spc == 128) return false;
+      spc <<= 1;
+    } else {
+      if (clusters > FAT16_MAX_CLUSTERS) break;
+      if (fixed || spc == 1) return false;
+      spc >>= 1;
+    }
+  }
+  if (type == 16 && clusters <= FAT12_MAX_CLUSTERS) return false;
+  if (type == 32 && clusters >= FAT32EOC_MIN - 2) return false;
+
+  // a sparse file reads as zeros, so only blocks with data are written;
+  // Sd2Card is not used since it will not write block zero
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) return false;
+  auto put = [&out](uint32_t n, const cache_t& b) {
+    out.seekp((std::streamoff)n << 9);
+    out.write(reinterpret_cast<const char*>(b.data), 512);
+    return !out.fail();
+  };
+  cache_t block;
+  memset(&block, 0, sizeof(block));
+  fbs_t* fbs = &block.fbs;
+  fbs->jmpToBootCode[0] = 0XEB;
+  fbs->jmpToBootCode[1] = type == 16 ? 0X3C : 0X58;
+  fbs->jmpToBootCode[2] = 0X90;
+  memcpy(fbs->oemName, "SdFormat", 8);
+  fbs->bpb.bytesPerSector = 512;
+  fbs->bpb.sectorsPerCluster = spc;
+  fbs->bpb.reservedSectorCount = reserved;
+  fbs->bpb.fatCount = 2;
+  fbs->bpb.mediaType = 0XF8;
+  fbs->bpb.sectorsPerTrtack = 63;
+  fbs->bpb.headCount = 255;
+  if (type == 16) {
+    fbs->bpb.rootDirEntryCount = 512;
+    fbs->bpb.sectorsPerFat16 = fatBlocks;
+  } else {
+    fbs->bpb.sectorsPerFat32 = fatBlocks;
+    fbs->bpb.fat32RootCluster = 2;
+    fbs->bpb.fat32FSInfo = 1;
+    fbs->bpb.fat32BackBootBlock = 6;
+  }
+  if (type == 16 && blocks < 0X10000) {
+    fbs->bpb.totalSectors16 = blocks;
+  } else {
+    fbs->bpb.totalSectors32 = blocks;
+  }
+  // FAT32 keeps the extended fields after its larger BPB
+  uint8_t* ext = type == 16 ? block.data + 36 : &fbs->driveNumber;
+  ext[0] = 0X80;
+  ext[2] = 0X29;
+  uint32_t serial = (uint32_t)time(0) ^ blocks;
+  memcpy(ext + 3, &serial, 4);
+  memcpy(ext + 7, "NO NAME    ", 11);
+  memcpy(ext + 18, type == 16 ? "FAT16   " : "FAT32   ", 8);
+  fbs->bootSectorSig0 = BOOTSIG0;
+  fbs->bootSectorSig1 = BOOTSIG1;
+  if (!put(0, block)) return false;
+  if (type == 32) {
+    if (!put(6, block)) return false;
+
+    // everything is free but the root directory
+    memset(&block, 0, sizeof(block));
+    block.fsinfo.leadSignature = FSINFO_LEAD_SIG;
+    block.fsinfo.structSignature = FSINFO_STRUCT_SIG;
+    block.fsinfo.freeCount = clusters - 1;
+    block.fsinfo.nextFree = 3;
+    block.fsinfo.trailSignature = FSINFO_TRAIL_SIG;
+    if (!put(1, block) || !put(7, block)) return false;
+  }
+  // media type and end of chain entries, and the FAT32 root directory
+  memset(&block, 0, sizeof(block));
+  if (type == 16) {
+    block.fat16[0] = 0XFFF8;
+    block.fat16[1] = FAT16EOC;
+  } else {
+    block.fat32[0] = 0X0FFFFFF8;
+    block.fat32[1] = FAT32EOC;
+    block.fat32[2] = FAT32EOC;
+  }
+  for (uint8_t i = 0; i < 2; i++) {
+    if (!put(reserved + i * fatBlocks, block)) return false;
+  }
+  out.close();
+  if (out.fail()) return false;
+  std::error_code ec;
+  std::filesystem::resize_file(path, size, ec);
+  return !ec;
+}
+//------------------------------------------------------------------------------
+// Place the reserved area, FATs and FAT16 root directory of a volume of
+// blocks with spc blocks per cluster.  Reserved blocks are added to start
+// the data region on a cluster boundary.
+uint8_t SdFormat::layout(uint8_t type, uint32_t blocks, uint32_t spc,
+                         uint16_t* reserved, uint32_t* fatBlocks,
+                         uint32_t* clusters) {
+  uint32_t rootBlocks = type == 16 ? 32 : 0;
+  uint32_t r = type == 16 ? 1 : 32;
+  if (blocks <= r + rootBlocks + 2) return false;
+
+  // each FAT covers every cluster the volume could have without them
+  uint64_t most = (blocks - r - rootBlocks) / spc;
+  uint32_t fb = ((most + 2) * (type == 16 ? 2 : 4) + 511) / 512;
+  uint64_t meta = r + 2ULL * fb + rootBlocks;
+  r += (spc - meta % spc) % spc;
+  meta = r + 2ULL * fb + rootBlocks;
+  if (meta + spc > blocks || (type == 16 && fb > 0XFFFF)) return false;
+
+  *reserved = r;
+  *fatBlocks = fb;
+  *clusters = (blocks - meta) / spc;
+  return true;
+}
@@ -0,0 +1,70 @@
+/* Arduino SdFat Library
+ * Copyright (C) 2009 by William Greiman
+ *
+ * This file is part of the Arduino SdFat Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino SdFat Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef SdFormat_h
+#define SdFormat_h
+/**
+ * \file
+ * SdFormat class, builds FAT16 and FAT32 card images on the host
+ */
+#include "SdFat.h"
+//------------------------------------------------------------------------------
+/**
+ * \class SdFormat
+ * \brief Create a FAT16 or FAT32 card image and fill it from a host folder
+ *
+ * format() writes a sparse image file: only the boot sector, FSInfo and
+ * the first block of each FAT are written, so the time taken does not
+ * depend on the capacity.  copyFolder() copies a host directory tree into
+ * a mounted volume through SdFile, so names are made the way SdFile makes
+ * them.  Each file's clusters are reserved in one run and its data is
+ * written with raw multiple block writes.
+ */
+class SdFormat {
+ public:
+  /**
+   * \param[in] fatType 16 or 32, or zero for FAT16 up to 2 GiB and FAT32
+   * above, as on SD and SDHC cards.
+   *
+   * \param[in] clusterBytes Cluster size, a power of two from 512 to
+   * 65536, or zero for the smallest size that gives the FAT type a legal
+   * cluster count; on FAT32 at least 4 KiB up to 8 GiB, doubling with the
+   * capacity up to 32 KiB.
+   */
+  explicit SdFormat(uint8_t fatType = 0, uint32_t clusterBytes = 0)
+    : fatType_(fatType), clusterBytes_(clusterBytes) {}
+  uint8_t copyFolder(SdFile* dir, const char* folder);
+  uint8_t format(const char* path, uint64_t bytes);
+
+ private:
+  // most clusters a FAT12 and a FAT16 volume can have
+  static uint32_t const FAT12_MAX_CLUSTERS = 4084;
+  static uint32_t const FAT16_MAX_CLUSTERS = 65524;
+  // bytes read from a host file per raw write
+  static uint32_t const COPY_CHUNK = 1UL << 20;
+
+  uint8_t fatType_;
+  uint32_t clusterBytes_;
+
+  uint8_t copyFile(SdFile* dir, const char* name, const char* path);
+  static uint8_t layout(uint8_t type, uint32_t blocks, uint32_t spc,
+                        uint16_t* reserved, uint32_t* fatBlocks,
+                        uint32_t* clusters);
+};
+#endif  // SdFormat_h
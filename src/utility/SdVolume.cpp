@@ -18,14 +18,11 @@
  * <http://www.gnu.org/licenses/>.
  */
 #include "SdFat.h"
-//------------------------------------------------------------------------------
-// raw block cache
-// init cacheBlockNumber_to invalid SD block number
-uint32_t SdVolume::cacheBlockNumber_ = 0XFFFFFFFF;
-cache_t  SdVolume::cacheBuffer_;     // 512 byte cache for Sd2Card
-Sd2Card* SdVolume::sdCard_;          // pointer to SD card object
-uint8_t  SdVolume::cacheDirty_ = 0;  // cacheFlush() will write block if true
-uint32_t SdVolume::cacheMirrorBlock_ = 0;  // mirror  block for second FAT
+#include <string.h>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>
+#include <vector>
 //------------------------------------------------------------------------------
 // find a contiguous group of clusters
 uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
@@ -55,24 +52,44 @@ uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
   // last cluster of FAT
   uint32_t fatEnd = clusterCount_ + 1;
 
-  // search the FAT for free clusters
-  for (uint32_t n = 0;; n++, endCluster++) {
-    // can't find space checked all clusters
-    if (n >= clusterCount_) return false;
+  // a FAT32 volume mounted from its FSInfo has no map until one is needed;
+  // runs are found much faster in the map than in the FAT
+  if (!freeMap_ && fatType_ == 32 && count > 1 && !freeMapInit()) {
+    return false;
+  }
+  if (freeMap_) {
+    // search the free cluster map, wrapping to the beginning once
+    uint32_t found = 0;
+    if (bgnCluster <= fatEnd) found = freeMapFind(bgnCluster, fatEnd, count);
+    if (!found) found = freeMapFind(2, fatEnd, count);
+    if (!found) return false;
+    bgnCluster = found;
+    endCluster = found + count - 1;
+  } else {
+    // search the FAT for free clusters
+    for (uint32_t n = 0;; n++, endCluster++) {
+      // can't find space checked all clusters
+      if (n >= clusterCount_) return false;
 
-    // past end - start from beginning of FAT
-    if (endCluster > fatEnd) {
-      bgnCluster = endCluster = 2;
-    }
-    uint32_t f;
-    if (!fatGet(endCluster, &f)) return false;
+      // no free cluster near the hint, build the map and search that
+      if (n == SD_FAT_SCAN_MAX && fatType_ == 32) {
+        return freeMapInit() && allocContiguous(count, curCluster);
+      }
 
-    if (f != 0) {
-      // cluster in use try next cluster as bgnCluster
-      bgnCluster = endCluster + 1;
-    } else if ((endCluster - bgnCluster + 1) == count) {
-      // done - found space
-      break;
+      // past end - start from beginning of FAT
+      if (endCluster > fatEnd) {
+        bgnCluster = endCluster = 2;
+      }
+      uint32_t f;
+      if (!fatGet(endCluster, &f)) return false;
+
+      if (f != 0) {
+        // cluster in use try next cluster as bgnCluster
+        bgnCluster = endCluster + 1;
+      } else if ((endCluster - bgnCluster + 1) == count) {
+        // done - found space
+        break;
+      }
     }
   }
   // mark end of chain
@@ -96,48 +113,218 @@ uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
   return true;
 }
 //------------------------------------------------------------------------------
+// Allocate count clusters in a row in the free cluster map only, for exFAT
+// files whose clusters are contiguous and not in the FAT.  A non-zero
+// *curCluster asks for the clusters right after it and fails if they are
+// not free.  The first new cluster is returned in *curCluster.
+uint8_t SdVolume::allocUnchained(uint32_t count, uint32_t* curCluster) {
+  if (!freeMap_ || count == 0) return false;
+
+  // last cluster of FAT
+  uint32_t fatEnd = clusterCount_ + 1;
+  uint32_t found;
+  if (*curCluster) {
+    uint32_t first = *curCluster + 1;
+    if (first > fatEnd || count - 1 > fatEnd - first) return false;
+    found = freeMapFind(first, first + count - 1, count);
+    if (found != first) return false;
+  } else {
+    found = 0;
+    if (allocSearchStart_ <= fatEnd) {
+      found = freeMapFind(allocSearchStart_, fatEnd, count);
+    }
+    if (!found) found = freeMapFind(2, fatEnd, count);
+    if (!found) return false;
+
+    // remember possible next free cluster
+    if (count == 1) allocSearchStart_ = found + 1;
+  }
+  for (uint32_t c = found; c < found + count; c++) {
+    if (!freeMapSet(c, true)) return false;
+  }
+  *curCluster = found;
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * Write back all dirty blocks and empty the cache.
+ *
+ * \return A pointer to a 512 byte buffer that is not caching any block.
+ */
+uint8_t* SdVolume::cacheClear(void) {
+  cacheFlush();
+  for (uint8_t i = 0; i < cacheSlotCount_; i++) {
+    cacheSlots_[i] = cache_slot_t();
+  }
+  cacheCurrent_ = &cacheSlots_[cacheFatSlots_];
+  // the caller may write the card directly
+  readAheadCount_ = 0;
+  return cacheCurrent_->buffer.data;
+}
+//------------------------------------------------------------------------------
+uint8_t SdVolume::cacheConfigure(uint8_t fatSlots, uint8_t dataSlots) {
+  if (fatSlots == 0 || dataSlots == 0 ||
+    fatSlots + dataSlots > SD_CACHE_MAX_SLOTS) {
+    return false;
+  }
+  if (!cacheFlush()) return false;
+  cacheClear();
+  cacheFatSlots_ = fatSlots;
+  cacheSlotCount_ = fatSlots + dataSlots;
+  cacheCurrent_ = &cacheSlots_[cacheFatSlots_];
+  return true;
+}
+//------------------------------------------------------------------------------
+// find the slot holding blockNumber, zero if not cached
+cache_slot_t* SdVolume::cacheFind(uint32_t blockNumber) {
+  if (cacheCurrent_->blockNumber == blockNumber) return cacheCurrent_;
+  for (uint8_t i = 0; i < cacheSlotCount_; i++) {
+    if (cacheSlots_[i].blockNumber == blockNumber) return &cacheSlots_[i];
+  }
+  return 0;
+}
+//------------------------------------------------------------------------------
 uint8_t SdVolume::cacheFlush(void) {
-  if (cacheDirty_) {
-    if (!sdCard_->writeBlock(cacheBlockNumber_, cacheBuffer_.data)) {
+  // lowest dirty block first so the card is written in block order
+  while (true) {
+    cache_slot_t* next = 0;
+    for (uint8_t i = 0; i < cacheSlotCount_; i++) {
+      cache_slot_t* slot = &cacheSlots_[i];
+      if (slot->dirty && (!next || slot->blockNumber < next->blockNumber)) {
+        next = slot;
+      }
+    }
+    if (!next) break;
+    if (!cacheWriteBack(next)) return false;
+  }
+  return fatCopyFlush();
+}
+//------------------------------------------------------------------------------
+void SdVolume::cacheInvalidate(uint32_t block, uint32_t count) {
+  for (uint8_t i = 0; i < cacheSlotCount_; i++) {
+    cache_slot_t* slot = &cacheSlots_[i];
+    if (slot->blockNumber - block < count) {
+      slot->blockNumber = 0XFFFFFFFF;
+      slot->mirrorBlock = 0;
+      slot->mirrorCount = 0;
+      slot->dirty = 0;
+    }
+  }
+  if (block < readAheadBlock_ + readAheadCount_ &&
+    readAheadBlock_ < block + count) {
+    readAheadCount_ = 0;
+  }
+  stripeInvalidate(block, count);
+}
+//------------------------------------------------------------------------------
+// cacheRawBlock() when the block is not the current one
+uint8_t SdVolume::cacheLoad(uint32_t blockNumber, uint8_t action,
+                            uint8_t pool) {
+  cache_slot_t* slot = cacheFind(blockNumber);
+  if (slot) {
+    if (pool == CACHE_POOL_FAT) {
+      cacheStats_.fatHits++;
+    } else {
+      cacheStats_.dataHits++;
+    }
+  } else {
+    if (pool == CACHE_POOL_FAT) {
+      cacheStats_.fatMisses++;
+    } else {
+      cacheStats_.dataMisses++;
+    }
+    slot = cacheVictim(pool);
+    if (!cacheWriteBack(slot)) return false;
+    slot->blockNumber = 0XFFFFFFFF;
+    if (!readAheadCopy(blockNumber, 0, 512, slot->buffer.data) &&
+      !sdCard_->readBlock(blockNumber, slot->buffer.data)) {
       return false;
     }
-    // mirror FAT tables
-    if (cacheMirrorBlock_) {
-      if (!sdCard_->writeBlock(cacheMirrorBlock_, cacheBuffer_.data)) {
-        return false;
-      }
-      cacheMirrorBlock_ = 0;
+    slot->blockNumber = blockNumber;
+  }
+  slot->lastUse = ++cacheClock_;
+  slot->dirty |= action;
+  cacheCurrent_ = slot;
+  return true;
+}
+//------------------------------------------------------------------------------
+uint8_t SdVolume::cacheSync(uint32_t block, uint32_t count) {
+  for (uint8_t i = 0; i < cacheSlotCount_; i++) {
+    cache_slot_t* slot = &cacheSlots_[i];
+    if (slot->blockNumber - block < count && !cacheWriteBack(slot)) {
+      return false;
     }
-    cacheDirty_ = 0;
   }
   return true;
 }
 //------------------------------------------------------------------------------
-uint8_t SdVolume::cacheRawBlock(uint32_t blockNumber, uint8_t action) {
-  if (cacheBlockNumber_ != blockNumber) {
-    if (!cacheFlush()) return false;
-    if (!sdCard_->readBlock(blockNumber, cacheBuffer_.data)) return false;
-    cacheBlockNumber_ = blockNumber;
+// least recently used slot of a pool, an empty slot if there is one
+cache_slot_t* SdVolume::cacheVictim(uint8_t pool) {
+  uint8_t first = pool == CACHE_POOL_FAT ? 0 : cacheFatSlots_;
+  uint8_t end = pool == CACHE_POOL_FAT ? cacheFatSlots_ : cacheSlotCount_;
+  cache_slot_t* victim = &cacheSlots_[first];
+  // with FAT write back a dirty FAT block stays while a clean one can go
+  uint8_t keepDirty = pool == CACHE_POOL_FAT && fatWriteBack_;
+  for (uint8_t i = first; i < end; i++) {
+    cache_slot_t* slot = &cacheSlots_[i];
+    if (slot->blockNumber == 0XFFFFFFFF) return slot;
+    if (keepDirty && !slot->dirty != !victim->dirty) {
+      if (!slot->dirty) victim = slot;
+    } else if (slot->lastUse < victim->lastUse) {
+      victim = slot;
+    }
+  }
+  return victim;
+}
+//------------------------------------------------------------------------------
+uint8_t SdVolume::cacheWriteBack(cache_slot_t* slot) {
+  if (slot->dirty) {
+    if (!writeBlock(slot->blockNumber, slot->buffer.data)) {
+      return false;
+    }
+    // mirror FAT tables now or at the next cacheFlush()
+    if (slot->mirrorCount) {
+      uint32_t stride = slot->mirrorBlock - slot->blockNumber;
+      if (!fatWriteBack_ ||
+        !fatCopyPending(slot->blockNumber, stride, slot->mirrorCount)) {
+        if (!fatCopyWrite(slot->blockNumber, slot->buffer.data, 1, stride,
+                          slot->mirrorCount)) {
+          return false;
+        }
+      }
+      slot->mirrorBlock = 0;
+      slot->mirrorCount = 0;
+    }
+    // keep a read-ahead copy of the block current
+    if (readAheadContains(slot->blockNumber)) {
+      memcpy(readAheadBuffer_ + ((slot->blockNumber - readAheadBlock_) << 9),
+             slot->buffer.data, 512);
+    }
+    slot->dirty = 0;
+    cacheStats_.writeBacks++;
   }
-  cacheDirty_ |= action;
   return true;
 }
 //------------------------------------------------------------------------------
 // cache a zero block for blockNumber
 uint8_t SdVolume::cacheZeroBlock(uint32_t blockNumber) {
-  if (!cacheFlush()) return false;
-
-  // loop take less flash than memset(cacheBuffer_.data, 0, 512);
-  for (uint16_t i = 0; i < 512; i++) {
-    cacheBuffer_.data[i] = 0;
+  cache_slot_t* slot = cacheFind(blockNumber);
+  if (!slot) {
+    slot = cacheVictim(0);
+    if (!cacheWriteBack(slot)) return false;
   }
-  cacheBlockNumber_ = blockNumber;
+  memset(slot->buffer.data, 0, 512);
+  slot->blockNumber = blockNumber;
+  slot->mirrorBlock = 0;
+  slot->mirrorCount = 0;
+  slot->lastUse = ++cacheClock_;
+  cacheCurrent_ = slot;
   cacheSetDirty();
   return true;
 }
 //------------------------------------------------------------------------------
 // return the size in bytes of a cluster chain
-uint8_t SdVolume::chainSize(uint32_t cluster, uint32_t* size) const {
+uint8_t SdVolume::chainSize(uint32_t cluster, uint32_t* size) {
   uint32_t s = 0;
   do {
     if (!fatGet(cluster, &cluster)) return false;
@@ -147,18 +334,287 @@ uint8_t SdVolume::chainSize(uint32_t cluster, uint32_t* size) const {
   return true;
 }
 //------------------------------------------------------------------------------
+// set *isFree if cluster is free, from freeMap_ if there is one since exFAT
+// does not keep free clusters zero in the FAT
+uint8_t SdVolume::clusterFree(uint32_t cluster, uint8_t* isFree) {
+  if (cluster < 2 || cluster > clusterCount_ + 1) {
+    *isFree = false;
+    return true;
+  }
+  if (freeMap_) {
+    *isFree = !(freeMap_[cluster >> 5] & (1UL << (cluster & 31)));
+    return true;
+  }
+  uint32_t f;
+  if (!fatGet(cluster, &f)) return false;
+  *isFree = f == 0;
+  return true;
+}
+//------------------------------------------------------------------------------
+uint8_t SdVolume::concurrentEnable(uint8_t enable) {
+  if (!enable) {
+    if (!concurrentEnabled()) return true;
+    // readers use the stripes until they let go of lock_
+    SdVolumeLock hold(this);
+    delete[] stripes_.exchange(0);
+    return true;
+  }
+  if (!sdCard_ || !sdCard_->isImage()) return false;
+  if (!concurrentEnabled()) stripes_ = new cache_stripe_t[SD_CACHE_STRIPES];
+  return true;
+}
+//------------------------------------------------------------------------------
+void SdVolume::dirIndexClear(void) {
+  for (uint8_t i = 0; i < SD_DIR_INDEXES; i++) dirIndexes_[i].clear();
+}
+//------------------------------------------------------------------------------
+// forget the index of a directory that is being removed
+void SdVolume::dirIndexDrop(uint32_t dirCluster) {
+  for (uint8_t i = 0; i < SD_DIR_INDEXES; i++) {
+    if (dirIndexes_[i].valid_ && dirIndexes_[i].dirCluster_ == dirCluster) {
+      dirIndexes_[i].clear();
+    }
+  }
+}
+//------------------------------------------------------------------------------
+// a directory entry is being deleted, remove it from whichever index has it
+void SdVolume::dirIndexErase(const uint8_t* name, uint32_t block,
+                             uint8_t dirIndex, uint8_t lfnCount) {
+  for (uint8_t i = 0; i < SD_DIR_INDEXES; i++) {
+    if (dirIndexes_[i].valid_ &&
+      dirIndexes_[i].erase(name, block, dirIndex, lfnCount)) {
+      return;
+    }
+  }
+}
+//------------------------------------------------------------------------------
+// the index for a directory, or an empty one recycled for it
+SdDirIndex* SdVolume::dirIndexFor(uint32_t dirCluster) {
+  SdDirIndex* victim = &dirIndexes_[0];
+  for (uint8_t i = 0; i < SD_DIR_INDEXES; i++) {
+    SdDirIndex* index = &dirIndexes_[i];
+    if (index->valid_ && index->dirCluster_ == dirCluster) {
+      index->lastUse_ = ++dirIndexClock_;
+      return index;
+    }
+    if (!index->valid_) {
+      if (victim->valid_) victim = index;
+    } else if (victim->valid_ && index->lastUse_ < victim->lastUse_) {
+      victim = index;
+    }
+  }
+  victim->clear();
+  victim->dirCluster_ = dirCluster;
+  victim->lastUse_ = ++dirIndexClock_;
+  return victim;
+}
+//------------------------------------------------------------------------------
+// Mount the exFAT volume whose boot sector is in the cache.  The layout
+// comes from the boot sector; the allocation bitmap and up-case table are
+// found through their entries in the root directory.
+uint8_t SdVolume::exFatInit(uint32_t volumeStartBlock) {
+  exfat_fbs_t* fbs = &cacheBuffer()->exfbs;
+  // 512 byte sectors, one FAT and no more than the 32 MiB clusters exFAT
+  // allows; a second FAT is only used by TexFAT
+  if (fbs->bytesPerSectorShift != 9 ||
+    fbs->numberOfFats != 1 ||
+    fbs->sectorsPerClusterShift > 16) {
+    return false;
+  }
+  clusterSizeShift_ = fbs->sectorsPerClusterShift;
+  blocksPerCluster_ = 1UL << clusterSizeShift_;
+  fatCount_ = 1;
+  blocksPerFat_ = fbs->fatLength;
+  fatStartBlock_ = volumeStartBlock + fbs->fatOffset;
+  dataStartBlock_ = volumeStartBlock + fbs->clusterHeapOffset;
+  clusterCount_ = fbs->clusterCount;
+  rootDirEntryCount_ = 0;
+  rootDirStart_ = fbs->rootDirectoryCluster;
+
+  // cluster numbers must fit the 28 bits fatGet() keeps of an entry
+  if (clusterCount_ == 0 || clusterCount_ >= FAT32EOC_MIN - 2 ||
+    clusterCount_ + 2 > 128 * blocksPerFat_ ||
+    rootDirStart_ < 2 || rootDirStart_ > clusterCount_ + 1) {
+    return false;
+  }
+  fatType_ = 64;
+
+  // the bitmap and up-case table entries are at the start of the root
+  uint32_t bitmapCluster = 0;
+  uint32_t bitmapLength = 0;
+  uint32_t upcaseCluster = 0;
+  uint32_t upcaseLength = 0;
+  uint32_t cluster = rootDirStart_;
+  uint8_t done = false;
+  while (!done) {
+    for (uint32_t b = 0; b < blocksPerCluster_ && !done; b++) {
+      if (!cacheRawBlock(clusterStartBlock(cluster) + b, CACHE_FOR_READ)) {
+        return false;
+      }
+      for (uint8_t i = 0; i < 16 && !done; i++) {
+        const exdir_alloc_t* e =
+          reinterpret_cast<const exdir_alloc_t*>(cacheBuffer()->dir + i);
+        if (e->type == EXFAT_TYPE_BITMAP && !(e->flags & 1)) {
+          bitmapCluster = e->firstCluster;
+          bitmapLength = e->dataLength;
+        } else if (e->type == EXFAT_TYPE_UPCASE) {
+          upcaseCluster = e->firstCluster;
+          upcaseLength = e->dataLength;
+        }
+        done = e->type == EXFAT_TYPE_END || (bitmapCluster && upcaseCluster);
+      }
+    }
+    if (!done) {
+      if (!fatGet(cluster, &cluster)) return false;
+      done = isEOC(cluster);
+    }
+  }
+  if (bitmapCluster < 2 || bitmapCluster > clusterCount_ + 1 ||
+    bitmapLength < (clusterCount_ + 7) / 8 || upcaseCluster == 0) {
+    return false;
+  }
+  // freeMapSet() writes the bitmap as one run of blocks
+  uint32_t bitmapClusters = ((bitmapLength - 1) >> (clusterSizeShift_ + 9)) + 1;
+  for (uint32_t c = bitmapCluster; c + 1 < bitmapCluster + bitmapClusters; c++) {
+    uint32_t next;
+    if (!fatGet(c, &next)) return false;
+    if (next != c + 1) return false;
+  }
+  bitmapStartBlock_ = clusterStartBlock(bitmapCluster);
+  if (!exUpcaseInit(upcaseCluster, upcaseLength)) return false;
+  return freeMapInit();
+}
+//------------------------------------------------------------------------------
+// Load the up-case table.  On the card it is compressed: a run of
+// characters that are their own upper case is 0XFFFF and the run length.
+// Only the characters that change are kept.
+uint8_t SdVolume::exUpcaseInit(uint32_t cluster, uint32_t length) {
+  uint32_t entries = length / 2;
+  if (entries == 0) return false;
+
+  // every entry could be a character that changes
+  uint16_t* pairs = new uint16_t[2 * entries];
+  uint32_t count = 0;
+  uint32_t c = 0;        // character the next entry is for
+  uint8_t run = false;   // next entry is the length of an unchanged run
+  uint32_t block = 0;    // blocks of cluster read
+  for (uint32_t i = 0; i < entries; i++) {
+    if ((i & 0XFF) == 0) {
+      if (block == blocksPerCluster_) {
+        if (!fatGet(cluster, &cluster) || isEOC(cluster)) {
+          delete[] pairs;
+          return false;
+        }
+        block = 0;
+      }
+      if (!cacheRawBlock(clusterStartBlock(cluster) + block++,
+                         CACHE_FOR_READ)) {
+        delete[] pairs;
+        return false;
+      }
+    }
+    uint16_t u = cacheBuffer()->fat16[i & 0XFF];
+    if (run) {
+      c += u;
+      run = false;
+    } else if (u == 0XFFFF) {
+      run = true;
+    } else {
+      if (u != c && c <= 0XFFFF) {
+        pairs[2 * count] = c;
+        pairs[2 * count + 1] = u;
+        count++;
+      }
+      c++;
+    }
+  }
+  upcase_ = pairs;
+  upcaseCount_ = count;
+  return true;
+}
+//------------------------------------------------------------------------------
+// write the FAT copies cacheWriteBack() left for later, adjacent blocks
+// in one transfer
+uint8_t SdVolume::fatCopyFlush(void) {
+  uint8_t i = 0;
+  while (i < fatPendingCount_) {
+    uint32_t block = fatPending_[i];
+    uint8_t n = 1;
+    while (i + n < fatPendingCount_ && n < SD_FAT_COPY_RUN &&
+      fatPending_[i + n] == block + n) {
+      n++;
+    }
+    // cached blocks are at least as new as the first copy on the card
+    uint8_t cached = true;
+    for (uint8_t j = 0; j < n && cached; j++) {
+      cache_slot_t* slot = cacheFind(block + j);
+      if (slot) {
+        memcpy(fatCopyBuffer_ + (j << 9), slot->buffer.data, 512);
+      } else {
+        cached = false;
+      }
+    }
+    if (!cached && !sdCard_->readBlocks(block, fatCopyBuffer_, n)) {
+      return false;
+    }
+    if (!fatCopyWrite(block, fatCopyBuffer_, n, fatPendingStride_,
+                      fatPendingCopies_)) {
+      return false;
+    }
+    i += n;
+  }
+  fatPendingCount_ = 0;
+  return true;
+}
+//------------------------------------------------------------------------------
+// add a FAT block to the ones whose copies wait for fatCopyFlush(), false
+// if the list is full or holds blocks of a FAT with another layout
+uint8_t SdVolume::fatCopyPending(uint32_t block, uint32_t stride,
+                                 uint8_t copies) {
+  if (fatPendingCount_ &&
+    (stride != fatPendingStride_ || copies != fatPendingCopies_)) {
+    return false;
+  }
+  uint8_t i = 0;
+  while (i < fatPendingCount_ && fatPending_[i] < block) i++;
+  if (i < fatPendingCount_ && fatPending_[i] == block) return true;
+  if (fatPendingCount_ == SD_FAT_PENDING_MAX) return false;
+  memmove(&fatPending_[i + 1], &fatPending_[i],
+          (fatPendingCount_ - i) * sizeof(fatPending_[0]));
+  fatPending_[i] = block;
+  fatPendingCount_++;
+  fatPendingStride_ = stride;
+  fatPendingCopies_ = copies;
+  return true;
+}
+//------------------------------------------------------------------------------
+// write count FAT blocks from src to the copies after the first
+uint8_t SdVolume::fatCopyWrite(uint32_t block, const uint8_t* src,
+                               uint32_t count, uint32_t stride,
+                               uint8_t copies) {
+  for (uint8_t k = 1; k <= copies; k++) {
+    if (!writeBlocks(block + k * stride, src, count)) return false;
+    cacheStats_.fatCopyWrites += count;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+uint8_t SdVolume::fatWriteBackEnable(uint8_t enable) {
+  fatWriteBack_ = enable;
+  // copies left for later go out now if nothing will leave more
+  return enable || fatCopyFlush();
+}
+//------------------------------------------------------------------------------
 // Fetch a FAT entry
-uint8_t SdVolume::fatGet(uint32_t cluster, uint32_t* value) const {
+uint8_t SdVolume::fatGet(uint32_t cluster, uint32_t* value) {
   if (cluster > (clusterCount_ + 1)) return false;
   uint32_t lba = fatStartBlock_;
   lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
-  if (lba != cacheBlockNumber_) {
-    if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
-  }
+  if (!cacheRawBlock(lba, CACHE_FOR_READ, CACHE_POOL_FAT)) return false;
   if (fatType_ == 16) {
-    *value = cacheBuffer_.fat16[cluster & 0XFF];
+    *value = cacheBuffer()->fat16[cluster & 0XFF];
   } else {
-    *value = cacheBuffer_.fat32[cluster & 0X7F] & FAT32MASK;
+    *value = cacheBuffer()->fat32[cluster & 0X7F] & FAT32MASK;
   }
   return true;
 }
@@ -175,42 +631,321 @@ uint8_t SdVolume::fatPut(uint32_t cluster, uint32_t value) {
   uint32_t lba = fatStartBlock_;
   lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
 
-  if (lba != cacheBlockNumber_) {
-    if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
-  }
+  if (!cacheRawBlock(lba, CACHE_FOR_WRITE, CACHE_POOL_FAT)) return false;
   // store entry
+  uint32_t old;
   if (fatType_ == 16) {
-    cacheBuffer_.fat16[cluster & 0XFF] = value;
+    old = cacheBuffer()->fat16[cluster & 0XFF];
+    cacheBuffer()->fat16[cluster & 0XFF] = value;
   } else {
-    cacheBuffer_.fat32[cluster & 0X7F] = value;
+    old = cacheBuffer()->fat32[cluster & 0X7F];
+    cacheBuffer()->fat32[cluster & 0X7F] = value;
   }
-  cacheSetDirty();
 
-  // mirror second FAT
-  if (fatCount_ > 1) cacheMirrorBlock_ = lba + blocksPerFat_;
-  return true;
+  // mirror to the other FATs
+  if (fatCount_ > 1) cacheSetMirror(lba + blocksPerFat_, fatCount_ - 1);
+
+  // keep the free cluster map in step, or without one the FSInfo count
+  if (!freeMap_) {
+    if (freeClusters_ != FSINFO_UNKNOWN && !old != !value) {
+      if (value) {
+        freeClusters_--;
+      } else {
+        freeClusters_++;
+      }
+      fsInfoDirty_ = true;
+    }
+    return true;
+  }
+  return freeMapSet(cluster, value != 0);
+}
+//------------------------------------------------------------------------------
+// chain count clusters from cluster in the FAT and end the chain there
+uint8_t SdVolume::fatPutRun(uint32_t cluster, uint32_t count) {
+  uint32_t last = cluster + count - 1;
+  for (uint32_t c = cluster; c < last; c++) {
+    if (!fatPut(c, c + 1)) return false;
+  }
+  return fatPutEOC(last);
 }
 //------------------------------------------------------------------------------
 // free a cluster chain
 uint8_t SdVolume::freeChain(uint32_t cluster) {
+  return freeChains(&cluster, 1);
+}
+//------------------------------------------------------------------------------
+// Free the count cluster chains that start at first.  The chains are read
+// first, then the clusters are sorted and each FAT block is changed once,
+// with one mirror for the other FATs, rather than once per cluster.
+// Nothing is freed if a chain can't be read.
+uint8_t SdVolume::freeChains(const uint32_t* first, uint32_t count) {
   // clear free cluster location
   allocSearchStart_ = 2;
 
-  do {
-    uint32_t next;
-    if (!fatGet(cluster, &next)) return false;
+  std::vector<uint32_t> clusters;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t cluster = first[i];
+    do {
+      // a chain longer than the volume has a loop
+      if (clusters.size() > clusterCount_) return false;
+      clusters.push_back(cluster);
+      if (!fatGet(cluster, &cluster)) return false;
+    } while (!isEOC(cluster));
+  }
+  std::sort(clusters.begin(), clusters.end());
 
-    // free cluster
-    if (!fatPut(cluster, 0)) return false;
+  uint8_t shift = fatType_ == 16 ? 8 : 7;
+  for (size_t i = 0; i < clusters.size();) {
+    // error if reserved cluster, fatGet() checked the end of the FAT
+    if (clusters[i] < 2) return false;
+    uint32_t lba = fatStartBlock_ + (clusters[i] >> shift);
+    if (!cacheRawBlock(lba, CACHE_FOR_WRITE, CACHE_POOL_FAT)) return false;
+    cache_t* b = cacheBuffer();
 
-    cluster = next;
-  } while (!isEOC(cluster));
+    // clear the entries in this block, keeping the ones that were in use
+    size_t end = i;
+    size_t used = i;
+    for (; end < clusters.size() &&
+         fatStartBlock_ + (clusters[end] >> shift) == lba; end++) {
+      uint32_t c = clusters[end];
+      uint32_t old;
+      if (fatType_ == 16) {
+        old = b->fat16[c & 0XFF];
+        b->fat16[c & 0XFF] = 0;
+      } else {
+        old = b->fat32[c & 0X7F];
+        b->fat32[c & 0X7F] = 0;
+      }
+      if (old) clusters[used++] = c;
+    }
+    if (fatCount_ > 1) cacheSetMirror(lba + blocksPerFat_, fatCount_ - 1);
 
+    // the map may cache another block, so it is updated after the FAT
+    if (!freeMap_) {
+      if (freeClusters_ != FSINFO_UNKNOWN && used > i) {
+        freeClusters_ += used - i;
+        fsInfoDirty_ = true;
+      }
+    } else {
+      for (size_t k = i; k < used; k++) {
+        if (!freeMapSet(clusters[k], false)) return false;
+      }
+    }
+    i = end;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// free count clusters from cluster that are not in the FAT
+uint8_t SdVolume::freeUnchained(uint32_t cluster, uint32_t count) {
+  // clear free cluster location
+  allocSearchStart_ = 2;
+
+  for (uint32_t c = cluster; c < cluster + count; c++) {
+    if (!freeMapSet(c, false)) return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// first cluster of count free clusters in a row within [first, last],
+// zero if there is no such run
+uint32_t SdVolume::freeMapFind(uint32_t first, uint32_t last,
+                               uint32_t count) const {
+  // free clusters in a row just before c
+  uint32_t run = 0;
+  uint32_t c = first;
+  while (c <= last) {
+    uint32_t shift = c & 31;
+    uint32_t avail = 32 - shift;
+    uint32_t used = freeMap_[c >> 5] >> shift;
+
+    // free clusters from c up to the next one in use in this word
+    uint32_t freeRun = used ? __builtin_ctz(used) : avail;
+    if (run + freeRun >= count) {
+      uint32_t start = c - run;
+      return start + count - 1 <= last ? start : 0;
+    }
+    if (freeRun == avail) {
+      run += avail;
+      c += avail;
+      continue;
+    }
+    // skip the clusters in use that follow, a whole word at a time if full
+    uint32_t rest = ~used >> freeRun;
+    uint32_t usedRun = avail - freeRun;
+    if (rest && (uint32_t)__builtin_ctz(rest) < usedRun) {
+      usedRun = __builtin_ctz(rest);
+    }
+    run = 0;
+    c += freeRun + usedRun;
+  }
+  return 0;
+}
+//------------------------------------------------------------------------------
+// Build freeMap_ from the first FAT.  The FAT is read many blocks per
+// transfer and each group of 32 entries is packed into one map word.  An
+// exFAT volume has an allocation bitmap instead, which is copied.
+uint8_t SdVolume::freeMapInit(void) {
+  delete[] freeMap_;
+  freeMap_ = 0;
+
+  // fatGet() and fatPut() do not handle FAT12
+  if (fatType_ != 16 && fatType_ != 32 && fatType_ != 64) return true;
+
+  uint32_t entries = clusterCount_ + 2;
+  uint32_t words = (entries + 31) >> 5;
+  uint16_t perBlock = fatType_ == 16 ? 256 : 128;
+  uint32_t const CHUNK_BLOCKS = 64;
+
+  // where the FAT or allocation bitmap is and its size in blocks
+  uint32_t start = fatStartBlock_;
+  uint32_t blocks = (entries + perBlock - 1) / perBlock;
+  if (fatType_ == 64) {
+    start = bitmapStartBlock_;
+    blocks = (clusterCount_ + 4095) >> 12;
+  }
+  // blocks waiting in the cache are newer than the card
+  if (!cacheSync(start, blocks)) return false;
+
+  uint32_t* map = new uint32_t[words];
+  memset(map, 0, words * sizeof(uint32_t));
+  uint8_t* chunk = new uint8_t[CHUNK_BLOCKS * 512];
+  for (uint32_t b = 0; b < blocks; b += CHUNK_BLOCKS) {
+    uint32_t n = blocks - b < CHUNK_BLOCKS ? blocks - b : CHUNK_BLOCKS;
+    if (!readBlocks(start + b, chunk, n)) {
+      delete[] chunk;
+      delete[] map;
+      return false;
+    }
+    if (fatType_ == 64) {
+      // bitmap bit n is cluster n + 2 so map words are bitmap words moved
+      // up two bits; bits past the last cluster only reach the padding
+      const uint32_t* bits = reinterpret_cast<const uint32_t*>(chunk);
+      uint32_t base = b * 128;
+      uint32_t end = base + n * 128;
+      if (end > words) end = words;
+      for (uint32_t k = base; k < end; k++) {
+        map[k] |= bits[k - base] << 2;
+        if (k + 1 < words) map[k + 1] |= bits[k - base] >> 30;
+      }
+      continue;
+    }
+    // chunks hold a multiple of 32 entries so each word is filled at once
+    uint32_t base = b * perBlock;
+    uint32_t end = base + n * perBlock;
+    if (end > entries) end = entries;
+    const uint16_t* fat16 = reinterpret_cast<const uint16_t*>(chunk);
+    const uint32_t* fat32 = reinterpret_cast<const uint32_t*>(chunk);
+    for (uint32_t c = base; c < end; c += 32) {
+      uint32_t k = end - c < 32 ? end - c : 32;
+      uint32_t word = 0;
+      if (fatType_ == 16) {
+        for (uint32_t i = 0; i < k; i++) {
+          word |= (uint32_t)(fat16[c - base + i] != 0) << i;
+        }
+      } else {
+        for (uint32_t i = 0; i < k; i++) {
+          word |= (uint32_t)((fat32[c - base + i] & FAT32MASK) != 0) << i;
+        }
+      }
+      map[c >> 5] = word;
+    }
+  }
+  delete[] chunk;
+
+  // reserved entries and the padding after the last cluster are never free
+  map[0] |= 3;
+  if (entries & 31) map[words - 1] |= 0XFFFFFFFF << (entries & 31);
+
+  uint32_t used = 0;
+  for (uint32_t i = 0; i < words; i++) used += __builtin_popcount(map[i]);
+  // correct a stale FSInfo count at the next sync
+  if (freeClusters_ != words * 32 - used) fsInfoDirty_ = true;
+  freeClusters_ = words * 32 - used;
+  freeMap_ = map;
+  return true;
+}
+//------------------------------------------------------------------------------
+// Mark a cluster used or free in freeMap_ and, on exFAT, in the allocation
+// bitmap, where bit n is cluster n + 2.
+uint8_t SdVolume::freeMapSet(uint32_t cluster, uint8_t used) {
+  if (!freeMap_) return true;
+  uint32_t* word = &freeMap_[cluster >> 5];
+  uint32_t bit = 1UL << (cluster & 31);
+  if (!(*word & bit) == !used) return true;
+  if (fatType_ == 64) {
+    uint32_t n = cluster - 2;
+    if (!cacheRawBlock(bitmapStartBlock_ + (n >> 12), CACHE_FOR_WRITE,
+                       CACHE_POOL_FAT)) {
+      return false;
+    }
+    uint8_t* b = &cacheBuffer()->data[(n >> 3) & 0X1FF];
+    if (used) {
+      *b |= 1 << (n & 7);
+    } else {
+      *b &= ~(1 << (n & 7));
+    }
+  }
+  if (used) {
+    *word |= bit;
+    freeClusters_--;
+  } else {
+    *word &= ~bit;
+    freeClusters_++;
+  }
+  fsInfoDirty_ = true;
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * \return The number of free clusters, or 0XFFFFFFFF for FAT12 volumes
+ * or if the FAT could not be read.
+ *
+ * The count is kept as clusters are allocated and freed.  A FAT32 volume
+ * takes it from its FSInfo sector at init() and the FAT is only scanned if
+ * that count is missing or impossible.  On exFAT the count comes from the
+ * allocation bitmap.
+ */
+uint32_t SdVolume::freeClusterCount(void) {
+  if (freeClusters_ == FSINFO_UNKNOWN && !freeMap_) freeMapInit();
+  return freeClusters_;
+}
+//------------------------------------------------------------------------------
+// Take the free count and next free hint from the FSInfo sector.  False if
+// the sector is not FSInfo or the count is unknown or larger than the
+// volume, then the FAT has to be scanned for it.
+uint8_t SdVolume::fsInfoLoad(void) {
+  if (!cacheRawBlock(fsInfoBlock_, CACHE_FOR_READ)) return false;
+  fsinfo_t* fsi = &cacheBuffer()->fsinfo;
+  if (fsi->leadSignature != FSINFO_LEAD_SIG ||
+    fsi->structSignature != FSINFO_STRUCT_SIG ||
+    fsi->trailSignature != FSINFO_TRAIL_SIG) {
+    // never write to it
+    fsInfoBlock_ = 0;
+    return false;
+  }
+  if (fsi->nextFree >= 2 && fsi->nextFree <= clusterCount_ + 1) {
+    allocSearchStart_ = fsi->nextFree;
+  }
+  if (fsi->freeCount > clusterCount_) return false;
+  freeClusters_ = fsi->freeCount;
+  return true;
+}
+//------------------------------------------------------------------------------
+// Write the free count and next free hint to the FSInfo sector if the count
+// changed.  The sector is left dirty in the cache for the caller's flush.
+uint8_t SdVolume::fsInfoSync(void) {
+  if (!fsInfoDirty_ || !fsInfoBlock_) return true;
+  if (!cacheRawBlock(fsInfoBlock_, CACHE_FOR_WRITE)) return false;
+  fsinfo_t* fsi = &cacheBuffer()->fsinfo;
+  fsi->freeCount = freeClusters_;
+  fsi->nextFree = allocSearchStart_;
+  fsInfoDirty_ = false;
   return true;
 }
 //------------------------------------------------------------------------------
 /**
- * Initialize a FAT volume.
+ * Initialize a FAT or exFAT volume.
  *
  * \param[in] dev The SD card where the volume is located.
  *
@@ -222,17 +957,37 @@ uint8_t SdVolume::freeChain(uint32_t cluster) {
  * \return The value one, true, is returned for success and
  * the value zero, false, is returned for failure.  Reasons for
  * failure include not finding a valid partition, not finding a valid
- * FAT file system in the specified partition or an I/O error.
+ * FAT file system in the specified partition or an I/O error.  exFAT
+ * volumes must have 512 byte sectors and a single FAT, so TexFAT is not
+ * supported.
  */
 uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
   uint32_t volumeStartBlock = 0;
+  // blocks cached from an earlier mount belong to that card
+  for (uint8_t i = 0; i < cacheSlotCount_; i++) {
+    cacheSlots_[i] = cache_slot_t();
+  }
+  cacheCurrent_ = &cacheSlots_[cacheFatSlots_];
+  fatPendingCount_ = 0;
+  stripeInvalidate(0, 0XFFFFFFFF);
   sdCard_ = dev;
+  readAheadCount_ = 0;
+  delete[] freeMap_;
+  freeMap_ = 0;
+  freeClusters_ = FSINFO_UNKNOWN;
+  fsInfoBlock_ = 0;
+  fsInfoDirty_ = false;
+  allocSearchStart_ = 2;
+  delete[] upcase_;
+  upcase_ = 0;
+  upcaseCount_ = 0;
+  dirIndexClear();
   // if part == 0 assume super floppy with FAT boot sector in block zero
   // if part > 0 assume mbr volume with partition table
   if (part) {
     if (part > 4)return false;
     if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ)) return false;
-    part_t* p = &cacheBuffer_.mbr.part[part-1];
+    part_t* p = &cacheBuffer()->mbr.part[part-1];
     if ((p->boot & 0X7F) !=0  ||
       p->totalSectors < 100 ||
       p->firstSector == 0) {
@@ -242,7 +997,10 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
     volumeStartBlock = p->firstSector;
   }
   if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ)) return false;
-  bpb_t* bpb = &cacheBuffer_.fbs.bpb;
+  if (!memcmp(cacheBuffer()->exfbs.fileSystemName, "EXFAT   ", 8)) {
+    return exFatInit(volumeStartBlock);
+  }
+  bpb_t* bpb = &cacheBuffer()->fbs.bpb;
   if (bpb->bytesPerSector != 512 ||
     bpb->fatCount == 0 ||
     bpb->reservedSectorCount == 0 ||
@@ -255,7 +1013,7 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
 
   // determine shift that is same as multiply by blocksPerCluster_
   clusterSizeShift_ = 0;
-  while (blocksPerCluster_ != (1 << clusterSizeShift_)) {
+  while (blocksPerCluster_ != (1UL << clusterSizeShift_)) {
     // error if not power of 2
     if (clusterSizeShift_++ > 7) return false;
   }
@@ -290,6 +1048,137 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
   } else {
     rootDirStart_ = bpb->fat32RootCluster;
     fatType_ = 32;
+    if (bpb->fat32FSInfo && bpb->fat32FSInfo < bpb->reservedSectorCount) {
+      fsInfoBlock_ = volumeStartBlock + bpb->fat32FSInfo;
+    }
+    // with a free count from FSInfo the FAT is scanned when first needed
+    if (fsInfoBlock_ && fsInfoLoad()) return true;
   }
+  return freeMapInit();
+}
+//------------------------------------------------------------------------------
+uint8_t SdVolume::readAheadConfigure(uint8_t blocks) {
+  if (blocks > SD_READ_AHEAD_MAX_BLOCKS) return false;
+  readAheadWindow_ = blocks;
+  readAheadCount_ = 0;
+  return true;
+}
+//------------------------------------------------------------------------------
+// copy from the read-ahead window, false if it does not hold block
+uint8_t SdVolume::readAheadCopy(uint32_t block, uint16_t offset,
+                                uint16_t count, uint8_t* dst) {
+  if (!readAheadContains(block)) return false;
+  memcpy(dst, readAheadBuffer_ + ((block - readAheadBlock_) << 9) + offset,
+         count);
+  cacheStats_.readAheadHits++;
+  return true;
+}
+//------------------------------------------------------------------------------
+// read count blocks from block into the read-ahead window
+uint8_t SdVolume::readAheadFill(uint32_t block, uint8_t count) {
+  cacheStats_.readAheadMisses++;
+  readAheadCount_ = 0;
+  if (!sdCard_->readBlocks(block, readAheadBuffer_, count)) return false;
+  readAheadBlock_ = block;
+  readAheadCount_ = count;
   return true;
 }
+//------------------------------------------------------------------------------
+// fatGet() for a reader holding lock_ shared, see SdFile::readShared()
+uint8_t SdVolume::sharedFatGet(uint32_t cluster, uint32_t* value) {
+  if (cluster > (clusterCount_ + 1)) return false;
+  uint32_t lba = fatStartBlock_;
+  lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
+  if (fatType_ == 16) {
+    uint16_t entry;
+    if (!sharedRead(lba, (cluster & 0XFF) << 1, 2,
+                    reinterpret_cast<uint8_t*>(&entry))) {
+      return false;
+    }
+    *value = entry;
+  } else {
+    uint32_t entry;
+    if (!sharedRead(lba, (cluster & 0X7F) << 2, 4,
+                    reinterpret_cast<uint8_t*>(&entry))) {
+      return false;
+    }
+    *value = entry & FAT32MASK;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// Copy count bytes at offset in block for a reader holding lock_ shared.
+// Nothing changes the block cache while readers hold the lock, and it may
+// have blocks newer than the card, so it is looked in first.  Otherwise
+// the block comes from its stripe of the readers' cache.
+uint8_t SdVolume::sharedRead(uint32_t block, uint16_t offset,
+                             uint16_t count, uint8_t* dst) {
+  cache_slot_t* slot = cacheFind(block);
+  if (slot) {
+    memcpy(dst, slot->buffer.data + offset, count);
+    return true;
+  }
+  cache_stripe_t* stripe = &stripes_.load()[block % SD_CACHE_STRIPES];
+  std::lock_guard<std::mutex> hold(stripe->lock);
+  cache_slot_t* oldest = stripe->slots;
+  for (uint8_t i = 0; i < SD_CACHE_STRIPE_SLOTS; i++) {
+    if (stripe->slots[i].blockNumber == block) {
+      slot = &stripe->slots[i];
+      break;
+    }
+    if (stripe->slots[i].lastUse < oldest->lastUse) oldest = &stripe->slots[i];
+  }
+  if (!slot) {
+    slot = oldest;
+    if (!sdCard_->readBlock(block, slot->buffer.data)) {
+      slot->blockNumber = 0XFFFFFFFF;
+      return false;
+    }
+    slot->blockNumber = block;
+  }
+  slot->lastUse = ++stripe->clock;
+  memcpy(dst, slot->buffer.data + offset, count);
+  return true;
+}
+//------------------------------------------------------------------------------
+// read count whole blocks for a reader holding lock_ shared, then lay any
+// of them held by the block cache over what the card had
+uint8_t SdVolume::sharedReadBlocks(uint32_t block, uint8_t* dst,
+                                   uint32_t count) {
+  if (!sdCard_->readBlocks(block, dst, count)) return false;
+  for (uint8_t i = 0; i < cacheSlotCount_; i++) {
+    cache_slot_t* slot = &cacheSlots_[i];
+    if (slot->blockNumber - block < count) {
+      memcpy(dst + ((slot->blockNumber - block) << 9), slot->buffer.data, 512);
+    }
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// forget blocks in [block, block + count) held by the readers' cache; the
+// card is only written with lock_ held exclusively, so no reader is in it
+void SdVolume::stripeInvalidate(uint32_t block, uint32_t count) {
+  cache_stripe_t* stripes = stripes_.load();
+  if (!stripes) return;
+  for (uint8_t i = 0; i < SD_CACHE_STRIPES; i++) {
+    for (uint8_t k = 0; k < SD_CACHE_STRIPE_SLOTS; k++) {
+      cache_slot_t* slot = &stripes[i].slots[k];
+      if (slot->blockNumber - block < count) slot->blockNumber = 0XFFFFFFFF;
+    }
+  }
+}
+//------------------------------------------------------------------------------
+// exFAT upper case of a name character
+uint16_t SdVolume::upcase(uint16_t c) const {
+  uint32_t lo = 0;
+  uint32_t hi = upcaseCount_;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (upcase_[2 * mid] < c) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < upcaseCount_ && upcase_[2 * lo] == c ? upcase_[2 * lo + 1] : c;
+}
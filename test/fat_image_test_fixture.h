@@ -0,0 +1,303 @@
+#ifndef TEENSY_X86_SD_STUBS_FAT_IMAGE_TEST_FIXTURE_H
+#define TEENSY_X86_SD_STUBS_FAT_IMAGE_TEST_FIXTURE_H
+
+#include "default_test_fixture.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+// Write an empty super-floppy FAT16 volume (no partition table) of
+// `blocks` 512 byte blocks to `path`, with 2 KiB clusters and two FATs.
+inline bool format_fat16_image(const char *path, uint32_t blocks) {
+    const uint8_t sectorsPerCluster = 4;
+    const uint16_t reservedSectors = 1;
+    const uint16_t rootEntries = 512;
+    const uint32_t rootBlocks = rootEntries * 32 / 512;
+    uint32_t clusters = (blocks - reservedSectors - rootBlocks) / sectorsPerCluster;
+    uint32_t fatBlocks = ((clusters + 2) * 2 + 511) / 512;
+
+    std::vector<uint8_t> image((size_t)blocks * 512, 0);
+    fbs_t *fbs = reinterpret_cast<fbs_t *>(image.data());
+    fbs->jmpToBootCode[0] = 0XEB;
+    fbs->jmpToBootCode[1] = 0X3C;
+    fbs->jmpToBootCode[2] = 0X90;
+    memcpy(fbs->oemName, "X86STUBS", 8);
+    fbs->bpb.bytesPerSector = 512;
+    fbs->bpb.sectorsPerCluster = sectorsPerCluster;
+    fbs->bpb.reservedSectorCount = reservedSectors;
+    fbs->bpb.fatCount = 2;
+    fbs->bpb.rootDirEntryCount = rootEntries;
+    if (blocks < 0X10000)
+        fbs->bpb.totalSectors16 = blocks;
+    else
+        fbs->bpb.totalSectors32 = blocks;
+    fbs->bpb.mediaType = 0XF8;
+    fbs->bpb.sectorsPerFat16 = fatBlocks;
+    fbs->bootSignature = 0X29;
+    memcpy(fbs->fileSystemType, "FAT16   ", 8);
+    fbs->bootSectorSig0 = BOOTSIG0;
+    fbs->bootSectorSig1 = BOOTSIG1;
+
+    for (int fat = 0; fat < 2; fat++) {
+        uint16_t *entries = reinterpret_cast<uint16_t *>(
+            image.data() + (reservedSectors + fat * fatBlocks) * 512);
+        entries[0] = 0XFFF8;
+        entries[1] = 0XFFFF;
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(image.data()), image.size());
+    return (bool)out;
+}
+
+// Write an empty super-floppy FAT32 volume of `blocks` 512 byte blocks to
+// `path`, with 512 byte clusters, two FATs, the root directory in cluster 2
+// and an FSInfo sector.  FAT32 needs 65525 clusters, so `blocks` must be
+// about 67000 or more; the file is sparse past the first root cluster.
+inline bool format_fat32_image(const char *path, uint32_t blocks) {
+    const uint16_t reservedSectors = 32;
+    uint32_t fatBlocks = ((blocks - reservedSectors + 2) * 4 + 511) / 512;
+    uint32_t clusters = blocks - reservedSectors - 2 * fatBlocks;
+    if (clusters < 65525)
+        return false;
+
+    std::vector<uint8_t> image((size_t)(reservedSectors + 2 * fatBlocks + 1) * 512, 0);
+    fbs_t *fbs = reinterpret_cast<fbs_t *>(image.data());
+    fbs->jmpToBootCode[0] = 0XEB;
+    fbs->jmpToBootCode[1] = 0X58;
+    fbs->jmpToBootCode[2] = 0X90;
+    memcpy(fbs->oemName, "X86STUBS", 8);
+    fbs->bpb.bytesPerSector = 512;
+    fbs->bpb.sectorsPerCluster = 1;
+    fbs->bpb.reservedSectorCount = reservedSectors;
+    fbs->bpb.fatCount = 2;
+    fbs->bpb.totalSectors32 = blocks;
+    fbs->bpb.mediaType = 0XF8;
+    fbs->bpb.sectorsPerFat32 = fatBlocks;
+    fbs->bpb.fat32RootCluster = 2;
+    fbs->bpb.fat32FSInfo = 1;
+    fbs->bpb.fat32BackBootBlock = 6;
+    fbs->bootSignature = 0X29;
+    memcpy(fbs->fileSystemType, "FAT32   ", 8);
+    fbs->bootSectorSig0 = BOOTSIG0;
+    fbs->bootSectorSig1 = BOOTSIG1;
+
+    // everything free but the root directory
+    fsinfo_t *fsi = reinterpret_cast<fsinfo_t *>(image.data() + 512);
+    fsi->leadSignature = FSINFO_LEAD_SIG;
+    fsi->structSignature = FSINFO_STRUCT_SIG;
+    fsi->freeCount = clusters - 1;
+    fsi->nextFree = 3;
+    fsi->trailSignature = FSINFO_TRAIL_SIG;
+    memcpy(image.data() + 6 * 512, image.data(), 2 * 512);
+
+    for (int fat = 0; fat < 2; fat++) {
+        uint32_t *entries = reinterpret_cast<uint32_t *>(
+            image.data() + (reservedSectors + fat * fatBlocks) * 512);
+        entries[0] = 0X0FFFFFF8;
+        entries[1] = 0X0FFFFFFF;
+        entries[2] = FAT32EOC;
+    }
+
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(image.data()), image.size());
+        if (!out)
+            return false;
+    }
+    std::error_code ec;
+    std::filesystem::resize_file(path, (uintmax_t)blocks * 512, ec);
+    return !ec;
+}
+
+// Write an empty exFAT volume (no partition table) of `blocks` 512 byte
+// blocks to `path`, with 4 KiB clusters.  Cluster 2 holds the allocation
+// bitmap, cluster 3 an up-case table for ASCII letters and cluster 4 the
+// root directory.
+inline bool format_exfat_image(const char *path, uint32_t blocks) {
+    const uint8_t clusterShift = 3;
+    const uint32_t fatOffset = 24;
+    uint32_t fatLength = (((blocks >> clusterShift) + 2) * 4 + 511) / 512;
+    uint32_t heapOffset = (fatOffset + fatLength + 7) & ~7U;
+    uint32_t clusters = (blocks - heapOffset) >> clusterShift;
+
+    std::vector<uint8_t> image((size_t)blocks * 512, 0);
+    auto block = [&](uint32_t n) { return image.data() + (size_t)n * 512; };
+    auto cluster = [&](uint32_t c) {
+        return block(heapOffset + ((c - 2) << clusterShift));
+    };
+
+    // main boot region: boot sector, eight extended boot sectors, OEM
+    // parameters, a reserved sector and the checksum sector
+    exfat_fbs_t *fbs = reinterpret_cast<exfat_fbs_t *>(block(0));
+    fbs->jmpToBootCode[0] = 0XEB;
+    fbs->jmpToBootCode[1] = 0X76;
+    fbs->jmpToBootCode[2] = 0X90;
+    memcpy(fbs->fileSystemName, "EXFAT   ", 8);
+    fbs->volumeLength = blocks;
+    fbs->fatOffset = fatOffset;
+    fbs->fatLength = fatLength;
+    fbs->clusterHeapOffset = heapOffset;
+    fbs->clusterCount = clusters;
+    fbs->rootDirectoryCluster = 4;
+    fbs->volumeSerialNumber = 0X12345678;
+    fbs->fileSystemRevision = 0X0100;
+    fbs->bytesPerSectorShift = 9;
+    fbs->sectorsPerClusterShift = clusterShift;
+    fbs->numberOfFats = 1;
+    fbs->driveSelect = 0X80;
+    fbs->percentInUse = 0XFF;
+    fbs->bootSectorSig0 = BOOTSIG0;
+    fbs->bootSectorSig1 = BOOTSIG1;
+    for (uint32_t i = 1; i <= 8; i++) {
+        block(i)[510] = BOOTSIG0;
+        block(i)[511] = BOOTSIG1;
+    }
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < 11 * 512; i++) {
+        if (i == 106 || i == 107 || i == 112)
+            continue;
+        sum = ((sum & 1) ? 0X80000000 : 0) + (sum >> 1) + image[i];
+    }
+    for (uint32_t i = 0; i < 128; i++)
+        memcpy(block(11) + 4 * i, &sum, 4);
+    // backup boot region
+    memcpy(block(12), block(0), 12 * 512);
+
+    // FAT: media entry, then one cluster each for the bitmap, the up-case
+    // table and the root directory
+    uint32_t *fat = reinterpret_cast<uint32_t *>(block(fatOffset));
+    fat[0] = 0XFFFFFFF8;
+    fat[1] = 0XFFFFFFFF;
+    fat[2] = fat[3] = fat[4] = EXFAT_EOC;
+
+    // allocation bitmap, bit n for cluster n + 2
+    cluster(2)[0] = 0X07;
+
+    // up-case table: 'a' to 'z' change, the runs around them do not
+    std::vector<uint16_t> upcase = {0XFFFF, 'a'};
+    for (uint16_t c = 'a'; c <= 'z'; c++)
+        upcase.push_back(c - ('a' - 'A'));
+    upcase.push_back(0XFFFF);
+    upcase.push_back(0X10000 - ('z' + 1));
+    memcpy(cluster(3), upcase.data(), upcase.size() * 2);
+    uint32_t upcaseSum = 0;
+    for (uint32_t i = 0; i < upcase.size() * 2; i++)
+        upcaseSum = ((upcaseSum & 1) ? 0X80000000 : 0) + (upcaseSum >> 1) + cluster(3)[i];
+
+    // root directory with the bitmap and up-case table entries
+    exdir_alloc_t *bitmap = reinterpret_cast<exdir_alloc_t *>(cluster(4));
+    bitmap->type = EXFAT_TYPE_BITMAP;
+    bitmap->firstCluster = 2;
+    bitmap->dataLength = (clusters + 7) / 8;
+    exdir_alloc_t *upcaseEntry = bitmap + 1;
+    upcaseEntry->type = EXFAT_TYPE_UPCASE;
+    memcpy(upcaseEntry->reserved + 2, &upcaseSum, 4);
+    upcaseEntry->firstCluster = 3;
+    upcaseEntry->dataLength = upcase.size() * 2;
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(image.data()), image.size());
+    return (bool)out;
+}
+
+// Mounts a freshly formatted 16 MiB FAT16 card image as the SD card.
+struct FatImageTestFixture : public DefaultTestFixture
+{
+    const char *imagePath = "output/card.img";
+
+    FatImageTestFixture()
+    {
+        std::filesystem::create_directories("output");
+        format_fat16_image(imagePath, 32768);
+        SD.setSDCardImagePath(imagePath);
+    }
+
+    ~FatImageTestFixture()
+    {
+        SD.setSDCardFolderPath("output", true);
+        std::remove(imagePath);
+    }
+};
+
+// Test data that differs from block to block and from file to file.
+inline std::vector<uint8_t> pattern(size_t size, uint8_t seed) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; i++)
+        data[i] = (uint8_t)(i * seed + (i >> 11));
+    return data;
+}
+
+// Create `name` in `dir` holding `data`, written 1000 bytes at a time so
+// the writes straddle block boundaries. Returns false on any failure.
+inline bool writeFile(SdFile &dir, const char *name, const std::vector<uint8_t> &data) {
+    SdFile f;
+    if (!f.open(&dir, name, O_CREAT | O_WRITE))
+        return false;
+    for (size_t pos = 0; pos < data.size(); pos += 1000) {
+        size_t n = std::min<size_t>(1000, data.size() - pos);
+        if (f.write(data.data() + pos, n) != n)
+            return false;
+    }
+    return f.close();
+}
+
+// Read all of `name` in `dir`. A file that can't be opened or read in
+// full comes back empty.
+inline std::vector<uint8_t> readFile(SdFile &dir, const char *name) {
+    SdFile f;
+    std::vector<uint8_t> data;
+    if (!f.open(&dir, name, O_READ))
+        return data;
+    data.resize(f.fileSize());
+    for (size_t pos = 0; pos < data.size(); pos += 16384) {
+        size_t n = std::min<size_t>(16384, data.size() - pos);
+        if (f.read(data.data() + pos, n) != (int)n)
+            return std::vector<uint8_t>();
+    }
+    f.close();
+    return data;
+}
+
+// Mounts a freshly formatted 35 MiB FAT32 card image as the SD card.
+struct Fat32ImageTestFixture : public DefaultTestFixture
+{
+    const char *imagePath = "output/fat32.img";
+
+    Fat32ImageTestFixture()
+    {
+        std::filesystem::create_directories("output");
+        format_fat32_image(imagePath, 70000);
+        SD.setSDCardImagePath(imagePath);
+    }
+
+    ~Fat32ImageTestFixture()
+    {
+        SD.setSDCardFolderPath("output", true);
+        std::remove(imagePath);
+    }
+};
+
+// Mounts a freshly formatted 16 MiB exFAT card image as the SD card.
+struct ExFatImageTestFixture : public DefaultTestFixture
+{
+    const char *imagePath = "output/exfat.img";
+
+    ExFatImageTestFixture()
+    {
+        std::filesystem::create_directories("output");
+        format_exfat_image(imagePath, 32768);
+        SD.setSDCardImagePath(imagePath);
+    }
+
+    ~ExFatImageTestFixture()
+    {
+        SD.setSDCardFolderPath("output", true);
+        std::remove(imagePath);
+    }
+};
+#endif //TEENSY_X86_SD_STUBS_FAT_IMAGE_TEST_FIXTURE_H
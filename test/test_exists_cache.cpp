@@ -0,0 +1,54 @@
+#include <boost/test/unit_test.hpp>   // do NOT define BOOST_TEST_MODULE here
+#include "default_test_fixture.h"
+
+#include <filesystem>
+#include <fstream>
+
+BOOST_AUTO_TEST_SUITE(exists_cache_tests)
+
+    BOOST_FIXTURE_TEST_CASE(exists_sees_files_and_directories, DefaultTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        std::filesystem::create_directories("output/exists_dir");
+        std::ofstream("output/exists_dir/file.txt") << "x";
+
+        BOOST_CHECK(SD.exists("exists_dir"));
+        BOOST_CHECK(SD.exists("exists_dir/file.txt"));
+        BOOST_CHECK(!SD.exists("exists_dir/missing.txt"));
+
+        std::filesystem::remove_all("output/exists_dir");
+    }
+
+    BOOST_FIXTURE_TEST_CASE(cache_follows_sdclass_changes, DefaultTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        SD.setMetadataCache(true);
+
+        BOOST_CHECK(!SD.exists("cached/log.txt"));
+        BOOST_CHECK(SD.mkdir("cached"));
+        BOOST_CHECK(SD.exists("cached"));
+
+        File f = SD.open("cached/log.txt", FILE_WRITE);
+        if (!f) {
+            BOOST_FAIL("File was not opened (for write)...");
+        }
+        f.close();
+        BOOST_CHECK(SD.exists("cached/log.txt"));
+        // differently spelled paths share one entry
+        BOOST_CHECK(SD.exists("/cached//log.txt"));
+
+        BOOST_CHECK(SD.remove("cached/log.txt"));
+        BOOST_CHECK(!SD.exists("./cached/log.txt"));
+        BOOST_CHECK(SD.rmdir("cached"));
+        BOOST_CHECK(!SD.exists("cached"));
+
+        // changes made behind SDClass's back are not seen until the cache is reset
+        BOOST_CHECK(!SD.exists("external.txt"));
+        std::ofstream("output/external.txt") << "x";
+        BOOST_CHECK(!SD.exists("external.txt"));
+        SD.setSDCardFolderPath("output", true);
+        BOOST_CHECK(SD.exists("external.txt"));
+
+        SD.setMetadataCache(false);
+        std::remove("output/external.txt");
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,48 @@
+#include <boost/test/unit_test.hpp>   // do NOT define BOOST_TEST_MODULE here
+#include "default_test_fixture.h"
+
+#include <sys/stat.h>
+
+BOOST_AUTO_TEST_SUITE(file_preallocate_tests)
+
+    BOOST_FIXTURE_TEST_CASE(folder_preallocate_keeps_size, DefaultTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        if (SD.exists("prealloc.bin"))
+            SD.remove("prealloc.bin");
+
+        File f = SD.open("prealloc.bin", FILE_WRITE);
+        if (!f) BOOST_FAIL("could not open file");
+        f.write((const uint8_t *)"abc", 3);
+        bool contiguous = true;
+        BOOST_CHECK(f.preallocate(1 << 20, &contiguous));
+        // the host doesn't say where the blocks went
+        BOOST_CHECK(!contiguous);
+        BOOST_CHECK_EQUAL(f.size(), 3u);
+        f.close();
+
+        struct stat st;
+        BOOST_REQUIRE(stat("output/prealloc.bin", &st) == 0);
+        BOOST_CHECK_EQUAL(st.st_size, 3);
+        BOOST_CHECK_GE((long long)st.st_blocks * 512, 1 << 20);
+
+        File r = SD.open("prealloc.bin", FILE_READ);
+        BOOST_CHECK(!r.preallocate(1 << 20));
+        r.close();
+        SD.remove("prealloc.bin");
+    }
+
+    BOOST_FIXTURE_TEST_CASE(ram_preallocate_keeps_size, DefaultTestFixture) {
+        SD.setSDCardRamFileSystem();
+        File f = SD.open("log.bin", FILE_WRITE);
+        if (!f) BOOST_FAIL("could not open file");
+        bool contiguous = false;
+        BOOST_CHECK(f.preallocate(4096, &contiguous));
+        BOOST_CHECK(contiguous);
+        BOOST_CHECK_EQUAL(f.size(), 0u);
+        f.write((const uint8_t *)"abc", 3);
+        BOOST_CHECK_EQUAL(f.size(), 3u);
+        f.close();
+        SD.setSDCardFolderPath("output", true);
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
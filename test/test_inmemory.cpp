@@ -1,6 +1,8 @@
 #include <boost/test/unit_test.hpp>   // do NOT define BOOST_TEST_MODULE here
 #include "default_test_fixture.h"
 
+#include <string>
+
 BOOST_AUTO_TEST_SUITE(inmemory_tests)
 
     BOOST_FIXTURE_TEST_CASE(can_read_inmemory_buffer, DefaultTestFixture) {
@@ -28,4 +30,25 @@ BOOST_AUTO_TEST_SUITE(inmemory_tests)
         f.close();
     }
 
+    BOOST_FIXTURE_TEST_CASE(bulk_reads_stop_at_end_of_buffer, DefaultTestFixture) {
+        SD.setSDCardFileData((char*)"0123456789", 10);
+
+        File f = SD.open("anything");
+        if (!f) {
+            BOOST_FAIL("In-memory file was not opened...");
+        }
+
+        char buffer[16] = {0};
+        BOOST_CHECK_EQUAL(f.read(buffer, 4), 4);
+        BOOST_CHECK_EQUAL(f.readBytes(buffer, 4), 4u);
+        BOOST_CHECK_EQUAL(std::string(buffer, 4), "4567");
+        BOOST_CHECK_EQUAL(f.read(buffer, 16), 2);
+        BOOST_CHECK_EQUAL(std::string(buffer, 2), "89");
+        BOOST_CHECK_EQUAL(f.read(buffer, 16), 0);
+        BOOST_CHECK_EQUAL(f.readBytes(buffer, 16), 0u);
+        BOOST_CHECK_EQUAL(f.position(), 10u);
+
+        f.close();
+    }
+
 BOOST_AUTO_TEST_SUITE_END()
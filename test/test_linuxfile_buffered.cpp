@@ -0,0 +1,102 @@
+#include <boost/test/unit_test.hpp>   // do NOT define BOOST_TEST_MODULE here
+#include "default_test_fixture.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+BOOST_AUTO_TEST_SUITE(linuxfile_buffered_tests)
+
+    // Byte-wise writes, overwrites behind the write position and reads of
+    // pending data must agree with what lands on disk, whatever the buffer size.
+    static void check_buffered_io(uint32_t bufferSize) {
+        SD.setSDCardFolderPath("output", true);
+        SD.setFileBufferSize(bufferSize);
+        SD.remove("buffered.bin");
+
+        std::vector<uint8_t> data(3000);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = (uint8_t)(i * 31 + 7);
+
+        File f = SD.open("buffered.bin", O_READ | O_WRITE | O_CREAT);
+        if (!f) {
+            BOOST_FAIL("File was not opened (for read/write)...");
+        }
+        for (size_t i = 0; i < 1000; i++)
+            BOOST_REQUIRE_EQUAL(f.write(data[i]), 1u);
+        BOOST_CHECK_EQUAL(f.write(&data[1000], 2000), 2000u);
+        BOOST_CHECK_EQUAL(f.size(), 3000u);
+        BOOST_CHECK_EQUAL(f.position(), 3000u);
+
+        // patch bytes that may still be sitting in the buffer
+        data[2990] = 'x';
+        data[10] = 'y';
+        BOOST_CHECK(f.seek(2990));
+        f.write('x');
+        BOOST_CHECK(f.seek(10));
+        f.write('y');
+
+        BOOST_CHECK(f.seek(0));
+        std::vector<uint8_t> back(data.size());
+        BOOST_CHECK_EQUAL(f.read(back.data(), 5), 5);
+        BOOST_CHECK_EQUAL(f.peek(), data[5]);
+        BOOST_CHECK_EQUAL(f.read(&back[5], 2995), 2995);
+        BOOST_CHECK(back == data);
+        BOOST_CHECK_EQUAL(f.read(), -1);
+        f.close();
+
+        File r = SD.open("buffered.bin", O_READ);
+        if (!r) {
+            BOOST_FAIL("File was not opened (for read)...");
+        }
+        BOOST_CHECK_EQUAL(r.size(), 3000u);
+        std::fill(back.begin(), back.end(), 0);
+        for (size_t i = 0; i < back.size(); i++)
+            back[i] = r.read();
+        BOOST_CHECK(back == data);
+        r.close();
+
+        SD.remove("buffered.bin");
+        SD.setFileBufferSize(4096);
+    }
+
+    BOOST_FIXTURE_TEST_CASE(default_buffer, DefaultTestFixture) {
+        check_buffered_io(4096);
+    }
+
+    BOOST_FIXTURE_TEST_CASE(tiny_buffer, DefaultTestFixture) {
+        check_buffered_io(7);
+    }
+
+    BOOST_FIXTURE_TEST_CASE(unbuffered, DefaultTestFixture) {
+        check_buffered_io(0);
+    }
+
+    BOOST_FIXTURE_TEST_CASE(append_always_writes_at_end, DefaultTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        SD.remove("append.txt");
+
+        File f = SD.open("append.txt", FILE_WRITE);
+        if (!f) {
+            BOOST_FAIL("File was not opened (for append)...");
+        }
+        f.write((const uint8_t *)"abc", 3);
+        BOOST_CHECK(f.seek(0));
+        BOOST_CHECK_EQUAL(f.read(), 'a');
+        f.write((const uint8_t *)"def", 3);
+        BOOST_CHECK_EQUAL(f.size(), 6u);
+        f.close();
+
+        File r = SD.open("append.txt", O_READ);
+        if (!r) {
+            BOOST_FAIL("File was not opened (for read)...");
+        }
+        char buffer[8] = {0};
+        BOOST_CHECK_EQUAL(r.read(buffer, 8), 6);
+        BOOST_CHECK_EQUAL(std::string(buffer), "abcdef");
+        r.close();
+
+        SD.remove("append.txt");
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
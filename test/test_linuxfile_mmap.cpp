@@ -0,0 +1,118 @@
+#include <boost/test/unit_test.hpp>   // do NOT define BOOST_TEST_MODULE here
+#include "default_test_fixture.h"
+
+#include <vector>
+
+BOOST_AUTO_TEST_SUITE(linuxfile_mmap_tests)
+
+    BOOST_FIXTURE_TEST_CASE(mapped_reads_match_stream_reads, DefaultTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        SD.remove("mapped.bin");
+
+        std::vector<uint8_t> data(5000);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = (uint8_t)(i * 13);
+
+        File write_file = SD.open("mapped.bin", O_WRITE);
+        if (!write_file) {
+            BOOST_FAIL("File was not opened (for write)...");
+        }
+        write_file.write(data.data(), data.size());
+        write_file.close();
+
+        SD.setMemoryMappedReads(true);
+        File f = SD.open("mapped.bin", O_READ);
+        if (!f) {
+            BOOST_FAIL("File was not opened (for read)...");
+        }
+        BOOST_CHECK_EQUAL(f.size(), data.size());
+        BOOST_CHECK_EQUAL(f.peek(), data[0]);
+        BOOST_CHECK_EQUAL(f.read(), data[0]);
+        BOOST_CHECK_EQUAL(f.position(), 1u);
+
+        uint8_t buffer[512];
+        BOOST_CHECK_EQUAL(f.read(buffer, 512), 512);
+        BOOST_CHECK_EQUAL_COLLECTIONS(&buffer[0], &buffer[512], &data[1], &data[513]);
+
+        // the view points into the mapping and advances the position
+        const uint8_t *view = nullptr;
+        BOOST_CHECK(f.seek(4000));
+        BOOST_CHECK_EQUAL(f.readView(&view, 2000), 1000);
+        BOOST_REQUIRE(view != nullptr);
+        BOOST_CHECK_EQUAL_COLLECTIONS(view, view + 1000, &data[4000], &data[5000]);
+        BOOST_CHECK_EQUAL(f.position(), 5000u);
+        BOOST_CHECK_EQUAL(f.read(), -1);
+        BOOST_CHECK(!f.seek(5001));
+        f.close();
+
+        // write modes still go through the stream
+        File w = SD.open("mapped.bin", O_READ | O_WRITE);
+        if (!w) {
+            BOOST_FAIL("File was not opened (for read/write)...");
+        }
+        BOOST_CHECK_EQUAL(w.readView(&view, 10), -1);
+        w.close();
+
+        SD.setMemoryMappedReads(false);
+        SD.remove("mapped.bin");
+    }
+
+    BOOST_FIXTURE_TEST_CASE(mapped_file_refuses_truncate, DefaultTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        SD.remove("mapped.bin");
+
+        std::vector<uint8_t> data(10000);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = (uint8_t)(i * 7);
+        File write_file = SD.open("mapped.bin", O_WRITE);
+        if (!write_file) {
+            BOOST_FAIL("File was not opened (for write)...");
+        }
+        write_file.write(data.data(), data.size());
+        write_file.close();
+
+        // shrinking the file under the mapping would fault the next read
+        SD.setMemoryMappedReads(true);
+        File f = SD.open("mapped.bin", O_READ);
+        if (!f) {
+            BOOST_FAIL("File was not opened (for read)...");
+        }
+        BOOST_CHECK(!f.truncate(100));
+        BOOST_CHECK_EQUAL(f.size(), data.size());
+        std::vector<uint8_t> back(data.size());
+        BOOST_CHECK(f.seek(0));
+        BOOST_CHECK_EQUAL(f.read(back.data(), back.size()), (int)data.size());
+        BOOST_CHECK(back == data);
+        f.close();
+        SD.setMemoryMappedReads(false);
+
+        File check = SD.open("mapped.bin", O_READ);
+        BOOST_CHECK_EQUAL(check.size(), data.size());
+        check.close();
+        SD.remove("mapped.bin");
+    }
+
+    BOOST_FIXTURE_TEST_CASE(mapped_empty_file, DefaultTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        File write_file = SD.open("mapped_empty.bin", O_WRITE);
+        if (!write_file) {
+            BOOST_FAIL("File was not opened (for write)...");
+        }
+        write_file.close();
+
+        SD.setMemoryMappedReads(true);
+        File f = SD.open("mapped_empty.bin", O_READ);
+        if (!f) {
+            BOOST_FAIL("File was not opened (for read)...");
+        }
+        const uint8_t *view = nullptr;
+        BOOST_CHECK_EQUAL(f.size(), 0u);
+        BOOST_CHECK_EQUAL(f.readView(&view, 10), 0);
+        BOOST_CHECK_EQUAL(f.read(), -1);
+        f.close();
+
+        SD.setMemoryMappedReads(false);
+        SD.remove("mapped_empty.bin");
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,151 @@
+#include <boost/test/unit_test.hpp>   // do NOT define BOOST_TEST_MODULE here
+#include "default_test_fixture.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Selects an empty RAM file system for the test and goes back to the output
+// folder afterwards.
+struct RamFileSystemTestFixture : public DefaultTestFixture
+{
+    RamFileSystemTestFixture()
+    {
+        SD.setSDCardRamFileSystem();
+    }
+
+    ~RamFileSystemTestFixture()
+    {
+        SD.setSDCardFolderPath("output", true);
+    }
+};
+
+BOOST_AUTO_TEST_SUITE(ramfilesystem_tests)
+
+    BOOST_FIXTURE_TEST_CASE(write_append_and_read_back, RamFileSystemTestFixture) {
+        BOOST_CHECK(SD.begin());
+        BOOST_CHECK(SD.usingRamFileSystem());
+        BOOST_CHECK(!SD.exists("log.txt"));
+
+        File f = SD.open("log.txt", O_WRITE);
+        if (!f) {
+            BOOST_FAIL("File was not opened (for write)...");
+        }
+        BOOST_CHECK_EQUAL(f.write((const uint8_t *)"hello", 5), 5u);
+        f.close();
+        BOOST_CHECK(SD.exists("log.txt"));
+
+        File a = SD.open("log.txt", FILE_WRITE);
+        if (!a) {
+            BOOST_FAIL("File was not opened (for append)...");
+        }
+        BOOST_CHECK(a.seek(0));
+        BOOST_CHECK_EQUAL(a.write((const uint8_t *)" world", 6), 6u);
+        BOOST_CHECK_EQUAL(a.size(), 11u);
+        a.close();
+
+        File r = SD.open("log.txt");
+        if (!r) {
+            BOOST_FAIL("File was not opened (for read)...");
+        }
+        char buffer[16] = {0};
+        BOOST_CHECK_EQUAL(r.peek(), 'h');
+        BOOST_CHECK_EQUAL(r.read(buffer, 16), 11);
+        BOOST_CHECK_EQUAL(std::string(buffer), "hello world");
+        BOOST_CHECK_EQUAL(r.read(), -1);
+        BOOST_CHECK_EQUAL(r.write('x'), 0u);
+        r.close();
+
+        // plain O_WRITE starts the file over
+        File t = SD.open("log.txt", O_WRITE);
+        if (!t) {
+            BOOST_FAIL("File was not opened (for truncate)...");
+        }
+        BOOST_CHECK_EQUAL(t.size(), 0u);
+        t.close();
+    }
+
+    BOOST_FIXTURE_TEST_CASE(truncate_and_missing_files, RamFileSystemTestFixture) {
+        File missing = SD.open("missing.txt", O_READ);
+        BOOST_CHECK(!missing);
+        File nested = SD.open("no/such/dir.txt", FILE_WRITE);
+        BOOST_CHECK(!nested);
+
+        File f = SD.open("data.bin", O_READ | O_WRITE | O_CREAT);
+        if (!f) {
+            BOOST_FAIL("File was not opened (for read/write)...");
+        }
+        f.write((const uint8_t *)"0123456789", 10);
+        BOOST_CHECK(f.truncate(4));
+        BOOST_CHECK_EQUAL(f.size(), 4u);
+        BOOST_CHECK_EQUAL(f.position(), 4u);
+        BOOST_CHECK(f.seek(1));
+        const uint8_t *view = nullptr;
+        BOOST_CHECK_EQUAL(f.readView(&view, 10), 3);
+        BOOST_REQUIRE(view != nullptr);
+        BOOST_CHECK_EQUAL(std::string((const char *)view, 3), "123");
+        BOOST_CHECK(!f.seek(5));
+        f.close();
+    }
+
+    BOOST_FIXTURE_TEST_CASE(directories, RamFileSystemTestFixture) {
+        BOOST_CHECK(SD.mkdir("logs/day1"));
+        BOOST_CHECK(SD.exists("logs"));
+        BOOST_CHECK(SD.exists("/logs/day1/"));
+
+        const char *names[] = {"b.txt", "a.txt", "c.txt"};
+        for (const char *name : names) {
+            File f = SD.open(std::string("logs/day1/") + name, FILE_WRITE);
+            if (!f) {
+                BOOST_FAIL("File was not opened (for write)...");
+            }
+            f.write((const uint8_t *)name, 1);
+            f.close();
+        }
+        // a file is in the way
+        BOOST_CHECK(!SD.mkdir("logs/day1/a.txt/sub"));
+
+        File dir = SD.open("logs/day1");
+        if (!dir) {
+            BOOST_FAIL("Directory was not opened...");
+        }
+        BOOST_REQUIRE(dir.isDirectory());
+        for (int pass = 0; pass < 2; pass++) {
+            std::vector<std::string> found;
+            while (true) {
+                File child = dir.openNextFile();
+                if (!child)
+                    break;
+                BOOST_CHECK(!child.isDirectory());
+                BOOST_CHECK_EQUAL(child.size(), 1u);
+                found.push_back(child.name());
+                child.close();
+            }
+            BOOST_REQUIRE_EQUAL(found.size(), 3u);
+            BOOST_CHECK_EQUAL(found[0], "a.txt");
+            BOOST_CHECK_EQUAL(found[2], "c.txt");
+        }
+        dir.close();
+
+        BOOST_CHECK(SD.remove("logs/day1/a.txt"));
+        BOOST_CHECK(!SD.exists("logs/day1/a.txt"));
+        BOOST_CHECK(SD.rmdir("logs"));
+        BOOST_CHECK(!SD.exists("logs/day1/b.txt"));
+        BOOST_CHECK(!SD.exists("logs"));
+    }
+
+    BOOST_FIXTURE_TEST_CASE(nothing_reaches_the_host, RamFileSystemTestFixture) {
+        File f = SD.open("ram_only.txt", O_WRITE);
+        if (!f) {
+            BOOST_FAIL("File was not opened (for write)...");
+        }
+        f.write((const uint8_t *)"x", 1);
+        f.close();
+        BOOST_CHECK(!std::filesystem::exists("output/ram_only.txt"));
+
+        // selecting the RAM file system again starts from an empty tree
+        SD.setSDCardRamFileSystem();
+        BOOST_CHECK(!SD.exists("ram_only.txt"));
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,235 @@
+#include <boost/test/unit_test.hpp>   // do NOT define BOOST_TEST_MODULE here
+#include "fat_image_test_fixture.h"
+
+#include <cstring>
+#include <vector>
+
+// Raw edits that corrupt a mounted image behind the volume's back.
+static uint32_t getFat(Sd2Card &card, SdVolume &volume, uint32_t cluster) {
+    uint8_t block[512];
+    uint32_t perBlock = volume.fatType() == 16 ? 256 : 128;
+    card.readBlock(volume.fatStartBlock() + cluster / perBlock, block);
+    if (volume.fatType() == 16)
+        return reinterpret_cast<uint16_t *>(block)[cluster % perBlock];
+    return reinterpret_cast<uint32_t *>(block)[cluster % perBlock];
+}
+
+static void putFat(Sd2Card &card, SdVolume &volume, uint32_t cluster, uint32_t value) {
+    uint8_t block[512];
+    uint32_t perBlock = volume.fatType() == 16 ? 256 : 128;
+    for (uint8_t copy = 0; copy < volume.fatCount(); copy++) {
+        uint32_t b = volume.fatStartBlock() + copy * volume.blocksPerFat() + cluster / perBlock;
+        card.readBlock(b, block);
+        if (volume.fatType() == 16)
+            reinterpret_cast<uint16_t *>(block)[cluster % perBlock] = value;
+        else
+            reinterpret_cast<uint32_t *>(block)[cluster % perBlock] = value;
+        card.writeBlock(b, block);
+    }
+}
+
+static void putFileSize(Sd2Card &card, SdFile &file, uint32_t size) {
+    uint8_t block[512];
+    card.readBlock(file.dirBlock(), block);
+    reinterpret_cast<dir_t *>(block)[file.dirIndex()].fileSize = size;
+    card.writeBlock(file.dirBlock(), block);
+}
+
+// exFAT allocation bitmap in cluster 2, bit n for cluster n + 2
+static void putBitmap(Sd2Card &card, SdVolume &volume, uint32_t cluster, bool used) {
+    uint8_t block[512];
+    uint32_t n = cluster - 2;
+    uint32_t b = volume.dataStartBlock() + (n >> 12);
+    card.readBlock(b, block);
+    if (used)
+        block[(n >> 3) & 511] |= 1 << (n & 7);
+    else
+        block[(n >> 3) & 511] &= ~(1 << (n & 7));
+    card.writeBlock(b, block);
+}
+
+static void checkSame(const check_report_t &a, const check_report_t &b) {
+    BOOST_CHECK_EQUAL(a.files, b.files);
+    BOOST_CHECK_EQUAL(a.directories, b.directories);
+    BOOST_CHECK_EQUAL(a.usedClusters, b.usedClusters);
+    BOOST_CHECK_EQUAL(a.freeClusters, b.freeClusters);
+    BOOST_CHECK_EQUAL(a.badChains, b.badChains);
+    BOOST_CHECK_EQUAL(a.crossLinks, b.crossLinks);
+    BOOST_CHECK_EQUAL(a.lostChains, b.lostChains);
+    BOOST_CHECK_EQUAL(a.lostClusters, b.lostClusters);
+    BOOST_CHECK_EQUAL(a.sizeMismatches, b.sizeMismatches);
+    BOOST_CHECK_EQUAL(a.bitmapMismatches, b.bitmapMismatches);
+}
+
+BOOST_AUTO_TEST_SUITE(sdcard_check_tests)
+
+    BOOST_FIXTURE_TEST_CASE(fresh_image_is_clean, FatImageTestFixture) {
+        check_report_t report;
+        BOOST_REQUIRE(SD.checkCardImage(&report));
+        BOOST_CHECK(report.clean());
+        BOOST_CHECK_EQUAL(report.files, 0u);
+        BOOST_CHECK_EQUAL(report.directories, 1u);
+        BOOST_CHECK_EQUAL(report.usedClusters, 0u);
+
+        SD.mkdir("logs");
+        File f = SD.open("logs/run1.txt", FILE_WRITE);
+        f.write((const uint8_t *)"hello", 5);
+        f.close();
+        BOOST_REQUIRE(SD.checkCardImage(&report, false, 3));
+        BOOST_CHECK(report.clean());
+        BOOST_CHECK_EQUAL(report.files, 1u);
+        BOOST_CHECK_EQUAL(report.directories, 2u);
+        BOOST_CHECK_EQUAL(report.usedClusters, 2u);
+
+        SD.setSDCardFolderPath("output", true);
+        BOOST_CHECK(!SD.checkCardImage(&report));
+    }
+
+    BOOST_FIXTURE_TEST_CASE(finds_and_repairs_fat_damage, FatImageTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        Sd2Card card;
+        BOOST_REQUIRE(card.openImage(imagePath));
+        SdVolume volume;
+        BOOST_REQUIRE(volume.init(&card));
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&volume));
+
+        // 2 KiB clusters: A 5, LOGS 1, B 3, C 2, D 2
+        std::vector<uint8_t> a(10000), b(6000), c(3000), d(4000);
+        for (size_t i = 0; i < a.size(); i++) a[i] = (uint8_t)(i * 7);
+        for (size_t i = 0; i < b.size(); i++) b[i] = (uint8_t)(i * 5 + 1);
+        for (size_t i = 0; i < c.size(); i++) c[i] = (uint8_t)(i * 3 + 2);
+        for (size_t i = 0; i < d.size(); i++) d[i] = (uint8_t)(i + 3);
+        BOOST_REQUIRE(writeFile(root, "A.BIN", a));
+        SdFile logs;
+        BOOST_REQUIRE(logs.makeDir(&root, "LOGS"));
+        BOOST_REQUIRE(writeFile(logs, "B.BIN", b));
+        BOOST_REQUIRE(writeFile(root, "C.BIN", c));
+        BOOST_REQUIRE(writeFile(root, "D.BIN", d));
+
+        SdCheck checker(4);
+        check_report_t report;
+        BOOST_REQUIRE(checker.check(&volume, &report));
+        BOOST_CHECK(report.clean());
+        BOOST_CHECK_EQUAL(report.files, 4u);
+        BOOST_CHECK_EQUAL(report.directories, 2u);
+        BOOST_CHECK_EQUAL(report.usedClusters, 13u);
+        BOOST_CHECK_EQUAL(report.freeClusters, volume.freeClusterCount());
+
+        SdFile fa, fb, fc, fd;
+        BOOST_REQUIRE(fa.open(&root, "A.BIN", O_READ));
+        BOOST_REQUIRE(fb.open(&logs, "B.BIN", O_READ));
+        BOOST_REQUIRE(fc.open(&root, "C.BIN", O_READ));
+        BOOST_REQUIRE(fd.open(&root, "D.BIN", O_READ));
+        volume.cacheClear();
+
+        // a lost chain of two clusters near the end
+        uint32_t lost = volume.clusterCount() - 10;
+        putFat(card, volume, lost, lost + 1);
+        putFat(card, volume, lost + 1, 0XFFFF);
+        // C's last cluster runs into A's third
+        uint32_t cLast = getFat(card, volume, fc.firstCluster());
+        putFat(card, volume, cLast, fa.firstCluster() + 2);
+        // B claims more than its three clusters
+        putFileSize(card, fb, 20000);
+        // D's first cluster leads to a free one
+        putFat(card, volume, fd.firstCluster(), lost + 5);
+
+        // the damage is on the card, not in what the volume has loaded
+        SdVolume again;
+        BOOST_REQUIRE(again.init(&card));
+        check_report_t one;
+        BOOST_REQUIRE(SdCheck(1).check(&again, &one));
+        BOOST_REQUIRE(checker.check(&again, &report));
+        checkSame(one, report);
+        BOOST_CHECK(!report.clean());
+        // the chain and D's second cluster, now cut off
+        BOOST_CHECK_EQUAL(report.lostChains, 2u);
+        BOOST_CHECK_EQUAL(report.lostClusters, 3u);
+        BOOST_CHECK_EQUAL(report.crossLinks, 1u);
+        BOOST_CHECK_EQUAL(report.sizeMismatches, 1u);
+        BOOST_CHECK_EQUAL(report.badChains, 1u);
+        BOOST_CHECK_EQUAL(report.repairs, 0u);
+
+        BOOST_REQUIRE(checker.check(&again, &report, true));
+        BOOST_CHECK_GT(report.repairs, 0u);
+        BOOST_REQUIRE(checker.check(&again, &report));
+        BOOST_CHECK(report.clean());
+        BOOST_CHECK_EQUAL(report.files, 4u);
+        again.cacheClear();
+        SdVolume rescan;
+        BOOST_REQUIRE(rescan.init(&card));
+        BOOST_CHECK_EQUAL(rescan.freeClusterCount(), again.freeClusterCount());
+        BOOST_CHECK_EQUAL(rescan.freeClusterCount(), report.freeClusters);
+
+        // what was good is still there
+        SdFile root2, logs2;
+        BOOST_REQUIRE(root2.openRoot(&rescan));
+        BOOST_CHECK(readFile(root2, "A.BIN") == a);
+        BOOST_CHECK(readFile(root2, "C.BIN") == c);
+        BOOST_REQUIRE(logs2.open(&root2, "LOGS", O_READ));
+        std::vector<uint8_t> b2 = readFile(logs2, "B.BIN");
+        BOOST_CHECK_EQUAL(b2.size(), 3u * 2048);
+        BOOST_CHECK(std::equal(b.begin(), b.end(), b2.begin()));
+        std::vector<uint8_t> d2 = readFile(root2, "D.BIN");
+        BOOST_CHECK_EQUAL(d2.size(), 2048u);
+        BOOST_CHECK(std::equal(d2.begin(), d2.end(), d.begin()));
+    }
+
+    BOOST_FIXTURE_TEST_CASE(finds_and_repairs_exfat_bitmap, ExFatImageTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        Sd2Card card;
+        BOOST_REQUIRE(card.openImage(imagePath));
+        SdVolume volume;
+        BOOST_REQUIRE(volume.init(&card));
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&volume));
+
+        // 4 KiB clusters: a contiguous file of 5 and a directory with one of 2
+        std::vector<uint8_t> data(20000);
+        for (size_t i = 0; i < data.size(); i++) data[i] = (uint8_t)(i * 9);
+        BOOST_REQUIRE(writeFile(root, "Contiguous Data.bin", data));
+        SdFile sub;
+        BOOST_REQUIRE(sub.makeDir(&root, "Sub Folder"));
+        BOOST_REQUIRE(writeFile(sub, "Inner.bin", std::vector<uint8_t>(5000, 'x')));
+
+        check_report_t report;
+        BOOST_REQUIRE(SdCheck().check(&volume, &report));
+        BOOST_CHECK(report.clean());
+        BOOST_CHECK_EQUAL(report.files, 2u);
+        BOOST_CHECK_EQUAL(report.directories, 2u);
+        // bitmap, up-case table, root, the file, the folder and its file
+        BOOST_CHECK_EQUAL(report.usedClusters, 3u + 5 + 1 + 2);
+        BOOST_CHECK_EQUAL(report.freeClusters, volume.freeClusterCount());
+
+        SdFile f;
+        BOOST_REQUIRE(f.open(&root, "contiguous data.bin", O_READ));
+        volume.cacheClear();
+        // a cluster in use that no file has, and one of the file's marked free
+        uint32_t lost = volume.clusterCount() - 3;
+        putBitmap(card, volume, lost, true);
+        putBitmap(card, volume, f.firstCluster() + 2, false);
+
+        SdVolume again;
+        BOOST_REQUIRE(again.init(&card));
+        check_report_t one;
+        BOOST_REQUIRE(SdCheck(1).check(&again, &one));
+        BOOST_REQUIRE(SdCheck(4).check(&again, &report, true));
+        checkSame(one, report);
+        BOOST_CHECK_EQUAL(report.lostChains, 1u);
+        BOOST_CHECK_EQUAL(report.lostClusters, 1u);
+        BOOST_CHECK_EQUAL(report.bitmapMismatches, 1u);
+        BOOST_CHECK_EQUAL(report.repairs, 2u);
+
+        again.cacheClear();
+        SdVolume rescan;
+        BOOST_REQUIRE(rescan.init(&card));
+        BOOST_REQUIRE(SdCheck(4).check(&rescan, &report));
+        BOOST_CHECK(report.clean());
+        BOOST_CHECK_EQUAL(rescan.freeClusterCount(), report.freeClusters);
+        SdFile root2;
+        BOOST_REQUIRE(root2.openRoot(&rescan));
+        BOOST_CHECK(readFile(root2, "Contiguous Data.bin") == data);
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,139 @@
+#include <boost/test/unit_test.hpp>   // do NOT define BOOST_TEST_MODULE here
+#include "fat_image_test_fixture.h"
+
+#include <string>
+#include <vector>
+
+// Write the files a 2 KiB cluster each in turn, so their chains interleave.
+static void writeInterleaved(std::vector<SdFile> &files, const std::vector<std::vector<uint8_t>> &data) {
+    for (size_t pos = 0;; pos += 2048) {
+        bool more = false;
+        for (size_t i = 0; i < files.size(); i++) {
+            if (pos >= data[i].size())
+                continue;
+            size_t n = std::min<size_t>(2048, data[i].size() - pos);
+            BOOST_REQUIRE_EQUAL(files[i].write(data[i].data() + pos, n), n);
+            more = true;
+        }
+        if (!more)
+            break;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(sdcard_defrag_tests)
+
+    BOOST_FIXTURE_TEST_CASE(moves_interleaved_files_into_runs, FatImageTestFixture) {
+        // five logs in a subdirectory and one in root, 10 KiB + 100 bytes
+        // each, so 6 clusters each with 5 breaks, and one contiguous file
+        BOOST_REQUIRE(SD.mkdir("logs"));
+        std::vector<std::string> names;
+        for (int i = 1; i <= 5; i++)
+            names.push_back("logs/Sensor " + std::to_string(i) + ".csv");
+        names.push_back("top.bin");
+        std::vector<File> files;
+        std::vector<std::vector<uint8_t>> data;
+        for (size_t i = 0; i < names.size(); i++) {
+            files.push_back(SD.open(names[i].c_str(), FILE_WRITE));
+            if (!files.back()) BOOST_FAIL("could not open file");
+            data.push_back(pattern(5 * 2048 + 100, (uint8_t)(3 + 2 * i)));
+        }
+        for (size_t pos = 0; pos < data[0].size(); pos += 2048) {
+            size_t n = std::min<size_t>(2048, data[0].size() - pos);
+            for (size_t i = 0; i < files.size(); i++)
+                BOOST_REQUIRE_EQUAL(files[i].write(data[i].data() + pos, n), n);
+        }
+        for (auto &f : files)
+            f.close();
+        std::vector<uint8_t> whole = pattern(20000, 9);
+        File w = SD.open("whole.bin", FILE_WRITE);
+        if (!w) BOOST_FAIL("could not open file");
+        BOOST_REQUIRE_EQUAL(w.write(whole.data(), whole.size()), whole.size());
+        w.close();
+
+        defrag_report_t report;
+        BOOST_REQUIRE(SD.defragCardImage(&report));
+        BOOST_CHECK_EQUAL(report.files, 7u);
+        BOOST_CHECK_EQUAL(report.fragmentedBefore, 6u);
+        BOOST_CHECK_EQUAL(report.scoreBefore, 6u * 5);
+        BOOST_CHECK_EQUAL(report.fragmentedAfter, 0u);
+        BOOST_CHECK_EQUAL(report.scoreAfter, 0u);
+        BOOST_CHECK_EQUAL(report.movedFiles, 6u);
+        BOOST_CHECK_EQUAL(report.movedClusters, 6u * 6);
+
+        // the files read back the same through the volume that moved them
+        for (size_t i = 0; i < names.size(); i++) {
+            File f = SD.open(names[i].c_str());
+            if (!f) BOOST_FAIL("could not open file");
+            std::vector<uint8_t> back(f.size());
+            BOOST_CHECK_EQUAL(f.read(back.data(), back.size()), (int)back.size());
+            f.close();
+            BOOST_CHECK(back == data[i]);
+        }
+        check_report_t check;
+        BOOST_REQUIRE(SD.checkCardImage(&check));
+        BOOST_CHECK(check.clean());
+        BOOST_CHECK_EQUAL(check.files, 7u);
+
+        // nothing is left to do
+        BOOST_REQUIRE(SD.defragCardImage(&report));
+        BOOST_CHECK_EQUAL(report.scoreBefore, 0u);
+        BOOST_CHECK_EQUAL(report.movedFiles, 0u);
+    }
+
+    BOOST_FIXTURE_TEST_CASE(leaves_files_with_no_room, FatImageTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        Sd2Card card;
+        BOOST_REQUIRE(card.openImage(imagePath));
+        SdVolume volume;
+        BOOST_REQUIRE(volume.init(&card));
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&volume));
+
+        // two 1500 cluster files interleaved, then a filler leaving 1000
+        // clusters free, too few for either
+        std::vector<std::vector<uint8_t>> data = {pattern(1500 * 2048, 5), pattern(1500 * 2048, 7)};
+        std::vector<SdFile> files(2);
+        BOOST_REQUIRE(files[0].open(&root, "A.BIN", O_CREAT | O_WRITE));
+        BOOST_REQUIRE(files[1].open(&root, "B.BIN", O_CREAT | O_WRITE));
+        writeInterleaved(files, data);
+        for (auto &f : files)
+            BOOST_REQUIRE(f.close());
+        SdFile filler;
+        BOOST_REQUIRE(filler.open(&root, "FILLER.BIN", O_CREAT | O_WRITE));
+        BOOST_REQUIRE(filler.preallocate((volume.freeClusterCount() - 1000) * 2048));
+        BOOST_REQUIRE(filler.close());
+        const uint32_t left = volume.freeClusterCount();
+        BOOST_CHECK_EQUAL(left, 1000u);
+
+        defrag_report_t report;
+        BOOST_REQUIRE(SdDefrag().defrag(&volume, &report));
+        BOOST_CHECK_EQUAL(report.fragmentedBefore, 2u);
+        BOOST_CHECK_EQUAL(report.fragmentedAfter, 2u);
+        BOOST_CHECK_EQUAL(report.scoreAfter, report.scoreBefore);
+        BOOST_CHECK_EQUAL(report.movedFiles, 0u);
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), left);
+
+        // with the filler gone the first file moves, and its old clusters
+        // leave room for the second
+        BOOST_REQUIRE(SdFile::remove(&root, "FILLER.BIN"));
+        BOOST_REQUIRE(SdDefrag().defrag(&volume, &report));
+        BOOST_CHECK_EQUAL(report.fragmentedAfter, 0u);
+        BOOST_CHECK_EQUAL(report.movedFiles, 2u);
+        BOOST_CHECK_EQUAL(report.movedClusters, 3000u);
+        BOOST_CHECK(readFile(root, "A.BIN") == data[0]);
+        BOOST_CHECK(readFile(root, "B.BIN") == data[1]);
+        SdFile f;
+        uint32_t bgn, end;
+        BOOST_REQUIRE(f.open(&root, "B.BIN", O_READ));
+        BOOST_CHECK(f.contiguousRange(&bgn, &end));
+        f.close();
+
+        check_report_t check;
+        BOOST_REQUIRE(SdCheck().check(&volume, &check));
+        BOOST_CHECK(check.clean());
+        SdVolume rescan;
+        BOOST_REQUIRE(rescan.init(&card));
+        BOOST_CHECK_EQUAL(rescan.freeClusterCount(), volume.freeClusterCount());
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
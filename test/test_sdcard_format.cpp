@@ -0,0 +1,131 @@
+#include <boost/test/unit_test.hpp>   // do NOT define BOOST_TEST_MODULE here
+#include "fat_image_test_fixture.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+static void writeHostFile(const std::string &path, const std::vector<uint8_t> &data) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(data.data()), data.size());
+}
+
+static std::vector<uint8_t> readCardFile(const char *path) {
+    File f = SD.open(path);
+    std::vector<uint8_t> data;
+    if (!f)
+        return data;
+    data.resize(f.size());
+    size_t done = 0;
+    while (done < data.size()) {
+        int n = f.read(data.data() + done, data.size() - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    f.close();
+    return data;
+}
+
+BOOST_AUTO_TEST_SUITE(sdcard_format_tests)
+
+    BOOST_FIXTURE_TEST_CASE(formats_fat16_and_fat32, DefaultTestFixture) {
+        std::filesystem::create_directories("output");
+        const char *path = "output/format.img";
+        struct { uint64_t bytes; uint8_t type; uint32_t clusterBytes; uint8_t expectType; uint32_t expectCluster; } cases[] = {
+            {64ULL << 20, 0, 0, 16, 1024},
+            {64ULL << 20, 16, 8192, 16, 8192},
+            {3ULL << 30, 0, 0, 32, 4096},
+            {64ULL << 20, 32, 0, 32, 512},
+            {32ULL << 30, 0, 0, 32, 16384},
+        };
+        for (auto &c : cases) {
+            BOOST_TEST_CONTEXT("bytes " << c.bytes << " type " << (int)c.type) {
+                BOOST_REQUIRE(SdFormat(c.type, c.clusterBytes).format(path, c.bytes));
+                BOOST_CHECK_EQUAL(std::filesystem::file_size(path), c.bytes);
+                // only the metadata blocks are written
+                struct stat st;
+                BOOST_REQUIRE(stat(path, &st) == 0);
+                BOOST_CHECK_LT((uint64_t)st.st_blocks * 512, 1u << 20);
+
+                Sd2Card card;
+                BOOST_REQUIRE(card.openImage(path));
+                SdVolume volume;
+                BOOST_REQUIRE(volume.init(&card));
+                BOOST_CHECK_EQUAL(volume.fatType(), c.expectType);
+                BOOST_CHECK_EQUAL(volume.blocksPerCluster() * 512, c.expectCluster);
+                BOOST_CHECK_EQUAL(volume.dataStartBlock() % volume.blocksPerCluster(), 0u);
+                uint32_t root = c.expectType == 32 ? 1 : 0;
+                BOOST_CHECK_EQUAL(volume.freeClusterCount(), volume.clusterCount() - root);
+
+                check_report_t report;
+                BOOST_REQUIRE(SdCheck().check(&volume, &report));
+                BOOST_CHECK(report.clean());
+                BOOST_CHECK_EQUAL(report.freeClusters, volume.clusterCount() - root);
+            }
+        }
+        // FAT12 sized, past FAT16 and too small for FAT32
+        BOOST_CHECK(!SdFormat(16).format(path, 1ULL << 20));
+        BOOST_CHECK(!SdFormat(16).format(path, 5ULL << 30));
+        BOOST_CHECK(!SdFormat(32).format(path, 16ULL << 20));
+        BOOST_CHECK(!SdFormat(0, 3000).format(path, 64ULL << 20));
+        BOOST_CHECK(!SdFormat(12).format(path, 64ULL << 20));
+        std::remove(path);
+    }
+
+    BOOST_FIXTURE_TEST_CASE(copies_a_folder_into_the_image, DefaultTestFixture) {
+        std::filesystem::create_directories("output/tree/logs/deep");
+        std::vector<uint8_t> readme = pattern(11, 3);
+        std::vector<uint8_t> wav = pattern((1 << 20) + 100, 7);
+        std::vector<uint8_t> deep = pattern(100000, 5);
+        writeHostFile("output/tree/readme.txt", readme);
+        writeHostFile("output/tree/Field Recording 01.wav", wav);
+        writeHostFile("output/tree/logs/empty.bin", {});
+        writeHostFile("output/tree/logs/deep/x.bin", deep);
+        const char *path = "output/tree.img";
+
+        for (uint8_t type : {16, 32}) {
+            BOOST_TEST_CONTEXT("FAT" << (int)type) {
+                BOOST_REQUIRE(SD.formatCardImage(path, 64ULL << 20, "output/tree", type));
+                BOOST_CHECK(readCardFile("readme.txt") == readme);
+                BOOST_CHECK(readCardFile("Field Recording 01.wav") == wav);
+                BOOST_CHECK(SD.exists("logs/empty.bin"));
+                BOOST_CHECK(readCardFile("logs/empty.bin").empty());
+                BOOST_CHECK(readCardFile("logs/deep/x.bin") == deep);
+                check_report_t report;
+                BOOST_REQUIRE(SD.checkCardImage(&report));
+                BOOST_CHECK(report.clean());
+                BOOST_CHECK_EQUAL(report.files, 4u);
+                BOOST_CHECK_EQUAL(report.directories, 3u);
+
+                // each file is in one run of clusters
+                SD.setSDCardFolderPath("output", true);
+                Sd2Card card;
+                BOOST_REQUIRE(card.openImage(path));
+                SdVolume volume;
+                BOOST_REQUIRE(volume.init(&card));
+                SdFile root, f;
+                BOOST_REQUIRE(root.openRoot(&volume));
+                BOOST_REQUIRE(f.open(&root, "Field Recording 01.wav", O_READ));
+                uint32_t bgn, end;
+                BOOST_CHECK(f.contiguousRange(&bgn, &end));
+                uint32_t clusterBlocks = volume.blocksPerCluster();
+                BOOST_CHECK_EQUAL(end - bgn + 1, (wav.size() / 512 / clusterBlocks + 1) * clusterBlocks);
+                f.close();
+            }
+        }
+
+        // the folder must exist and its names fit FAT
+        BOOST_CHECK(!SD.formatCardImage(path, 64ULL << 20, "output/missing"));
+        writeHostFile("output/tree/not a FAT name?.txt", readme);
+        BOOST_CHECK(!SD.formatCardImage(path, 64ULL << 20, "output/tree"));
+
+        SD.setSDCardFolderPath("output", true);
+        std::filesystem::remove_all("output/tree");
+        std::remove(path);
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
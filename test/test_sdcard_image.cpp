@@ -0,0 +1,1622 @@
+#include <boost/test/unit_test.hpp>   // do NOT define BOOST_TEST_MODULE here
+#include "fat_image_test_fixture.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+BOOST_AUTO_TEST_SUITE(sdcard_image_tests)
+
+    BOOST_FIXTURE_TEST_CASE(mounts_fat16_image, FatImageTestFixture) {
+        BOOST_CHECK(SD.begin());
+        BOOST_CHECK_EQUAL(SD.getSDCardImagePath(), std::string(imagePath));
+        BOOST_CHECK(SD.exists("/"));
+        BOOST_CHECK(!SD.exists("missing.txt"));
+    }
+
+    BOOST_FIXTURE_TEST_CASE(rejects_unformatted_image, DefaultTestFixture) {
+        std::filesystem::create_directories("output");
+        std::vector<char> zeros(64 * 512, 0);
+        std::ofstream("output/blank.img", std::ios::binary).write(zeros.data(), zeros.size());
+
+        BOOST_CHECK(!SD.setSDCardImagePath("output/blank.img"));
+        BOOST_CHECK(!SD.setSDCardImagePath("output/does_not_exist.img"));
+
+        SD.setSDCardFolderPath("output", true);
+        std::remove("output/blank.img");
+    }
+
+    BOOST_FIXTURE_TEST_CASE(write_then_read_back, FatImageTestFixture) {
+        const char *expected = "hello world";
+
+        File write_file = SD.open("test.txt", FILE_WRITE);
+        if (!write_file) {
+            BOOST_FAIL("File was not opened (for write)...");
+        }
+        BOOST_CHECK_EQUAL(write_file.write((const uint8_t *)expected, 11), 11u);
+        write_file.close();
+
+        BOOST_CHECK(SD.exists("test.txt"));
+
+        File read_file = SD.open("test.txt", FILE_READ);
+        if (!read_file) {
+            BOOST_FAIL("File was not opened (for read)...");
+        }
+        BOOST_CHECK_EQUAL(read_file.size(), 11u);
+        BOOST_CHECK_EQUAL(read_file.peek(), (int)'h');
+        char buffer[11] = {0};
+        BOOST_CHECK_EQUAL(read_file.read(buffer, 20), 11);
+        BOOST_CHECK_EQUAL_COLLECTIONS(&buffer[0], &buffer[11], &expected[0], &expected[11]);
+        BOOST_CHECK_EQUAL(read_file.read(), -1);
+        read_file.close();
+    }
+
+    BOOST_FIXTURE_TEST_CASE(large_file_spans_clusters_and_survives_remount, FatImageTestFixture) {
+        std::vector<uint8_t> data(100000);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = (uint8_t)(i * 7 + (i >> 8));
+
+        File f = SD.open("big.bin", FILE_WRITE);
+        if (!f) BOOST_FAIL("could not open file");
+        BOOST_CHECK_EQUAL(f.write(data.data(), data.size()), data.size());
+        f.close();
+
+        // remount so nothing is served from the block cache
+        BOOST_REQUIRE(SD.setSDCardImagePath(imagePath));
+
+        File r = SD.open("big.bin");
+        if (!r) BOOST_FAIL("could not open file");
+        BOOST_CHECK_EQUAL(r.size(), data.size());
+        std::vector<uint8_t> back(data.size());
+        BOOST_CHECK_EQUAL(r.read(back.data(), back.size()), (int)back.size());
+        BOOST_CHECK(back == data);
+
+        BOOST_CHECK(r.seek(70000));
+        BOOST_CHECK_EQUAL(r.read(), data[70000]);
+        BOOST_CHECK(r.seek(10));
+        BOOST_CHECK_EQUAL(r.read(), data[10]);
+        r.close();
+    }
+
+    BOOST_FIXTURE_TEST_CASE(multi_block_io_over_fragmented_files, FatImageTestFixture) {
+        // growing two files in turn leaves each with a chain full of gaps
+        std::vector<uint8_t> a(40000), b(40000);
+        for (size_t i = 0; i < a.size(); i++) {
+            a[i] = (uint8_t)(i * 3);
+            b[i] = (uint8_t)(i * 5 + 1);
+        }
+        File fa = SD.open("a.bin", FILE_WRITE);
+        File fb = SD.open("b.bin", FILE_WRITE);
+        if (!fa || !fb) BOOST_FAIL("could not open file");
+        for (size_t done = 0; done < a.size(); done += 5000) {
+            BOOST_CHECK_EQUAL(fa.write(&a[done], 5000), 5000u);
+            BOOST_CHECK_EQUAL(fb.write(&b[done], 5000), 5000u);
+        }
+        fa.close();
+        fb.close();
+
+        // overwrite the middle with whole and partial blocks
+        File w = SD.open("a.bin", O_READ | O_WRITE);
+        if (!w) BOOST_FAIL("could not open file");
+        for (size_t i = 1000; i < 31000; i++)
+            a[i] = (uint8_t)~a[i];
+        BOOST_CHECK(w.seek(1000));
+        BOOST_CHECK_EQUAL(w.write(&a[1000], 30000), 30000u);
+        w.close();
+
+        BOOST_REQUIRE(SD.setSDCardImagePath(imagePath));
+        for (auto *file : {"a.bin", "b.bin"}) {
+            const std::vector<uint8_t> &expected = file[0] == 'a' ? a : b;
+            File r = SD.open(file);
+            if (!r) BOOST_FAIL("could not open file");
+            std::vector<uint8_t> back(expected.size());
+            BOOST_CHECK_EQUAL(r.read(back.data(), back.size()), (int)back.size());
+            BOOST_CHECK(back == expected);
+            // unaligned start
+            BOOST_CHECK(r.seek(777));
+            BOOST_CHECK_EQUAL(r.read(back.data(), 20000), 20000);
+            BOOST_CHECK(std::equal(back.begin(), back.begin() + 20000, expected.begin() + 777));
+            r.close();
+        }
+    }
+
+    BOOST_FIXTURE_TEST_CASE(seeks_across_many_fragments, FatImageTestFixture) {
+        // alternate one cluster at a time so each file has ~100 runs, more
+        // than an SdFile keeps in its extent table
+        const uint32_t cluster = 2048;
+        const uint32_t size = 100 * cluster;
+        std::vector<uint8_t> a(size), b(size);
+        for (uint32_t i = 0; i < size; i++) {
+            a[i] = (uint8_t)(i * 7 + i / 251);
+            b[i] = (uint8_t)(i * 13 + 5);
+        }
+        File fa = SD.open("a.bin", FILE_WRITE);
+        File fb = SD.open("b.bin", FILE_WRITE);
+        if (!fa || !fb) BOOST_FAIL("could not open file");
+        for (uint32_t done = 0; done < size; done += cluster) {
+            BOOST_CHECK_EQUAL(fa.write(&a[done], cluster), cluster);
+            BOOST_CHECK_EQUAL(fb.write(&b[done], cluster), cluster);
+        }
+        fa.close();
+        fb.close();
+
+        File r = SD.open("a.bin");
+        if (!r) BOOST_FAIL("could not open file");
+        // backwards, then scattered, through and beyond the mapped runs
+        for (int32_t pos = size - 3; pos > 100; pos -= 2500) {
+            BOOST_REQUIRE(r.seek(pos));
+            BOOST_CHECK_EQUAL(r.read(), a[pos]);
+        }
+        uint32_t x = 1;
+        for (int i = 0; i < 500; i++) {
+            x = x * 1103515245 + 12345;
+            uint32_t pos = (x >> 8) % size;
+            BOOST_REQUIRE(r.seek(pos));
+            BOOST_CHECK_EQUAL(r.read(), a[pos]);
+        }
+        BOOST_CHECK(r.seek(size));
+        BOOST_CHECK(!r.seek(size + 1));
+        r.close();
+
+        // appends find the end of a fragmented chain
+        File w = SD.open("b.bin", FILE_WRITE);
+        if (!w) BOOST_FAIL("could not open file");
+        BOOST_CHECK_EQUAL(w.write((const uint8_t *)"end", 3), 3u);
+        w.close();
+        File rb = SD.open("b.bin");
+        if (!rb) BOOST_FAIL("could not open file");
+        BOOST_CHECK_EQUAL(rb.size(), size + 3);
+        BOOST_REQUIRE(rb.seek(size - 1));
+        BOOST_CHECK_EQUAL(rb.read(), b[size - 1]);
+        BOOST_CHECK_EQUAL(rb.read(), 'e');
+        rb.close();
+    }
+
+    BOOST_FIXTURE_TEST_CASE(subdirectory_spanning_clusters, FatImageTestFixture) {
+        // 64 entries fill a 2 KiB cluster
+        BOOST_REQUIRE(SD.mkdir("many"));
+        char name[20];
+        for (int i = 0; i < 150; i++) {
+            snprintf(name, sizeof(name), "many/f%03d.txt", i);
+            File f = SD.open(name, FILE_WRITE);
+            if (!f) BOOST_FAIL("could not open file");
+            f.close();
+        }
+        BOOST_REQUIRE(SD.setSDCardImagePath(imagePath));
+        BOOST_CHECK(SD.exists("many/f149.txt"));
+        File dir = SD.open("many");
+        if (!dir) BOOST_FAIL("could not open file");
+        int count = 0;
+        while (true) {
+            File child = dir.openNextFile();
+            if (!child)
+                break;
+            count++;
+            child.close();
+        }
+        dir.close();
+        BOOST_CHECK_EQUAL(count, 150);
+    }
+
+    BOOST_FIXTURE_TEST_CASE(directory_name_index, FatImageTestFixture) {
+        SD.setMetadataCache(true);
+        BOOST_REQUIRE(SD.mkdir("logs"));
+        char name[24];
+        for (int i = 0; i < 300; i++) {
+            snprintf(name, sizeof(name), "logs/l%04d.txt", i);
+            File f = SD.open(name, FILE_WRITE);
+            if (!f) BOOST_FAIL("could not open file");
+            f.write((const uint8_t *)name, strlen(name));
+            f.close();
+        }
+        BOOST_CHECK(SD.exists("logs/l0000.txt"));
+        BOOST_CHECK(SD.exists("logs/l0299.txt"));
+        BOOST_CHECK(!SD.exists("logs/l0300.txt"));
+
+        // removed names disappear and their slots are reused
+        for (int i = 0; i < 300; i += 3) {
+            snprintf(name, sizeof(name), "logs/l%04d.txt", i);
+            BOOST_CHECK(SD.remove(name));
+        }
+        BOOST_CHECK(!SD.exists("logs/l0000.txt"));
+        BOOST_CHECK(SD.exists("logs/l0001.txt"));
+        File n = SD.open("logs/new.txt", FILE_WRITE);
+        if (!n) BOOST_FAIL("could not open file");
+        n.close();
+        BOOST_CHECK(SD.exists("logs/new.txt"));
+
+        // a directory created where a removed one was starts out empty
+        BOOST_REQUIRE(SD.mkdir("tmp"));
+        File t = SD.open("tmp/a.txt", FILE_WRITE);
+        if (!t) BOOST_FAIL("could not open file");
+        t.close();
+        BOOST_CHECK(SD.exists("tmp/a.txt"));
+        BOOST_CHECK(SD.remove("tmp/a.txt"));
+        BOOST_CHECK(SD.rmdir("tmp"));
+        BOOST_REQUIRE(SD.mkdir("tmp2"));
+        BOOST_CHECK(!SD.exists("tmp2/a.txt"));
+
+        // the card agrees once remounted without the index
+        SD.setMetadataCache(false);
+        BOOST_REQUIRE(SD.setSDCardImagePath(imagePath));
+        File dir = SD.open("logs");
+        if (!dir) BOOST_FAIL("could not open file");
+        int count = 0;
+        while (true) {
+            File child = dir.openNextFile();
+            if (!child)
+                break;
+            count++;
+            child.close();
+        }
+        dir.close();
+        BOOST_CHECK_EQUAL(count, 201);
+        BOOST_CHECK(SD.exists("logs/new.txt"));
+        BOOST_CHECK(!SD.exists("logs/l0003.txt"));
+        File r = SD.open("logs/l0298.txt");
+        if (!r) BOOST_FAIL("could not open file");
+        BOOST_CHECK_EQUAL(r.size(), 14u);
+        r.close();
+    }
+
+    BOOST_FIXTURE_TEST_CASE(long_file_names, FatImageTestFixture) {
+        const char *expected = "take one";
+        File f = SD.open("Field Recording 01.wav", FILE_WRITE);
+        if (!f) BOOST_FAIL("could not open file");
+        f.write((const uint8_t *)expected, strlen(expected));
+        f.close();
+        f = SD.open("Field Recording 02.wav", FILE_WRITE);
+        if (!f) BOOST_FAIL("could not open file");
+        f.close();
+        f = SD.open("caf\xC3\xA9 menu.txt", FILE_WRITE);
+        if (!f) BOOST_FAIL("could not open file");
+        f.close();
+        BOOST_REQUIRE(SD.mkdir("A Directory With A Long Name"));
+        f = SD.open("A Directory With A Long Name/and a long file name.txt", FILE_WRITE);
+        if (!f) BOOST_FAIL("could not open file");
+        f.close();
+
+        // long names ignore the case of ASCII letters and each gets its own 8.3 name
+        BOOST_REQUIRE(SD.setSDCardImagePath(imagePath));
+        File r = SD.open("field recording 01.WAV");
+        if (!r) BOOST_FAIL("could not open file");
+        BOOST_CHECK_EQUAL(r.size(), strlen(expected));
+        r.close();
+        BOOST_CHECK(SD.exists("FIELDR~1.WAV"));
+        BOOST_CHECK(SD.exists("FIELDR~2.WAV"));
+        BOOST_CHECK(!SD.exists("FIELDR~3.WAV"));
+        // only ASCII letters fold
+        BOOST_CHECK(!SD.exists("CAF\xC3\x89 menu.txt"));
+        BOOST_CHECK(SD.exists("caf\xC3\xA9 menu.txt"));
+        BOOST_CHECK(SD.exists("a directory with a long name/AND A LONG FILE NAME.TXT"));
+
+        // a listing shows the long names as they were written
+        std::vector<std::string> names;
+        File dir = SD.open("/");
+        if (!dir) BOOST_FAIL("could not open file");
+        while (true) {
+            File child = dir.openNextFile();
+            if (!child)
+                break;
+            names.push_back(child.name());
+            child.close();
+        }
+        dir.close();
+        std::sort(names.begin(), names.end());
+        std::vector<std::string> expectedNames = {
+            "A Directory With A Long Name", "Field Recording 01.wav",
+            "Field Recording 02.wav", "caf\xC3\xA9 menu.txt"};
+        BOOST_CHECK_EQUAL_COLLECTIONS(names.begin(), names.end(),
+                                      expectedNames.begin(), expectedNames.end());
+
+        // a component too long for a long name is not cut down to one that exists
+        std::string tooLong(800, 'x');
+        BOOST_CHECK(!SD.exists((tooLong + "/x.txt").c_str()));
+        BOOST_CHECK(!SD.open((std::string("A Directory With A Long Name") + tooLong).c_str()));
+
+        BOOST_CHECK(SD.remove("Field Recording 01.wav"));
+        BOOST_CHECK(!SD.exists("Field Recording 01.wav"));
+        BOOST_CHECK(!SD.exists("FIELDR~1.WAV"));
+        BOOST_CHECK(SD.exists("Field Recording 02.wav"));
+    }
+
+    BOOST_FIXTURE_TEST_CASE(long_name_entries, FatImageTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        Sd2Card card;
+        BOOST_REQUIRE(card.openImage(imagePath));
+        SdVolume volume;
+        BOOST_REQUIRE(volume.init(&card));
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&volume));
+        // live long name entries in the root directory
+        auto countLongEntries = [&root]() {
+            int n = 0;
+            dir_t d;
+            root.rewind();
+            while (root.read(&d, sizeof(d)) == sizeof(d) && d.name[0] != DIR_NAME_FREE) {
+                if (d.name[0] != DIR_NAME_DELETED && DIR_IS_LONG_NAME(&d))
+                    n++;
+            }
+            return n;
+        };
+
+        // 30 characters take three long name entries; 8.3 names take none
+        SdFile f;
+        BOOST_REQUIRE(f.open(&root, "thirty character long name.txt", O_CREAT | O_WRITE));
+        char name[3 * LDIR_NAME_MAX + 1];
+        BOOST_REQUIRE(f.getName(name, sizeof(name)));
+        BOOST_CHECK_EQUAL(std::string(name), "thirty character long name.txt");
+        BOOST_REQUIRE(f.close());
+        BOOST_REQUIRE(f.open(&root, "SHORT.TXT", O_CREAT | O_WRITE));
+        BOOST_REQUIRE(f.getName(name, sizeof(name)));
+        BOOST_CHECK_EQUAL(std::string(name), "SHORT.TXT");
+        BOOST_REQUIRE(f.close());
+        BOOST_CHECK_EQUAL(countLongEntries(), 3);
+
+        // opening by the generated 8.3 name still finds the long name
+        BOOST_REQUIRE(f.open(&root, "THIRTY~1.TXT", O_READ));
+        BOOST_REQUIRE(f.getName(name, sizeof(name)));
+        BOOST_CHECK_EQUAL(std::string(name), "thirty character long name.txt");
+        BOOST_CHECK(!f.getName(name, 20));
+        BOOST_REQUIRE(f.close());
+
+        // removing the file removes its long name entries, which a longer
+        // name can then reuse
+        BOOST_REQUIRE(SdFile::remove(&root, "THIRTY~1.TXT"));
+        BOOST_CHECK_EQUAL(countLongEntries(), 0);
+        BOOST_CHECK(!f.open(&root, "thirty character long name.txt", O_READ));
+
+        // the same through the name index, with names that need several blocks of entries
+        volume.dirIndexEnable(true);
+        std::string longName(200, 'n');
+        for (int i = 0; i < 20; i++) {
+            std::string n = longName + std::to_string(i);
+            BOOST_REQUIRE(f.open(&root, n.c_str(), O_CREAT | O_WRITE));
+            BOOST_REQUIRE(f.close());
+        }
+        BOOST_CHECK_EQUAL(countLongEntries(), 20 * 16);
+        BOOST_REQUIRE(f.open(&root, (longName + "7").c_str(), O_READ));
+        BOOST_REQUIRE(f.getName(name, sizeof(name)));
+        BOOST_CHECK_EQUAL(std::string(name), longName + "7");
+        BOOST_REQUIRE(f.close());
+        BOOST_REQUIRE(SdFile::remove(&root, (longName + "7").c_str()));
+        BOOST_CHECK(!f.open(&root, (longName + "7").c_str(), O_READ));
+        BOOST_CHECK_EQUAL(countLongEntries(), 19 * 16);
+
+        // the generated 8.3 names are all different
+        volume.dirIndexEnable(false);
+        BOOST_REQUIRE(f.open(&root, (longName + "7").c_str(), O_CREAT | O_WRITE));
+        BOOST_REQUIRE(f.close());
+        std::vector<std::string> shortNames;
+        dir_t d;
+        root.rewind();
+        while (root.readDir(&d) > 0) {
+            char shortName[13];
+            SdFile::dirName(d, shortName);
+            shortNames.push_back(shortName);
+        }
+        BOOST_CHECK_EQUAL(shortNames.size(), 21u);
+        std::sort(shortNames.begin(), shortNames.end());
+        BOOST_CHECK(std::adjacent_find(shortNames.begin(), shortNames.end()) == shortNames.end());
+    }
+
+    BOOST_FIXTURE_TEST_CASE(illegal_short_name_characters_take_long_names, FatImageTestFixture) {
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&SD.cardVolume()));
+        // characters FAT doesn't allow in 8.3 names, in upper and lower case
+        const char *names[] = {"a+b.txt", "x[1].c", "k=v", "semi;c", "A,B.TXT", "C^D"};
+        for (const char *n : names) {
+            SdFile f;
+            BOOST_REQUIRE(f.open(&root, n, O_CREAT | O_WRITE));
+            char name[3 * LDIR_NAME_MAX + 1];
+            BOOST_REQUIRE(f.getName(name, sizeof(name)));
+            BOOST_CHECK_EQUAL(std::string(name), n);
+            BOOST_REQUIRE(f.close());
+        }
+        // every one has a long name entry and a generated 8.3 name that
+        // holds none of them
+        int longEntries = 0;
+        std::vector<std::string> shortNames;
+        dir_t d;
+        root.rewind();
+        while (root.read(&d, sizeof(d)) == sizeof(d) && d.name[0] != DIR_NAME_FREE) {
+            if (d.name[0] == DIR_NAME_DELETED)
+                continue;
+            if (DIR_IS_LONG_NAME(&d)) {
+                longEntries++;
+            } else if (DIR_IS_FILE(&d)) {
+                char shortName[13];
+                SdFile::dirName(d, shortName);
+                shortNames.push_back(shortName);
+            }
+        }
+        BOOST_CHECK_EQUAL(longEntries, 6);
+        BOOST_REQUIRE_EQUAL(shortNames.size(), 6u);
+        for (const std::string &n : shortNames) {
+            BOOST_CHECK(n.find('~') != std::string::npos);
+            BOOST_CHECK(n.find_first_of("|<>^+=?/[];,*\"\\:") == std::string::npos);
+        }
+        root.close();
+        BOOST_CHECK(SD.exists("x[1].c"));
+        BOOST_CHECK(SD.remove("semi;c"));
+        BOOST_CHECK(!SD.exists("semi;c"));
+    }
+
+    BOOST_FIXTURE_TEST_CASE(block_cache_pools_and_counters, FatImageTestFixture) {
+        BOOST_CHECK(!SD.cardVolume().cacheConfigure(0, 4));
+        BOOST_CHECK(!SD.cardVolume().cacheConfigure(4, 0));
+        BOOST_CHECK(!SD.cardVolume().cacheConfigure(SD_CACHE_MAX_SLOTS, 1));
+        BOOST_REQUIRE(SD.cardVolume().cacheConfigure(2, 8));
+
+        File f = SD.open("cached.txt", FILE_WRITE);
+        if (!f) BOOST_FAIL("could not open file");
+        std::vector<uint8_t> data(3000, 'c');
+        BOOST_CHECK_EQUAL(f.write(data.data(), data.size()), data.size());
+        f.close();
+        BOOST_CHECK(SD.cardVolume().cacheStats().writeBacks > 0);
+
+        // everything the second pass touches is already cached
+        SD.cardVolume().cacheClear();
+        for (int pass = 0; pass < 2; pass++) {
+            SD.cardVolume().cacheResetStats();
+            File r = SD.open("cached.txt");
+            if (!r) BOOST_FAIL("could not open file");
+            char c;
+            while (r.read(&c, 1) == 1) {}
+            r.close();
+            const cache_stats_t &stats = SD.cardVolume().cacheStats();
+            BOOST_CHECK(stats.fatHits + stats.fatMisses > 0);
+            if (pass == 0) {
+                BOOST_CHECK(stats.dataMisses > 0);
+                BOOST_CHECK(stats.fatMisses > 0);
+            } else {
+                BOOST_CHECK_EQUAL(stats.dataMisses, 0u);
+                BOOST_CHECK_EQUAL(stats.fatMisses, 0u);
+                BOOST_CHECK(stats.dataHits > 0);
+            }
+        }
+
+        BOOST_CHECK(SD.cardVolume().cacheConfigure(SD_CACHE_FAT_SLOTS, SD_CACHE_DATA_SLOTS));
+    }
+
+    BOOST_FIXTURE_TEST_CASE(read_ahead_window, FatImageTestFixture) {
+        BOOST_CHECK(!SD.cardVolume().readAheadConfigure(SD_READ_AHEAD_MAX_BLOCKS + 1));
+        BOOST_REQUIRE(SD.cardVolume().readAheadConfigure(8));
+
+        // 40 KiB in 20 clusters, every byte telling where it is
+        std::vector<uint8_t> data(40 * 1024);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = (uint8_t)(i * 7 + (i >> 9));
+        File f = SD.open("stream.bin", FILE_WRITE);
+        if (!f) BOOST_FAIL("could not open file");
+        BOOST_CHECK_EQUAL(f.write(data.data(), data.size()), data.size());
+        f.close();
+
+        // a sequential reader gets most blocks from the window
+        for (size_t chunk : {100, 512}) {
+            SD.cardVolume().cacheClear();
+            SD.cardVolume().cacheResetStats();
+            File r = SD.open("stream.bin");
+            if (!r) BOOST_FAIL("could not open file");
+            std::vector<uint8_t> back(data.size());
+            for (size_t pos = 0; pos < back.size(); pos += chunk)
+                r.read(back.data() + pos, std::min(chunk, back.size() - pos));
+            r.close();
+            BOOST_CHECK(back == data);
+            const cache_stats_t &stats = SD.cardVolume().cacheStats();
+            BOOST_CHECK(stats.readAheadMisses > 0);
+            BOOST_CHECK(stats.readAheadMisses <= 80 / 8 + 1);
+            BOOST_CHECK(stats.readAheadHits >= 70);
+        }
+
+        // writes are seen through the window
+        File r = SD.open("stream.bin");
+        if (!r) BOOST_FAIL("could not open file");
+        uint8_t buf[512];
+        BOOST_CHECK_EQUAL(r.read(buf, 512), 512);
+        BOOST_CHECK_EQUAL(r.read(buf, 512), 512);
+        File w = SD.open("stream.bin", O_READ | O_WRITE);
+        if (!w) BOOST_FAIL("could not open file");
+        w.seek(1024 + 3);
+        w.write((const uint8_t *)"xyz", 3);
+        w.seek(2048);
+        std::vector<uint8_t> block(1024, 'w');
+        w.write(block.data(), block.size());
+        w.close();
+        BOOST_CHECK_EQUAL(r.read(buf, 512), 512);
+        BOOST_CHECK(!memcmp(buf + 3, "xyz", 3));
+        BOOST_CHECK_EQUAL(buf[0], data[1024]);
+        BOOST_CHECK_EQUAL(r.read(buf, 512), 512);
+        BOOST_CHECK_EQUAL(r.read(buf, 512), 512);
+        BOOST_CHECK_EQUAL(buf[511], 'w');
+        r.close();
+
+        // a window of zero turns read-ahead off
+        BOOST_REQUIRE(SD.cardVolume().readAheadConfigure(0));
+        SD.cardVolume().cacheResetStats();
+        r = SD.open("stream.bin");
+        if (!r) BOOST_FAIL("could not open file");
+        while (r.read(buf, 512) == 512) {}
+        r.close();
+        BOOST_CHECK_EQUAL(SD.cardVolume().cacheStats().readAheadHits, 0u);
+        BOOST_CHECK_EQUAL(SD.cardVolume().cacheStats().readAheadMisses, 0u);
+        BOOST_CHECK(SD.cardVolume().readAheadConfigure(SD_READ_AHEAD_BLOCKS));
+    }
+
+    BOOST_FIXTURE_TEST_CASE(free_cluster_map_follows_allocation, FatImageTestFixture) {
+        // mount the image directly so the volume can be inspected
+        SD.setSDCardFolderPath("output", true);
+        Sd2Card card;
+        BOOST_REQUIRE(card.openImage(imagePath));
+        SdVolume volume;
+        BOOST_REQUIRE(volume.init(&card));
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&volume));
+        const uint32_t empty = volume.freeClusterCount();
+        BOOST_CHECK_EQUAL(empty, volume.clusterCount());
+
+        // 10000 bytes take five 2 KiB clusters
+        std::vector<uint8_t> data(10000, 'm');
+        SdFile f;
+        BOOST_REQUIRE(f.open(&root, "MAP.BIN", O_CREAT | O_WRITE));
+        BOOST_CHECK_EQUAL(f.write(data.data(), data.size()), data.size());
+        BOOST_REQUIRE(f.close());
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 5);
+
+        // a fresh scan of the FAT agrees with the running count
+        SdVolume rescan;
+        BOOST_REQUIRE(rescan.init(&card));
+        BOOST_CHECK_EQUAL(rescan.freeClusterCount(), empty - 5);
+
+        BOOST_REQUIRE(SdFile::remove(&root, "MAP.BIN"));
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty);
+
+        // allocation reuses the clusters that were just freed
+        BOOST_REQUIRE(f.open(&root, "MAP.BIN", O_CREAT | O_WRITE));
+        BOOST_CHECK_EQUAL(f.write(data.data(), data.size()), data.size());
+        BOOST_CHECK_EQUAL(f.firstCluster(), 2u);
+        BOOST_REQUIRE(f.close());
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 5);
+    }
+
+    BOOST_FIXTURE_TEST_CASE(fat32_free_count_from_fsinfo, Fat32ImageTestFixture) {
+        File g = SD.open("hello.txt", FILE_WRITE);
+        if (!g) BOOST_FAIL("could not open file");
+        g.write((const uint8_t *)"hello", 5);
+        g.close();
+        BOOST_CHECK(SD.remove("hello.txt"));
+
+        SD.setSDCardFolderPath("output", true);
+        Sd2Card card;
+        BOOST_REQUIRE(card.openImage(imagePath));
+        fsinfo_t fsi;
+        BOOST_REQUIRE(card.readBlock(1, reinterpret_cast<uint8_t *>(&fsi)));
+        const uint32_t empty = fsi.freeCount;
+
+        // a stale count is believed, so the FAT was not scanned to get it
+        fsi.freeCount = empty - 7;
+        BOOST_REQUIRE(card.writeBlock(1, reinterpret_cast<uint8_t *>(&fsi)));
+        SdVolume volume;
+        BOOST_REQUIRE(volume.init(&card));
+        BOOST_CHECK_EQUAL(volume.fatType(), 32);
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 7);
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&volume));
+
+        // 10000 bytes take 20 clusters, found from the next free hint
+        std::vector<uint8_t> data(10000, 'f');
+        SdFile f;
+        BOOST_REQUIRE(f.open(&root, "FSINFO.BIN", O_CREAT | O_WRITE));
+        BOOST_CHECK_EQUAL(f.write(data.data(), data.size()), data.size());
+        BOOST_REQUIRE(f.close());
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 27);
+
+        // close() wrote the count and hint back
+        BOOST_REQUIRE(card.readBlock(1, reinterpret_cast<uint8_t *>(&fsi)));
+        BOOST_CHECK_EQUAL(fsi.freeCount, empty - 27);
+        BOOST_CHECK_EQUAL(fsi.leadSignature, FSINFO_LEAD_SIG);
+        BOOST_CHECK_EQUAL(fsi.trailSignature, FSINFO_TRAIL_SIG);
+        SdVolume again;
+        BOOST_REQUIRE(again.init(&card));
+        BOOST_CHECK_EQUAL(again.freeClusterCount(), empty - 27);
+        root.close();
+        BOOST_REQUIRE(root.openRoot(&again));
+        BOOST_REQUIRE(f.open(&root, "NEXT.BIN", O_CREAT | O_WRITE));
+        BOOST_CHECK_EQUAL(f.write(data.data(), 1), 1);
+        // the hint is where the search starts, after FSINFO.BIN's first
+        BOOST_CHECK_EQUAL(fsi.nextFree, 4u);
+        BOOST_CHECK_EQUAL(f.firstCluster(), 23u);
+        BOOST_REQUIRE(f.close());
+
+        // a run is searched for in the free cluster map, which corrects the
+        // count and the next sync corrects FSInfo
+        BOOST_REQUIRE(f.open(&root, "RUN.BIN", O_CREAT | O_WRITE));
+        BOOST_REQUIRE(f.preallocate(65536));
+        BOOST_CHECK_EQUAL(again.freeClusterCount(), empty - 20 - 1 - 128);
+        for (int i = 0; i < 8; i++)
+            BOOST_REQUIRE_EQUAL(f.write(data.data(), 8192), 8192u);
+        BOOST_REQUIRE(f.close());
+        BOOST_REQUIRE(card.readBlock(1, reinterpret_cast<uint8_t *>(&fsi)));
+        BOOST_CHECK_EQUAL(fsi.freeCount, empty - 20 - 1 - 128);
+
+        check_report_t report;
+        BOOST_REQUIRE(SdCheck().check(&again, &report));
+        BOOST_CHECK(report.clean());
+        BOOST_CHECK_EQUAL(report.freeClusters, empty - 20 - 1 - 128);
+    }
+
+    BOOST_FIXTURE_TEST_CASE(fat32_fsinfo_fallbacks, Fat32ImageTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        Sd2Card card;
+        BOOST_REQUIRE(card.openImage(imagePath));
+        SdVolume volume;
+        BOOST_REQUIRE(volume.init(&card));
+        const uint32_t empty = volume.freeClusterCount();
+
+        // clusters 3 to 3002 in use behind the hint, more than the search
+        // from the hint looks at before scanning the whole FAT
+        uint8_t block[512];
+        for (uint8_t copy = 0; copy < volume.fatCount(); copy++) {
+            for (uint32_t b = 0; b < 24; b++) {
+                uint32_t lba = volume.fatStartBlock() + copy * volume.blocksPerFat() + b;
+                BOOST_REQUIRE(card.readBlock(lba, block));
+                uint32_t *fat = reinterpret_cast<uint32_t *>(block);
+                for (uint32_t i = 0; i < 128; i++) {
+                    uint32_t c = b * 128 + i;
+                    if (c >= 3 && c <= 3002) fat[i] = FAT32EOC;
+                }
+                BOOST_REQUIRE(card.writeBlock(lba, block));
+            }
+        }
+        fsinfo_t fsi;
+        BOOST_REQUIRE(card.readBlock(1, reinterpret_cast<uint8_t *>(&fsi)));
+        fsi.freeCount = empty - 3000;
+        fsi.nextFree = 3;
+        BOOST_REQUIRE(card.writeBlock(1, reinterpret_cast<uint8_t *>(&fsi)));
+        volume.cacheClear();
+
+        SdVolume again;
+        BOOST_REQUIRE(again.init(&card));
+        BOOST_CHECK_EQUAL(again.freeClusterCount(), empty - 3000);
+        SdFile root;
+        root.close();
+        BOOST_REQUIRE(root.openRoot(&again));
+        SdFile f;
+        BOOST_REQUIRE(f.open(&root, "FAR.BIN", O_CREAT | O_WRITE));
+        BOOST_CHECK_EQUAL(f.write("x", 1), 1);
+        BOOST_CHECK_EQUAL(f.firstCluster(), 3003u);
+        BOOST_REQUIRE(f.close());
+        BOOST_CHECK_EQUAL(again.freeClusterCount(), empty - 3001);
+
+        // an unknown count has the FAT scanned at init() and is written back
+        again.cacheClear();
+        BOOST_REQUIRE(card.readBlock(1, reinterpret_cast<uint8_t *>(&fsi)));
+        fsi.freeCount = FSINFO_UNKNOWN;
+        BOOST_REQUIRE(card.writeBlock(1, reinterpret_cast<uint8_t *>(&fsi)));
+        SdVolume rescan;
+        BOOST_REQUIRE(rescan.init(&card));
+        BOOST_CHECK_EQUAL(rescan.freeClusterCount(), empty - 3001);
+        root.close();
+        BOOST_REQUIRE(root.openRoot(&rescan));
+        BOOST_REQUIRE(root.sync());
+        BOOST_REQUIRE(card.readBlock(1, reinterpret_cast<uint8_t *>(&fsi)));
+        BOOST_CHECK_EQUAL(fsi.freeCount, empty - 3001);
+
+        // a sector that is not FSInfo is ignored and never written
+        std::vector<uint8_t> zeros(512, 0);
+        rescan.cacheClear();
+        BOOST_REQUIRE(card.writeBlock(1, zeros.data()));
+        SdVolume bare;
+        BOOST_REQUIRE(bare.init(&card));
+        BOOST_CHECK_EQUAL(bare.freeClusterCount(), empty - 3001);
+        root.close();
+        BOOST_REQUIRE(root.openRoot(&bare));
+        BOOST_REQUIRE(f.open(&root, "FAR.BIN", O_WRITE | O_APPEND));
+        BOOST_CHECK_EQUAL(f.write(zeros.data(), 512), 512);
+        BOOST_REQUIRE(f.close());
+        BOOST_REQUIRE(card.readBlock(1, block));
+        BOOST_CHECK(std::equal(block, block + 512, zeros.begin()));
+    }
+
+    BOOST_FIXTURE_TEST_CASE(fat_copies_written_back_at_sync, FatImageTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        Sd2Card card;
+        BOOST_REQUIRE(card.openImage(imagePath));
+        SdVolume volume;
+        BOOST_REQUIRE(volume.init(&card));
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&volume));
+        // one FAT slot, so two files in different FAT blocks take turns in it
+        BOOST_REQUIRE(volume.cacheConfigure(1, 8));
+
+        // 300 clusters, the last of them in the second FAT block
+        std::vector<uint8_t> cluster(2048, 'f');
+        SdFile far;
+        BOOST_REQUIRE(far.open(&root, "FAR.BIN", O_CREAT | O_WRITE));
+        for (int i = 0; i < 300; i++)
+            BOOST_REQUIRE_EQUAL(far.write(cluster.data(), cluster.size()), (int)cluster.size());
+        BOOST_REQUIRE(far.close());
+
+        auto fatCopiesMatch = [&]() {
+            uint8_t a[512], b[512];
+            for (uint32_t i = 0; i < volume.blocksPerFat(); i++) {
+                if (!card.readBlock(volume.fatStartBlock() + i, a) ||
+                    !card.readBlock(volume.fatStartBlock() + volume.blocksPerFat() + i, b) ||
+                    memcmp(a, b, 512))
+                    return false;
+            }
+            return true;
+        };
+        uint32_t copyWrites[2];
+        for (int writeBack = 0; writeBack < 2; writeBack++) {
+            BOOST_REQUIRE(volume.fatWriteBackEnable(writeBack));
+            BOOST_CHECK_EQUAL(volume.fatWriteBackEnabled(), writeBack);
+            volume.cacheResetStats();
+            // grow a file a cluster at a time while reading the first one
+            SdFile grow;
+            BOOST_REQUIRE(far.open(&root, "FAR.BIN", O_READ));
+            BOOST_REQUIRE(grow.open(&root, writeBack ? "GROW2.BIN" : "GROW1.BIN", O_CREAT | O_WRITE));
+            for (int i = 0; i < 100; i++) {
+                BOOST_REQUIRE_EQUAL(grow.write(cluster.data(), cluster.size()), (int)cluster.size());
+                BOOST_REQUIRE_EQUAL(far.read(cluster.data(), cluster.size()), (int)cluster.size());
+            }
+            BOOST_REQUIRE(grow.close());
+            BOOST_REQUIRE(far.close());
+            copyWrites[writeBack] = volume.cacheStats().fatCopyWrites;
+            BOOST_CHECK(fatCopiesMatch());
+        }
+        // write through copies the growing file's FAT block each time it is
+        // evicted, write back once at close
+        BOOST_CHECK(copyWrites[0] >= 99);
+        BOOST_CHECK(copyWrites[1] <= 2);
+
+        // a fresh mount reads both files back
+        volume.cacheClear();
+        SdVolume again;
+        BOOST_REQUIRE(again.init(&card));
+        SdFile root2, f;
+        BOOST_REQUIRE(root2.openRoot(&again));
+        BOOST_REQUIRE(f.open(&root2, "GROW2.BIN", O_READ));
+        BOOST_CHECK_EQUAL(f.fileSize(), 100u * 2048);
+        BOOST_REQUIRE(f.seekSet(f.fileSize() - 1));
+        BOOST_CHECK_EQUAL(f.read(), 'f');
+        BOOST_REQUIRE(f.close());
+    }
+
+    BOOST_FIXTURE_TEST_CASE(directories_and_remove, FatImageTestFixture) {
+        BOOST_REQUIRE(SD.mkdir("logs/day1"));
+        BOOST_CHECK(SD.exists("logs"));
+        BOOST_CHECK(SD.exists("logs/day1"));
+
+        File a = SD.open("logs/day1/a.txt", FILE_WRITE);
+        if (!a) BOOST_FAIL("could not open file");
+        a.write((const uint8_t *)"a", 1);
+        a.close();
+        File b = SD.open("logs/day1/b.txt", FILE_WRITE);
+        if (!b) BOOST_FAIL("could not open file");
+        b.write((const uint8_t *)"b", 1);
+        b.close();
+
+        File dir = SD.open("logs/day1");
+        if (!dir) BOOST_FAIL("could not open file");
+        BOOST_REQUIRE(dir.isDirectory());
+        std::vector<std::string> names;
+        while (true) {
+            File child = dir.openNextFile();
+            if (!child)
+                break;
+            names.push_back(child.name());
+            child.close();
+        }
+        dir.close();
+        std::sort(names.begin(), names.end());
+        BOOST_REQUIRE_EQUAL(names.size(), 2u);
+        BOOST_CHECK_EQUAL(names[0], "A.TXT");
+        BOOST_CHECK_EQUAL(names[1], "B.TXT");
+
+        // a directory opened by its path with a trailing slash is named
+        // after its last component, root after the slash
+        File sub = SD.open("logs/day1/");
+        if (!sub) BOOST_FAIL("could not open directory");
+        BOOST_CHECK(sub.isDirectory());
+        BOOST_CHECK_EQUAL(sub.name(), "day1");
+        sub.close();
+        File top = SD.open("/");
+        if (!top) BOOST_FAIL("could not open root");
+        BOOST_CHECK_EQUAL(top.name(), "/");
+        top.close();
+
+        // a directory must be empty before rmdir
+        BOOST_CHECK(!SD.rmdir("logs/day1"));
+        BOOST_CHECK(SD.remove("logs/day1/a.txt"));
+        BOOST_CHECK(SD.remove("logs/day1/b.txt"));
+        BOOST_CHECK(!SD.exists("logs/day1/a.txt"));
+        BOOST_CHECK(SD.rmdir("logs/day1"));
+        BOOST_CHECK(!SD.exists("logs/day1"));
+    }
+
+    BOOST_FIXTURE_TEST_CASE(rm_rf_star_frees_in_batches, FatImageTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        Sd2Card card;
+        BOOST_REQUIRE(card.openImage(imagePath));
+        SdVolume volume;
+        BOOST_REQUIRE(volume.init(&card));
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&volume));
+        const uint32_t empty = volume.freeClusterCount();
+        volume.dirIndexEnable(true);
+
+        // 40 files with long names, written a cluster each in turn so their
+        // chains are interleaved, half of them in a subdirectory
+        SdFile logs, old;
+        BOOST_REQUIRE(logs.makeDir(&root, "logs"));
+        BOOST_REQUIRE(old.makeDir(&logs, "old"));
+        SdFile files[40];
+        for (int i = 0; i < 40; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "Session Log %02d.txt", i);
+            BOOST_REQUIRE(files[i].open(i & 1 ? &old : &logs, name, O_CREAT | O_WRITE));
+        }
+        std::vector<uint8_t> data(2048, 'r');
+        for (int round = 0; round < 8; round++) {
+            for (auto &f : files)
+                BOOST_REQUIRE_EQUAL(f.write(data.data(), data.size()), data.size());
+        }
+        for (auto &f : files)
+            BOOST_REQUIRE(f.close());
+        BOOST_REQUIRE(old.close());
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 40 * 8 - 2);
+
+        // the nine directory blocks and two FAT blocks are written about
+        // once each, not once or twice per file
+        volume.cacheResetStats();
+        BOOST_REQUIRE(logs.rmRfStar());
+        BOOST_CHECK(!logs.isOpen());
+        BOOST_CHECK_LE(volume.cacheStats().writeBacks, 16u);
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty);
+        BOOST_CHECK(!old.open(&root, "logs", O_READ));
+
+        // nothing is left behind
+        check_report_t report;
+        BOOST_REQUIRE(SdCheck().check(&volume, &report));
+        BOOST_CHECK(report.clean());
+        BOOST_CHECK_EQUAL(report.files, 0u);
+        BOOST_CHECK_EQUAL(report.directories, 1u);
+        SdVolume rescan;
+        BOOST_REQUIRE(rescan.init(&card));
+        BOOST_CHECK_EQUAL(rescan.freeClusterCount(), empty);
+
+        // the root directory itself stays
+        BOOST_REQUIRE(files[0].open(&root, "LEFT.TXT", O_CREAT | O_WRITE));
+        BOOST_REQUIRE_EQUAL(files[0].write(data.data(), data.size()), data.size());
+        BOOST_REQUIRE(files[0].close());
+        BOOST_REQUIRE(root.rmRfStar());
+        BOOST_CHECK(root.isOpen());
+        BOOST_CHECK(!files[0].open(&root, "LEFT.TXT", O_READ));
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty);
+    }
+
+    BOOST_FIXTURE_TEST_CASE(volumes_mounted_side_by_side, FatImageTestFixture) {
+        // a FAT32 image next to the fixture's FAT16 one, with caches small
+        // enough that every file evicts blocks the other volume would
+        // clobber if the two shared them
+        SDClass second;
+        const char *secondPath = "output/second.img";
+        BOOST_REQUIRE(format_fat32_image(secondPath, 70000));
+        BOOST_REQUIRE(second.setSDCardImagePath(secondPath));
+        BOOST_REQUIRE(SD.cardVolume().cacheConfigure(1, 2));
+        BOOST_REQUIRE(second.cardVolume().cacheConfigure(1, 2));
+        SD.cardVolume().cacheResetStats();
+        second.cardVolume().cacheResetStats();
+
+        auto writeFiles = [](SDClass *sd, uint8_t seed, bool *ok) {
+            *ok = sd->mkdir("logs");
+            for (int i = 0; *ok && i < 12; i++) {
+                std::string name = "logs/Sensor " + std::to_string(i) + ".csv";
+                File f = sd->open(name.c_str(), FILE_WRITE);
+                if (!f) {
+                    *ok = false;
+                    break;
+                }
+                std::vector<uint8_t> data(5000 + 700 * i);
+                for (size_t j = 0; j < data.size(); j++)
+                    data[j] = (uint8_t)(j * seed + i);
+                *ok = f.write(data.data(), data.size()) == data.size();
+                f.close();
+            }
+        };
+        bool ok[2] = {false, false};
+        std::thread a(writeFiles, &SD, 3, &ok[0]);
+        std::thread b(writeFiles, &second, 5, &ok[1]);
+        a.join();
+        b.join();
+        BOOST_REQUIRE(ok[0]);
+        BOOST_REQUIRE(ok[1]);
+        BOOST_CHECK(SD.cardVolume().cacheStats().writeBacks > 0);
+        BOOST_CHECK(second.cardVolume().cacheStats().writeBacks > 0);
+
+        SDClass *cards[2] = {&SD, &second};
+        uint8_t seeds[2] = {3, 5};
+        for (int c = 0; c < 2; c++) {
+            for (int i = 0; i < 12; i++) {
+                std::string name = "logs/Sensor " + std::to_string(i) + ".csv";
+                File f = cards[c]->open(name.c_str());
+                if (!f) BOOST_FAIL("could not open file");
+                std::vector<uint8_t> back(f.size());
+                BOOST_CHECK_EQUAL(back.size(), 5000u + 700 * i);
+                BOOST_CHECK_EQUAL(f.read(back.data(), back.size()), (int)back.size());
+                f.close();
+                bool same = true;
+                for (size_t j = 0; j < back.size(); j++)
+                    same = same && back[j] == (uint8_t)(j * seeds[c] + i);
+                BOOST_CHECK(same);
+            }
+            check_report_t report;
+            BOOST_REQUIRE(cards[c]->checkCardImage(&report));
+            BOOST_CHECK(report.clean());
+            BOOST_CHECK_EQUAL(report.files, 12u);
+        }
+        BOOST_CHECK_EQUAL(second.cardVolume().fatType(), 32);
+        BOOST_CHECK(SD.cardVolume().cacheConfigure(SD_CACHE_FAT_SLOTS, SD_CACHE_DATA_SLOTS));
+        second.setSDCardFolderPath("output", true);
+        std::remove(secondPath);
+    }
+
+    BOOST_FIXTURE_TEST_CASE(concurrent_readers_share_a_volume, FatImageTestFixture) {
+        BOOST_REQUIRE(SD.setConcurrentReaders(true));
+        BOOST_CHECK(SD.cardVolume().concurrentEnabled());
+
+        // eight files written a cluster each in turn, so every read follows
+        // a fragmented chain through the FAT
+        const int readers = 8;
+        auto expected = [](int file, size_t pos) { return (uint8_t)(pos * (2 * file + 3) + (pos >> 9)); };
+        std::vector<File> files;
+        for (int i = 0; i < readers; i++) {
+            files.push_back(SD.open(("Reader " + std::to_string(i) + ".bin").c_str(), FILE_WRITE));
+            if (!files.back()) BOOST_FAIL("could not open file");
+        }
+        const size_t size = 40 * 2048 + 300;
+        std::vector<uint8_t> chunk(2048);
+        for (size_t pos = 0; pos < size; pos += chunk.size()) {
+            size_t n = std::min(chunk.size(), size - pos);
+            for (int i = 0; i < readers; i++) {
+                for (size_t j = 0; j < n; j++)
+                    chunk[j] = expected(i, pos + j);
+                BOOST_REQUIRE_EQUAL(files[i].write(chunk.data(), n), n);
+            }
+        }
+        for (auto &f : files)
+            f.close();
+
+        // each reader goes through its file in mixed reads and seeks while
+        // another thread appends to a log and creates files
+        std::vector<int> bad(readers, 0);
+        std::vector<std::thread> pool;
+        for (int i = 0; i < readers; i++) {
+            pool.emplace_back([&, i]() {
+                File f = SD.open(("Reader " + std::to_string(i) + ".bin").c_str());
+                if (!f) {
+                    bad[i]++;
+                    return;
+                }
+                std::vector<uint8_t> buf(20000);
+                size_t sizes[] = {1, 100, 512, 4096, 20000};
+                for (int round = 0; round < 30; round++) {
+                    uint32_t pos = (uint32_t)((round * 7919 + i * 104729) % size);
+                    size_t n = std::min(sizes[round % 5], size - pos);
+                    if (!f.seek(pos) || f.read(buf.data(), n) != (int)n)
+                        bad[i]++;
+                    for (size_t j = 0; j < n; j++)
+                        bad[i] += buf[j] != expected(i, pos + j);
+                }
+                f.close();
+            });
+        }
+        std::thread writer([&]() {
+            File log = SD.open("log.txt", FILE_WRITE);
+            for (int i = 0; i < 200; i++)
+                log.write((const uint8_t *)"0123456789\n", 11);
+            log.close();
+            for (int i = 0; i < 20; i++) {
+                File f = SD.open(("new " + std::to_string(i) + ".txt").c_str(), FILE_WRITE);
+                f.write((const uint8_t *)"x", 1);
+                f.close();
+            }
+        });
+        for (auto &t : pool)
+            t.join();
+        writer.join();
+        for (int i = 0; i < readers; i++)
+            BOOST_CHECK_EQUAL(bad[i], 0);
+
+        File log = SD.open("log.txt");
+        if (!log) BOOST_FAIL("could not open file");
+        BOOST_CHECK_EQUAL(log.size(), 200u * 11);
+        log.close();
+        check_report_t report;
+        BOOST_REQUIRE(SD.checkCardImage(&report));
+        BOOST_CHECK(report.clean());
+        BOOST_CHECK_EQUAL(report.files, (uint32_t)readers + 21);
+
+        // an SPI card takes one transfer at a time
+        BOOST_REQUIRE(SD.setConcurrentReaders(false));
+        BOOST_CHECK(!SD.cardVolume().concurrentEnabled());
+
+        // a remount starts with the mode off, whatever it was before
+        BOOST_REQUIRE(SD.setConcurrentReaders(true));
+        BOOST_REQUIRE(SD.setSDCardImagePath(imagePath));
+        BOOST_CHECK(!SD.cardVolume().concurrentEnabled());
+        BOOST_CHECK(SD.exists("log.txt"));
+        BOOST_REQUIRE(SD.setConcurrentReaders(true));
+        SD.setSDCardRamFileSystem();
+        BOOST_CHECK(!SD.cardVolume().concurrentEnabled());
+        BOOST_REQUIRE(SD.setSDCardImagePath(imagePath));
+        BOOST_CHECK(!SD.cardVolume().concurrentEnabled());
+        SdVolume bare;
+        BOOST_CHECK(!bare.concurrentEnable(true));
+        SD.setSDCardFolderPath("output", true);
+        BOOST_CHECK(!SD.setConcurrentReaders(true));
+    }
+
+    BOOST_FIXTURE_TEST_CASE(readers_wait_for_check_and_defrag, FatImageTestFixture) {
+        BOOST_REQUIRE(SD.setConcurrentReaders(true));
+
+        // one file in a run of its own for the readers, then two that
+        // interleave a cluster at a time for the defragmenter to move
+        std::vector<uint8_t> steady = pattern(30 * 2048 + 300, 11);
+        File s = SD.open("steady.bin", FILE_WRITE);
+        if (!s) BOOST_FAIL("could not open file");
+        BOOST_REQUIRE_EQUAL(s.write(steady.data(), steady.size()), steady.size());
+        s.close();
+        std::vector<std::vector<uint8_t>> data = {pattern(20 * 2048, 5), pattern(20 * 2048, 7)};
+        File a = SD.open("A.BIN", FILE_WRITE);
+        File b = SD.open("B.BIN", FILE_WRITE);
+        if (!a || !b) BOOST_FAIL("could not open file");
+        for (size_t pos = 0; pos < data[0].size(); pos += 2048) {
+            BOOST_REQUIRE_EQUAL(a.write(data[0].data() + pos, 2048), 2048u);
+            BOOST_REQUIRE_EQUAL(b.write(data[1].data() + pos, 2048), 2048u);
+        }
+        a.close();
+        b.close();
+
+        // readers go through steady.bin until the main thread is done
+        std::atomic<bool> done(false);
+        auto reader = [&](int i, int *bad, int *rounds) {
+            File f = SD.open("steady.bin");
+            if (!f) {
+                (*bad)++;
+                return;
+            }
+            std::vector<uint8_t> buf(4096);
+            size_t sizes[] = {1, 100, 512, 4096};
+            for (int round = 0; !done || round < 20; round++) {
+                uint32_t pos = (uint32_t)((round * 7919 + i * 104729) % steady.size());
+                size_t n = std::min(sizes[round % 4], steady.size() - pos);
+                if (!f.seek(pos) || f.read(buf.data(), n) != (int)n)
+                    (*bad)++;
+                for (size_t j = 0; j < n; j++)
+                    *bad += buf[j] != steady[pos + j];
+                (*rounds)++;
+            }
+            f.close();
+        };
+        const int readers = 4;
+        std::vector<int> bad(readers, 0), rounds(readers, 0);
+        std::vector<std::thread> pool;
+        for (int i = 0; i < readers; i++)
+            pool.emplace_back(reader, i, &bad[i], &rounds[i]);
+        check_report_t report;
+        BOOST_CHECK(SD.checkCardImage(&report));
+        BOOST_CHECK(report.clean());
+        BOOST_CHECK(SD.checkCardImage(&report, true));
+        defrag_report_t moved;
+        BOOST_CHECK(SD.defragCardImage(&moved));
+        BOOST_CHECK_EQUAL(moved.fragmentedBefore, 2u);
+        BOOST_CHECK_EQUAL(moved.fragmentedAfter, 0u);
+        done = true;
+        for (auto &t : pool)
+            t.join();
+        for (int i = 0; i < readers; i++) {
+            BOOST_CHECK_EQUAL(bad[i], 0);
+            BOOST_CHECK_GE(rounds[i], 20);
+        }
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&SD.cardVolume()));
+        BOOST_CHECK(readFile(root, "A.BIN") == data[0]);
+        BOOST_CHECK(readFile(root, "B.BIN") == data[1]);
+        root.close();
+
+        // turning the mode off waits for a reader part way through, which
+        // then carries on alone
+        done = false;
+        int lastBad = 0, lastRounds = 0;
+        std::thread last(reader, 0, &lastBad, &lastRounds);
+        BOOST_CHECK(SD.setConcurrentReaders(false));
+        done = true;
+        last.join();
+        BOOST_CHECK_EQUAL(lastBad, 0);
+        BOOST_CHECK(!SD.cardVolume().concurrentEnabled());
+    }
+
+    BOOST_FIXTURE_TEST_CASE(preallocate_reserves_contiguous_clusters, FatImageTestFixture) {
+        // through the File API first
+        File g = SD.open("log.bin", FILE_WRITE);
+        if (!g) BOOST_FAIL("could not open file");
+        bool contiguous = false;
+        BOOST_CHECK(g.preallocate(65536, &contiguous));
+        BOOST_CHECK(contiguous);
+        BOOST_CHECK_EQUAL(g.size(), 0u);
+        g.close();
+        BOOST_CHECK(SD.remove("log.bin"));
+
+        SD.setSDCardFolderPath("output", true);
+        Sd2Card card;
+        BOOST_REQUIRE(card.openImage(imagePath));
+        SdVolume volume;
+        BOOST_REQUIRE(volume.init(&card));
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&volume));
+        const uint32_t empty = volume.freeClusterCount();
+
+        // 100000 bytes take 49 2 KiB clusters, reserved up front in one run
+        std::vector<uint8_t> data(100000);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = (uint8_t)(i * 3 + (i >> 9));
+        SdFile f;
+        BOOST_REQUIRE(f.open(&root, "RESERVED.BIN", O_CREAT | O_WRITE));
+        BOOST_REQUIRE(f.preallocate(data.size()));
+        BOOST_CHECK_EQUAL(f.fileSize(), 0u);
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 49);
+        uint32_t bgn, end;
+        BOOST_CHECK(f.contiguousRange(&bgn, &end));
+        BOOST_CHECK_EQUAL(end - bgn + 1, 49u * 4);
+        // asking for less than the file has is a no-op
+        BOOST_REQUIRE(f.preallocate(1000));
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 49);
+
+        // writing fills the reserved clusters instead of allocating more
+        for (size_t pos = 0; pos < data.size(); pos += 10000)
+            BOOST_REQUIRE_EQUAL(f.write(data.data() + pos, 10000), 10000u);
+        BOOST_REQUIRE(f.close());
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 49);
+
+        volume.cacheClear();
+        BOOST_REQUIRE(f.open(&root, "RESERVED.BIN", O_READ));
+        BOOST_CHECK_EQUAL(f.fileSize(), data.size());
+        std::vector<uint8_t> back(data.size());
+        for (size_t pos = 0; pos < back.size(); pos += 10000)
+            BOOST_REQUIRE_EQUAL(f.read(back.data() + pos, 10000), 10000);
+        BOOST_CHECK(back == data);
+        BOOST_REQUIRE(f.close());
+
+        // a reservation past the end of the data is given back by truncate
+        BOOST_REQUIRE(f.open(&root, "RESERVED.BIN", O_WRITE));
+        BOOST_REQUIRE(f.preallocate(200000));
+        BOOST_CHECK_EQUAL(f.fileSize(), data.size());
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 98);
+        BOOST_REQUIRE(f.truncate(f.fileSize()));
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 49);
+        BOOST_REQUIRE(f.close());
+
+        // a read-only file can't reserve anything
+        BOOST_REQUIRE(f.open(&root, "RESERVED.BIN", O_READ));
+        BOOST_CHECK(!f.preallocate(200000));
+        BOOST_REQUIRE(f.close());
+
+        BOOST_REQUIRE(SdFile::remove(&root, "RESERVED.BIN"));
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty);
+    }
+
+    BOOST_FIXTURE_TEST_CASE(raw_stream_writes_whole_blocks, FatImageTestFixture) {
+        std::vector<uint8_t> data(128 * 512);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = (uint8_t)(i * 11 + (i >> 9));
+
+        // a file without clusters has nothing to stream into
+        File f = SD.open("stream.bin", FILE_WRITE);
+        if (!f) BOOST_FAIL("could not open file");
+        BOOST_CHECK(!f.rawStreamStart());
+
+        BOOST_REQUIRE(f.preallocate(data.size()));
+        BOOST_REQUIRE(f.rawStreamStart());
+        BOOST_CHECK(!f.rawStreamStart());
+        BOOST_CHECK_EQUAL(f.write(data.data(), 100 * 512), 100u * 512);
+        // partial blocks are refused, the size waits for the stop
+        BOOST_CHECK_EQUAL(f.write(data.data(), 100), 0u);
+        BOOST_CHECK_EQUAL(f.size(), 0u);
+        BOOST_CHECK_EQUAL(f.position(), 100u * 512);
+        BOOST_CHECK(!f.seek(0));
+        BOOST_CHECK_EQUAL(f.write(data.data() + 100 * 512, 28 * 512), 28u * 512);
+        // no clusters left
+        BOOST_CHECK_EQUAL(f.write(data.data(), 512), 0u);
+        BOOST_REQUIRE(f.rawStreamStop());
+        BOOST_CHECK(!f.rawStreamStop());
+        BOOST_CHECK_EQUAL(f.size(), data.size());
+        f.close();
+
+        File r = SD.open("stream.bin", FILE_READ);
+        if (!r) BOOST_FAIL("could not open file");
+        BOOST_CHECK_EQUAL(r.size(), data.size());
+        std::vector<uint8_t> back(data.size());
+        BOOST_CHECK_EQUAL(r.read(back.data(), back.size()), (int)back.size());
+        BOOST_CHECK(back == data);
+        r.close();
+    }
+
+    BOOST_FIXTURE_TEST_CASE(raw_stream_skips_the_cache, FatImageTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        Sd2Card card;
+        BOOST_REQUIRE(card.openImage(imagePath));
+        SdVolume volume;
+        BOOST_REQUIRE(volume.init(&card));
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&volume));
+        const uint32_t empty = volume.freeClusterCount();
+
+        std::vector<uint8_t> data(40 * 512);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = (uint8_t)(i * 13 + (i >> 9));
+        SdFile f;
+        BOOST_REQUIRE(f.createContiguous(&root, "LOG.BIN", 64 * 512));
+        BOOST_REQUIRE(f.rawStreamStart());
+        volume.cacheResetStats();
+        for (int i = 0; i < 40; i++)
+            BOOST_REQUIRE(f.rawStreamWrite(data.data() + 512 * i, 1));
+        BOOST_CHECK(!f.write("x"));
+        BOOST_CHECK_EQUAL(volume.cacheStats().fatHits + volume.cacheStats().fatMisses
+                          + volume.cacheStats().dataHits + volume.cacheStats().dataMisses
+                          + volume.cacheStats().writeBacks, 0u);
+        // close() stops the stream; the preset size of a contiguous file stays
+        BOOST_REQUIRE(f.close());
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 16);
+
+        volume.cacheClear();
+        BOOST_REQUIRE(f.open(&root, "LOG.BIN", O_READ | O_WRITE));
+        BOOST_CHECK_EQUAL(f.fileSize(), 64u * 512);
+        std::vector<uint8_t> back(data.size());
+        BOOST_REQUIRE_EQUAL(f.read(back.data(), back.size()), (int)back.size());
+        BOOST_CHECK(back == data);
+        // a stream from the current position, then ordinary writes go on from it
+        BOOST_REQUIRE(f.rawStreamStart());
+        BOOST_REQUIRE(f.rawStreamWrite(data.data(), 24));
+        BOOST_REQUIRE(f.rawStreamStop());
+        BOOST_CHECK_EQUAL(f.curPosition(), 64u * 512);
+        BOOST_CHECK_EQUAL(f.write("tail"), 4u);
+        BOOST_CHECK_EQUAL(f.fileSize(), 64u * 512 + 4);
+        BOOST_REQUIRE(f.close());
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 17);
+
+        BOOST_REQUIRE(SdFile::remove(&root, "LOG.BIN"));
+    }
+
+    BOOST_FIXTURE_TEST_CASE(exfat_files_and_long_names, ExFatImageTestFixture) {
+        BOOST_REQUIRE(SD.begin());
+        BOOST_CHECK(SD.exists("/"));
+        BOOST_CHECK(!SD.exists("missing.txt"));
+
+        const char *names[] = {"Field Recording 01.wav", "notes.txt", "Ünïcödé ✓.bin"};
+        for (const char *name : names) {
+            File f = SD.open(name, FILE_WRITE);
+            if (!f) BOOST_FAIL("could not open file");
+            BOOST_CHECK_EQUAL(f.write((const uint8_t *)name, strlen(name)), strlen(name));
+            f.close();
+        }
+        // names match without regard to case
+        BOOST_CHECK(SD.exists("NOTES.TXT"));
+        BOOST_CHECK(SD.exists("field recording 01.WAV"));
+        BOOST_CHECK(!SD.exists("notes.tx"));
+
+        // remount so nothing is served from the block cache
+        BOOST_REQUIRE(SD.setSDCardImagePath(imagePath));
+        for (const char *name : names) {
+            File r = SD.open(name);
+            if (!r) BOOST_FAIL("could not open file");
+            BOOST_CHECK_EQUAL(r.size(), strlen(name));
+            std::string back(r.size(), 0);
+            BOOST_CHECK_EQUAL(r.read(&back[0], back.size()), (int)back.size());
+            BOOST_CHECK_EQUAL(back, name);
+            r.close();
+        }
+        File root = SD.open("/");
+        if (!root) BOOST_FAIL("could not open root");
+        std::vector<std::string> listed;
+        while (true) {
+            File child = root.openNextFile();
+            if (!child)
+                break;
+            listed.push_back(child.name());
+            child.close();
+        }
+        root.close();
+        std::vector<std::string> expected(std::begin(names), std::end(names));
+        BOOST_CHECK(listed == expected);
+
+        // O_TRUNC empties a file and its clusters are reused
+        File t = SD.open("notes.txt", O_WRITE | O_TRUNC);
+        if (!t) BOOST_FAIL("could not open file");
+        BOOST_CHECK_EQUAL(t.size(), 0u);
+        t.close();
+    }
+
+    BOOST_FIXTURE_TEST_CASE(exfat_directories_and_remove, ExFatImageTestFixture) {
+        BOOST_REQUIRE(SD.mkdir("logs/day1"));
+        BOOST_CHECK(SD.exists("logs"));
+        BOOST_CHECK(SD.exists("logs/day1"));
+
+        // 40 files of three entries each take the directory past a cluster
+        for (int i = 0; i < 40; i++) {
+            std::string name = "logs/day1/entry " + std::to_string(i) + ".txt";
+            File f = SD.open(name.c_str(), FILE_WRITE);
+            if (!f) BOOST_FAIL("could not open file");
+            f.write((const uint8_t *)name.c_str(), name.size());
+            f.close();
+        }
+        File dir = SD.open("logs/day1");
+        if (!dir) BOOST_FAIL("could not open directory");
+        BOOST_REQUIRE(dir.isDirectory());
+        int count = 0;
+        while (true) {
+            File child = dir.openNextFile();
+            if (!child)
+                break;
+            count++;
+            child.close();
+        }
+        dir.close();
+        BOOST_CHECK_EQUAL(count, 40);
+
+        BOOST_REQUIRE(SD.setSDCardImagePath(imagePath));
+        BOOST_CHECK(SD.exists("logs/day1/entry 39.txt"));
+        BOOST_CHECK(!SD.rmdir("logs/day1"));
+        for (int i = 0; i < 40; i++) {
+            std::string name = "logs/day1/entry " + std::to_string(i) + ".txt";
+            BOOST_CHECK(SD.remove(name.c_str()));
+        }
+        BOOST_CHECK(!SD.exists("logs/day1/entry 0.txt"));
+        BOOST_CHECK(SD.rmdir("logs/day1"));
+        BOOST_CHECK(!SD.exists("logs/day1"));
+        BOOST_CHECK(SD.exists("logs"));
+    }
+
+    BOOST_FIXTURE_TEST_CASE(exfat_root_listing_sees_a_grown_root, ExFatImageTestFixture) {
+        // 60 files of three entries each take the root past its cluster
+        for (int i = 0; i < 60; i++) {
+            std::string name = "entry " + std::to_string(i) + ".txt";
+            File f = SD.open(name.c_str(), FILE_WRITE);
+            if (!f) BOOST_FAIL("could not open file");
+            f.close();
+        }
+        File dir = SD.open("/");
+        if (!dir) BOOST_FAIL("could not open root");
+        int count = 0;
+        while (true) {
+            File child = dir.openNextFile();
+            if (!child)
+                break;
+            count++;
+            child.close();
+        }
+        dir.close();
+        BOOST_CHECK_EQUAL(count, 60);
+        BOOST_CHECK(SD.exists("entry 59.txt"));
+    }
+
+    BOOST_FIXTURE_TEST_CASE(exfat_full_card_keeps_no_lost_clusters, ExFatImageTestFixture) {
+        const uint32_t empty = SD.cardVolume().freeClusterCount();
+
+        // 100000 byte files until the card fills part way through one
+        std::vector<uint8_t> data = pattern(100000, 3);
+        std::vector<std::string> names;
+        bool full = false;
+        for (int i = 0; !full && i < 1000; i++) {
+            names.push_back("fill " + std::to_string(i) + ".bin");
+            File f = SD.open(names.back().c_str(), FILE_WRITE);
+            if (!f) BOOST_FAIL("could not open file");
+            for (size_t pos = 0; pos < data.size(); pos += 10000) {
+                if (f.write(data.data() + pos, 10000) != 10000) {
+                    full = true;
+                    break;
+                }
+            }
+            f.close();
+        }
+        BOOST_REQUIRE(full);
+        check_report_t report;
+        BOOST_REQUIRE(SD.checkCardImage(&report));
+        BOOST_CHECK(report.clean());
+
+        // every file cluster comes back once the files are gone; only the
+        // root directory keeps the clusters it grew by
+        for (const std::string &name : names)
+            BOOST_CHECK(SD.remove(name.c_str()));
+        BOOST_REQUIRE(SD.checkCardImage(&report));
+        BOOST_CHECK(report.clean());
+        BOOST_CHECK_EQUAL(report.lostClusters, 0u);
+        BOOST_REQUIRE(SD.setSDCardImagePath(imagePath));
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&SD.cardVolume()));
+        uint32_t rootClusters = root.fileSize() >> (SD.cardVolume().clusterSizeShift() + 9);
+        root.close();
+        BOOST_CHECK_EQUAL(SD.cardVolume().freeClusterCount(), empty - (rootClusters - 1));
+    }
+
+    BOOST_FIXTURE_TEST_CASE(exfat_contiguous_files_skip_the_fat, ExFatImageTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        Sd2Card card;
+        BOOST_REQUIRE(card.openImage(imagePath));
+        SdVolume volume;
+        BOOST_REQUIRE(volume.init(&card));
+        BOOST_CHECK_EQUAL(volume.fatType(), 64);
+        BOOST_CHECK_EQUAL(volume.blocksPerCluster(), 8u);
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&volume));
+        const uint32_t empty = volume.freeClusterCount();
+        BOOST_CHECK_EQUAL(empty, volume.clusterCount() - 3);
+
+        // 100000 bytes take 25 clusters in a row
+        std::vector<uint8_t> data(100000);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = (uint8_t)(i * 7 + (i >> 8));
+        SdFile f;
+        BOOST_REQUIRE(f.open(&root, "Contiguous.bin", O_CREAT | O_WRITE));
+        for (size_t pos = 0; pos < data.size(); pos += 10000)
+            BOOST_REQUIRE_EQUAL(f.write(data.data() + pos, 10000), 10000u);
+        BOOST_REQUIRE(f.close());
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 25);
+
+        // reading it never looks at the FAT
+        volume.cacheClear();
+        BOOST_REQUIRE(f.open(&root, "contiguous.bin", O_READ));
+        uint32_t bgn, end;
+        BOOST_REQUIRE(f.contiguousRange(&bgn, &end));
+        BOOST_CHECK_EQUAL(end - bgn + 1, 25u * 8);
+        volume.cacheResetStats();
+        std::vector<uint8_t> back(data.size());
+        for (size_t pos = 0; pos < back.size(); pos += 1000)
+            BOOST_REQUIRE_EQUAL(f.read(back.data() + pos, 1000), 1000);
+        BOOST_CHECK(back == data);
+        BOOST_REQUIRE(f.seekSet(70000));
+        BOOST_CHECK_EQUAL(f.read(), data[70000]);
+        BOOST_CHECK_EQUAL(volume.cacheStats().fatHits + volume.cacheStats().fatMisses, 0u);
+        BOOST_REQUIRE(f.close());
+
+        // files written in turn can't stay contiguous and go on in the FAT
+        SdFile a, b;
+        BOOST_REQUIRE(a.open(&root, "A.BIN", O_CREAT | O_WRITE));
+        BOOST_REQUIRE(b.open(&root, "B.BIN", O_CREAT | O_WRITE));
+        for (int i = 0; i < 6; i++) {
+            BOOST_REQUIRE_EQUAL(a.write(data.data() + 4096 * i, 4096), 4096);
+            BOOST_REQUIRE_EQUAL(b.write(data.data() + 4096 * (i + 6), 4096), 4096);
+        }
+        BOOST_REQUIRE(a.close());
+        BOOST_REQUIRE(b.close());
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 37);
+
+        // a fresh mount reads the bitmap and both files back
+        volume.cacheClear();
+        SdVolume again;
+        BOOST_REQUIRE(again.init(&card));
+        BOOST_CHECK_EQUAL(again.freeClusterCount(), empty - 37);
+        SdFile root2;
+        BOOST_REQUIRE(root2.openRoot(&again));
+        BOOST_REQUIRE(a.open(&root2, "a.bin", O_READ));
+        BOOST_REQUIRE(b.open(&root2, "b.bin", O_READ));
+        BOOST_CHECK(!a.contiguousRange(&bgn, &end));
+        std::vector<uint8_t> chunk(6 * 4096);
+        BOOST_REQUIRE_EQUAL(a.read(chunk.data(), chunk.size()), (int)chunk.size());
+        BOOST_CHECK(std::equal(chunk.begin(), chunk.end(), data.begin()));
+        BOOST_REQUIRE_EQUAL(b.read(chunk.data(), chunk.size()), (int)chunk.size());
+        BOOST_CHECK(std::equal(chunk.begin(), chunk.end(), data.begin() + 6 * 4096));
+        BOOST_REQUIRE(a.close());
+        BOOST_REQUIRE(b.close());
+
+        BOOST_REQUIRE(SdFile::remove(&root2, "A.BIN"));
+        BOOST_REQUIRE(SdFile::remove(&root2, "B.BIN"));
+        BOOST_REQUIRE(SdFile::remove(&root2, "CONTIGUOUS.BIN"));
+        BOOST_CHECK_EQUAL(again.freeClusterCount(), empty);
+        again.cacheClear();
+        SdVolume rescan;
+        BOOST_REQUIRE(rescan.init(&card));
+        BOOST_CHECK_EQUAL(rescan.freeClusterCount(), empty);
+    }
+
+    BOOST_FIXTURE_TEST_CASE(exfat_preallocate_survives_remount, ExFatImageTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        Sd2Card card;
+        BOOST_REQUIRE(card.openImage(imagePath));
+        SdVolume volume;
+        BOOST_REQUIRE(volume.init(&card));
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&volume));
+        const uint32_t empty = volume.freeClusterCount();
+
+        // 100000 bytes take 25 4 KiB clusters, reserved without a FAT chain
+        SdFile f;
+        BOOST_REQUIRE(f.open(&root, "Recording.wav", O_CREAT | O_WRITE));
+        BOOST_REQUIRE(f.preallocate(100000));
+        BOOST_CHECK_EQUAL(f.fileSize(), 0u);
+        uint32_t bgn, end;
+        BOOST_CHECK(f.contiguousRange(&bgn, &end));
+        BOOST_CHECK_EQUAL(end - bgn + 1, 25u * 8);
+        BOOST_REQUIRE(f.close());
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 25);
+
+        // the reservation is kept in DataLength past ValidDataLength
+        volume.cacheClear();
+        SdVolume again;
+        BOOST_REQUIRE(again.init(&card));
+        BOOST_CHECK_EQUAL(again.freeClusterCount(), empty - 25);
+        SdFile root2;
+        BOOST_REQUIRE(root2.openRoot(&again));
+        BOOST_REQUIRE(f.open(&root2, "recording.wav", O_WRITE | O_APPEND));
+        BOOST_CHECK_EQUAL(f.fileSize(), 0u);
+        std::vector<uint8_t> data(60000);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = (uint8_t)(i * 5 + (i >> 7));
+        for (size_t pos = 0; pos < data.size(); pos += 10000)
+            BOOST_REQUIRE_EQUAL(f.write(data.data() + pos, 10000), 10000u);
+        BOOST_REQUIRE(f.close());
+        BOOST_CHECK_EQUAL(again.freeClusterCount(), empty - 25);
+
+        again.cacheClear();
+        SdVolume third;
+        BOOST_REQUIRE(third.init(&card));
+        BOOST_CHECK_EQUAL(third.freeClusterCount(), empty - 25);
+        SdFile root3;
+        BOOST_REQUIRE(root3.openRoot(&third));
+        BOOST_REQUIRE(f.open(&root3, "RECORDING.WAV", O_READ));
+        BOOST_CHECK_EQUAL(f.fileSize(), data.size());
+        std::vector<uint8_t> back(data.size());
+        BOOST_REQUIRE_EQUAL(f.read(back.data(), 30000), 30000);
+        BOOST_REQUIRE_EQUAL(f.read(back.data() + 30000, 30000), 30000);
+        BOOST_CHECK(back == data);
+        BOOST_CHECK_EQUAL(f.read(), -1);
+        BOOST_REQUIRE(f.close());
+
+        BOOST_REQUIRE(SdFile::remove(&root3, "Recording.wav"));
+        BOOST_CHECK_EQUAL(third.freeClusterCount(), empty);
+        third.cacheClear();
+        SdVolume rescan;
+        BOOST_REQUIRE(rescan.init(&card));
+        BOOST_CHECK_EQUAL(rescan.freeClusterCount(), empty);
+    }
+
+    BOOST_FIXTURE_TEST_CASE(exfat_raw_stream_survives_remount, ExFatImageTestFixture) {
+        SD.setSDCardFolderPath("output", true);
+        Sd2Card card;
+        BOOST_REQUIRE(card.openImage(imagePath));
+        SdVolume volume;
+        BOOST_REQUIRE(volume.init(&card));
+        SdFile root;
+        BOOST_REQUIRE(root.openRoot(&volume));
+        const uint32_t empty = volume.freeClusterCount();
+
+        std::vector<uint8_t> data(150 * 512);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = (uint8_t)(i * 17 + (i >> 9));
+        SdFile f;
+        BOOST_REQUIRE(f.open(&root, "Stream Log.bin", O_CREAT | O_WRITE));
+        BOOST_REQUIRE(f.preallocate(200 * 512));
+        BOOST_REQUIRE(f.rawStreamStart());
+        BOOST_REQUIRE(f.rawStreamWrite(data.data(), 150));
+        BOOST_REQUIRE(f.close());
+        BOOST_CHECK_EQUAL(volume.freeClusterCount(), empty - 25);
+
+        volume.cacheClear();
+        SdVolume again;
+        BOOST_REQUIRE(again.init(&card));
+        BOOST_CHECK_EQUAL(again.freeClusterCount(), empty - 25);
+        SdFile root2;
+        BOOST_REQUIRE(root2.openRoot(&again));
+        BOOST_REQUIRE(f.open(&root2, "stream log.bin", O_READ));
+        BOOST_CHECK_EQUAL(f.fileSize(), data.size());
+        std::vector<uint8_t> back(data.size());
+        for (size_t pos = 0; pos < back.size(); pos += 25 * 512)
+            BOOST_REQUIRE_EQUAL(f.read(back.data() + pos, 25 * 512), 25 * 512);
+        BOOST_CHECK(back == data);
+        BOOST_REQUIRE(f.close());
+    }
+
+BOOST_AUTO_TEST_SUITE_END()